@@ -19,4 +19,8 @@ macro(rg_setup_compile_options)
         # Still debating whether -fno-inline is necessary or not...
         component_compile_options(-DRG_ENABLE_PROFILING -finstrument-functions)
     endif()
+
+    if(RG_ENABLE_SPANS)
+        component_compile_options(-DRG_ENABLE_SPANS)
+    endif()
 endmacro()
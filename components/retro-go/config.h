@@ -10,6 +10,8 @@
 #include "targets/retro-ruler-V1/config.h"
 #elif defined(RG_TARGET_SDL2)
 #include "targets/sdl2/config.h"
+#elif defined(RG_TARGET_HEADLESS)
+#include "targets/headless/config.h"
 #elif defined(RG_TARGET_MRGC_GBM)
 #include "targets/mrgc-gbm/config.h"
 #elif defined(RG_TARGET_ESPLAY_MICRO)
@@ -132,6 +134,11 @@
 #ifndef RG_GAMEPAD_DEBOUNCE_RELEASE
 #define RG_GAMEPAD_DEBOUNCE_RELEASE (2)
 #endif
+// How often the gamepad is sampled, in Hz. 1000 lowers the latency by up to 10ms but costs more CPU time on the
+// input task, especially with I2C or serial gamepads. It can also be changed at runtime in the debug menu.
+#ifndef RG_GAMEPAD_SAMPLE_RATE
+#define RG_GAMEPAD_SAMPLE_RATE (100)
+#endif
 // Wait for ADC value to be stable before registering it (values of 50 - 250 are typically good)
 #ifndef RG_GAMEPAD_ADC_FILTER_WINDOW
 #define RG_GAMEPAD_ADC_FILTER_WINDOW (150)
@@ -149,6 +156,15 @@
 #endif
 #endif
 
+// Keys that must be held together to rewind (when enabled in the options)
+#ifndef RG_REWIND_KEYS
+#define RG_REWIND_KEYS (RG_KEY_SELECT | RG_KEY_LEFT)
+#endif
+
+#ifndef RG_AUDIO_USE_FILE
+#define RG_AUDIO_USE_FILE 0
+#endif
+
 #ifndef RG_ZIP_SUPPORT
 #define RG_ZIP_SUPPORT 1
 #endif
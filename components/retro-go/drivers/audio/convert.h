@@ -0,0 +1,90 @@
+#pragma once
+
+// Sample conversion kernels used by the I2S sink. They're kept in their own header so that they can be
+// benchmarked and checked against each other on the host, see tools/bench_audio_convert.c.
+//
+// All kernels take interleaved stereo int16 and a Q15 gain (0 to 32767, which is 100%).
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef void (*rg_audio_convert_t)(int16_t *dst, const int16_t *src, size_t frames, int gain);
+
+#define RG_AUDIO_GAIN_Q15(percent) ((percent) * 32767 / 100)
+
+// External DAC: plain stereo with gain
+static inline void rg_audio_convert_stereo(int16_t *dst, const int16_t *src, size_t frames, int gain)
+{
+    for (size_t i = 0; i < frames * 2; ++i)
+        dst[i] = (src[i] * gain) >> 15;
+}
+
+// Internal DAC, one channel: mono mix on the left (mode 1) or the right (mode 2).
+// The DAC expects unsigned data, hence the 0x8000 bias.
+static inline void rg_audio_convert_dac_left(int16_t *dst, const int16_t *src, size_t frames, int gain)
+{
+    for (size_t i = 0; i < frames; ++i, src += 2, dst += 2)
+    {
+        int sample = ((src[0] + src[1]) * gain) >> 16;
+        dst[0] = sample + 0x8000;
+        dst[1] = 0;
+    }
+}
+
+static inline void rg_audio_convert_dac_right(int16_t *dst, const int16_t *src, size_t frames, int gain)
+{
+    for (size_t i = 0; i < frames; ++i, src += 2, dst += 2)
+    {
+        int sample = ((src[0] + src[1]) * gain) >> 16;
+        dst[0] = 0;
+        dst[1] = sample + 0x8000;
+    }
+}
+
+// Internal DAC, both channels (mode 3): a differential mono output to increase resolution.
+// The right channel carries the sample clamped to +/-0x7F00, the left one only what's beyond that.
+static inline void rg_audio_convert_dac_both(int16_t *dst, const int16_t *src, size_t frames, int gain)
+{
+    for (size_t i = 0; i < frames; ++i, src += 2, dst += 2)
+    {
+        int sample = ((src[0] + src[1]) * gain) >> 16;
+        int clamped = sample > 0x7F00 ? 0x7F00 : (sample < -0x7F00 ? -0x7F00 : sample);
+        dst[0] = 0x8000 + (sample - clamped);
+        dst[1] = -0x8000 + clamped;
+    }
+}
+
+#if defined(CONFIG_IDF_TARGET_ESP32S3)
+// ESP32-S3 PIE: 8 lanes of (sample * gain) >> 15 per instruction. Both buffers must be 16-byte aligned,
+// otherwise (or for the tail) we fall back to the C kernel. We're the only user of the PIE registers, so
+// it doesn't matter whether the OS preserves them. noinline keeps our LOOP out of any compiler loop.
+static inline __attribute__((noinline)) void rg_audio_convert_stereo_pie(int16_t *dst, const int16_t *src, size_t frames, int gain)
+{
+    size_t samples = frames * 2;
+    size_t blocks = samples / 8;
+
+    if (((uintptr_t)dst | (uintptr_t)src) & 15)
+        blocks = 0;
+
+    if (blocks > 0)
+    {
+        int16_t gains[8] __attribute__((aligned(16)));
+        const int16_t *g = gains;
+        for (size_t i = 0; i < 8; ++i)
+            gains[i] = gain;
+        asm volatile(
+            "wsr.sar %[shift]\n"
+            "ee.vld.128.ip q1, %[g], 0\n"
+            "loopnez %[n], 1f\n"
+            "ee.vld.128.ip q0, %[src], 16\n"
+            "ee.vmul.s16 q2, q0, q1\n"
+            "ee.vst.128.ip q2, %[dst], 16\n"
+            "1:\n"
+            : [src] "+r"(src), [dst] "+r"(dst), [g] "+r"(g)
+            : [n] "r"(blocks), [shift] "r"(15)
+            : "memory");
+    }
+
+    rg_audio_convert_stereo(dst, src, (samples - blocks * 8) / 2, gain);
+}
+#endif
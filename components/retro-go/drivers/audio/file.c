@@ -0,0 +1,141 @@
+#include "rg_system.h"
+#include "rg_audio.h"
+
+#if RG_AUDIO_USE_FILE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+// The file is written through stdio with a large buffer, so that most submissions are a memcpy
+#define WRITE_BUFFER_SIZE 32768
+
+typedef struct __attribute__((packed))
+{
+    char riff[4];
+    uint32_t riff_size;
+    char wave[4];
+    char fmt[4];
+    uint32_t fmt_size;
+    uint16_t format;
+    uint16_t channels;
+    uint32_t sample_rate;
+    uint32_t byte_rate;
+    uint16_t block_align;
+    uint16_t bits_per_sample;
+    char data[4];
+    uint32_t data_size;
+} wav_header_t;
+
+static FILE *fp;
+static char *buffer;
+static uint32_t frames;
+static int sampleRate;
+static int64_t busyUntil;
+static const char *lastError = "Unspecified Error";
+
+static bool write_header(void)
+{
+    // WAV is little-endian, like all our targets
+    wav_header_t header = {
+        .riff = "RIFF",
+        .riff_size = sizeof(wav_header_t) - 8 + frames * 4,
+        .wave = "WAVE",
+        .fmt = "fmt ",
+        .fmt_size = 16,
+        .format = 1, // PCM
+        .channels = 2,
+        .sample_rate = sampleRate,
+        .byte_rate = sampleRate * 4,
+        .block_align = 4,
+        .bits_per_sample = 16,
+        .data = "data",
+        .data_size = frames * 4,
+    };
+    return fseek(fp, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, fp) == 1;
+}
+
+static bool driver_init(int device, int _sampleRate)
+{
+    const char *path = rg_audio_get_capture_path();
+
+    sampleRate = _sampleRate;
+    frames = 0;
+    busyUntil = 0;
+
+    if (!(fp = fopen(path, "wb")))
+    {
+        lastError = strerror(errno);
+        return false;
+    }
+    if ((buffer = malloc(WRITE_BUFFER_SIZE)))
+        setvbuf(fp, buffer, _IOFBF, WRITE_BUFFER_SIZE);
+
+    if (!write_header())
+    {
+        lastError = "Failed to write WAV header";
+        fclose(fp), fp = NULL;
+        free(buffer), buffer = NULL;
+        return false;
+    }
+
+    RG_LOGI("Writing audio to '%s'\n", path);
+    return true;
+}
+
+static bool driver_deinit(void)
+{
+    if (!fp)
+        return true;
+    // The sizes in the header are only known now
+    bool success = write_header();
+    success &= fclose(fp) == 0;
+    free(buffer);
+    fp = NULL;
+    buffer = NULL;
+    RG_LOGI("Wrote %u frames of audio\n", (unsigned)frames);
+    return success;
+}
+
+static bool driver_submit(const rg_audio_frame_t *_frames, size_t count)
+{
+    if (!fp || fwrite(_frames, sizeof(rg_audio_frame_t), count, fp) != count)
+        return false;
+    frames += count;
+
+    // Outside of benchmarks the emulator expects to be paced by the audio, just like with the dummy sink
+    if (!rg_system_get_app()->isBenchmark)
+    {
+        if (busyUntil > rg_system_timer())
+            rg_usleep(busyUntil - rg_system_timer());
+        busyUntil = rg_system_timer() + (count * (1000000.f / sampleRate));
+    }
+    return true;
+}
+
+static bool driver_set_sample_rate(int _sampleRate)
+{
+    // A WAV file has a single rate, we can only change it until the first frame is written
+    if (frames > 0)
+    {
+        RG_LOGW("Can't change the sample rate of a non-empty capture, keeping %d\n", sampleRate);
+        return false;
+    }
+    sampleRate = _sampleRate;
+    return write_header();
+}
+
+static const char *driver_get_error(void)
+{
+    return lastError;
+}
+
+const rg_audio_driver_t rg_audio_driver_file = {
+    .name = "file",
+    .init = driver_init,
+    .deinit = driver_deinit,
+    .submit = driver_submit,
+    .set_sample_rate = driver_set_sample_rate,
+    .get_error = driver_get_error,
+};
+
+#endif // RG_AUDIO_USE_FILE
@@ -15,17 +15,27 @@
 #include <driver/dac.h>
 #endif
 
+#include "convert.h"
+
 static struct {
     const char *last_error;
+    rg_audio_convert_t convert;
     int device;
     int volume;
+    int gain;
     bool muted;
 } state;
 
+static void update_gain(void)
+{
+    state.gain = state.muted ? 0 : RG_AUDIO_GAIN_Q15(state.volume);
+}
+
 static bool driver_init(int device, int sample_rate)
 {
     state.last_error = NULL;
     state.device = device;
+    state.convert = rg_audio_convert_stereo;
 
     if (state.device == 0)
     {
@@ -44,6 +54,12 @@ static bool driver_init(int device, int sample_rate)
             ret = i2s_set_dac_mode(RG_AUDIO_USE_INT_DAC);
         if (ret != ESP_OK)
             state.last_error = esp_err_to_name(ret);
+        if (RG_AUDIO_USE_INT_DAC == 1)
+            state.convert = rg_audio_convert_dac_left;
+        else if (RG_AUDIO_USE_INT_DAC == 2)
+            state.convert = rg_audio_convert_dac_right;
+        else
+            state.convert = rg_audio_convert_dac_both;
     #else
         state.last_error = "This device does not support internal DAC mode!";
     #endif
@@ -76,6 +92,9 @@ static bool driver_init(int device, int sample_rate)
         }
         if (ret != ESP_OK)
             state.last_error = esp_err_to_name(ret);
+    #if CONFIG_IDF_TARGET_ESP32S3
+        state.convert = rg_audio_convert_stereo_pie;
+    #endif
     #else
         state.last_error = "This device does not support external DAC mode!";
     #endif
@@ -117,61 +136,17 @@ static bool driver_deinit(void)
 
 static bool driver_submit(const rg_audio_frame_t *frames, size_t count)
 {
-    float volume = state.muted ? 0.f : (state.volume * 0.01f);
-    rg_audio_frame_t buffer[180];
+    rg_audio_frame_t buffer[180] __attribute__((aligned(16)));
     size_t written = 0;
-    size_t pos = 0;
-
-    bool use_internal_dac = state.device == 0;
 
-    for (size_t i = 0; i < count; ++i)
+    while (count > 0)
     {
-        int left = frames[i].left * volume;
-        int right = frames[i].right * volume;
-
-        if (use_internal_dac)
-        {
-            int sample = (left + right) >> 1;
-        #if RG_AUDIO_USE_INT_DAC == 1
-            left = sample + 0x8000; // the internal DAC expects unsigned data
-            right = 0;
-        #elif RG_AUDIO_USE_INT_DAC == 2
-            left = 0; 
-            right = sample + 0x8000; // the internal DAC expects unsigned data
-        #elif RG_AUDIO_USE_INT_DAC == 3
-            // In two channel mode we use left and right as a differential mono output to increase resolution.
-            if (sample > 0x7F00)
-            {
-                left = 0x8000 + (sample - 0x7F00);
-                right = -0x8000 + 0x7F00;
-            }
-            else if (sample < -0x7F00)
-            {
-                left = 0x8000 + (sample + 0x7F00);
-                right = -0x8000 + -0x7F00;
-            }
-            else
-            {
-                left = 0x8000;
-                right = -0x8000 + sample;
-            }
-        #endif
-        }
-
-        // Clipping   (not necessary, we have (int16 * vol) and volume is never more than 1.0)
-        // if (left > 32767) left = 32767; else if (left < -32768) left = -32767;
-        // if (right > 32767) right = 32767; else if (right < -32768) right = -32767;
-
-        // Queue
-        buffer[pos].left = left;
-        buffer[pos].right = right;
-
-        if (i == count - 1 || ++pos == RG_COUNT(buffer))
-        {
-            if (i2s_write(I2S_NUM_0, (void *)buffer, pos * 4, &written, 1000) != ESP_OK)
-                RG_LOGW("I2S Submission error! Written: %d/%d\n", written, pos * 4);
-            pos = 0;
-        }
+        size_t chunk = RG_MIN(count, RG_COUNT(buffer));
+        state.convert((int16_t *)buffer, (const int16_t *)frames, chunk, state.gain);
+        if (i2s_write(I2S_NUM_0, (void *)buffer, chunk * 4, &written, 1000) != ESP_OK)
+            RG_LOGW("I2S Submission error! Written: %d/%d\n", written, chunk * 4);
+        frames += chunk;
+        count -= chunk;
     }
     return true;
 }
@@ -191,12 +166,14 @@ static bool driver_set_mute(bool mute)
         rg_i2c_gpio_set_level(AW_HEADPHONE_EN, !mute);
     #endif
     state.muted = mute;
+    update_gain();
     return true;
 }
 
 static bool driver_set_volume(int volume)
 {
     state.volume = volume;
+    update_gain();
     return true;
 }
 
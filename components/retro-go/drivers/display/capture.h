@@ -0,0 +1,103 @@
+// Capture driver: a dummy display that keeps what the screen would show, for regression tests.
+// Every frame drawn by the display task is folded into a CRC32 and can be saved as a PNG.
+// Only the lines written since the previous frame are hashed again (with the faster rg_hash),
+// the CRC is then computed over the line hashes.
+
+static uint16_t lcd_buffer[LCD_BUFFER_LENGTH];
+static uint16_t lcd_screen[RG_SCREEN_HEIGHT * RG_SCREEN_WIDTH]; // 565 BE, like a real panel
+static uint32_t lcd_line_hash[RG_SCREEN_HEIGHT];
+static uint8_t lcd_line_dirty[RG_SCREEN_HEIGHT];
+static int win_left, win_top, win_width, win_height, cursor;
+static uint32_t capture_hash;
+static uint32_t capture_frames;
+static char *capture_dir;
+
+static void lcd_init(void)
+{
+    memset(lcd_screen, 0, sizeof(lcd_screen));
+    memset(lcd_line_dirty, 1, sizeof(lcd_line_dirty));
+    capture_hash = 0;
+    capture_frames = 0;
+}
+
+static void lcd_deinit(void)
+{
+}
+
+static void lcd_set_backlight(float percent)
+{
+}
+
+static void lcd_set_window(int left, int top, int width, int height)
+{
+    win_left = left;
+    win_top = top;
+    win_width = width;
+    win_height = height;
+    cursor = 0;
+}
+
+static inline uint16_t *lcd_get_buffer(size_t length)
+{
+    return lcd_buffer;
+}
+
+static inline void lcd_send_buffer(uint16_t *buffer, size_t length)
+{
+    // The panel fills the window line by line, whatever doesn't fit is lost
+    while (length > 0 && cursor < win_width * win_height)
+    {
+        int x = win_left + cursor % win_width;
+        int y = win_top + cursor / win_width;
+        size_t count = RG_MIN(length, (size_t)(win_width - cursor % win_width));
+        if (y >= 0 && y < RG_SCREEN_HEIGHT)
+        {
+            int skip = RG_MAX(-x, 0);
+            int copy = RG_MIN((int)count, RG_SCREEN_WIDTH - x) - skip;
+            if (copy > 0)
+            {
+                memcpy(&lcd_screen[y * RG_SCREEN_WIDTH + x + skip], buffer + skip, copy * 2);
+                lcd_line_dirty[y] = 1;
+            }
+        }
+        buffer += count;
+        length -= count;
+        cursor += count;
+    }
+}
+
+static void lcd_sync(void)
+{
+}
+
+// Called by the display task once an update has been drawn
+static void lcd_capture_frame(void)
+{
+    for (int y = 0; y < RG_SCREEN_HEIGHT; ++y)
+    {
+        if (lcd_line_dirty[y])
+            lcd_line_hash[y] = rg_hash((const char *)&lcd_screen[y * RG_SCREEN_WIDTH], RG_SCREEN_WIDTH * 2);
+        lcd_line_dirty[y] = 0;
+    }
+    capture_hash = rg_crc32(capture_hash, (const uint8_t *)lcd_line_hash, sizeof(lcd_line_hash));
+    capture_frames++;
+
+    if (capture_dir)
+    {
+        char filename[RG_PATH_MAX + 1];
+        snprintf(filename, sizeof(filename), "%s/frame_%05u.png", capture_dir, (unsigned)capture_frames);
+        rg_surface_t surface = {
+            .width = RG_SCREEN_WIDTH,
+            .height = RG_SCREEN_HEIGHT,
+            .stride = RG_SCREEN_WIDTH * 2,
+            .format = RG_PIXEL_565_BE,
+            .data = lcd_screen,
+        };
+        if (!rg_surface_save_image_file(&surface, filename, 0, 0))
+            RG_LOGE("Failed to save frame to '%s'\n", filename);
+    }
+}
+
+const rg_display_driver_t rg_display_driver_capture = {
+    .name = "capture",
+};
@@ -1,49 +1,82 @@
 #ifdef RG_ENABLE_NETPLAY
 
-#include <freertos/FreeRTOS.h>
-#include <lwip/ip_addr.h>
+#include "rg_system.h"
+#include "rg_netplay.h"
+
 #include <sys/socket.h>
 #include <netinet/in.h>
-#include <esp_system.h>
-#include <esp_event.h>
-#include <esp_wifi.h>
-#include <esp_log.h>
+#include <arpa/inet.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
-#include <assert.h>
-#include <netdb.h>
+#include <fcntl.h>
 
-#include "rg_system.h"
-#include "rg_netplay.h"
-
-#define NETPLAY_VERSION 0x01
-#define MAX_PLAYERS 8
+#ifdef ESP_PLATFORM
+#include <esp_event.h>
+#include <esp_wifi.h>
+#endif
 
-#define BROADCAST (inet_addr(WIFI_BROADCAST_ADDR))
+#define NETPLAY_VERSION 0x02
+#define NETPLAY_PORT 1234
 
 // The SSID should be randomized to avoid conflicts
 #define WIFI_SSID "RETRO-GO"
 #define WIFI_CHANNEL 12
-#define WIFI_BROADCAST_ADDR "192.168.4.255"
-#define WIFI_NETPLAY_PORT 1234
-
-// Test to skip the network task and semaphores
-#define NETPLAY_SYNCHRONOUS_TEST
+#define WIFI_HOST_ADDR "192.168.4.1"
+
+// Inputs are kept in rings indexed by frame. It must hold the input delay and the rollback window in both
+// directions, which are bounded by NETPLAY_MAX_DELAY and NETPLAY_MAX_ROLLBACK.
+#define HISTORY_SIZE 64
+#define SNAPSHOTS (NETPLAY_MAX_ROLLBACK + 1)
+#define MAX_INPUTS_PER_PACKET ((sizeof(((netplay_packet_t *)0)->data) - sizeof(netplay_input_t)) / NETPLAY_MAX_INPUT_LEN)
+#define CHECKS 4
+#define CHECK_INTERVAL 60
+#define PACE_INTERVAL 30
+#define PACE_STEP 4 // Slow down by at most 1/PACE_STEP of a frame per frame
+#define RESEND_INTERVAL 20000
+#define HANDSHAKE_INTERVAL 250000
+#define TIMEOUT 5000000
+
+static const char *SETTING_INPUT_DELAY = "NetplayDelay";
 
 static netplay_status_t netplay_status = NETPLAY_STATUS_NOT_INIT;
 static netplay_mode_t netplay_mode = NETPLAY_MODE_NONE;
 static netplay_callback_t netplay_callback = NULL;
-static SemaphoreHandle_t netplay_sync;
-// static bool netplay_available = false;
 
-static netplay_player_t players[MAX_PLAYERS];
+static netplay_player_t players[NETPLAY_MAX_PLAYERS];
 static netplay_player_t *local_player;
 static netplay_player_t *remote_player; // This only works in 2 player mode
 
-static tcpip_adapter_ip_info_t local_if;
-static wifi_config_t wifi_config;
+static struct sockaddr_in host_addr; // Where the guest looks for the host
+static struct sockaddr_in peer_addr;
+static int sock = -1;
+static int64_t last_contact, last_send;
+static int drop_rate; // Percentage of input packets to drop, for testing
+static uint32_t drop_seed = 1;
 
-static int rx_sock, tx_sock;
+static struct
+{
+    uint32_t frame;        // Next frame the app will emulate
+    uint32_t replay;       // Frame being emulated again, equal to frame when we aren't rolling back
+    uint32_t mispredicted; // Oldest frame emulated with a wrong prediction, UINT32_MAX if none
+    uint32_t remote_end;   // We have the remote input of every frame before this one
+    uint32_t peer_end;     // The peer has our input of every frame before this one
+    uint32_t peer_frame;   // Last frame the peer told us it was about to emulate
+    int peer_advantage;
+    int pace_debt;         // Microseconds we still have to give back to the peer
+    int delay;
+    size_t input_len;
+    uint8_t local[HISTORY_SIZE][NETPLAY_MAX_INPUT_LEN];
+    uint8_t remote[HISTORY_SIZE][NETPLAY_MAX_INPUT_LEN];
+    uint8_t used[HISTORY_SIZE][NETPLAY_MAX_INPUT_LEN]; // The remote input we emulated, possibly predicted
+    uint8_t *snapshots;
+    size_t snapshot_size[SNAPSHOTS];
+    size_t snapshot_capacity;
+    struct {uint32_t frame, crc;} checks[CHECKS];
+    uint32_t check_frame, check_crc; // Our most recent check, sent with the inputs
+    uint32_t desync_frame;
+    rg_netplay_stats_t stats;
+} session;
 
 
 static void dummy_netplay_callback(netplay_event_t event, void *arg)
@@ -52,269 +85,268 @@ static void dummy_netplay_callback(netplay_event_t event, void *arg)
 }
 
 
-static void network_cleanup()
+static void set_status(netplay_status_t status)
 {
-    if (rx_sock) close(rx_sock);
-    if (tx_sock) close(tx_sock);
+    bool changed = status != netplay_status;
+
+    netplay_status = status;
 
-    rx_sock = tx_sock = 0;
-    memset(&local_if, 0, sizeof(local_if));
+    if (changed)
+    {
+        (*netplay_callback)(RG_EVENT_TYPE_NETPLAY|NETPLAY_EVENT_STATUS_CHANGED, &netplay_status);
+    }
 }
 
 
-static void network_setup(tcpip_adapter_if_t tcpip_if)
+static void network_cleanup(void)
 {
-    tcpip_adapter_get_ip_info(tcpip_if, &local_if);
-
-    int player_id = ((local_if.ip.addr >> 24) & 0xF) - 1;
-    struct sockaddr_in rx_addr;
-    int bc_val = 1;
-
-    local_player = &players[player_id];
-    local_player->id = player_id;
-    local_player->version = NETPLAY_VERSION;
-    local_player->game_id = rg_system_get_app()->romCRC32;
-    local_player->ip_addr = local_if.ip.addr;
+    if (sock >= 0)
+        close(sock);
+    sock = -1;
+}
 
-    RG_LOGI("netplay: Local player ID: %d\n", local_player->id);
 
-    rx_addr.sin_family = AF_INET;
-    rx_addr.sin_addr.s_addr = htonl(INADDR_ANY);
-    rx_addr.sin_port = htons(WIFI_NETPLAY_PORT);
+static bool network_setup(void)
+{
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_addr.s_addr = htonl(INADDR_ANY),
+        // The guest answers from wherever, the host learns its address from the first packet
+        .sin_port = htons(netplay_mode == NETPLAY_MODE_HOST ? ntohs(host_addr.sin_port) : 0),
+    };
 
-    rx_sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
-    tx_sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
-    assert(rx_sock > 0 && tx_sock > 0);
+    network_cleanup();
 
-    setsockopt(rx_sock, SOL_SOCKET, SO_BROADCAST, &bc_val, sizeof bc_val);
-    setsockopt(tx_sock, SOL_SOCKET, SO_BROADCAST, &bc_val, sizeof bc_val);
+    if ((sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) < 0)
+    {
+        RG_LOGE("netplay: socket() failed\n");
+        return false;
+    }
 
-    if (bind(rx_sock, (struct sockaddr *)&rx_addr, sizeof rx_addr) < 0)
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
     {
-        RG_PANIC("netplay: bind() failed");
+        RG_LOGE("netplay: bind() failed\n");
+        network_cleanup();
+        return false;
     }
+
+    // Everything is polled from the emulation loop
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+
+    local_player = &players[netplay_mode == NETPLAY_MODE_HOST ? 0 : 1];
+    remote_player = &players[netplay_mode == NETPLAY_MODE_HOST ? 1 : 0];
+    local_player->version = NETPLAY_VERSION;
+    local_player->id = netplay_mode == NETPLAY_MODE_HOST ? 0 : 1;
+    remote_player->id = netplay_mode == NETPLAY_MODE_HOST ? 1 : 0;
+    local_player->game_id = rg_hash(rg_basename(rg_system_get_app()->romPath), strlen(rg_basename(rg_system_get_app()->romPath)));
+    local_player->input_delay = rg_netplay_get_input_delay();
+    peer_addr = host_addr;
+    last_contact = last_send = 0;
+
+    RG_LOGI("netplay: Local player ID: %d\n", local_player->id);
+    return true;
 }
 
 
-static void set_status(netplay_status_t status)
+static bool send_packet(uint8_t cmd, uint8_t arg, const void *data, uint8_t data_len)
 {
-    bool changed = status != netplay_status;
+    netplay_packet_t packet = {local_player->id, cmd, arg, data_len, {0}};
+    size_t len = sizeof(packet) - sizeof(packet.data) + data_len;
 
-    netplay_status = status;
+    if (sock < 0)
+        return false;
 
-    if (changed)
+    if (data_len > 0)
+        memcpy(&packet.data, data, data_len);
+
+    last_send = rg_system_timer();
+
+    if (cmd == NETPLAY_PACKET_INPUT && drop_rate > 0)
     {
-        (*netplay_callback)(RG_EVENT_TYPE_NETPLAY|NETPLAY_EVENT_STATUS_CHANGED, &netplay_status);
+        drop_seed = drop_seed * 1103515245 + 12345;
+        if ((drop_seed >> 16) % 100 < drop_rate)
+            return true;
     }
+
+    if (sendto(sock, &packet, len, 0, (struct sockaddr *)&peer_addr, sizeof(peer_addr)) < 0)
+    {
+        RG_LOGE("netplay: sendto() failed\n");
+        return false;
+    }
+
+    return true;
 }
 
 
-static inline bool receive_packet(netplay_packet_t *packet, int timeout)
+// Waits up to timeout_us for something to read on the socket
+static void wait_packet(int timeout_us)
 {
+    struct timeval timeout = {timeout_us / 1000000, timeout_us % 1000000};
     fd_set read_fd_set;
 
     FD_ZERO(&read_fd_set);
-    FD_SET(rx_sock, &read_fd_set);
+    FD_SET(sock, &read_fd_set);
 
-    int sel = select(FD_SETSIZE, &read_fd_set, NULL, NULL, NULL);
-
-    if (sel > 0)
-    {
-        return recv(rx_sock, &packet, sizeof packet, 0) >= 0;
-    }
-    else if (sel < 0)
-    {
+    if (select(sock + 1, &read_fd_set, NULL, NULL, &timeout) < 0)
         RG_LOGE("netplay: select() failed\n");
-    }
+}
 
-    return false;
+
+static void session_start(void)
+{
+    size_t input_len = session.input_len;
+
+    free(session.snapshots);
+    memset(&session, 0, sizeof(session));
+    session.input_len = input_len;
+    session.mispredicted = UINT32_MAX;
+    session.delay = RG_MIN(remote_player->input_delay, NETPLAY_MAX_DELAY);
+    // Nobody presses anything during the first frames, that's what the delay is made of
+    session.remote_end = session.peer_end = session.delay;
+
+    RG_LOGI("netplay: Connected, player_id=%d game_id=%08X input_delay=%d\n",
+            remote_player->id, (unsigned)remote_player->game_id, session.delay);
+
+    // Both emulators must start from the same state
+    rg_emu_reset(true);
+    (*netplay_callback)(RG_EVENT_TYPE_NETPLAY|NETPLAY_EVENT_GAME_RESET, NULL);
+    set_status(NETPLAY_STATUS_CONNECTED);
 }
 
 
-static inline void send_packet(uint32_t dest, uint8_t cmd, uint8_t arg, void *data, uint8_t data_len)
+static void receive_inputs(const netplay_input_t *packet, size_t len)
 {
-    netplay_packet_t packet = {local_player->id, cmd, arg, data_len, {}};
-    size_t len = sizeof(packet) - sizeof(packet.data) + data_len;
-    struct sockaddr_in tx_addr;
+    size_t input_len = session.input_len;
 
-    if (data_len > 0)
+    if (len < sizeof(netplay_input_t) || input_len == 0 || len != sizeof(netplay_input_t) + packet->count * input_len)
     {
-        memcpy(&packet.data, data, data_len);
+        RG_LOGE("netplay: Input packet size mismatch. received=%d\n", (int)len);
+        return;
     }
 
-    if (dest < MAX_PLAYERS)
-    {
-        tx_addr.sin_family = AF_INET;
-        tx_addr.sin_port = htons(WIFI_NETPLAY_PORT);
-        tx_addr.sin_addr.s_addr = players[dest].ip_addr;
-    }
-    else
-    {
-        tx_addr.sin_family = AF_INET;
-        tx_addr.sin_port = htons(WIFI_NETPLAY_PORT);
-        tx_addr.sin_addr.s_addr = dest;
-    }
+    session.peer_frame = packet->current;
+    session.peer_advantage = packet->advantage;
+    if ((int32_t)(packet->ack - session.peer_end) > 0)
+        session.peer_end = packet->ack;
 
-    if (sendto(tx_sock, &packet, len, 0, (struct sockaddr*)&tx_addr, sizeof tx_addr) <= 0)
+    for (size_t i = 0; i < packet->count; ++i)
     {
-        RG_LOGE("netplay: sendto() failed\n");
-        // stop network
+        uint32_t frame = packet->frame + i;
+        const uint8_t *input = packet->inputs + i * input_len;
+
+        if ((int32_t)(frame - session.remote_end) < 0)
+            continue; // Already have it
+        if (frame != session.remote_end)
+            break; // Out of order, the next packet will repeat it
+
+        memcpy(session.remote[frame % HISTORY_SIZE], input, input_len);
+        if ((int32_t)(frame - session.frame) < 0 && memcmp(session.used[frame % HISTORY_SIZE], input, input_len) != 0)
+            session.mispredicted = RG_MIN(session.mispredicted, frame);
+        session.remote_end++;
     }
-}
 
-static void event_handler(void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data)
-{
-    if (event_base == WIFI_EVENT)
+    for (int i = 0; i < CHECKS && packet->check_frame; ++i)
     {
-        if (event_id == WIFI_EVENT_AP_START)
-        {
-            network_setup(TCPIP_ADAPTER_IF_AP);
-            set_status(NETPLAY_STATUS_LISTENING);
-        }
-        else if (event_id == WIFI_EVENT_AP_STOP || event_id == WIFI_EVENT_STA_STOP)
-        {
-            set_status(NETPLAY_STATUS_STOPPED);
-        }
-        else if (event_id == WIFI_EVENT_STA_CONNECTED || event_id == WIFI_EVENT_AP_STACONNECTED)
-        {
-            set_status(NETPLAY_STATUS_CONNECTING);
-        }
-        else if (event_id == WIFI_EVENT_AP_STADISCONNECTED || event_id == WIFI_EVENT_STA_DISCONNECTED)
-        {
-            set_status(NETPLAY_STATUS_DISCONNECTED);
-        }
-    }
-    else if (event_base == IP_EVENT)
-    {
-        if (event_id == IP_EVENT_STA_GOT_IP)
-        {
-            network_setup(TCPIP_ADAPTER_IF_STA);
-            set_status(NETPLAY_STATUS_HANDSHAKE);
-        }
-        else if (event_id == IP_EVENT_AP_STAIPASSIGNED)
+        if (session.checks[i].frame != packet->check_frame || packet->check_frame == session.desync_frame)
+            continue;
+        if (session.checks[i].crc != packet->check_crc)
         {
-            ip_event_got_ip_t* event = (ip_event_got_ip_t*) event_data;
-
-            send_packet(event->ip_info.ip.addr, NETPLAY_PACKET_INFO,
-                                       0, (void*)local_player, sizeof(netplay_player_t));
-            set_status(NETPLAY_STATUS_HANDSHAKE);
+            RG_LOGW("netplay: Desync detected at frame %u!\n", (unsigned)packet->check_frame);
+            session.desync_frame = packet->check_frame;
+            session.stats.desyncs++;
         }
     }
 }
 
 
-static void netplay_task()
+static void receive_packets(void)
 {
-    int len, expected_len;
     netplay_packet_t packet;
+    struct sockaddr_in from;
+    socklen_t from_len = sizeof(from);
+    int len;
 
-    RG_LOGI("netplay: Task started!\n");
-
-    while (1)
+    while (sock >= 0 && (len = recvfrom(sock, &packet, sizeof(packet), 0, (struct sockaddr *)&from, &from_len)) > 0)
     {
-        memset(&packet, 0, sizeof(netplay_packet_t));
-
-    #ifdef NETPLAY_SYNCHRONOUS_TEST
-        if (!rx_sock || netplay_status != NETPLAY_STATUS_HANDSHAKE)
-    #else
-        if (!rx_sock || netplay_status < NETPLAY_STATUS_HANDSHAKE)
-    #endif
-        {
-            rg_task_delay(100);
-            continue;
-        }
-
-        // if ((len = recv(client_sock, &packet, sizeof packet, 0)) <= 0)
-        if ((len = recvfrom(rx_sock, &packet, sizeof packet, 0, NULL, 0)) <= 0)
-        {
-            RG_LOGE("netplay: Socket disconnected! (recv() failed)\n");
-            rg_task_delay(100);
-            continue;
-        }
+        int expected_len = sizeof(packet) - sizeof(packet.data) + packet.data_len;
+        bool from_peer = from.sin_addr.s_addr == peer_addr.sin_addr.s_addr && from.sin_port == peer_addr.sin_port;
 
-        expected_len = sizeof(packet) - sizeof(packet.data) + packet.data_len;
+        from_len = sizeof(from);
 
-        if (expected_len != len)
+        if (len < 4 || expected_len != len)
         {
             RG_LOGE("netplay: Packet size mismatch. expected=%d received=%d\n", expected_len, len);
             continue;
         }
-        else if (packet.player_id >= MAX_PLAYERS)
+        else if (packet.player_id != remote_player->id)
         {
             RG_LOGE("netplay: Packet invalid player id: %d\n", packet.player_id);
             continue;
         }
-        else if (packet.player_id == local_player->id)
+        else if (!from_peer && !(netplay_mode == NETPLAY_MODE_HOST && packet.cmd == NETPLAY_PACKET_INFO))
         {
-            RG_LOGE("netplay: Received echo!\n");
             continue;
         }
 
-        netplay_player_t *packet_from = &players[packet.player_id];
-        packet_from->last_contact = rg_system_timer();
-
         switch (packet.cmd)
         {
-            case NETPLAY_PACKET_INFO: // HOST <-> GUEST
+            case NETPLAY_PACKET_INFO: // GUEST -> HOST
                 if (packet.data_len != sizeof(netplay_player_t))
                 {
                     RG_LOGE("netplay: Player struct size mismatch. expected=%d received=%d\n",
-                            sizeof(netplay_player_t), packet.data_len);
+                            (int)sizeof(netplay_player_t), packet.data_len);
+                    break;
+                }
+                if (netplay_status == NETPLAY_STATUS_CONNECTED)
+                {
+                    // Our READY got lost
+                    if (from_peer)
+                        send_packet(NETPLAY_PACKET_READY, 0, local_player, sizeof(netplay_player_t));
                     break;
                 }
 
-                memcpy(packet_from, packet.data, packet.data_len);
-                remote_player = packet_from;
-
+                memcpy(remote_player, packet.data, packet.data_len);
                 RG_LOGI("netplay: Remote client info player_id=%d game_id=%08X version=%02X\n",
-                        packet_from->id, packet_from->game_id, packet_from->version);
+                        remote_player->id, (unsigned)remote_player->game_id, remote_player->version);
 
-                if (packet_from->version != NETPLAY_VERSION)
+                if (remote_player->version != NETPLAY_VERSION)
                 {
                     RG_LOGE("netplay: Remote client protocol version mismatch.\n");
                     break;
                 }
 
-                if (netplay_mode == NETPLAY_MODE_HOST)
-                {
-                    // Check if all players are ready (at the moment only 1, no need to check) then send NETPLAY_PACKET_READY
-                    send_packet(packet_from->id, NETPLAY_PACKET_READY, 0, 0, 0);
-                    set_status(NETPLAY_STATUS_CONNECTED);
-                }
-                else
-                {
-                    send_packet(packet_from->id, NETPLAY_PACKET_INFO, 1, (void*)local_player, sizeof(netplay_player_t));
-                }
+                // Everyone uses the host's delay
+                remote_player->input_delay = local_player->input_delay;
+                peer_addr = from;
+                last_contact = rg_system_timer();
+                send_packet(NETPLAY_PACKET_READY, 0, local_player, sizeof(netplay_player_t));
+                session_start();
                 break;
 
             case NETPLAY_PACKET_READY: // HOST -> GUEST
-                // if (packet.data_len != sizeof(players))
-                // {
-                //     RG_LOGE("netplay: Players array size mismatch. expected=%d received=%d\n",
-                //             sizeof(players), packet.data_len);
-                //     break;
-                // }
-
-                // memcpy(&players, packet.data, packet.data_len);
-                set_status(NETPLAY_STATUS_CONNECTED);
+                if (netplay_status == NETPLAY_STATUS_CONNECTED || packet.data_len != sizeof(netplay_player_t))
+                    break;
+                memcpy(remote_player, packet.data, packet.data_len);
+                if (remote_player->version != NETPLAY_VERSION)
+                {
+                    RG_LOGE("netplay: Remote client protocol version mismatch.\n");
+                    break;
+                }
+                last_contact = rg_system_timer();
+                session_start();
                 break;
 
-            case NETPLAY_PACKET_SYNC_REQ: // HOST -> GUEST
-                memcpy(&packet_from->sync_data, packet.data, packet.data_len);
-                xSemaphoreGive(netplay_sync);
+            case NETPLAY_PACKET_INPUT: // HOST <-> GUEST
+                last_contact = rg_system_timer();
+                if (netplay_status == NETPLAY_STATUS_CONNECTED)
+                    receive_inputs((netplay_input_t *)packet.data, packet.data_len);
                 break;
 
-            case NETPLAY_PACKET_SYNC_ACK: // GUEST -> HOST
-                memcpy(&packet_from->sync_data, packet.data, packet.data_len);
-
-                // if received all players ACK then:
-                send_packet(remote_player->id, NETPLAY_PACKET_SYNC_DONE, packet.arg, 0, 0);
-                xSemaphoreGive(netplay_sync);
-                break;
-
-            case NETPLAY_PACKET_SYNC_DONE: // HOST -> GUEST
-                xSemaphoreGive(netplay_sync);
-                break;
+            case NETPLAY_PACKET_QUIT: // HOST <-> GUEST
+                RG_LOGI("netplay: Remote player left.\n");
+                network_cleanup();
+                rg_netplay_stop();
+                return;
 
             default:
                 RG_LOGE("netplay: Received unknown packet type 0x%02x\n", packet.cmd);
@@ -323,6 +355,281 @@ static void netplay_task()
 }
 
 
+// Processes what we received and keeps the handshake going
+static void netplay_poll(void)
+{
+    receive_packets();
+
+    if (netplay_mode == NETPLAY_MODE_GUEST && netplay_status == NETPLAY_STATUS_HANDSHAKE
+        && rg_system_timer() - last_send > HANDSHAKE_INTERVAL)
+    {
+        send_packet(NETPLAY_PACKET_INFO, 0, local_player, sizeof(netplay_player_t));
+    }
+}
+
+
+static void send_inputs(void)
+{
+    uint8_t buffer[sizeof(((netplay_packet_t *)0)->data)];
+    netplay_input_t *packet = (netplay_input_t *)buffer;
+    uint32_t start = session.peer_end;
+    uint32_t end = session.frame + session.delay + 1;
+    size_t count = RG_MIN((size_t)(int32_t)(end - start), MAX_INPUTS_PER_PACKET);
+
+    packet->frame = start;
+    packet->ack = session.remote_end;
+    packet->current = session.frame;
+    packet->advantage = RG_MIN(RG_MAX(session.stats.advantage, -127), 127);
+    packet->count = count;
+    packet->check_frame = session.check_frame;
+    packet->check_crc = session.check_crc;
+    for (size_t i = 0; i < count; ++i)
+        memcpy(packet->inputs + i * session.input_len, session.local[(start + i) % HISTORY_SIZE], session.input_len);
+
+    send_packet(NETPLAY_PACKET_INPUT, 0, packet, sizeof(netplay_input_t) + count * session.input_len);
+}
+
+
+// We can only predict so far, past that we wait for the peer (resending our inputs in case they were lost)
+static bool wait_peer(void)
+{
+    if ((int32_t)(session.frame - session.remote_end) <= NETPLAY_MAX_ROLLBACK)
+        return true;
+
+    session.stats.stalls++;
+
+    while ((int32_t)(session.frame - session.remote_end) > NETPLAY_MAX_ROLLBACK)
+    {
+        if (rg_system_timer() - last_contact > TIMEOUT)
+        {
+            RG_LOGE("netplay: Lost sync...\n");
+            rg_netplay_stop();
+            return false;
+        }
+        if (rg_system_timer() - last_send > RESEND_INTERVAL)
+            send_inputs();
+        wait_packet(RESEND_INTERVAL);
+        receive_packets();
+        if (netplay_status != NETPLAY_STATUS_CONNECTED)
+            return false;
+    }
+
+    return true;
+}
+
+
+// If we're further ahead of the peer than it is of us, we slow down a bit to let it catch up. Otherwise the
+// player who is behind would do all the rollbacks. Like GGPO, the wait is spread over the following frames
+// so that it shows up as a slightly slower game instead of a freeze.
+static void adjust_pace(void)
+{
+    int frame_time = rg_system_get_app()->frameTime;
+
+    session.stats.advantage = (int32_t)(session.frame - session.peer_frame);
+
+    if (session.frame % PACE_INTERVAL == 0)
+    {
+        int skew = (session.stats.advantage - session.peer_advantage) / 2;
+        session.pace_debt = RG_MAX(RG_MIN(skew, NETPLAY_MAX_ROLLBACK / 2), 0) * frame_time;
+    }
+
+    if (session.pace_debt > 0)
+    {
+        int wait = RG_MIN(session.pace_debt, frame_time / PACE_STEP);
+        session.pace_debt -= wait;
+        rg_usleep(wait);
+    }
+}
+
+
+// Saves the state at the beginning of a frame if we might have to come back to it or if it's time to check it
+static bool prepare_frame(uint32_t frame, bool loaded)
+{
+    int slot = frame % SNAPSHOTS;
+    uint8_t *snapshot = session.snapshots + slot * session.snapshot_capacity;
+    bool check = frame > 0 && frame % CHECK_INTERVAL == 0 && (int32_t)(frame - session.remote_end) <= 0;
+
+    if ((int32_t)(frame - session.remote_end) < 0 && !check)
+        return true;
+
+    if (!loaded)
+    {
+        session.snapshot_size[slot] = rg_emu_save_state_mem(snapshot, session.snapshot_capacity);
+        if (!session.snapshot_size[slot])
+        {
+            RG_LOGE("netplay: Unable to save the state!\n");
+            return false;
+        }
+    }
+
+    if (check)
+    {
+        session.check_frame = frame;
+        session.check_crc = rg_crc32(0, snapshot, session.snapshot_size[slot]);
+        session.checks[(frame / CHECK_INTERVAL) % CHECKS].frame = session.check_frame;
+        session.checks[(frame / CHECK_INTERVAL) % CHECKS].crc = session.check_crc;
+    }
+
+    return true;
+}
+
+
+static void get_inputs(uint32_t frame, void *data_out)
+{
+    size_t len = session.input_len;
+    uint8_t *out = data_out;
+
+    // Our prediction is that the peer keeps doing whatever it was last seen doing
+    if ((int32_t)(frame - session.remote_end) >= 0)
+        memcpy(session.used[frame % HISTORY_SIZE], session.remote[(session.remote_end - 1) % HISTORY_SIZE], len);
+    else
+        memcpy(session.used[frame % HISTORY_SIZE], session.remote[frame % HISTORY_SIZE], len);
+
+    memcpy(out + local_player->id * len, session.local[frame % HISTORY_SIZE], len);
+    memcpy(out + remote_player->id * len, session.used[frame % HISTORY_SIZE], len);
+}
+
+
+static bool session_alloc(size_t input_len)
+{
+    session.input_len = input_len;
+    session.snapshot_capacity = rg_emu_save_state_mem(NULL, 0);
+    if (session.snapshot_capacity)
+        session.snapshots = rg_alloc(session.snapshot_capacity * SNAPSHOTS, MEM_SLOW | MEM_NOPANIC);
+    if (!session.snapshots)
+    {
+        RG_LOGE("netplay: This app doesn't support in-memory states or we're out of memory.\n");
+        return false;
+    }
+    RG_LOGI("netplay: Rollback ready, state=%d bytes\n", (int)session.snapshot_capacity);
+    return true;
+}
+
+
+bool rg_netplay_sync(const void *data_in, void *data_out, size_t data_len)
+{
+    if (netplay_mode == NETPLAY_MODE_NONE)
+        return false;
+
+    RG_ASSERT(data_len > 0 && data_len <= NETPLAY_MAX_INPUT_LEN, "Invalid input length");
+    bool loaded = false;
+
+    if (session.replay == session.frame)
+    {
+        session.input_len = data_len;
+
+        // A game started in netplay mode waits for its peer on its first frame
+        for (int64_t start = rg_system_timer(); netplay_status != NETPLAY_STATUS_CONNECTED;)
+        {
+            if (rg_system_timer() - start > TIMEOUT * 6 || netplay_mode == NETPLAY_MODE_NONE)
+            {
+                RG_LOGE("netplay: Peer didn't show up.\n");
+                rg_netplay_stop();
+                return false;
+            }
+            wait_packet(RESEND_INTERVAL);
+            netplay_poll();
+        }
+
+        if (!session.snapshots && !session_alloc(data_len))
+        {
+            rg_netplay_stop();
+            return false;
+        }
+
+        memcpy(session.local[(session.frame + session.delay) % HISTORY_SIZE], data_in, data_len);
+        receive_packets();
+        send_inputs();
+
+        if (!wait_peer())
+            return false;
+
+        adjust_pace();
+
+        if (session.mispredicted != UINT32_MAX)
+        {
+            uint32_t frame = session.mispredicted;
+            int slot = frame % SNAPSHOTS;
+
+            session.mispredicted = UINT32_MAX;
+            session.stats.rollbacks++;
+            session.stats.resimulated += session.frame - frame;
+
+            if (!rg_emu_load_state_mem(session.snapshots + slot * session.snapshot_capacity, session.snapshot_size[slot]))
+            {
+                RG_LOGE("netplay: Rollback to frame %u failed!\n", (unsigned)frame);
+                rg_netplay_stop();
+                return false;
+            }
+            session.replay = frame;
+            loaded = true;
+        }
+    }
+    else
+    {
+        session.replay++;
+    }
+
+    if (!prepare_frame(session.replay, loaded))
+    {
+        rg_netplay_stop();
+        return false;
+    }
+
+    get_inputs(session.replay, data_out);
+
+    if (session.replay != session.frame)
+        return true;
+
+    if (++session.frame % 600 == 0)
+    {
+        RG_LOGI("netplay: frame=%u rollbacks=%d resimulated=%d stalls=%d advantage=%d desyncs=%d\n",
+                (unsigned)session.frame, session.stats.rollbacks, session.stats.resimulated, session.stats.stalls,
+                session.stats.advantage, session.stats.desyncs);
+    }
+    session.replay = session.frame;
+
+    return false;
+}
+
+
+#ifdef ESP_PLATFORM
+static void event_handler(void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data)
+{
+    if (event_base == WIFI_EVENT)
+    {
+        if (event_id == WIFI_EVENT_AP_START)
+        {
+            network_setup();
+            set_status(NETPLAY_STATUS_LISTENING);
+        }
+        else if (event_id == WIFI_EVENT_AP_STOP || event_id == WIFI_EVENT_STA_STOP)
+        {
+            set_status(NETPLAY_STATUS_STOPPED);
+        }
+        else if (event_id == WIFI_EVENT_STA_CONNECTED || event_id == WIFI_EVENT_AP_STACONNECTED)
+        {
+            if (netplay_status != NETPLAY_STATUS_CONNECTED)
+                set_status(NETPLAY_STATUS_CONNECTING);
+        }
+        else if (event_id == WIFI_EVENT_AP_STADISCONNECTED || event_id == WIFI_EVENT_STA_DISCONNECTED)
+        {
+            set_status(NETPLAY_STATUS_DISCONNECTED);
+        }
+    }
+    else if (event_base == IP_EVENT)
+    {
+        if (event_id == IP_EVENT_STA_GOT_IP)
+        {
+            // The guest introduces itself, see netplay_poll
+            network_setup();
+            set_status(NETPLAY_STATUS_HANDSHAKE);
+        }
+    }
+}
+#endif
+
+
 static void netplay_init()
 {
     RG_LOGI("%s called.\n", __func__);
@@ -332,8 +639,12 @@ static void netplay_init()
         netplay_status = NETPLAY_STATUS_STOPPED;
         netplay_callback = netplay_callback ?: dummy_netplay_callback;
         netplay_mode = NETPLAY_MODE_NONE;
-        netplay_sync = xSemaphoreCreateMutex();
 
+        host_addr.sin_family = AF_INET;
+        host_addr.sin_port = htons(NETPLAY_PORT);
+        host_addr.sin_addr.s_addr = inet_addr(WIFI_HOST_ADDR);
+
+    #ifdef ESP_PLATFORM
         tcpip_adapter_init();
 
         esp_event_loop_create_default();
@@ -344,8 +655,12 @@ static void netplay_init()
         ESP_ERROR_CHECK(esp_event_handler_register(IP_EVENT, ESP_EVENT_ANY_ID, &event_handler, NULL));
         ESP_ERROR_CHECK(esp_wifi_set_ps(WIFI_PS_NONE)); // Improves latency a lot
         ESP_ERROR_CHECK(esp_wifi_set_storage(WIFI_STORAGE_RAM));
-
-        rg_task_create("rg_netplay", &netplay_task, NULL, 4096, RG_TASK_PRIORITY - 2, 1);
+    #else
+        // On a computer we use whatever network there is, see NETPLAY.md
+        host_addr.sin_addr.s_addr = inet_addr(getenv("RG_NETPLAY_HOST") ?: "127.0.0.1");
+        host_addr.sin_port = htons(atoi(getenv("RG_NETPLAY_PORT") ?: "0") ?: NETPLAY_PORT);
+        drop_rate = atoi(getenv("RG_NETPLAY_DROP") ?: "0");
+    #endif
     }
 }
 
@@ -358,37 +673,69 @@ void rg_netplay_init(netplay_callback_t callback)
 }
 
 
-bool rg_netplay_quick_start(void)
+void rg_netplay_deinit(void)
 {
-    const char *status_msg = _("Initializing...");
-    const char *screen_msg = NULL;
-    // int timeout = 100;
+    rg_netplay_stop();
+    free(session.snapshots);
+    session.snapshots = NULL;
+}
+
+
+static rg_gui_event_t input_delay_cb(rg_gui_option_t *option, rg_gui_event_t event)
+{
+    if (event == RG_DIALOG_PREV)
+        rg_netplay_set_input_delay(rg_netplay_get_input_delay() - 1);
+    if (event == RG_DIALOG_NEXT)
+        rg_netplay_set_input_delay(rg_netplay_get_input_delay() + 1);
+
+    sprintf(option->value, _("%d frames"), rg_netplay_get_input_delay());
 
+    return RG_DIALOG_VOID;
+}
+
+
+bool rg_netplay_quick_start(void)
+{
     rg_display_clear(0);
 
     const rg_gui_option_t options[] = {
         {1, _("Host Game (P1)"), NULL, RG_DIALOG_FLAG_NORMAL, NULL},
         {2, _("Find Game (P2)"), NULL, RG_DIALOG_FLAG_NORMAL, NULL},
+        {3, _("Input delay"), "-", RG_DIALOG_FLAG_NORMAL, &input_delay_cb},
         RG_DIALOG_END
     };
 
     int ret = rg_gui_dialog(_("Netplay"), options, 0);
 
     if (ret == 1)
-        rg_netplay_start(NETPLAY_MODE_HOST);
+        return rg_netplay_connect(NETPLAY_MODE_HOST);
     else if (ret == 2)
-        rg_netplay_start(NETPLAY_MODE_GUEST);
-    else
+        return rg_netplay_connect(NETPLAY_MODE_GUEST);
+
+    return false;
+}
+
+
+bool rg_netplay_connect(netplay_mode_t mode)
+{
+    const char *status_msg = _("Initializing...");
+    const char *screen_msg = NULL;
+
+    if (!rg_netplay_start(mode))
         return false;
 
     while (1)
     {
+        netplay_poll();
+
         switch (netplay_status)
         {
             case NETPLAY_STATUS_CONNECTED:
-                return remote_player->game_id == local_player->game_id
-                    || rg_gui_confirm(_("Netplay"), _("ROMs not identical. Continue?"), 1);
-                break;
+                if (remote_player->game_id == local_player->game_id
+                    || rg_gui_confirm(_("Netplay"), _("ROMs not identical. Continue?"), 1))
+                    return true;
+                rg_netplay_stop();
+                return false;
 
             case NETPLAY_STATUS_HANDSHAKE:
                 status_msg = _("Exchanging info...");
@@ -437,8 +784,6 @@ bool rg_netplay_start(netplay_mode_t mode)
 {
     RG_LOGI("%s called.\n", __func__);
 
-    esp_err_t ret = ESP_FAIL;
-
     if (netplay_status == NETPLAY_STATUS_NOT_INIT)
     {
         netplay_init();
@@ -449,126 +794,99 @@ bool rg_netplay_start(netplay_mode_t mode)
     }
 
     memset(&players, 0xFF, sizeof(players));
-    local_player = NULL;
-    remote_player = NULL;
+    local_player = &players[0];
+    remote_player = &players[1];
 
-    if (mode == NETPLAY_MODE_GUEST)
+    if (mode != NETPLAY_MODE_GUEST && mode != NETPLAY_MODE_HOST)
     {
-        RG_LOGI("netplay: Starting in guest mode.\n");
+        RG_PANIC("netplay: Error: Unknown mode!");
+    }
+
+    RG_LOGI("netplay: Starting in %s mode.\n", mode == NETPLAY_MODE_HOST ? "host" : "guest");
+    netplay_mode = mode;
 
+#ifdef ESP_PLATFORM
+    static wifi_config_t wifi_config;
+    esp_err_t ret;
+
+    if (mode == NETPLAY_MODE_GUEST)
+    {
         strncpy((char*)wifi_config.sta.ssid, WIFI_SSID, 32);
         wifi_config.sta.channel = WIFI_CHANNEL;
         ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
         ESP_ERROR_CHECK(esp_wifi_set_config(ESP_IF_WIFI_STA, &wifi_config));
         ESP_ERROR_CHECK(esp_wifi_start());
         ret = esp_wifi_connect();
-        netplay_mode = NETPLAY_MODE_GUEST;
     }
-    else if (mode == NETPLAY_MODE_HOST)
+    else
     {
-        RG_LOGI("netplay: Starting in host mode.\n");
-
         strncpy((char*)wifi_config.ap.ssid, WIFI_SSID, 32);
         wifi_config.ap.authmode = WIFI_AUTH_OPEN;
         wifi_config.ap.channel = WIFI_CHANNEL;
-        wifi_config.ap.max_connection = MAX_PLAYERS - 1;
+        wifi_config.ap.max_connection = NETPLAY_MAX_PLAYERS - 1;
         ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_AP));
         ESP_ERROR_CHECK(esp_wifi_set_config(ESP_IF_WIFI_AP, &wifi_config));
         ret = esp_wifi_start();
-        netplay_mode = NETPLAY_MODE_HOST;
     }
-    else
+
+    if (ret != ESP_OK)
     {
-        RG_PANIC("netplay: Error: Unknown mode!");
+        netplay_mode = NETPLAY_MODE_NONE;
+        return false;
     }
-
-    return ret == ESP_OK;
-}
-
-
-bool rg_netplay_stop(void)
-{
-    RG_LOGI("%s called.\n", __func__);
-
-    esp_err_t ret = ESP_FAIL;
-
-    if (netplay_mode != NETPLAY_MODE_NONE)
+#else
+    if (!network_setup())
     {
-        network_cleanup();
-        ret = esp_wifi_stop();
-        netplay_status = NETPLAY_STATUS_STOPPED;
         netplay_mode = NETPLAY_MODE_NONE;
-        xSemaphoreGive(netplay_sync);
+        return false;
     }
+    set_status(mode == NETPLAY_MODE_HOST ? NETPLAY_STATUS_LISTENING : NETPLAY_STATUS_HANDSHAKE);
+#endif
 
-    return ret == ESP_OK;
+    return true;
 }
 
 
-void rg_netplay_sync(void *data_in, void *data_out, uint8_t data_len)
+bool rg_netplay_stop(void)
 {
-    static uint32_t sync_count = 0, sync_time = 0, start_time = 0;
-    static netplay_packet_t packet;
+    RG_LOGI("%s called.\n", __func__);
 
-    if (netplay_status != NETPLAY_STATUS_CONNECTED)
-    {
-        return;
-    }
+    if (netplay_mode == NETPLAY_MODE_NONE)
+        return false;
 
-    start_time = rg_system_timer();
+    // Best effort, the peer will time out if this gets lost
+    if (netplay_status == NETPLAY_STATUS_CONNECTED)
+        send_packet(NETPLAY_PACKET_QUIT, 0, NULL, 0);
 
-    memcpy(&local_player->sync_data, data_in, data_len);
+    network_cleanup();
+#ifdef ESP_PLATFORM
+    esp_wifi_stop();
+#endif
+    netplay_mode = NETPLAY_MODE_NONE;
+    set_status(NETPLAY_STATUS_STOPPED);
+    free(session.snapshots);
+    session.snapshots = NULL;
+    session.replay = session.frame;
 
-    if (netplay_mode == NETPLAY_MODE_HOST)
-    {
-        send_packet(remote_player->id, NETPLAY_PACKET_SYNC_REQ, 0, (void*)data_in, data_len);
-    }
+    return true;
+}
 
-#ifdef NETPLAY_SYNCHRONOUS_TEST
-    if (netplay_mode == NETPLAY_MODE_HOST)
-    {
-        do {
-            recv(rx_sock, &packet, sizeof packet, 0); // ACK
-        } while (packet.cmd != NETPLAY_PACKET_SYNC_ACK);
-        // send_packet(remote_player->id, NETPLAY_PACKET_SYNC_DONE, packet.arg, 0, 0);
-    }
-    else
-    {
-        do {
-            recv(rx_sock, &packet, sizeof packet, 0); // REQ
-        } while (packet.cmd != NETPLAY_PACKET_SYNC_REQ);
-        send_packet(remote_player->id, NETPLAY_PACKET_SYNC_ACK, 0, (void*)data_in, data_len);
-        // recv(rx_sock, &packet, sizeof packet, 0); // DONE
-    }
 
-    memcpy(&remote_player->sync_data, packet.data, packet.data_len);
-    memcpy(data_out, remote_player->sync_data, data_len);
-#else
-    // wait to receive/send NETPLAY_PACKET_SYNC_DONE
-    if (xSemaphoreTake(netplay_sync, 10000 / portTICK_PERIOD_MS) != pdPASS)
-    {
-        RG_LOGE("netplay: Lost sync...\n");
-        rg_netplay_stop();
-        return;
-    }
+int rg_netplay_get_input_delay(void)
+{
+    return RG_MIN(RG_MAX(rg_settings_get_number(NS_GLOBAL, SETTING_INPUT_DELAY, 1), 0), NETPLAY_MAX_DELAY);
+}
 
-    memcpy(data_out, remote_player->sync_data, data_len);
 
-    if (netplay_mode == NETPLAY_MODE_GUEST)
-    {
-        send_packet(remote_player->id, NETPLAY_PACKET_SYNC_ACK, 0,
-                    local_player->sync_data, sizeof(local_player->sync_data));
-        xSemaphoreTake(netplay_sync, 1000 / portTICK_PERIOD_MS);
-    }
-#endif
+void rg_netplay_set_input_delay(int frames)
+{
+    rg_settings_set_number(NS_GLOBAL, SETTING_INPUT_DELAY, RG_MIN(RG_MAX(frames, 0), NETPLAY_MAX_DELAY));
+}
 
-    sync_time += rg_system_timer() - start_time;
 
-    if (++sync_count == 60)
-    {
-        RG_LOGI("netplay: Sync delay=%.4fms\n", (float)sync_time / sync_count / 1000);
-        sync_count = sync_time = 0;
-    }
+rg_netplay_stats_t rg_netplay_get_stats(void)
+{
+    return session.stats;
 }
 
 
@@ -1,8 +1,18 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
+// Rollback is only implemented for two players at the moment
+#define NETPLAY_MAX_PLAYERS 2
+// Largest input an app can exchange per player and per frame
+#define NETPLAY_MAX_INPUT_LEN 4
+// Largest input delay, in frames
+#define NETPLAY_MAX_DELAY 8
+// How many frames we can run on predicted input before we have to wait for the peer
+#define NETPLAY_MAX_ROLLBACK 8
+
 typedef enum {
     NETPLAY_MODE_NONE,
     NETPLAY_MODE_HOST,
@@ -26,28 +36,16 @@ typedef enum {
 } netplay_status_t;
 
 typedef enum {
-    NETPLAY_PACKET_INFO,       // Send protocol version and player struct
-    NETPLAY_PACKET_PING,       //
-    NETPLAY_PACKET_PONG,       //
-    NETPLAY_PACKET_READY,      // Sent by the host once all players are ready
-    // Synchronization packets
-    NETPLAY_PACKET_SYNC_REQ,   // Sent by the host to all players after reading input
-    NETPLAY_PACKET_SYNC_ACK,   // Sent by the guests after reading input and receiving SYNC_REQ
-    NETPLAY_PACKET_SYNC_DONE,  // Sent by the host when all guests have ACK, starts frame emulation
-    NETPLAY_PACKET_RESYNC,     // Sent when sync is lost, expects an exact frame number to resume at
-    // User interaction packets
-    NETPLAY_PACKET_GAME_START,  //
-    NETPLAY_PACKET_GAME_PAUSE,  //
-    NETPLAY_PACKET_GAME_RESET,  //
-    NETPLAY_PACKET_INPUT,       // Send gamepad data
-    NETPLAY_PACKET_SERIAL,      // Send serial data
-    NETPLAY_PACKET_RAW_DATA,    // Send raw data for the emulator to handle (serial, memory copy, etc)
+    NETPLAY_PACKET_INFO,       // Sent by the guest until the host answers, contains its player struct
+    NETPLAY_PACKET_READY,      // Sent by the host in response, contains its player struct (and the input delay)
+    NETPLAY_PACKET_INPUT,      // Sent by everyone every frame, see netplay_input_t
+    NETPLAY_PACKET_QUIT,       // Sent when a player stops netplay
 } netplay_packet_type_t;
 
 typedef struct __attribute__ ((packed)) {
     uint8_t player_id;
     uint8_t cmd;
-    uint8_t arg; // seq
+    uint8_t arg;
     uint8_t data_len;
     uint8_t data[128];
 } netplay_packet_t;
@@ -56,21 +54,54 @@ typedef struct __attribute__ ((packed)) {
     uint8_t  version;
     uint8_t  id;
     uint32_t game_id;
-    uint16_t status;
-    uint32_t ip_addr;
-    uint32_t last_contact;
-    uint8_t  sync_data[16];
+    uint8_t  input_len;
+    uint8_t  input_delay;
 } netplay_player_t;
 
+// Every input packet repeats all the inputs the receiver hasn't acknowledged yet, so a lost packet doesn't
+// have to be resent: the next one covers it.
+typedef struct __attribute__ ((packed)) {
+    uint32_t frame;          // Frame the first input applies to
+    uint32_t ack;            // Last frame of the receiver's input that we have (they can stop sending it)
+    uint32_t current;        // Frame the sender is about to emulate
+    int8_t   advantage;      // How many frames the sender thinks it is ahead of the receiver
+    uint8_t  count;          // Number of inputs
+    uint32_t check_frame;    // Frame of check_crc, 0 if none
+    uint32_t check_crc;      // CRC32 of the state at the beginning of check_frame, to detect desyncs
+    uint8_t  inputs[];       // count * input_len bytes
+} netplay_input_t;
+
+typedef struct {
+    int rollbacks;           // Number of mispredictions
+    int resimulated;         // Frames emulated again because of them
+    int stalls;              // Times we had to wait for the peer
+    int desyncs;             // State checks that didn't match
+    int advantage;           // Frames ahead of the peer (negative if behind)
+} rg_netplay_stats_t;
+
 typedef void (*netplay_callback_t)(netplay_event_t event, void *arg);
 typedef netplay_callback_t rg_netplay_handler_t;
 
 void rg_netplay_init(netplay_callback_t callback);
 void rg_netplay_deinit(void);
 bool rg_netplay_quick_start(void);
+// Starts netplay and waits for the peer, showing the progress. Both players then reset their emulator.
+bool rg_netplay_connect(netplay_mode_t mode);
 bool rg_netplay_start(netplay_mode_t mode);
 bool rg_netplay_stop(void);
-void rg_netplay_sync(void *data_in, void *data_out, uint8_t data_len);
+
+// Call once per frame right after reading the local input, before emulating. data_in is the local player's
+// input (data_len bytes), data_out receives every player's input for the frame, in player order.
+// When a prediction turns out to be wrong the state is rolled back and this returns true: the app must
+// emulate one frame with data_out, without video or audio, and call it again with the same data_in until
+// it returns false. When not connected it returns false and leaves data_out alone.
+bool rg_netplay_sync(const void *data_in, void *data_out, size_t data_len);
+
+// Frames between reading the local input and using it. Higher values mean fewer rollbacks but more latency.
+// The host's value is used by everyone.
+int rg_netplay_get_input_delay(void);
+void rg_netplay_set_input_delay(int frames);
+rg_netplay_stats_t rg_netplay_get_stats(void);
 
 netplay_mode_t rg_netplay_mode();
 netplay_status_t rg_netplay_status();
@@ -8,6 +8,7 @@ extern const rg_audio_driver_t rg_audio_driver_dummy;
 extern const rg_audio_driver_t rg_audio_driver_buzzer;
 extern const rg_audio_driver_t rg_audio_driver_i2s;
 extern const rg_audio_driver_t rg_audio_driver_sdl2;
+extern const rg_audio_driver_t rg_audio_driver_file;
 
 // static const rg_audio_driver_t *drivers[] = {
 //     NULL,
@@ -26,35 +27,79 @@ static const rg_audio_sink_t sinks[] = {
 #endif
 #if RG_AUDIO_USE_BUZZER_PIN
     {&rg_audio_driver_buzzer, 0, "Buzzer" },
+#endif
+#if RG_AUDIO_USE_FILE
+    {&rg_audio_driver_file,   0, "WAV file"},
+    {&rg_audio_driver_file,   1, "WAV file (exact)"},
 #endif
     // {rg_audio_driver_bt_a2dp, 0, "Bluetooth"},
 };
 
-#define ACQUIRE_DEVICE(timeout)                         \
-    ({                                                  \
-        bool lock = rg_mutex_take(audio.lock, timeout); \
-        if (!lock)                                      \
-            RG_LOGE("Failed to acquire lock!\n");       \
-        lock;                                           \
+#define ACQUIRE_DEVICE(timeout)                                              \
+    ({                                                                       \
+        __atomic_add_fetch(&audio.waiting, 1, __ATOMIC_SEQ_CST);             \
+        bool lock = rg_mutex_take(audio.lock, timeout);                      \
+        __atomic_sub_fetch(&audio.waiting, 1, __ATOMIC_SEQ_CST);             \
+        if (!lock)                                                           \
+            RG_LOGE("Failed to acquire lock!\n");                            \
+        while (lock && __atomic_load_n(&audio.submitting, __ATOMIC_SEQ_CST)) \
+            rg_task_yield();                                                 \
+        lock;                                                                \
     })
 #define RELEASE_DEVICE() rg_mutex_give(audio.lock)
 
+// Must be a power of two so that the free-running ring positions can wrap around
+#define AUDIO_RING_SIZE  2048
+// One I2S DMA buffer, that's how much the output task moves to the driver at once
+#define AUDIO_CHUNK_SIZE 180
+// How long rg_audio_submit may wait for room before dropping samples (us)
+#define AUDIO_SUBMIT_TIMEOUT 100000
+// Max rate control adjustment, 0.5% in 16.16 fixed point
+#define AUDIO_RATE_CONTROL_MAX 328
+// Default path of the file sink
+#define AUDIO_CAPTURE_PATH RG_STORAGE_ROOT "/audio.wav"
+
 static struct
 {
     const rg_audio_sink_t *sink;
     const rg_audio_driver_t *driver;
     rg_mutex_t *lock;
+    rg_task_t *task;
+    int waiting;
+    bool submitting;    // The output task is in driver->submit, which it calls without holding the lock
     int sampleRate;
     int filter;
     int volume;
     bool muted;
+    bool rateControl;
+    bool capture;       // The sink is a file, it only gets what was actually submitted
+    bool direct;        // The sink is written by rg_audio_submit itself, the output task stays out of the way
+    char *capturePath;  // Set by rg_audio_set_capture, overrides the sink chosen in the settings
+    int captureDevice;
 } audio;
 static rg_audio_counters_t counters;
 
+// Single producer (whoever calls rg_audio_submit), single consumer (audio_task). Each side only ever
+// writes its own position, the other side reads it with acquire semantics.
+static struct
+{
+    rg_audio_frame_t *buffer;
+    uint32_t head; // Written by the producer
+    uint32_t tail; // Written by the consumer
+    uint32_t limit; // Max fill, caps latency when the producer isn't paced by the frame scheduler
+} ring;
+
+static struct
+{
+    rg_audio_frame_t last; // Last input frame of the previous submission, we interpolate from it
+    uint32_t pos;          // Position of the next output frame relative to `last`, 16.16 fixed point
+} resampler;
+
 static const char *SETTING_DRIVER = "AudioDriver";
 static const char *SETTING_DEVICE = "AudioDevice";
 static const char *SETTING_VOLUME = "Volume";
 static const char *SETTING_FILTER = "AudioFilter";
+static const char *SETTING_RATE_CONTROL = "AudioRateControl";
 
 static const char *get_last_driver_error(void)
 {
@@ -63,6 +108,160 @@ static const char *get_last_driver_error(void)
     return "Unspecified Error";
 }
 
+static size_t ring_write(const rg_audio_frame_t *frames, size_t count)
+{
+    uint32_t head = ring.head;
+    uint32_t fill = head - __atomic_load_n(&ring.tail, __ATOMIC_ACQUIRE);
+    if (fill >= ring.limit)
+        return 0;
+
+    count = RG_MIN(count, ring.limit - fill);
+    size_t pos = head % AUDIO_RING_SIZE;
+    size_t part = RG_MIN(count, AUDIO_RING_SIZE - pos);
+    memcpy(ring.buffer + pos, frames, part * sizeof(rg_audio_frame_t));
+    memcpy(ring.buffer, frames + part, (count - part) * sizeof(rg_audio_frame_t));
+    __atomic_store_n(&ring.head, head + count, __ATOMIC_RELEASE);
+    return count;
+}
+
+static size_t ring_read(rg_audio_frame_t *frames, size_t count)
+{
+    uint32_t tail = ring.tail;
+    uint32_t fill = __atomic_load_n(&ring.head, __ATOMIC_ACQUIRE) - tail;
+
+    count = RG_MIN(count, fill);
+    size_t pos = tail % AUDIO_RING_SIZE;
+    size_t part = RG_MIN(count, AUDIO_RING_SIZE - pos);
+    memcpy(frames, ring.buffer + pos, part * sizeof(rg_audio_frame_t));
+    memcpy(frames + part, ring.buffer, (count - part) * sizeof(rg_audio_frame_t));
+    __atomic_store_n(&ring.tail, tail + count, __ATOMIC_RELEASE);
+    return count;
+}
+
+static void ring_reset(int sampleRate)
+{
+    // Only called with the device lock held, so the output task isn't reading
+    __atomic_store_n(&ring.tail, __atomic_load_n(&ring.head, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+    ring.limit = RG_MIN(sampleRate / 20, AUDIO_RING_SIZE); // 50ms
+    memset(&resampler, 0, sizeof(resampler));
+}
+
+static bool ring_push(const rg_audio_frame_t *frames, size_t count, int64_t deadline)
+{
+    while (count > 0)
+    {
+        size_t written = ring_write(frames, count);
+        frames += written;
+        count -= written;
+        if (count == 0)
+            break;
+        // The ring is full, which normally means that our producer isn't paced by the frame scheduler.
+        // We wait for the output task to make room, but if it's stuck we'd rather drop samples.
+        if (rg_system_timer() > deadline)
+        {
+            counters.overruns++;
+            return false;
+        }
+        rg_usleep(RG_MIN(count, AUDIO_CHUNK_SIZE) * 1000000 / audio.sampleRate);
+    }
+    return true;
+}
+
+static uint32_t rate_control_step(void)
+{
+    // Nudge the ratio by up to 0.5% to keep the ring half full. That's inaudible but enough to absorb
+    // the drift between the core's native refresh rate and the audio clock. Fuller ring = fewer frames out.
+    int target = ring.limit / 2;
+    int delta = RG_MIN(RG_MAX((int)rg_audio_get_queued() - target, -target), target);
+    return 0x10000 + delta * AUDIO_RATE_CONTROL_MAX / target;
+}
+
+static void resample_push(const rg_audio_frame_t *frames, size_t count, uint32_t step, int64_t deadline)
+{
+    rg_audio_frame_t buffer[128];
+    bool dropped = false;
+    uint32_t pos = resampler.pos;
+    size_t out = 0;
+
+    // Linear interpolation between frames[i - 1] and frames[i], where frames[-1] is the carried over frame
+    while ((pos >> 16) < count)
+    {
+        size_t i = pos >> 16;
+        const rg_audio_frame_t *a = i > 0 ? &frames[i - 1] : &resampler.last;
+        const rg_audio_frame_t *b = &frames[i];
+        int frac = (pos & 0xFFFF) >> 1; // 15 bits so that the product can't overflow
+        buffer[out].left = a->left + (((b->left - a->left) * frac) >> 15);
+        buffer[out].right = a->right + (((b->right - a->right) * frac) >> 15);
+        if (++out == RG_COUNT(buffer))
+        {
+            if (!dropped)
+                dropped = !ring_push(buffer, out, deadline);
+            out = 0;
+        }
+        pos += step;
+    }
+    if (!dropped)
+        ring_push(buffer, out, deadline);
+
+    resampler.pos = pos - (count << 16);
+    resampler.last = frames[count - 1];
+}
+
+static void audio_task(void *arg)
+{
+    rg_audio_frame_t buffer[AUDIO_CHUNK_SIZE] __attribute__((aligned(16))); // Drivers may use SIMD
+    bool playing = false;
+
+    while (1)
+    {
+        if (!rg_mutex_take(audio.lock, 100))
+            continue;
+
+        if (!audio.driver || audio.direct)
+        {
+            RELEASE_DEVICE();
+            rg_task_delay(10);
+            continue;
+        }
+
+        size_t count = ring_read(buffer, AUDIO_CHUNK_SIZE);
+        if (count > 0)
+        {
+            playing = true;
+        }
+        else
+        {
+            // Only the first empty read of a gap is an underrun, the rest is just a paused emulator
+            if (playing)
+                counters.underruns++;
+            playing = false;
+            // A file only gets what was actually submitted, there's no point hogging the lock meanwhile
+            if (audio.capture)
+            {
+                RELEASE_DEVICE();
+                rg_task_delay(1);
+                continue;
+            }
+            // Keep the driver fed with silence, otherwise the I2S DMA would loop over stale buffers
+            memset(buffer, 0, sizeof(buffer));
+            count = AUDIO_CHUNK_SIZE / 4;
+        }
+
+        // This is where we block on the hardware. We don't hold the lock meanwhile, so that a volume or mute
+        // change doesn't stall the DMA. Whoever takes the lock waits for the submit to return before touching
+        // the driver, and we can't start another one until they're done.
+        const rg_audio_driver_t *driver = audio.driver;
+        __atomic_store_n(&audio.submitting, true, __ATOMIC_SEQ_CST);
+        RELEASE_DEVICE();
+        driver->submit(buffer, count);
+        __atomic_store_n(&audio.submitting, false, __ATOMIC_SEQ_CST);
+
+        // Let a waiting task take the lock before we loop back
+        if (__atomic_load_n(&audio.waiting, __ATOMIC_SEQ_CST))
+            rg_task_yield();
+    }
+}
+
 void rg_audio_init(int sampleRate)
 {
     RG_ASSERT(audio.sink == NULL, "Audio sink already initialized!");
@@ -84,12 +283,40 @@ void rg_audio_init(int sampleRate)
     free(driver_name);
 
     if (!audio.sink) // Default to first non-dummy if no match found
+    {
         audio.sink = &sinks[1 % RG_COUNT(sinks)];
+#if RG_AUDIO_USE_FILE
+        // The file sinks come last, so this only happens when there's no real output. But a file must be
+        // chosen explicitly, we don't want to fill up the storage just because the settings were reset.
+        if (audio.sink->driver == &rg_audio_driver_file)
+            audio.sink = &sinks[0];
+#endif
+    }
+
+#if RG_AUDIO_USE_FILE
+    if (audio.capturePath)
+    {
+        for (size_t i = 0; i < RG_COUNT(sinks); ++i)
+        {
+            if (sinks[i].driver == &rg_audio_driver_file && sinks[i].device == audio.captureDevice)
+                audio.sink = &sinks[i];
+        }
+    }
+#endif
 
     audio.filter = (int)rg_settings_get_number(NS_GLOBAL, SETTING_FILTER, 0);
     audio.volume = (int)rg_settings_get_number(NS_GLOBAL, SETTING_VOLUME, 50);
+    audio.rateControl = rg_settings_get_boolean(NS_GLOBAL, SETTING_RATE_CONTROL, false);
     audio.sampleRate = sampleRate;
     audio.driver = audio.sink->driver;
+#if RG_AUDIO_USE_FILE
+    audio.capture = audio.driver == &rg_audio_driver_file;
+    audio.direct = audio.capture && audio.sink->device == 1;
+#endif
+
+    if (!ring.buffer)
+        ring.buffer = rg_alloc(AUDIO_RING_SIZE * sizeof(rg_audio_frame_t), MEM_ANY);
+    ring_reset(sampleRate);
 
     if (audio.driver->init(audio.sink->device, sampleRate))
     {
@@ -108,9 +335,13 @@ void rg_audio_init(int sampleRate)
         RG_LOGE(" - Error: %s\n", get_last_driver_error());
         audio.sink = &sinks[0]; // Switching to dummy might allow us to at least boot
         audio.driver = audio.sink->driver;
+        audio.capture = audio.direct = false;
     }
 
     RELEASE_DEVICE();
+
+    if (!audio.task)
+        audio.task = rg_task_create("rg_audio", &audio_task, NULL, 3 * 1024, RG_TASK_PRIORITY_7, 1);
 }
 
 void rg_audio_deinit(void)
@@ -141,16 +372,39 @@ void rg_audio_submit(const rg_audio_frame_t *frames, size_t count)
     if (!frames || !count)
         return;
 
-    if (ACQUIRE_DEVICE(0))
+    counters.totalSamples += count;
+
+    // Benchmarks run as fast as possible, there is nobody listening anyway (unless we're capturing)
+    if (rg_system_get_app()->isBenchmark && !audio.capture)
+        return;
+
+    RG_SPAN_BEGIN("rg_audio_submit");
+    if (audio.direct)
     {
-        audio.driver->submit(frames, count);
-        RELEASE_DEVICE();
+        // Every frame goes to the file, in order, without resampling. If that means waiting on the storage, so be it.
+        if (ACQUIRE_DEVICE(1000))
+        {
+            if (!audio.driver->submit(frames, count))
+                counters.overruns++;
+            RELEASE_DEVICE();
+        }
     }
+    else if (audio.capture && rg_system_get_app()->isBenchmark)
+        ring_push(frames, count, time_start); // Benchmarks don't wait, whatever doesn't fit is dropped
+    else if (audio.rateControl)
+        resample_push(frames, count, rate_control_step(), time_start + AUDIO_SUBMIT_TIMEOUT);
+    else
+        ring_push(frames, count, time_start + AUDIO_SUBMIT_TIMEOUT);
+    RG_SPAN_END();
 
-    counters.totalSamples += count;
     counters.busyTime += rg_system_timer() - time_start;
 }
 
+size_t rg_audio_get_queued(void)
+{
+    return __atomic_load_n(&ring.head, __ATOMIC_ACQUIRE) - __atomic_load_n(&ring.tail, __ATOMIC_ACQUIRE);
+}
+
 rg_audio_counters_t rg_audio_get_counters(void)
 {
     return counters;
@@ -184,6 +438,27 @@ void rg_audio_set_sink(const char *driver_name, int device)
     rg_audio_init(audio.sampleRate);
 }
 
+bool rg_audio_set_capture(const char *path, bool blocking)
+{
+#if RG_AUDIO_USE_FILE
+    RG_LOGI("path='%s', blocking=%d\n", path ?: "(none)", blocking);
+    free(audio.capturePath);
+    audio.capturePath = path ? strdup(path) : NULL;
+    audio.captureDevice = blocking ? 1 : 0;
+    rg_audio_deinit();
+    rg_audio_init(audio.sampleRate);
+    return !path || audio.capture;
+#else
+    RG_LOGE("This build doesn't have the file sink (RG_AUDIO_USE_FILE)!\n");
+    return false;
+#endif
+}
+
+const char *rg_audio_get_capture_path(void)
+{
+    return audio.capturePath ?: AUDIO_CAPTURE_PATH;
+}
+
 int rg_audio_get_volume(void)
 {
     return audio.volume;
@@ -218,6 +493,18 @@ void rg_audio_set_mute(bool mute)
     RELEASE_DEVICE();
 }
 
+bool rg_audio_get_rate_control(void)
+{
+    return audio.rateControl;
+}
+
+void rg_audio_set_rate_control(bool enable)
+{
+    audio.rateControl = enable;
+    rg_settings_set_boolean(NS_GLOBAL, SETTING_RATE_CONTROL, enable);
+    RG_LOGI("Rate control %s\n", enable ? "enabled" : "disabled");
+}
+
 int rg_audio_get_sample_rate(void)
 {
     return audio.sampleRate;
@@ -236,6 +523,7 @@ void rg_audio_set_sample_rate(int sampleRate)
         {
             audio.driver->set_sample_rate(sampleRate);
             audio.sampleRate = sampleRate;
+            ring_reset(sampleRate);
             RELEASE_DEVICE();
         }
     }
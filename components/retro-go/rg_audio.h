@@ -34,11 +34,16 @@ typedef struct
 {
     int64_t totalSamples;
     int64_t busyTime;
+    int underruns; // The output task found the ring empty while playing
+    int overruns;  // rg_audio_submit gave up waiting for room and dropped samples
 } rg_audio_counters_t;
 
 void rg_audio_init(int sample_rate);
 void rg_audio_deinit(void);
+// Queues frames for the output task, it only waits if the ring is full
 void rg_audio_submit(const rg_audio_frame_t *frames, size_t count);
+// Number of frames queued in the ring but not yet handed to the driver
+size_t rg_audio_get_queued(void);
 rg_audio_counters_t rg_audio_get_counters(void);
 
 // const char **rg_audio_get_drivers(void);
@@ -47,10 +52,19 @@ const char *rg_audio_get_driver(void);
 const rg_audio_sink_t *rg_audio_get_sinks(size_t *count);
 const rg_audio_sink_t *rg_audio_get_sink(void);
 void rg_audio_set_sink(const char *driver_name, int device);
+// Writes the audio to a WAV file instead of the selected sink (NULL goes back to the sink). In blocking mode
+// rg_audio_submit writes every frame itself, without resampling or drops, so that captures can be diffed.
+// Otherwise frames go through the ring like with any other sink and benchmarks never wait on the storage.
+bool rg_audio_set_capture(const char *path, bool blocking);
+const char *rg_audio_get_capture_path(void);
 
 int rg_audio_get_volume(void);
 void rg_audio_set_volume(int percent);
 bool rg_audio_get_mute(void);
 void rg_audio_set_mute(bool mute);
+// Rate control resamples submissions by up to 0.5% to keep the ring half full. This lets the
+// frame scheduler pace with the clock at the core's native rate instead of following the audio.
+bool rg_audio_get_rate_control(void);
+void rg_audio_set_rate_control(bool enable);
 int rg_audio_get_sample_rate(void);
 void rg_audio_set_sample_rate(int sample_rate);
@@ -10,16 +10,57 @@
 #define LCD_BUFFER_LENGTH (RG_SCREEN_WIDTH * 4) // In pixels
 #endif
 
+// Maximum number of surfaces in the frame queue
+#define QUEUE_MAX_DEPTH 4
+// Wakes up the display task to drain the frame queue
+#define DISPLAY_MSG_QUEUE 1
+
+// Partial updates track changes per source line, they are disabled for sources taller than that
+#define SOURCE_LINES_MAX 512
+
 // static rg_display_driver_t driver;
 static rg_task_t *display_task_queue;
 static rg_display_counters_t counters;
 static rg_display_config_t config;
 static rg_surface_t *osd;
 static rg_surface_t *border;
+static const rg_surface_t *last_update;
 static rg_display_t display;
 static int16_t map_viewport_to_source_x[RG_SCREEN_WIDTH + 1];
 static int16_t map_viewport_to_source_y[RG_SCREEN_HEIGHT + 1];
-static uint32_t screen_line_checksum[RG_SCREEN_HEIGHT + 1];
+static uint32_t source_line_checksum[SOURCE_LINES_MAX];
+static uint8_t source_line_changed[SOURCE_LINES_MAX + 1];
+static uint8_t screen_line_invalid[RG_SCREEN_HEIGHT + 1];
+static uint32_t source_palette_checksum;
+
+// Horizontal scaling span table, built once in update_viewport_scaling. When upscaling by less than 2x
+// (or not scaling at all) a line is a series of runs: copy `runs[i]` source pixels, then duplicate the
+// last one (or blend it with the next one when filtering). This lets write_update convert each source
+// pixel only once and fuse the filter into the same pass instead of gathering every output pixel.
+static struct
+{
+    uint8_t runs[RG_SCREEN_WIDTH];
+    int count;      // Number of runs, each outputs runs[i] + 1 pixels
+    int tail;       // Pixels copied after the last run
+    bool tail_dup;  // The last output pixel is a duplicate (it's never blended)
+    int width;      // Output width, 0 if the ratio isn't supported
+} scale_x;
+
+// Frame queue, see rg_display_set_queue. Slots are owned by the display and are either free,
+// waiting in `pending` (oldest first), or being drawn.
+static struct
+{
+    rg_surface_t *slots[QUEUE_MAX_DEPTH];
+    uint32_t dirty_rows[QUEUE_MAX_DEPTH][SOURCE_LINES_MAX / 32]; // Copies of update->dirty_rows
+    int64_t submitted[QUEUE_MAX_DEPTH];
+    int pending[QUEUE_MAX_DEPTH];
+    volatile int count;
+    volatile int drawing;
+    bool resync; // A frame was dropped, the next one must be drawn in full
+    size_t depth;
+    rg_display_queue_policy_t policy;
+    rg_mutex_t *lock;
+} queue = {.drawing = -1};
 
 #define LINE_IS_REPEATED(Y) (map_viewport_to_source_y[(Y)] == map_viewport_to_source_y[(Y) - 1])
 // This is to avoid flooring a number that is approximated to .9999999 and be explicit about it
@@ -47,6 +88,8 @@ static inline void lcd_send_buffer(uint16_t *buffer, size_t length);
 #include "drivers/display/dsi.h"
 #elif RG_SCREEN_DRIVER == 99
 #include "drivers/display/sdl2.h"
+#elif RG_SCREEN_DRIVER == 97
+#include "drivers/display/capture.h"
 #else
 #include "drivers/display/dummy.h"
 #endif
@@ -102,7 +145,46 @@ static inline void write_update(const rg_surface_t *update)
     const void *data = update->data + update->offset + (crop_top * stride) + (crop_left * RG_PIXEL_GET_SIZE(format));
     const uint16_t *palette = update->palette;
 
-    const bool partial_update = RG_SCREEN_PARTIAL_UPDATES;
+    const bool partial_update = RG_SCREEN_PARTIAL_UPDATES && map_viewport_to_source_y[draw_height - 1] < SOURCE_LINES_MAX - 1;
+
+    // Find which source lines changed since the last update, before doing any scaling work. The emulator
+    // may tell us through update->dirty_rows, otherwise we compare a checksum of the source lines.
+    if (partial_update)
+    {
+        const size_t line_length = (map_viewport_to_source_x[draw_width - 1] + 1) * RG_PIXEL_GET_SIZE(format);
+        const uint32_t *dirty_rows = update->dirty_rows;
+        const int first_row = update->offset / stride + crop_top; // dirty_rows doesn't account for offset
+        int first_line = map_viewport_to_source_y[0];
+        int last_line = RG_MIN(map_viewport_to_source_y[draw_height - 1] + filter_y, update->height - crop_top - 1);
+        bool changed_all = false;
+
+        if (palette)
+        {
+            uint32_t checksum = rg_hash((void *)palette, 256 * 2);
+            changed_all = checksum != source_palette_checksum;
+            source_palette_checksum = checksum;
+        }
+
+        for (int line = first_line; line <= last_line; ++line)
+        {
+            if (dirty_rows)
+            {
+                int row = first_row + line;
+                source_line_changed[line] = changed_all || (dirty_rows[row / 32] & (1u << (row % 32)));
+                source_line_checksum[line] = 0; // Bitmap and checksums can't be mixed
+            }
+            else
+            {
+                uint32_t checksum = rg_hash(data + line * stride, line_length);
+                source_line_changed[line] = changed_all || checksum != source_line_checksum[line];
+                source_line_checksum[line] = checksum;
+            }
+        }
+        source_line_changed[last_line + 1] = false;
+    }
+
+    // The span table is only valid if we draw the whole viewport width
+    const bool use_runs = scale_x.width == draw_width;
 
     int lines_per_buffer = LCD_BUFFER_LENGTH / draw_width;
     int lines_remaining = draw_height;
@@ -124,15 +206,31 @@ static inline void write_update(const rg_surface_t *update)
                 --lines_to_copy;
         }
 
+        bool need_update = !partial_update;
+
+        for (int i = 0; i < lines_to_copy && !need_update; ++i)
+        {
+            int line = map_viewport_to_source_y[y + i];
+            // The vertical filter blends a repeated line with the next source line
+            if (source_line_changed[line] || (filter_y && source_line_changed[line + 1]))
+                need_update = true;
+            else if (screen_line_invalid[draw_top + y + i])
+                need_update = true;
+        }
+
+        if (!need_update)
+        {
+            lines_remaining -= lines_to_copy;
+            y += lines_to_copy;
+            continue;
+        }
+
         uint16_t *line_buffer = lcd_get_buffer(LCD_BUFFER_LENGTH);
         #if RG_SCREEN_DRIVER == 1
         line_buffer += y * RG_SCREEN_WIDTH;
         #endif
         uint16_t *line_buffer_ptr = line_buffer;
 
-        uint32_t checksum = 0xFFFFFFFF;
-        bool need_update = !partial_update;
-
         for (int i = 0; i < lines_to_copy; ++i)
         {
             if (i > 0 && LINE_IS_REPEATED(y))
@@ -140,6 +238,37 @@ static inline void write_update(const rg_surface_t *update)
                 memcpy(line_buffer_ptr, line_buffer_ptr - draw_width, draw_width * 2);
                 line_buffer_ptr += draw_width;
             }
+            else if (use_runs)
+            {
+                #define RENDER_RUNS(PTR_TYPE, PIXEL, FILTER) { \
+                    const PTR_TYPE *src = (const PTR_TYPE *)(data + map_viewport_to_source_y[y] * stride); \
+                    uint16_t *dst = line_buffer_ptr; \
+                    for (int r = 0; r < scale_x.count; ++r) { \
+                        for (int n = scale_x.runs[r]; n > 0; --n, ++src) \
+                            *dst++ = (PIXEL); \
+                        *dst = (FILTER) ? blend_pixels(dst[-1], (PIXEL)) : dst[-1]; \
+                        dst++; \
+                    } \
+                    for (int n = scale_x.tail; n > 0; --n, ++src) \
+                        *dst++ = (PIXEL); \
+                    if (scale_x.tail_dup) { \
+                        *dst = dst[-1]; \
+                        dst++; \
+                    } \
+                    line_buffer_ptr = dst; \
+                }
+                #define RENDER_RUNS_FORMAT(FILTER) \
+                    if (format & RG_PIXEL_PALETTE) \
+                        RENDER_RUNS(uint8_t, palette[*src], FILTER) \
+                    else if (format == RG_PIXEL_565_LE) \
+                        RENDER_RUNS(uint16_t, (uint16_t)((*src << 8) | (*src >> 8)), FILTER) \
+                    else \
+                        RENDER_RUNS(uint16_t, *src, FILTER)
+                if (filter_x)
+                    RENDER_RUNS_FORMAT(true)
+                else
+                    RENDER_RUNS_FORMAT(false)
+            }
             else
             {
                 #define RENDER_LINE(PTR_TYPE, PIXEL) { \
@@ -155,23 +284,13 @@ static inline void write_update(const rg_surface_t *update)
                     RENDER_LINE(uint16_t, (buffer[x] << 8) | (buffer[x] >> 8))
                 else
                     RENDER_LINE(uint16_t, buffer[x])
-
-                if (partial_update)
-                {
-                    checksum = rg_hash((void*)(line_buffer_ptr - draw_width), draw_width * 2);
-                }
-            }
-
-            if (screen_line_checksum[draw_top + y] != checksum)
-            {
-                screen_line_checksum[draw_top + y] = checksum;
-                need_update = true;
             }
 
+            screen_line_invalid[draw_top + y] = false;
             ++y;
         }
 
-        if (filter_x && need_update)
+        if (filter_x && !use_runs)
         {
             for (int i = 0; i < lines_to_copy; ++i)
             {
@@ -186,7 +305,7 @@ static inline void write_update(const rg_surface_t *update)
             }
         }
 
-        if (filter_y && need_update)
+        if (filter_y)
         {
             int top = y - lines_to_copy;
             for (int i = 1; i < lines_to_copy - 1; ++i)
@@ -204,21 +323,13 @@ static inline void write_update(const rg_surface_t *update)
             }
         }
 
-        if (need_update)
-        {
-            int left = display.screen.margins.left + draw_left;
-            int top = display.screen.margins.top + draw_top + y - lines_to_copy;
-            if (top != window_top)
-                lcd_set_window(left, top, draw_width, lines_remaining);
-            lcd_send_buffer(line_buffer, draw_width * lines_to_copy);
-            window_top = top + lines_to_copy;
-            lines_updated += lines_to_copy;
-        }
-        else
-        {
-            // Return unused buffer
-            lcd_send_buffer(line_buffer, 0);
-        }
+        int left = display.screen.margins.left + draw_left;
+        int top = display.screen.margins.top + draw_top + y - lines_to_copy;
+        if (top != window_top)
+            lcd_set_window(left, top, draw_width, lines_remaining);
+        lcd_send_buffer(line_buffer, draw_width * lines_to_copy);
+        window_top = top + lines_to_copy;
+        lines_updated += lines_to_copy;
 
         lines_remaining -= lines_to_copy;
     }
@@ -282,13 +393,45 @@ static void update_viewport_scaling(void)
     display.viewport.filter_y = (config.filter == RG_DISPLAY_FILTER_VERT || config.filter == RG_DISPLAY_FILTER_BOTH) &&
                                 (config.scaling && (display.viewport.height % src_height) != 0);
 
-    memset(screen_line_checksum, 0, sizeof(screen_line_checksum));
+    // Everything must be redrawn after a viewport change
+    memset(source_line_checksum, 0, sizeof(source_line_checksum));
+    memset(screen_line_invalid, 1, sizeof(screen_line_invalid));
 
     for (int x = 0; x < screen_width; ++x)
         map_viewport_to_source_x[x] = FLOAT_TO_INT(x * display.viewport.step_x);
     for (int y = 0; y < screen_height; ++y)
         map_viewport_to_source_y[y] = FLOAT_TO_INT(y * display.viewport.step_y);
 
+    // Build the span table for the width that write_update will draw (the viewport minus cropping)
+    int draw_width = display.viewport.width + RG_MIN(display.viewport.left, 0) * 2;
+    scale_x.count = scale_x.tail = 0;
+    scale_x.tail_dup = false;
+    scale_x.width = draw_width;
+    for (int x = 1, run = 1; x <= draw_width; ++x)
+    {
+        int step = (x < draw_width) ? map_viewport_to_source_x[x] - map_viewport_to_source_x[x - 1] : 1;
+        if (x == draw_width)
+            scale_x.tail = run;
+        else if (step == 1)
+            run++;
+        else if (step == 0 && run > 0 && run <= 255)
+        {
+            if (x == draw_width - 1)
+            {
+                scale_x.tail = run;
+                scale_x.tail_dup = true;
+                break;
+            }
+            scale_x.runs[scale_x.count++] = run;
+            run = 0;
+        }
+        else // Downscaling or upscaling by 2x or more, use the generic path
+        {
+            scale_x.width = 0;
+            break;
+        }
+    }
+
     RG_LOGI("%dx%d@%.3f => %dx%d@%.3f left:%d top:%d step_x:%.2f step_y:%.2f", src_width, src_height,
             (float)src_width / src_height, new_width, new_height, (float)new_width / new_height,
             display.viewport.left, display.viewport.top, display.viewport.step_x, display.viewport.step_y);
@@ -317,6 +460,151 @@ static bool load_border_file(const char *filename)
     return false;
 }
 
+static rg_surface_t *queue_pop(void)
+{
+    rg_surface_t *update = NULL;
+    rg_mutex_take(queue.lock, -1);
+    if (queue.count > 0)
+    {
+        int slot = queue.pending[0];
+        memmove(&queue.pending[0], &queue.pending[1], --queue.count * sizeof(int));
+        queue.drawing = slot;
+        counters.queueTime += rg_system_timer() - queue.submitted[slot];
+        update = queue.slots[slot];
+    }
+    rg_mutex_give(queue.lock);
+    return update;
+}
+
+static void queue_push(const rg_surface_t *update)
+{
+    // In benchmark mode no frame can be dropped, we wait for a free slot instead
+    if (rg_system_get_app()->isBenchmark)
+        rg_display_sync(true);
+
+    rg_mutex_take(queue.lock, -1);
+
+    // Find a slot that is neither waiting nor being drawn
+    int slot = -1;
+    for (int i = 0; i < queue.depth && slot < 0; ++i)
+    {
+        slot = (i != queue.drawing) ? i : -1;
+        for (int j = 0; j < queue.count && slot >= 0; ++j)
+            slot = (queue.pending[j] != i) ? i : -1;
+    }
+
+    if (slot < 0)
+    {
+        counters.droppedFrames++;
+        if (queue.policy == RG_DISPLAY_QUEUE_DROP_NEWEST || queue.count == 0)
+        {
+            // The next frame's dirty rows will be relative to one we never drew
+            queue.resync = true;
+            rg_mutex_give(queue.lock);
+            return;
+        }
+        slot = queue.pending[0];
+        memmove(&queue.pending[0], &queue.pending[1], --queue.count * sizeof(int));
+        // Same for the frame that came after the one we dropped
+        if (queue.count > 0)
+            memset(queue.dirty_rows[queue.pending[0]], 0xFF, sizeof(queue.dirty_rows[0]));
+        else
+            queue.resync = true;
+    }
+
+    // The display task only reads pending slots, so the copy can be done without holding the lock
+    rg_mutex_give(queue.lock);
+
+    rg_surface_t *dest = queue.slots[slot];
+    size_t line_length = update->width * RG_PIXEL_GET_SIZE(update->format);
+    for (int y = 0; y < update->height; ++y)
+        memcpy(dest->data + y * dest->stride, update->data + update->offset + y * update->stride, line_length);
+    if (dest->palette && update->palette)
+        memcpy(dest->palette, update->palette, 256 * 2);
+    dest->dirty_rows = NULL;
+    if (update->dirty_rows && update->height <= SOURCE_LINES_MAX)
+    {
+        // Our copy starts at update->offset, so must its bitmap
+        uint32_t *dirty_rows = queue.dirty_rows[slot];
+        int first_row = update->offset / update->stride;
+        memset(dirty_rows, queue.resync ? 0xFF : 0, sizeof(queue.dirty_rows[0]));
+        for (int y = 0; y < update->height && !queue.resync; ++y)
+        {
+            int row = first_row + y;
+            if (update->dirty_rows[row / 32] & (1u << (row % 32)))
+                dirty_rows[y / 32] |= 1u << (y % 32);
+        }
+        dest->dirty_rows = dirty_rows;
+    }
+    queue.resync = false;
+
+    rg_mutex_take(queue.lock, -1);
+    if (queue.count > 0 || queue.drawing >= 0)
+        counters.delayedFrames++;
+    queue.submitted[slot] = rg_system_timer();
+    queue.pending[queue.count++] = slot;
+    last_update = dest;
+    rg_mutex_give(queue.lock);
+
+    // Wake up the display task, unless a wake up is already pending
+    if (!rg_task_messages_waiting(display_task_queue))
+        rg_task_send(display_task_queue, &(rg_task_msg_t){.type = DISPLAY_MSG_QUEUE});
+}
+
+static void queue_free_slots(void)
+{
+    for (size_t i = 0; i < QUEUE_MAX_DEPTH; ++i)
+    {
+        rg_surface_free(queue.slots[i]);
+        queue.slots[i] = NULL;
+    }
+}
+
+static bool queue_alloc_slots(const rg_surface_t *update)
+{
+    const rg_surface_t *slot = queue.slots[0];
+    if (slot && slot->width == update->width && slot->height == update->height && slot->format == update->format)
+        return true;
+
+    rg_display_sync(true);
+    queue_free_slots();
+    for (size_t i = 0; i < queue.depth; ++i)
+    {
+        queue.slots[i] = rg_surface_create(update->width, update->height, update->format, MEM_SLOW|MEM_NOPANIC);
+        if (!queue.slots[i])
+        {
+            RG_LOGE("Failed to allocate frame queue, disabling it!");
+            queue_free_slots();
+            queue.depth = 0;
+            return false;
+        }
+    }
+    RG_LOGI("Frame queue ready: %dx%d, depth=%d", update->width, update->height, (int)queue.depth);
+    return true;
+}
+
+IRAM_ATTR
+static void draw_update(const rg_surface_t *update)
+{
+    if (display.changed)
+    {
+        update_viewport_scaling();
+        // Clear the screen if the viewport doesn't cover the entire screen because garbage could remain on the sides
+        if (display.viewport.width < display.screen.width || display.viewport.height < display.screen.height)
+        {
+            if (border)
+                rg_display_write_rect(0, 0, border->width, border->height, 0, border->data, RG_DISPLAY_WRITE_NOSYNC);
+            else
+                rg_display_clear_except(display.viewport.left, display.viewport.top, display.viewport.width, display.viewport.height, C_BLACK);
+        }
+        display.changed = false;
+    }
+
+    RG_SPAN_BEGIN("write_update");
+    write_update(update);
+    RG_SPAN_END();
+}
+
 IRAM_ATTR
 static void display_task(void *arg)
 {
@@ -328,32 +616,42 @@ static void display_task(void *arg)
         if (msg.type == RG_TASK_MSG_STOP)
             break;
 
-        if (display.changed)
+        // Frames from the queue are already ours, the wake up message can be released immediately
+        if (msg.type == DISPLAY_MSG_QUEUE)
         {
-            update_viewport_scaling();
-            // Clear the screen if the viewport doesn't cover the entire screen because garbage could remain on the sides
-            if (display.viewport.width < display.screen.width || display.viewport.height < display.screen.height)
+            rg_task_receive(&msg);
+            const rg_surface_t *update;
+            while ((update = queue_pop()))
             {
-                if (border)
-                    rg_display_write_rect(0, 0, border->width, border->height, 0, border->data, RG_DISPLAY_WRITE_NOSYNC);
-                else
-                    rg_display_clear_except(display.viewport.left, display.viewport.top, display.viewport.width, display.viewport.height, C_BLACK);
+                draw_update(update);
+            #if RG_SCREEN_DRIVER == 97
+                lcd_capture_frame();
+            #endif
+                queue.drawing = -1;
+                RG_SPAN_BEGIN("lcd_sync");
+                lcd_sync();
+                RG_SPAN_END();
             }
-            display.changed = false;
+            continue;
         }
 
-        write_update(msg.dataPtr);
+        draw_update(msg.dataPtr);
+    #if RG_SCREEN_DRIVER == 97
+        lcd_capture_frame();
+    #endif
 
         rg_task_receive(&msg);
 
+        RG_SPAN_BEGIN("lcd_sync");
         lcd_sync();
+        RG_SPAN_END();
     }
 }
 
 void rg_display_force_redraw(void)
 {
     display.changed = true;
-    // memset(screen_line_checksum, 0, sizeof(screen_line_checksum));
+    // memset(screen_line_invalid, 1, sizeof(screen_line_invalid));
     rg_system_event(RG_EVENT_REDRAW, NULL);
     rg_display_sync(true);
 }
@@ -368,6 +666,30 @@ rg_display_counters_t rg_display_get_counters(void)
     return counters;
 }
 
+const rg_surface_t *rg_display_get_last_update(void)
+{
+    return last_update;
+}
+
+uint32_t rg_display_get_capture_hash(void)
+{
+#if RG_SCREEN_DRIVER == 97
+    return capture_hash;
+#else
+    return 0;
+#endif
+}
+
+void rg_display_set_capture_dir(const char *path)
+{
+#if RG_SCREEN_DRIVER == 97
+    free(capture_dir);
+    capture_dir = path ? strdup(path) : NULL;
+#else
+    RG_LOGW("Frames can only be saved by the capture driver (RG_SCREEN_DRIVER 97)\n");
+#endif
+}
+
 int rg_display_get_width(void)
 {
     // return display.screen.real_width - (display.screen.margins.left + display.screen.margins.right);
@@ -463,13 +785,14 @@ char *rg_display_get_border(void)
     return rg_settings_get_string(NS_APP, SETTING_BORDER, NULL);
 }
 
-void rg_display_submit(const rg_surface_t *update, uint32_t flags)
+bool rg_display_submit(const rg_surface_t *update, uint32_t flags)
 {
     const int64_t time_start = rg_system_timer();
+    bool copied = false;
 
     // Those things should probably be asserted, but this is a new system let's be forgiving...
     if (!update || !update->data)
-        return;
+        return true;
 
     if (display.source.width != update->width || display.source.height != update->height)
     {
@@ -479,17 +802,57 @@ void rg_display_submit(const rg_surface_t *update, uint32_t flags)
         display.changed = true;
     }
 
-    rg_task_send(display_task_queue, &(rg_task_msg_t){.dataPtr = update});
+    RG_SPAN_BEGIN("rg_display_submit");
+    if (queue.depth && queue_alloc_slots(update))
+    {
+        queue_push(update);
+        copied = true;
+    }
+    else
+    {
+        rg_task_send(display_task_queue, &(rg_task_msg_t){.dataPtr = update});
+        last_update = update;
+    }
+    RG_SPAN_END();
 
     counters.blockTime += rg_system_timer() - time_start;
     counters.totalFrames++;
+    return copied;
+}
+
+static inline bool display_busy(void)
+{
+    return rg_task_messages_waiting(display_task_queue) || queue.count > 0 || queue.drawing >= 0;
 }
 
 bool rg_display_sync(bool block)
 {
-    while (block && rg_task_messages_waiting(display_task_queue))
-        continue; // We should probably yield?
-    return !rg_task_messages_waiting(display_task_queue);
+    // In benchmark mode a frame must never be skipped because the display was busy
+    block |= rg_system_get_app()->isBenchmark;
+    RG_SPAN_BEGIN("rg_display_sync");
+    while (block && display_busy())
+    {
+    #ifdef RG_TARGET_SDL2
+        continue; // rg_task_yield pumps SDL events, which is only allowed on the main thread
+    #else
+        rg_task_yield(); // The display task might be sharing our core
+    #endif
+    }
+    RG_SPAN_END();
+    // With a queue we're only "late" if the next frame would be dropped
+    if (queue.depth)
+        return queue.count + (queue.drawing >= 0) < queue.depth;
+    return !display_busy();
+}
+
+void rg_display_set_queue(size_t depth, rg_display_queue_policy_t policy)
+{
+    RG_ASSERT_ARG(depth == 0 || (depth >= 2 && depth <= QUEUE_MAX_DEPTH));
+    rg_display_sync(true);
+    queue_free_slots();
+    queue.depth = depth;
+    queue.policy = policy;
+    // The slots are allocated on the first submit, when we know the size of the frames
 }
 
 void rg_display_write_rect(int left, int top, int width, int height, int stride, const uint16_t *buffer, uint32_t flags)
@@ -516,7 +879,7 @@ void rg_display_write_rect(int left, int top, int width, int height, int stride,
     // This isn't really necessary but it makes sense to invalidate
     // the lines we're about to overwrite...
     for (size_t y = 0; y < height; ++y)
-        screen_line_checksum[top + y] = 0;
+        screen_line_invalid[top + y] = true;
 
     lcd_set_window(left + display.screen.margins.left, top + display.screen.margins.top, width, height);
 
@@ -643,6 +1006,7 @@ void rg_display_init(void)
     rg_display_clear(C_BLACK);
     rg_task_delay(80); // Wait for the screen be cleared before turning on the backlight (40ms doesn't seem to be enough...)
     lcd_set_backlight(config.backlight);
+    queue.lock = rg_mutex_create();
     display_task_queue = rg_task_create("rg_display", &display_task, NULL, 4 * 1024, RG_TASK_PRIORITY_6, 1);
     if (config.border_file)
         load_border_file(config.border_file);
@@ -36,6 +36,12 @@ typedef enum
     RG_DISPLAY_BACKLIGHT_MAX = 100,
 } display_backlight_t;
 
+typedef enum
+{
+    RG_DISPLAY_QUEUE_DROP_OLDEST = 0, // When the queue is full the oldest waiting frame is replaced
+    RG_DISPLAY_QUEUE_DROP_NEWEST,     // When the queue is full the submitted frame is discarded
+} rg_display_queue_policy_t;
+
 enum
 {
     RG_DISPLAY_WRITE_NOSYNC = (1 << 0),
@@ -59,6 +65,9 @@ typedef struct
     int32_t partFrames;
     int64_t blockTime;
     int64_t busyTime;
+    int32_t droppedFrames; // Frames dropped because the queue was full
+    int32_t delayedFrames; // Frames that had to wait behind another frame in the queue
+    int64_t queueTime;     // Total time frames spent waiting in the queue
 } rg_display_counters_t;
 
 typedef struct
@@ -107,9 +116,21 @@ void rg_display_clear_except(int left, int top, int width, int height, uint16_t
 void rg_display_clear(uint16_t color_le);
 bool rg_display_sync(bool block);
 void rg_display_force_redraw(void);
-void rg_display_submit(const rg_surface_t *update, uint32_t flags);
+// Only the lines that changed since the previous update are scaled and sent, see rg_surface_t.dirty_rows
+// Returns true if the update was copied (or dropped), in which case the caller can reuse it right away.
+bool rg_display_submit(const rg_surface_t *update, uint32_t flags);
+// When depth > 0 rg_display_submit copies the update into one of `depth` surfaces owned by the display and
+// returns immediately, the caller can reuse its buffer right away. depth = 0 restores the default behavior,
+// where the caller must not touch the update until rg_display_sync() returns true. The queue is disabled
+// if its surfaces can't be allocated, check rg_display_submit's return value.
+void rg_display_set_queue(size_t depth, rg_display_queue_policy_t policy);
 
 rg_display_counters_t rg_display_get_counters(void);
+const rg_surface_t *rg_display_get_last_update(void);
+// Capture driver only (RG_SCREEN_DRIVER 97): CRC32 of every frame drawn so far, as the screen showed it after
+// scaling and filtering. Frames are also saved as PNG files if a directory is set.
+uint32_t rg_display_get_capture_hash(void);
+void rg_display_set_capture_dir(const char *path);
 const rg_display_t *rg_display_get_info(void);
 int rg_display_get_width(void);
 int rg_display_get_height(void);
@@ -1155,6 +1155,16 @@ static rg_gui_event_t audio_update_cb(rg_gui_option_t *option, rg_gui_event_t ev
     return RG_DIALOG_VOID;
 }
 
+static rg_gui_event_t rate_control_cb(rg_gui_option_t *option, rg_gui_event_t event)
+{
+    if (event == RG_DIALOG_PREV || event == RG_DIALOG_NEXT)
+        rg_audio_set_rate_control(!rg_audio_get_rate_control());
+
+    strcpy(option->value, rg_audio_get_rate_control() ? _("On") : _("Off"));
+
+    return RG_DIALOG_VOID;
+}
+
 static rg_gui_event_t filter_update_cb(rg_gui_option_t *option, rg_gui_event_t event)
 {
     int max = RG_DISPLAY_FILTER_COUNT - 1;
@@ -1244,6 +1254,14 @@ static rg_gui_event_t overclock_update_cb(rg_gui_option_t *option, rg_gui_event_
     return RG_DIALOG_VOID;
 }
 
+static rg_gui_event_t input_rate_cb(rg_gui_option_t *option, rg_gui_event_t event)
+{
+    if (event == RG_DIALOG_PREV || event == RG_DIALOG_NEXT)
+        rg_input_set_sample_rate(rg_input_get_sample_rate() > 100 ? 100 : 1000);
+    sprintf(option->value, "%dHz", rg_input_get_sample_rate());
+    return RG_DIALOG_VOID;
+}
+
 static rg_gui_event_t speedup_update_cb(rg_gui_option_t *option, rg_gui_event_t event)
 {
     if (event == RG_DIALOG_PREV || event == RG_DIALOG_NEXT)
@@ -1255,6 +1273,88 @@ static rg_gui_event_t speedup_update_cb(rg_gui_option_t *option, rg_gui_event_t
     return RG_DIALOG_VOID;
 }
 
+static rg_gui_event_t rewind_budget_cb(rg_gui_option_t *option, rg_gui_event_t event)
+{
+    static const int budgets[] = {0, 256, 512, 1024, 2048, 4096};
+    const int max = RG_COUNT(budgets) - 1;
+    int index = 0;
+
+    if (!rg_system_get_app()->handlers.saveStateMem)
+    {
+        option->flags = RG_DIALOG_FLAG_HIDDEN;
+        return RG_DIALOG_VOID;
+    }
+
+    while (index < max && budgets[index] < rg_rewind_get_budget())
+        index++;
+
+    if (event == RG_DIALOG_PREV && --index < 0)
+        index = max;
+    if (event == RG_DIALOG_NEXT && ++index > max)
+        index = 0;
+
+    if (event == RG_DIALOG_PREV || event == RG_DIALOG_NEXT)
+    {
+        rg_rewind_set_budget(budgets[index]);
+        return RG_DIALOG_REDRAW;
+    }
+
+    if (budgets[index] == 0)
+        strcpy(option->value, _("Off"));
+    else if (budgets[index] < 1024)
+        sprintf(option->value, "%dKB", budgets[index]);
+    else
+        sprintf(option->value, "%dMB", budgets[index] / 1024);
+
+    return RG_DIALOG_VOID;
+}
+
+static rg_gui_event_t rewind_interval_cb(rg_gui_option_t *option, rg_gui_event_t event)
+{
+    if (!rg_system_get_app()->handlers.saveStateMem || rg_rewind_get_budget() == 0)
+    {
+        option->flags = RG_DIALOG_FLAG_HIDDEN;
+        return RG_DIALOG_VOID;
+    }
+
+    if (event == RG_DIALOG_PREV)
+        rg_rewind_set_interval(rg_rewind_get_interval() - 1);
+    if (event == RG_DIALOG_NEXT)
+        rg_rewind_set_interval(rg_rewind_get_interval() + 1);
+
+    sprintf(option->value, _("%d frames"), rg_rewind_get_interval());
+    option->flags = RG_DIALOG_FLAG_NORMAL;
+
+    return RG_DIALOG_VOID;
+}
+
+static rg_gui_event_t runahead_cb(rg_gui_option_t *option, rg_gui_event_t event)
+{
+    int cost = rg_emu_get_runahead_cost();
+
+    if (cost < 0)
+    {
+        option->flags = RG_DIALOG_FLAG_HIDDEN;
+        return RG_DIALOG_VOID;
+    }
+
+    if (event == RG_DIALOG_PREV || event == RG_DIALOG_NEXT)
+        rg_emu_set_runahead(!rg_emu_get_runahead());
+
+    // The estimate is only known once it ran for a bit
+    if (!rg_emu_get_runahead())
+        strcpy(option->value, _("Off"));
+    else if (!rg_emu_runahead_is_active())
+        strcpy(option->value, _("Too slow"));
+    else if (cost > 0)
+        sprintf(option->value, "+%.1fms", cost / 1000.f);
+    else
+        strcpy(option->value, _("On"));
+    option->flags = RG_DIALOG_FLAG_NORMAL;
+
+    return RG_DIALOG_VOID;
+}
+
 static rg_gui_event_t led_indicator_opt_cb(rg_gui_option_t *option, rg_gui_event_t event)
 {
     if (event == RG_DIALOG_PREV || event == RG_DIALOG_NEXT)
@@ -1562,6 +1662,7 @@ void rg_gui_options_menu(void)
         #endif
         {0, _("Volume"),        "-", RG_DIALOG_FLAG_NORMAL, &volume_update_cb},
         {0, _("Audio out"),     "-", RG_DIALOG_FLAG_NORMAL, &audio_update_cb},
+        {0, _("Rate control"),  "-", RG_DIALOG_FLAG_NORMAL, &rate_control_cb},
         RG_DIALOG_END,
     };
     const rg_gui_option_t misc_options[] = {
@@ -1585,6 +1686,9 @@ void rg_gui_options_menu(void)
         {0, _("Filter"),        "-", RG_DIALOG_FLAG_NORMAL, &filter_update_cb},
         {0, _("Border"),        "-", RG_DIALOG_FLAG_NORMAL, &border_update_cb},
         {0, _("Speed"),         "-", RG_DIALOG_FLAG_NORMAL, &speedup_update_cb},
+        {0, _("Rewind"),        "-", RG_DIALOG_FLAG_NORMAL, &rewind_budget_cb},
+        {0, _("Rewind step"),   "-", RG_DIALOG_FLAG_HIDDEN, &rewind_interval_cb},
+        {0, _("Run-ahead"),     "-", RG_DIALOG_FLAG_HIDDEN, &runahead_cb},
         // {0, _("Misc options"),  NULL, RG_DIALOG_FLAG_NORMAL, &misc_options_cb},
         {0, _("Emulator options"), NULL, RG_DIALOG_FLAG_NORMAL, &app_options_cb},
         RG_DIALOG_END,
@@ -1659,10 +1763,11 @@ void rg_gui_debug_menu(void)
     char screen_res[20], source_res[20], scaled_res[20];
     char stack_hwm[20], heap_free[20], block_free[20];
     char local_time[32], timezone[32], uptime[20];
-    char battery_info[25], frame_time[32];
-    char app_name[32], network_str[64];
+    char battery_info[25], frame_time[32], audio_xruns[32];
+    char app_name[32], network_str[64], rewind_str[48];
+    char input_str[48];
 
-    const rg_gui_option_t options[] = {
+    rg_gui_option_t options[32] = {
         {0, "Screen res", screen_res,   RG_DIALOG_FLAG_NORMAL, NULL},
         {0, "Source res", source_res,   RG_DIALOG_FLAG_NORMAL, NULL},
         {0, "Scaled res", scaled_res,   RG_DIALOG_FLAG_NORMAL, NULL},
@@ -1676,8 +1781,15 @@ void rg_gui_debug_menu(void)
         {0, "Uptime    ", uptime,       RG_DIALOG_FLAG_NORMAL, NULL},
         {0, "Battery   ", battery_info, RG_DIALOG_FLAG_NORMAL, NULL},
         {0, "Blit time ", frame_time,   RG_DIALOG_FLAG_NORMAL, NULL},
+        {0, "Audio xrun", audio_xruns,  RG_DIALOG_FLAG_NORMAL, NULL},
+        {0, "Rewind    ", rewind_str,   RG_DIALOG_FLAG_NORMAL, NULL},
+        {0, "Input     ", input_str,    RG_DIALOG_FLAG_NORMAL, NULL},
+        RG_DIALOG_END
+    };
+    const rg_gui_option_t actions[] = {
         RG_DIALOG_SEPARATOR,
         {0, "Overclock", "-", RG_DIALOG_FLAG_NORMAL, &overclock_update_cb},
+        {0, "Input rate", "-", RG_DIALOG_FLAG_NORMAL, &input_rate_cb},
         {1, "Reboot to firmware", NULL, RG_DIALOG_FLAG_NORMAL, NULL},
         {2, "Clear cache    ", NULL, RG_DIALOG_FLAG_NORMAL, NULL},
         {3, "Save screenshot", NULL, RG_DIALOG_FLAG_NORMAL, NULL},
@@ -1688,6 +1800,16 @@ void rg_gui_debug_menu(void)
         RG_DIALOG_END
     };
 
+    // The app's own entries go with the other stats, before the actions
+    size_t count = get_dialog_items_count(options);
+    const rg_app_t *app = rg_system_get_app();
+    if (app->handlers.debug)
+    {
+        app->handlers.debug(options + count, RG_COUNT(options) - count - RG_COUNT(actions));
+        count = get_dialog_items_count(options);
+    }
+    memcpy(options + count, actions, sizeof(actions));
+
     const rg_display_t *display = rg_display_get_info();
     rg_display_counters_t display_stats = rg_display_get_counters();
     rg_stats_t stats = rg_system_get_counters();
@@ -1706,6 +1828,19 @@ void rg_gui_debug_menu(void)
     }
     else
         snprintf(frame_time, 20, "N/A");
+    rg_audio_counters_t audio_stats = rg_audio_get_counters();
+    snprintf(audio_xruns, 32, "%d under, %d over", audio_stats.underruns, audio_stats.overruns);
+    if (rg_rewind_is_enabled())
+    {
+        rg_rewind_stats_t rewind_stats = rg_rewind_get_stats();
+        snprintf(rewind_str, 48, "%d steps, %dKB\n%dus/snap, %dus/frame", rewind_stats.snapshots,
+                 (int)(rewind_stats.memoryUsed / 1024), rewind_stats.captureTime, rewind_stats.frameTime);
+    }
+    else
+        snprintf(rewind_str, 48, "Off");
+    rg_input_stats_t input_stats = rg_input_get_stats();
+    snprintf(input_str, 48, "%dHz, %d irq\njitter %dus avg, %dus max", input_stats.rate, input_stats.wakeups,
+             input_stats.avgJitter, input_stats.maxJitter);
     snprintf(stack_hwm, 20, "%d", stats.freeStackMain);
     snprintf(heap_free, 20, "%d+%d", stats.freeMemoryInt, stats.freeMemoryExt);
     snprintf(block_free, 20, "%d+%d", stats.freeBlockInt, stats.freeBlockExt);
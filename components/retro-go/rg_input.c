@@ -6,12 +6,15 @@
 #include <math.h>
 
 #ifdef ESP_PLATFORM
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
 #include <driver/gpio.h>
 #include <driver/adc.h>
+#include <esp_timer.h>
 // This is a lazy way to silence deprecation notices on some esp-idf versions...
 // This hardcoded value is the first thing to check if something stops working!
 #define ADC_ATTEN_DB_11 3
-#else
+#elif defined(RG_TARGET_SDL2)
 #include <SDL2/SDL.h>
 #endif
 
@@ -42,6 +45,43 @@ static bool input_task_running = false;
 static uint32_t gamepad_state = -1; // _Atomic
 static uint32_t gamepad_mapped = 0;
 static rg_battery_t battery_state = {0};
+static int sample_rate = RG_GAMEPAD_SAMPLE_RATE;
+
+// Key changes, written by the input task and read by one consumer. Neither side ever writes the other's index,
+// so no lock is needed as long as the slot is written before head is published.
+#define EVENT_QUEUE_SIZE 64
+static struct
+{
+    rg_input_event_t events[EVENT_QUEUE_SIZE];
+    uint32_t head;
+    uint32_t tail;
+    bool enabled;
+    int pushed;
+    int dropped;
+} queue;
+
+static struct
+{
+    int rate;
+    int samples;
+    int wakeups;
+    int scheduled;
+    int64_t jitterTotal;
+    int maxJitter;
+} sampling;
+
+#ifdef ESP_PLATFORM
+static TaskHandle_t input_task_handle;
+static esp_timer_handle_t input_timer;
+#endif
+
+typedef struct
+{
+    int frame;
+    uint32_t state;
+} trace_event_t;
+static trace_event_t *trace_events = NULL;
+static size_t trace_events_count = 0;
 
 #define UPDATE_GLOBAL_MAP(keymap)                 \
     for (size_t i = 0; i < RG_COUNT(keymap); ++i) \
@@ -212,35 +252,170 @@ bool rg_input_read_gamepad_raw(uint32_t *out)
     return true;
 }
 
+static void push_event(int64_t time, uint32_t state, uint32_t changed)
+{
+    if (!queue.enabled)
+        return;
+    uint32_t head = queue.head;
+    if (head - __atomic_load_n(&queue.tail, __ATOMIC_ACQUIRE) >= EVENT_QUEUE_SIZE)
+    {
+        queue.dropped++;
+        return;
+    }
+    queue.events[head % EVENT_QUEUE_SIZE] = (rg_input_event_t){time, state, changed};
+    __atomic_store_n(&queue.head, head + 1, __ATOMIC_RELEASE);
+    queue.pushed++;
+}
+
+#ifdef ESP_PLATFORM
+static void input_timer_cb(void *arg)
+{
+    xTaskNotifyGive(input_task_handle);
+}
+
+static void input_gpio_isr(void *arg)
+{
+    BaseType_t woken = pdFALSE;
+    // Only the fast mode can take samples at irregular intervals, the slow mode's debounce counts them
+    if (sample_rate > 100)
+        vTaskNotifyGiveFromISR(input_task_handle, &woken);
+    if (woken)
+        portYIELD_FROM_ISR();
+}
+#endif
+
+static void wait_until(int64_t time)
+{
+    int64_t delay = time - rg_system_timer();
+    if (delay <= 0)
+        return;
+#ifdef ESP_PLATFORM
+    // A one-shot timer gives us sub-tick wakeups without busy waiting on the emulation core
+    if (input_timer && esp_timer_start_once(input_timer, delay) == ESP_OK)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        esp_timer_stop(input_timer); // In case a button woke us up first
+    }
+    else
+        rg_task_delay(RG_MAX(delay / 1000, 1000 / RG_TICK_RATE));
+#else
+    rg_usleep(delay);
+#endif
+}
+
 static void input_task(void *arg)
 {
     uint8_t debounce[RG_KEY_COUNT];
+    int64_t edge_time[RG_KEY_COUNT] = {0};
     uint32_t local_gamepad_state = 0;
+    uint32_t unsettled = 0; // Keys whose raw level differs from their debounced state
     uint32_t state;
     int64_t next_battery_update = 0;
+    int64_t next_sample = 0;
 
     // Start the task with debounce history full to allow a button held during boot to be detected
     memset(debounce, 0xFF, sizeof(debounce));
     input_task_running = true;
 
+#ifdef ESP_PLATFORM
+    input_task_handle = xTaskGetCurrentTaskHandle();
+    const esp_timer_create_args_t timer_args = {.callback = &input_timer_cb, .name = "rg_input"};
+    if (esp_timer_create(&timer_args, &input_timer) != ESP_OK)
+        RG_LOGE("Unable to create the input timer, falling back to tick delays");
+#if defined(RG_GAMEPAD_GPIO_MAP)
+    // Wake up as soon as a button changes instead of waiting for the next sample. The service may already be
+    // installed by another driver, that's fine.
+    gpio_install_isr_service(0);
+    for (size_t i = 0; i < RG_COUNT(keymap_gpio); ++i)
+    {
+        gpio_set_intr_type(keymap_gpio[i].num, GPIO_INTR_ANYEDGE);
+        gpio_isr_handler_add(keymap_gpio[i].num, &input_gpio_isr, NULL);
+        gpio_intr_enable(keymap_gpio[i].num);
+    }
+#endif
+#endif
+
     while (input_task_running)
     {
+        int64_t now = rg_system_timer();
+        int rate = sample_rate;
+        int64_t period = 1000000 / rate;
+
+        if (rate != sampling.rate)
+        {
+            memset(&sampling, 0, sizeof(sampling));
+            sampling.rate = rate;
+            next_sample = now;
+        }
+
+        if (now >= next_sample)
+        {
+            int jitter = now - next_sample;
+            sampling.jitterTotal += jitter;
+            sampling.maxJitter = RG_MAX(sampling.maxJitter, jitter);
+            sampling.scheduled++;
+            // Stay on the grid unless we missed a whole period, then start over from now
+            next_sample += period;
+            if (next_sample <= now)
+                next_sample = now + period;
+        }
+        else
+            sampling.wakeups++;
+        sampling.samples++;
+
         if (rg_input_read_gamepad_raw(&state))
         {
+            uint32_t previous = local_gamepad_state;
+
             for (int i = 0; i < RG_KEY_COUNT; ++i)
             {
+                uint32_t bit = 1 << i;
                 uint32_t val = ((debounce[i] << 1) | ((state >> i) & 1));
                 debounce[i] = val & 0xFF;
 
-                if ((val & ((1 << RG_GAMEPAD_DEBOUNCE_PRESS) - 1)) == ((1 << RG_GAMEPAD_DEBOUNCE_PRESS) - 1))
+                if ((state ^ local_gamepad_state) & bit)
+                {
+                    if (!(unsettled & bit))
+                        edge_time[i] = now;
+                    unsettled |= bit;
+                }
+                else
+                {
+                    unsettled &= ~bit;
+                }
+
+                if (rate > 100)
+                {
+                    // The debounce constants are in 10ms samples. When sampling faster a press is reported on
+                    // the first sample and a release once the key stayed up that long, so bounces are ignored.
+                    if (state & bit)
+                        local_gamepad_state |= bit; // Pressed
+                    else if ((unsettled & bit) && now - edge_time[i] >= (RG_GAMEPAD_DEBOUNCE_RELEASE - 1) * 10000)
+                        local_gamepad_state &= ~bit; // Released
+                }
+                else if ((val & ((1 << RG_GAMEPAD_DEBOUNCE_PRESS) - 1)) == ((1 << RG_GAMEPAD_DEBOUNCE_PRESS) - 1))
                 {
-                    local_gamepad_state |= (1 << i); // Pressed
+                    local_gamepad_state |= bit; // Pressed
                 }
                 else if ((val & ((1 << RG_GAMEPAD_DEBOUNCE_RELEASE) - 1)) == 0)
                 {
-                    local_gamepad_state &= ~(1 << i); // Released
+                    local_gamepad_state &= ~bit; // Released
                 }
             }
+
+            uint32_t changed = local_gamepad_state ^ previous;
+            if (changed)
+            {
+                // Timestamp the change with the first sample that saw it, not the one that confirmed it
+                int64_t time = now;
+                for (int i = 0; i < RG_KEY_COUNT; ++i)
+                {
+                    if ((changed >> i) & 1)
+                        time = RG_MIN(time, edge_time[i]);
+                }
+                unsettled &= ~changed;
+                push_event(time, local_gamepad_state, changed);
+            }
             gamepad_state = local_gamepad_state;
         }
 
@@ -258,8 +433,17 @@ static void input_task(void *arg)
             next_battery_update = rg_system_timer() + 2 * 1000000; // update every 2 seconds
         }
 
-        rg_task_delay(10);
+        wait_until(next_sample);
+    }
+
+#ifdef ESP_PLATFORM
+    if (input_timer)
+    {
+        esp_timer_stop(input_timer);
+        esp_timer_delete(input_timer);
+        input_timer = NULL;
     }
+#endif
 
     input_task_running = false;
     gamepad_state = -1;
@@ -366,20 +550,84 @@ void rg_input_init(void)
 
 void rg_input_deinit(void)
 {
+#if defined(ESP_PLATFORM) && defined(RG_GAMEPAD_GPIO_MAP)
+    // The task may be gone by the time a button is pressed, the interrupt must not notify it anymore
+    for (size_t i = 0; i < RG_COUNT(keymap_gpio); ++i)
+    {
+        gpio_intr_disable(keymap_gpio[i].num);
+        gpio_isr_handler_remove(keymap_gpio[i].num);
+    }
+#endif
     input_task_running = false;
     // while (gamepad_state != -1)
     //     rg_task_yield();
     RG_LOGI("Input terminated.\n");
 }
 
+static uint32_t read_trace_state(void)
+{
+    int frame = rg_system_get_counters().ticks;
+    uint32_t state = 0;
+    // Traces are short enough that a linear scan is fine, they aren't used in normal operation anyway
+    for (size_t i = 0; i < trace_events_count && trace_events[i].frame <= frame; ++i)
+        state = trace_events[i].state;
+    return state;
+}
+
 uint32_t rg_input_read_gamepad(void)
 {
 #ifdef RG_TARGET_SDL2
     SDL_PumpEvents();
 #endif
+    if (trace_events)
+        return read_trace_state();
     return gamepad_state;
 }
 
+bool rg_input_load_trace(const char *filename)
+{
+    RG_ASSERT_ARG(filename);
+
+    FILE *fp = fopen(filename, "r");
+    if (!fp)
+    {
+        RG_LOGE("Unable to open input trace '%s'", filename);
+        return false;
+    }
+
+    free(trace_events);
+    trace_events = NULL;
+    trace_events_count = 0;
+
+    char line[128];
+    while (fgets(line, sizeof(line), fp))
+    {
+        char *ptr = line;
+        while (*ptr == ' ' || *ptr == '\t')
+            ptr++;
+        if (*ptr == '#' || *ptr == '\n' || *ptr == '\r' || *ptr == 0)
+            continue;
+
+        trace_event_t event;
+        event.frame = strtol(ptr, &ptr, 10);
+        event.state = strtoul(ptr, NULL, 0);
+        if (trace_events_count && event.frame < trace_events[trace_events_count - 1].frame)
+        {
+            RG_LOGE("Input trace events must be in order (frame %d)", event.frame);
+            break;
+        }
+
+        void *temp = realloc(trace_events, (trace_events_count + 1) * sizeof(trace_event_t));
+        RG_ASSERT(temp, "alloc failed");
+        trace_events = temp;
+        trace_events[trace_events_count++] = event;
+    }
+    fclose(fp);
+
+    RG_LOGI("Loaded %d events from input trace '%s'", (int)trace_events_count, filename);
+    return true;
+}
+
 bool rg_input_key_is_pressed(rg_key_t mask)
 {
     return (bool)(rg_input_read_gamepad() & mask);
@@ -402,6 +650,47 @@ rg_battery_t rg_input_read_battery(void)
     return battery_state;
 }
 
+bool rg_input_read_event(rg_input_event_t *out, int64_t before)
+{
+    RG_ASSERT_ARG(out);
+    // A replayed trace only has frame numbers, the app must keep using rg_input_read_gamepad
+    if (trace_events)
+        return false;
+    queue.enabled = true;
+    uint32_t tail = queue.tail;
+    if (tail == __atomic_load_n(&queue.head, __ATOMIC_ACQUIRE))
+        return false;
+    rg_input_event_t event = queue.events[tail % EVENT_QUEUE_SIZE];
+    if (event.time > before)
+        return false;
+    *out = event;
+    __atomic_store_n(&queue.tail, tail + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+int rg_input_get_sample_rate(void)
+{
+    return sample_rate;
+}
+
+void rg_input_set_sample_rate(int hz)
+{
+    sample_rate = RG_MIN(RG_MAX(hz, 10), 1000);
+}
+
+rg_input_stats_t rg_input_get_stats(void)
+{
+    return (rg_input_stats_t){
+        .rate = sampling.rate,
+        .samples = sampling.samples,
+        .wakeups = sampling.wakeups,
+        .avgJitter = sampling.scheduled ? sampling.jitterTotal / sampling.scheduled : 0,
+        .maxJitter = sampling.maxJitter,
+        .events = queue.pushed,
+        .dropped = queue.dropped,
+    };
+}
+
 const char *rg_input_get_key_name(rg_key_t key)
 {
     switch (key)
@@ -94,6 +94,24 @@ typedef struct
     char data[];
 } rg_keyboard_map_t;
 
+typedef struct
+{
+    int64_t time;     // rg_system_timer() of the first sample that saw the change
+    uint32_t state;   // Debounced gamepad state after the change
+    uint32_t changed; // Keys that changed
+} rg_input_event_t;
+
+typedef struct
+{
+    int rate;      // Sampling rate, in Hz
+    int samples;   // Samples taken since the rate was set
+    int wakeups;   // Samples taken early because a button interrupt fired
+    int avgJitter; // How late scheduled samples were taken, in us
+    int maxJitter;
+    int events;    // Key changes queued
+    int dropped;   // Key changes lost because the queue was full
+} rg_input_stats_t;
+
 void rg_input_init(void);
 void rg_input_deinit(void);
 bool rg_input_key_is_pressed(rg_key_t mask);
@@ -101,8 +119,18 @@ bool rg_input_wait_for_key(rg_key_t mask, bool pressed, int timeout_ms);
 const char *rg_input_get_key_name(rg_key_t key);
 const char *rg_input_get_key_mapping(rg_key_t key);
 uint32_t rg_input_read_gamepad(void);
+// Replay a scripted input trace (one `<frame> <keys>` per line) instead of reading the hardware
+bool rg_input_load_trace(const char *filename);
 int rg_input_read_keyboard(const rg_keyboard_map_t *map);
 rg_battery_t rg_input_read_battery(void);
 bool rg_input_read_gamepad_raw(uint32_t *out);
 bool rg_input_read_keyboard_raw(int *out);
 bool rg_input_read_battery_raw(rg_battery_t *out);
+// Pops the oldest key change that happened at or before `before` (a rg_system_timer() value), so that an app
+// can apply them at the right point of the frame. Only one task may read events. The queue starts filling on
+// the first call, apps that only use rg_input_read_gamepad don't pay for it.
+bool rg_input_read_event(rg_input_event_t *out, int64_t before);
+// Rates above 100Hz switch to eager debouncing and, on GPIO gamepads, also sample on button interrupts
+int rg_input_get_sample_rate(void);
+void rg_input_set_sample_rate(int hz);
+rg_input_stats_t rg_input_get_stats(void);
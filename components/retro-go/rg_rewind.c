@@ -0,0 +1,358 @@
+#include "rg_system.h"
+#include "rg_rewind.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_SNAPSHOTS 1024
+// A zero run shorter than this is cheaper to store as literals than to start a new token (4 bytes)
+#define MIN_ZERO_RUN  8
+// Worst case size of an encoded delta: one token per 65535 bytes plus the trailing run
+#define DELTA_BOUND(len) ((len) + ((len) / 0xFFFF + 2) * 4)
+
+static const char *SETTING_BUDGET = "RewindBudget";
+static const char *SETTING_INTERVAL = "RewindInterval";
+
+typedef struct
+{
+    uint32_t offset;
+    uint32_t size;
+} snapshot_t;
+
+static struct
+{
+    bool loaded;      // Settings have been read
+    bool initialized; // Buffers are allocated, or allocation failed and we shouldn't retry
+    bool enabled;
+    int budget;
+    int interval;
+    int counter;
+    uint8_t *ring;
+    size_t ringSize;
+    size_t head;
+    snapshot_t *snapshots;
+    size_t first, count;
+    uint8_t *current; // The newest state, in full
+    uint8_t *scratch; // Where the next state is saved before it's diffed against current
+    size_t capacity;  // Size of current and scratch
+    size_t stateSize; // 0 until current holds a state
+    size_t memoryUsed;
+    int captures;
+    int64_t captureTime;
+    int frames;
+} history;
+
+// Encodes a ^ b as tokens of [u16 equal bytes][u16 literals][literals...], both little-endian
+static size_t delta_encode(uint8_t *dst, const uint8_t *a, const uint8_t *b, size_t len)
+{
+    uint8_t *out = dst;
+    size_t pos = 0;
+
+    while (pos < len)
+    {
+        size_t start = pos;
+        // States are mostly unchanged between snapshots, skip them a word at a time when we can
+        if (((uintptr_t)a & 3) == 0 && ((uintptr_t)b & 3) == 0)
+        {
+            while ((pos & 3) && pos < len && pos - start < 0xFFFF && a[pos] == b[pos])
+                pos++;
+            while (pos + 4 <= len && pos - start + 4 <= 0xFFFF && *(uint32_t *)&a[pos] == *(uint32_t *)&b[pos])
+                pos += 4;
+        }
+        while (pos < len && pos - start < 0xFFFF && a[pos] == b[pos])
+            pos++;
+        size_t equal = pos - start;
+
+        uint8_t *header = out;
+        out += 4;
+        start = pos;
+        while (pos < len && pos - start < 0xFFFF)
+        {
+            if (a[pos] == b[pos])
+            {
+                size_t run = 1;
+                while (run < MIN_ZERO_RUN && pos + run < len && a[pos + run] == b[pos + run])
+                    run++;
+                if (run == MIN_ZERO_RUN || pos + run == len)
+                    break;
+            }
+            *out++ = a[pos] ^ b[pos];
+            pos++;
+        }
+        size_t literals = pos - start;
+
+        header[0] = equal & 0xFF;
+        header[1] = equal >> 8;
+        header[2] = literals & 0xFF;
+        header[3] = literals >> 8;
+    }
+
+    return out - dst;
+}
+
+// XORs an encoded delta into dst
+static bool delta_apply(uint8_t *dst, size_t len, const uint8_t *src, size_t src_len)
+{
+    const uint8_t *end = src + src_len;
+    size_t pos = 0;
+
+    while (src + 4 <= end)
+    {
+        size_t equal = src[0] | (src[1] << 8);
+        size_t literals = src[2] | (src[3] << 8);
+        src += 4;
+        pos += equal;
+        if (pos + literals > len || src + literals > end)
+            return false;
+        for (size_t i = 0; i < literals; ++i)
+            dst[pos++] ^= *src++;
+    }
+
+    return src == end && pos <= len;
+}
+
+static snapshot_t *oldest(void)
+{
+    return &history.snapshots[history.first];
+}
+
+static snapshot_t *newest(void)
+{
+    return &history.snapshots[(history.first + history.count - 1) % MAX_SNAPSHOTS];
+}
+
+static void evict_oldest(void)
+{
+    history.memoryUsed -= oldest()->size;
+    history.first = (history.first + 1) % MAX_SNAPSHOTS;
+    history.count--;
+}
+
+// Returns where `size` contiguous bytes can be written, dropping the oldest snapshots in the way
+static size_t make_room(size_t size)
+{
+    size_t start = history.head;
+
+    if (history.count == MAX_SNAPSHOTS)
+        evict_oldest();
+
+    if (start + size > history.ringSize)
+    {
+        // Wrap around. Whatever is past the head is older than what's at the beginning.
+        while (history.count && oldest()->offset >= start)
+            evict_oldest();
+        start = 0;
+    }
+    while (history.count && oldest()->offset >= start && oldest()->offset < start + size)
+        evict_oldest();
+
+    return start;
+}
+
+static void load_settings(void)
+{
+    if (history.loaded)
+        return;
+    history.budget = rg_settings_get_number(NS_APP, SETTING_BUDGET, 0);
+    history.interval = rg_settings_get_number(NS_APP, SETTING_INTERVAL, 6);
+    history.interval = RG_MIN(RG_MAX(history.interval, 1), 60);
+    history.loaded = true;
+}
+
+static void rewind_init(void)
+{
+    const rg_app_t *app = rg_system_get_app();
+
+    load_settings();
+    history.initialized = true;
+    history.enabled = false;
+
+    if (history.budget <= 0 || !app->handlers.saveStateMem || !app->handlers.loadStateMem)
+        return;
+
+    size_t size = rg_emu_save_state_mem(NULL, 0);
+    if (size == 0)
+    {
+        RG_LOGE("Unable to get the state size, rewind disabled.\n");
+        return;
+    }
+
+    history.capacity = size;
+    history.ringSize = (size_t)history.budget * 1024;
+    if (history.ringSize < DELTA_BOUND(size))
+    {
+        RG_LOGE("Rewind budget too small for a %d bytes state, rewind disabled.\n", (int)size);
+        return;
+    }
+
+    history.ring = rg_alloc(history.ringSize, MEM_SLOW | MEM_NOPANIC);
+    history.snapshots = rg_alloc(MAX_SNAPSHOTS * sizeof(snapshot_t), MEM_SLOW | MEM_NOPANIC);
+    history.current = rg_alloc(history.capacity, MEM_SLOW | MEM_NOPANIC);
+    history.scratch = rg_alloc(history.capacity, MEM_SLOW | MEM_NOPANIC);
+    if (!history.ring || !history.snapshots || !history.current || !history.scratch)
+    {
+        RG_LOGE("Not enough memory for rewind, disabled.\n");
+        rg_rewind_deinit();
+        history.initialized = true; // Don't retry every frame
+        return;
+    }
+
+    rg_rewind_clear();
+    history.enabled = true;
+    RG_LOGI("Rewind ready. budget=%dKB, interval=%d, state=%d bytes\n", history.budget, history.interval, (int)size);
+}
+
+void rg_rewind_deinit(void)
+{
+    free(history.ring);
+    free(history.snapshots);
+    free(history.current);
+    free(history.scratch);
+    history.ring = history.current = history.scratch = NULL;
+    history.snapshots = NULL;
+    history.enabled = false;
+    history.initialized = false;
+}
+
+void rg_rewind_clear(void)
+{
+    history.head = history.first = history.count = 0;
+    history.stateSize = history.memoryUsed = 0;
+    history.counter = 0;
+    history.captures = history.frames = 0;
+    history.captureTime = 0;
+}
+
+bool rg_rewind_capture(void)
+{
+    if (!history.enabled)
+        return false;
+
+    int64_t startTime = rg_system_timer();
+
+    size_t size = rg_emu_save_state_mem(history.scratch, history.capacity);
+    if (size == 0)
+    {
+        // The state grew, which some cores do when the game enables a feature. We'll take it from the top,
+        // unless it never worked in the first place.
+        RG_LOGW("Snapshot failed, resetting history.\n");
+        bool retry = history.stateSize != 0;
+        rg_rewind_deinit();
+        history.initialized = !retry;
+        return false;
+    }
+
+    if (size != history.stateSize)
+    {
+        // Nothing to diff against
+        rg_rewind_clear();
+    }
+    else
+    {
+        size_t offset = make_room(DELTA_BOUND(size));
+        size_t encoded = delta_encode(history.ring + offset, history.scratch, history.current, size);
+        history.snapshots[(history.first + history.count) % MAX_SNAPSHOTS] = (snapshot_t){offset, encoded};
+        history.count++;
+        history.head = offset + encoded;
+        history.memoryUsed += encoded;
+    }
+
+    uint8_t *temp = history.current;
+    history.current = history.scratch;
+    history.scratch = temp;
+    history.stateSize = size;
+
+    history.captures++;
+    history.captureTime += rg_system_timer() - startTime;
+    return true;
+}
+
+bool rg_rewind_step(void)
+{
+    if (!history.enabled || !history.stateSize)
+        return false;
+
+    // Once the history is exhausted we stay on the oldest state
+    if (history.count > 0)
+    {
+        snapshot_t *snapshot = newest();
+        if (!delta_apply(history.current, history.stateSize, history.ring + snapshot->offset, snapshot->size))
+        {
+            RG_LOGE("Corrupted snapshot, clearing rewind history.\n");
+            rg_rewind_clear();
+            return false;
+        }
+        history.head = snapshot->offset;
+        history.memoryUsed -= snapshot->size;
+        history.count--;
+    }
+    history.counter = 0;
+
+    return rg_emu_load_state_mem(history.current, history.stateSize);
+}
+
+void rg_rewind_tick(bool step_back)
+{
+    if (!history.initialized)
+        rewind_init();
+    if (!history.enabled)
+        return;
+
+    if (step_back)
+    {
+        rg_rewind_step();
+        return;
+    }
+
+    history.frames++;
+    if (history.counter-- <= 0)
+    {
+        rg_rewind_capture();
+        history.counter = history.interval - 1;
+    }
+}
+
+bool rg_rewind_is_enabled(void)
+{
+    return history.enabled;
+}
+
+rg_rewind_stats_t rg_rewind_get_stats(void)
+{
+    return (rg_rewind_stats_t){
+        .stateSize = history.stateSize,
+        .memoryUsed = history.memoryUsed,
+        .snapshots = history.count,
+        .captures = history.captures,
+        .captureTime = history.captures ? history.captureTime / history.captures : 0,
+        .frameTime = history.frames ? history.captureTime / history.frames : 0,
+    };
+}
+
+int rg_rewind_get_budget(void)
+{
+    load_settings();
+    return history.budget;
+}
+
+void rg_rewind_set_budget(int kb)
+{
+    load_settings();
+    history.budget = RG_MAX(kb, 0);
+    rg_settings_set_number(NS_APP, SETTING_BUDGET, history.budget);
+    rg_rewind_deinit(); // Reallocated on the next frame
+}
+
+int rg_rewind_get_interval(void)
+{
+    load_settings();
+    return history.interval;
+}
+
+void rg_rewind_set_interval(int frames)
+{
+    load_settings();
+    history.interval = RG_MIN(RG_MAX(frames, 1), 60);
+    rg_settings_set_number(NS_APP, SETTING_INTERVAL, history.interval);
+    history.counter = 0;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct
+{
+    size_t stateSize;   // Size of one full state
+    size_t memoryUsed;  // Bytes of the ring used by the snapshots
+    int snapshots;      // Number of steps we can go back
+    int captures;       // Snapshots taken since the history was last cleared
+    int captureTime;    // Average time to take one snapshot (us)
+    int frameTime;      // Average capture cost per emulated frame (us)
+} rg_rewind_stats_t;
+
+// Rewind keeps a snapshot of the emulator every few frames in a ring in external memory. Only the newest state
+// is kept in full, the others are XOR deltas against the next one, compressed with zero-run RLE. It requires the
+// app's in-memory state handlers and is driven by rg_system_frame_begin, the app doesn't have to do anything.
+void rg_rewind_deinit(void);
+// Called once per frame: takes a snapshot every `interval` frames, or goes one snapshot back if step_back
+void rg_rewind_tick(bool step_back);
+// Drops the history (after loading a state, reset, etc)
+void rg_rewind_clear(void);
+bool rg_rewind_capture(void);
+bool rg_rewind_step(void);
+bool rg_rewind_is_enabled(void);
+rg_rewind_stats_t rg_rewind_get_stats(void);
+
+// Memory budget in KB for the ring, 0 disables rewind. Both are per-app settings.
+int rg_rewind_get_budget(void);
+void rg_rewind_set_budget(int kb);
+// How many frames between snapshots, also how many frames a step goes back
+int rg_rewind_get_interval(void);
+void rg_rewind_set_interval(int frames);
@@ -510,8 +510,9 @@ bool rg_storage_write_file(const char *path, const void *data_ptr, size_t data_l
 
 /**
  * This is a minimal UNZIP implementation that utilizes only the miniz primitives found in ESP32's ROM.
- * I think that we should use miniz' ZIP API instead and bundle miniz with retro-go. But first I need
- * to do some testing to determine if the increased executable size is acceptable...
+ * Entries are located through the central directory, and inflated on demand through a 32KB window, so
+ * callers never need more than the part of the file that they're currently reading.
+ * Not supported: ZIP64, encryption, compression methods other than store and deflate.
  */
 #if RG_ZIP_SUPPORT
 
@@ -521,7 +522,9 @@ bool rg_storage_write_file(const char *path, const void *data_ptr, size_t data_l
 #include <miniz.h>
 #endif
 
-#define ZIP_MAGIC 0x04034b50
+#define ZIP_LOCAL_MAGIC 0x04034b50
+#define ZIP_CENTRAL_MAGIC 0x02014b50
+#define ZIP_END_MAGIC 0x06054b50
 typedef struct __attribute__((packed))
 {
     uint32_t magic;
@@ -535,118 +538,468 @@ typedef struct __attribute__((packed))
     uint32_t uncompressed_size;
     uint16_t filename_size;
     uint16_t extra_field_size;
-    uint8_t filename[226];
+    // uint8_t filename[];
     // uint8_t extra_field[];
     // uint8_t compressed_data[];
 } zip_header_t;
+typedef struct __attribute__((packed))
+{
+    uint32_t magic;
+    uint16_t version_made_by;
+    uint16_t version;
+    uint16_t flags;
+    uint16_t compression;
+    uint16_t modified_time;
+    uint16_t modified_date;
+    uint32_t checksum;
+    uint32_t compressed_size;
+    uint32_t uncompressed_size;
+    uint16_t filename_size;
+    uint16_t extra_field_size;
+    uint16_t comment_size;
+    uint16_t disk_number;
+    uint16_t internal_attributes;
+    uint32_t external_attributes;
+    uint32_t header_offset;
+    // uint8_t filename[];
+    // uint8_t extra_field[];
+    // uint8_t comment[];
+} zip_central_header_t;
+typedef struct __attribute__((packed))
+{
+    uint32_t magic;
+    uint16_t disk_number;
+    uint16_t central_disk_number;
+    uint16_t disk_entries;
+    uint16_t total_entries;
+    uint32_t central_size;
+    uint32_t central_offset;
+    uint16_t comment_size;
+} zip_end_header_t;
+
+struct rg_zip_s
+{
+    FILE *fp;
+    char name[256];
+    uint16_t compression;
+    size_t data_offset;
+    size_t compressed_size;
+    size_t size;
+    size_t position;
+    // Inflate state, the window doubles as our output buffer
+    tinfl_decompressor decomp;
+    tinfl_status status;
+    size_t stream_pos;
+    size_t input_pos, input_len;
+    size_t window_pos, window_len, window_ofs;
+    uint8_t *window;
+    uint8_t input[0x2000];
+};
 
-bool rg_storage_unzip_file(const char *zip_path, const char *filter, void **data_out, size_t *data_len, uint32_t flags)
+typedef int (zip_entry_cb_t)(const zip_central_header_t *entry, const char *name, size_t header_offset, void *arg);
+
+// Walks the central directory and calls callback for each entry until it returns RG_SCANDIR_STOP
+static bool zip_read_directory(FILE *fp, const char *zip_path, zip_entry_cb_t *callback, void *arg)
 {
-    RG_ASSERT_ARG(data_out && data_len);
-    CHECK_PATH(zip_path);
+    zip_end_header_t end = {0};
+    uint8_t *buffer = NULL;
+    size_t end_pos = 0;
+    bool success = false;
 
-    zip_header_t header = {0};
-    int header_pos = 0;
+    if (fseek(fp, 0, SEEK_END) != 0)
+        return false;
 
-    FILE *fp = fopen(zip_path, "rb");
-    if (!fp)
+    // The end of central directory record is followed by a comment of up to 64KB. Archives rarely have one,
+    // so we first look for the record at the very end and only search the rest of the tail if it isn't there.
+    size_t file_size = ftell(fp);
+    if (file_size < sizeof(zip_end_header_t))
+        goto _done;
+
+    end_pos = file_size - sizeof(zip_end_header_t);
+    if (fseek(fp, end_pos, SEEK_SET) != 0 || fread(&end, sizeof(end), 1, fp) != 1)
+        goto _done;
+
+    if (end.magic != ZIP_END_MAGIC || end.comment_size != 0)
+    {
+        size_t tail_size = RG_MIN(file_size, 0xFFFF + sizeof(zip_end_header_t));
+        if (!(buffer = malloc(tail_size)))
+            goto _done;
+
+        if (fseek(fp, file_size - tail_size, SEEK_SET) != 0 || fread(buffer, tail_size, 1, fp) != 1)
+            goto _done;
+
+        for (size_t pos = tail_size - sizeof(zip_end_header_t) + 1; pos-- > 0;)
+        {
+            memcpy(&end, buffer + pos, sizeof(end));
+            if (end.magic == ZIP_END_MAGIC)
+            {
+                end_pos = file_size - tail_size + pos;
+                break;
+            }
+        }
+        free(buffer);
+        buffer = NULL;
+    }
+
+    if (end.magic != ZIP_END_MAGIC || end.central_size > end_pos)
+    {
+        RG_LOGE("No central directory found: '%s'", zip_path);
+        goto _done;
+    }
+
+    // Offsets are relative to the start of the archive, which isn't always the start of the file
+    size_t central_pos = end_pos - end.central_size;
+    size_t shift = central_pos - RG_MIN(end.central_offset, central_pos);
+
+    if (!(buffer = malloc(end.central_size + 1)))
+        goto _done;
+
+    if (fseek(fp, central_pos, SEEK_SET) != 0 || (end.central_size && fread(buffer, end.central_size, 1, fp) != 1))
+    {
+        RG_LOGE("Read error (%d): '%s'", errno, zip_path);
+        goto _done;
+    }
+
+    success = true;
+
+    for (size_t pos = 0, i = 0; i < end.total_entries; ++i)
+    {
+        zip_central_header_t entry;
+        char name[256];
+
+        if (pos + sizeof(entry) > end.central_size)
+            break;
+        memcpy(&entry, buffer + pos, sizeof(entry));
+        if (entry.magic != ZIP_CENTRAL_MAGIC || pos + sizeof(entry) + entry.filename_size > end.central_size)
+        {
+            RG_LOGE("Corrupted central directory: '%s'", zip_path);
+            success = false;
+            break;
+        }
+
+        size_t name_len = RG_MIN(entry.filename_size, sizeof(name) - 1);
+        memcpy(name, buffer + pos + sizeof(entry), name_len);
+        name[name_len] = 0;
+
+        if (callback(&entry, name, entry.header_offset + shift, arg) == RG_SCANDIR_STOP)
+            break;
+
+        pos += sizeof(entry) + entry.filename_size + entry.extra_field_size + entry.comment_size;
+    }
+
+_done:
+    free(buffer);
+    return success;
+}
+
+static int zip_open_cb(const zip_central_header_t *entry, const char *name, size_t header_offset, void *arg)
+{
+    const char *filter = ((const char **)arg)[0];
+    rg_zip_t *zip = ((rg_zip_t **)arg)[1];
+    size_t name_len = strlen(name);
+
+    // Skip folders and the resource forks added by macOS
+    if (name_len == 0 || name[name_len - 1] == '/' || strncmp(name, "__MACOSX/", 9) == 0)
+        return RG_SCANDIR_CONTINUE;
+
+    // The filter is either a list of extensions or the name of the entry
+    if (filter && !rg_extension_match(name, filter) && strcmp(name, filter) != 0 && strcmp(rg_basename(name), filter) != 0)
+        return RG_SCANDIR_CONTINUE;
+
+    strcpy(zip->name, name);
+    zip->compression = entry->compression;
+    zip->compressed_size = entry->compressed_size;
+    zip->size = entry->uncompressed_size;
+    zip->data_offset = header_offset; // Adjusted later, the local header can't be read while we're iterating
+    if (entry->flags & 1)
+        zip->compression = 0xFFFF; // Encrypted
+    return RG_SCANDIR_STOP;
+}
+
+static void zip_rewind(rg_zip_t *zip)
+{
+    tinfl_init(&zip->decomp);
+    zip->status = TINFL_STATUS_NEEDS_MORE_INPUT;
+    zip->stream_pos = 0;
+    zip->input_pos = zip->input_len = 0;
+    zip->window_pos = zip->window_len = zip->window_ofs = 0;
+    zip->position = 0;
+}
+
+rg_zip_t *rg_storage_zip_open(const char *zip_path, const char *filter)
+{
+    if (!zip_path || !zip_path[0])
+    {
+        RG_LOGE("No path given");
+        return NULL;
+    }
+
+    rg_zip_t *zip = calloc(1, sizeof(rg_zip_t));
+    if (!zip)
+    {
+        RG_LOGE("Memory allocation failed: '%s'", zip_path);
+        return NULL;
+    }
+
+    if (!(zip->fp = fopen(zip_path, "rb")))
     {
         RG_LOGE("Fopen failed (%d): '%s'", errno, zip_path);
-        return false;
+        free(zip);
+        return NULL;
+    }
+
+    const void *args[2] = {filter, zip};
+    if (!zip_read_directory(zip->fp, zip_path, zip_open_cb, args) || !zip->name[0])
+    {
+        RG_LOGE("No entry matching '%s' found: '%s'", filter ?: "*", zip_path);
+        goto _fail;
+    }
+
+    if (zip->compression != 0 && zip->compression != 8)
+    {
+        RG_LOGE("Unsupported compression method %d: '%s'", zip->compression, zip->name);
+        goto _fail;
+    }
+
+    // The local header's extra field isn't always the same size as the central one
+    zip_header_t header;
+    if (fseek(zip->fp, zip->data_offset, SEEK_SET) != 0 || fread(&header, sizeof(header), 1, zip->fp) != 1
+        || header.magic != ZIP_LOCAL_MAGIC)
+    {
+        RG_LOGE("No valid local header found: '%s'", zip_path);
+        goto _fail;
+    }
+    zip->data_offset += sizeof(header) + header.filename_size + header.extra_field_size;
+
+    if (zip->compression == 8 && !(zip->window = malloc(TINFL_LZ_DICT_SIZE)))
+    {
+        RG_LOGE("Memory allocation failed: '%s'", zip_path);
+        goto _fail;
     }
 
-    // Very inefficient, we should read a block at a time and search it for a header. But I'm lazy.
-    // Thankfully the header is usually found on the very first read :)
-    for (header_pos = 0; !feof(fp) && header_pos < 0x10000; ++header_pos)
+    zip_rewind(zip);
+
+    RG_LOGI("Found file at %d, name: '%s', size: %d", (int)zip->data_offset, zip->name, (int)zip->size);
+    return zip;
+
+_fail:
+    rg_storage_zip_close(zip);
+    return NULL;
+}
+
+// Inflates the next size bytes into buffer, or simply skips them if buffer is NULL
+static size_t zip_inflate(rg_zip_t *zip, uint8_t *buffer, size_t size)
+{
+    size_t done = 0;
+
+    while (done < size)
     {
-        fseek(fp, header_pos, SEEK_SET);
-        fread(&header, sizeof(header), 1, fp);
-        if (header.magic == ZIP_MAGIC)
+        if (zip->window_len > 0)
+        {
+            size_t count = RG_MIN(zip->window_len, size - done);
+            if (buffer)
+                memcpy(buffer + done, zip->window + zip->window_pos, count);
+            zip->window_pos += count;
+            zip->window_len -= count;
+            done += count;
+            continue;
+        }
+
+        if (zip->status != TINFL_STATUS_NEEDS_MORE_INPUT && zip->status != TINFL_STATUS_HAS_MORE_OUTPUT)
             break;
+
+        if (zip->input_len == 0 && zip->stream_pos < zip->compressed_size)
+        {
+            size_t count = RG_MIN(sizeof(zip->input), zip->compressed_size - zip->stream_pos);
+            if (fseek(zip->fp, zip->data_offset + zip->stream_pos, SEEK_SET) != 0 || fread(zip->input, count, 1, zip->fp) != 1)
+            {
+                RG_LOGE("Read error (%d): '%s'", errno, zip->name);
+                zip->status = TINFL_STATUS_FAILED;
+                break;
+            }
+            zip->stream_pos += count;
+            zip->input_pos = 0;
+            zip->input_len = count;
+        }
+
+        bool has_more_input = zip->stream_pos < zip->compressed_size;
+        size_t input_size = zip->input_len;
+        size_t output_size = TINFL_LZ_DICT_SIZE - zip->window_ofs;
+        zip->status = tinfl_decompress(&zip->decomp, zip->input + zip->input_pos, &input_size,
+                                       zip->window, zip->window + zip->window_ofs, &output_size,
+                                       has_more_input ? TINFL_FLAG_HAS_MORE_INPUT : 0);
+        zip->input_pos += input_size;
+        zip->input_len -= input_size;
+        zip->window_pos = zip->window_ofs;
+        zip->window_len = output_size;
+        zip->window_ofs = (zip->window_ofs + output_size) & (TINFL_LZ_DICT_SIZE - 1);
+
+        if (zip->status < TINFL_STATUS_DONE || (zip->status == TINFL_STATUS_NEEDS_MORE_INPUT && !has_more_input && !output_size))
+        {
+            RG_LOGE("Decompression failed (%d): '%s'", (int)zip->status, zip->name);
+            zip->status = TINFL_STATUS_FAILED;
+            break;
+        }
+    }
+
+    zip->position += done;
+    return done;
+}
+
+size_t rg_storage_zip_read(rg_zip_t *zip, void *buffer, size_t size)
+{
+    RG_ASSERT_ARG(zip && buffer);
+
+    size = RG_MIN(size, zip->size - zip->position);
+
+    if (zip->compression == 8)
+        return zip_inflate(zip, buffer, size);
+
+    if (fseek(zip->fp, zip->data_offset + zip->position, SEEK_SET) != 0)
+        return 0;
+    size = fread(buffer, 1, size, zip->fp);
+    zip->position += size;
+    return size;
+}
+
+bool rg_storage_zip_seek(rg_zip_t *zip, size_t offset)
+{
+    RG_ASSERT_ARG(zip);
+
+    if (offset > zip->size)
+        return false;
+
+    if (zip->compression != 8)
+    {
+        zip->position = offset;
+        return true;
+    }
+
+    // A deflate stream can only be decoded forward, going back means starting over
+    if (offset < zip->position)
+        zip_rewind(zip);
+
+    return zip_inflate(zip, NULL, offset - zip->position) == offset - zip->position;
+}
+
+size_t rg_storage_zip_tell(rg_zip_t *zip)
+{
+    RG_ASSERT_ARG(zip);
+    return zip->position;
+}
+
+size_t rg_storage_zip_size(rg_zip_t *zip)
+{
+    RG_ASSERT_ARG(zip);
+    return zip->size;
+}
+
+const char *rg_storage_zip_name(rg_zip_t *zip)
+{
+    RG_ASSERT_ARG(zip);
+    return zip->name;
+}
+
+void rg_storage_zip_close(rg_zip_t *zip)
+{
+    if (!zip)
+        return;
+    if (zip->fp)
+        fclose(zip->fp);
+    free(zip->window);
+    free(zip);
+}
+
+static int zip_scandir_cb(const zip_central_header_t *entry, const char *name, size_t header_offset, void *arg)
+{
+    void **args = (void **)arg;
+    rg_scandir_t *result = args[0];
+    size_t name_len = strlen(name);
+
+    snprintf(result->path, sizeof(result->path), "%s", name);
+    result->basename = rg_basename(result->path);
+    result->is_dir = name_len > 0 && name[name_len - 1] == '/';
+    result->is_file = !result->is_dir;
+    result->size = entry->uncompressed_size;
+    result->mtime = 0;
+
+    return ((rg_scandir_cb_t *)args[1])(result, args[2]);
+}
+
+bool rg_storage_zip_scandir(const char *zip_path, rg_scandir_cb_t *callback, void *arg)
+{
+    RG_ASSERT_ARG(callback);
+    CHECK_PATH(zip_path);
+
+    FILE *fp = fopen(zip_path, "rb");
+    if (!fp)
+    {
+        RG_LOGE("Fopen failed (%d): '%s'", errno, zip_path);
+        return false;
     }
 
-    if (header.magic != ZIP_MAGIC)
+    rg_scandir_t *result = calloc(1, sizeof(rg_scandir_t));
+    if (!result)
     {
-        RG_LOGE("No valid header found: '%s'", zip_path);
         fclose(fp);
         return false;
     }
+    result->dirname = zip_path;
+
+    void *args[3] = {result, callback, arg};
+    bool success = zip_read_directory(fp, zip_path, zip_scandir_cb, args);
 
-    // Zero terminate or truncate filename just in case
-    header.filename[RG_MIN(header.filename_size, 225)] = 0;
+    free(result);
+    fclose(fp);
+    return success;
+}
+
+bool rg_storage_unzip_file(const char *zip_path, const char *filter, void **data_out, size_t *data_len, uint32_t flags)
+{
+    RG_ASSERT_ARG(data_out && data_len);
+    CHECK_PATH(zip_path);
 
-    RG_LOGI("Found file at %d, name: '%s', size: %d", header_pos, header.filename, (int)header.uncompressed_size);
+    rg_zip_t *zip = rg_storage_zip_open(zip_path, filter);
+    if (!zip)
+        return false;
 
-    size_t stream_offset = header_pos + 30 + header.filename_size + header.extra_field_size;
-    size_t stream_remaining = header.compressed_size;
     size_t output_buffer_align = RG_MAX(0x1000, (flags & 0xF) * 0x2000);
     size_t output_buffer_size;
-    size_t output_buffer_pos = 0;
     uint8_t *output_buffer = NULL;
 
     if (flags & RG_FILE_USER_BUFFER)
     {
-        output_buffer_size = RG_MIN(*data_len, header.uncompressed_size);
+        output_buffer_size = RG_MIN(*data_len, zip->size);
         output_buffer = *data_out;
     }
     else
     {
-        output_buffer_size = header.uncompressed_size;
+        output_buffer_size = zip->size;
         output_buffer = malloc((output_buffer_size + (output_buffer_align - 1)) & ~(output_buffer_align - 1));
     }
 
-    size_t read_buffer_size = 0x8000;
-    uint8_t *read_buffer = malloc(read_buffer_size);
-    tinfl_decompressor *decomp = malloc(sizeof(tinfl_decompressor));
-
-    if (!read_buffer || !output_buffer || !decomp)
+    if (!output_buffer)
     {
         RG_LOGE("Memory allocation failed: '%s'", zip_path);
-        goto _fail;
+        rg_storage_zip_close(zip);
+        return false;
     }
 
-    tinfl_status status;
-    tinfl_init(decomp);
-
-    do
+    // With user-provided buffer we might not reach the end of the entry, but it doesn't mean we've failed
+    if (rg_storage_zip_read(zip, output_buffer, output_buffer_size) != output_buffer_size)
     {
-        size_t input_size = RG_MIN(read_buffer_size, stream_remaining);
-        size_t output_size = output_buffer_size - output_buffer_pos;
-        if (fseek(fp, stream_offset, SEEK_SET) != 0 || fread(read_buffer, input_size, 1, fp) != 1)
-        {
-            RG_LOGE("Read error (%d): '%s'", errno, zip_path);
-            goto _fail;
-        }
-        stream_offset += input_size;
-        stream_remaining -= input_size;
-        status = tinfl_decompress(
-            decomp, read_buffer, &input_size, output_buffer, output_buffer + output_buffer_pos, &output_size,
-            TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF | (stream_remaining ? TINFL_FLAG_HAS_MORE_INPUT : 0));
-        output_buffer_pos += output_size;
-    } while (status == TINFL_STATUS_NEEDS_MORE_INPUT);
-
-    // With user-provided buffer we might not reach TINFL_STATUS_DONE, but it doesn't mean we've failed
-    if (status < TINFL_STATUS_DONE || output_buffer_pos != output_buffer_size) // (status != TINFL_STATUS_DONE)
-    {
-        RG_LOGE("Decompression failed (%d): %s", (int)status, zip_path);
-        goto _fail;
+        RG_LOGE("Decompression failed: %s", zip_path);
+        if (!(flags & RG_FILE_USER_BUFFER))
+            free(output_buffer);
+        rg_storage_zip_close(zip);
+        return false;
     }
 
-    free(read_buffer);
-    free(decomp);
-    fclose(fp);
+    rg_storage_zip_close(zip);
 
     *data_out = output_buffer;
     *data_len = output_buffer_size;
     return true;
-
-_fail:
-    if (!(flags & RG_FILE_USER_BUFFER))
-        free(output_buffer);
-    free(read_buffer);
-    free(decomp);
-    fclose(fp);
-    return false;
 }
 #else
 bool rg_storage_unzip_file(const char *zip_path, const char *filter, void **data_out, size_t *data_len, uint32_t flags)
@@ -654,4 +1007,37 @@ bool rg_storage_unzip_file(const char *zip_path, const char *filter, void **data
     RG_LOGE("ZIP support hasn't been enabled!");
     return false;
 }
+rg_zip_t *rg_storage_zip_open(const char *zip_path, const char *filter)
+{
+    RG_LOGE("ZIP support hasn't been enabled!");
+    return NULL;
+}
+size_t rg_storage_zip_read(rg_zip_t *zip, void *buffer, size_t size)
+{
+    return 0;
+}
+bool rg_storage_zip_seek(rg_zip_t *zip, size_t offset)
+{
+    return false;
+}
+size_t rg_storage_zip_tell(rg_zip_t *zip)
+{
+    return 0;
+}
+size_t rg_storage_zip_size(rg_zip_t *zip)
+{
+    return 0;
+}
+const char *rg_storage_zip_name(rg_zip_t *zip)
+{
+    return NULL;
+}
+void rg_storage_zip_close(rg_zip_t *zip)
+{
+}
+bool rg_storage_zip_scandir(const char *zip_path, rg_scandir_cb_t *callback, void *arg)
+{
+    RG_LOGE("ZIP support hasn't been enabled!");
+    return false;
+}
 #endif
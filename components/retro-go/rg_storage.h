@@ -78,3 +78,15 @@ enum
 bool rg_storage_read_file(const char *path, void **data_out, size_t *data_len, uint32_t flags);
 bool rg_storage_write_file(const char *path, const void *data_ptr, size_t data_len, uint32_t flags);
 bool rg_storage_unzip_file(const char *zip_path, const char *filter, void **data_out, size_t *data_len, uint32_t flags);
+
+// Streaming access to a single ZIP entry. filter is a list of extensions or an entry name, NULL picks the first file.
+// Seeking backward in a compressed entry restarts decompression from the beginning.
+typedef struct rg_zip_s rg_zip_t;
+rg_zip_t *rg_storage_zip_open(const char *zip_path, const char *filter);
+size_t rg_storage_zip_read(rg_zip_t *zip, void *buffer, size_t size);
+bool rg_storage_zip_seek(rg_zip_t *zip, size_t offset);
+size_t rg_storage_zip_tell(rg_zip_t *zip);
+size_t rg_storage_zip_size(rg_zip_t *zip);
+const char *rg_storage_zip_name(rg_zip_t *zip);
+void rg_storage_zip_close(rg_zip_t *zip);
+bool rg_storage_zip_scandir(const char *zip_path, rg_scandir_cb_t *callback, void *arg);
@@ -37,6 +37,7 @@ typedef struct
     int format;
     uint16_t *palette;
     void *data;
+    uint32_t *dirty_rows; // Optional bitmap of the rows of data (offset not applied) that changed since the previous rg_display_submit
     bool free_data;
     bool free_palette;
 } rg_surface_t;
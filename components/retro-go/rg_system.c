@@ -19,13 +19,20 @@
 #include <esp_timer.h>
 #include <esp_sleep.h>
 #include <driver/gpio.h>
-#else
+#elif defined(RG_TARGET_SDL2)
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_mutex.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
 #endif
 
 #define RG_STRUCT_MAGIC 0x12345678
 #define RG_LOGBUF_SIZE 2048
+#define RG_SPANS_BUFFER_SIZE 256
+#define RG_SPANS_MAX_DEPTH 8
 typedef struct
 {
     uint32_t magicWord;
@@ -58,8 +65,12 @@ struct rg_task_s
     TaskHandle_t handle;
 #else
     rg_task_msg_t msg;
-    int msgWaiting;
+    volatile int msgWaiting;
+#if defined(RG_TARGET_SDL2)
     SDL_threadID handle;
+#else
+    pthread_t handle;
+#endif
 #endif
     char name[16];
 };
@@ -81,6 +92,70 @@ static struct
 } *profile;
 #endif
 
+#ifdef RG_ENABLE_SPANS
+typedef struct
+{
+    const char *tag;
+    int64_t start;
+    int32_t duration;
+    int32_t depth;
+} span_record_t;
+
+typedef struct
+{
+    span_record_t records[RG_SPANS_BUFFER_SIZE];
+    span_record_t stack[RG_SPANS_MAX_DEPTH];
+    uint32_t cursor; // Total number of records written, the ring wraps around
+    uint32_t depth;
+} span_ring_t;
+#endif
+
+#ifndef ESP_PLATFORM
+static struct
+{
+    int frames;
+    uint32_t expect;
+    uint32_t expectScreen;
+    const char *audio;
+    bool audioAsync;
+    int64_t startTime;
+    int64_t startBusyTime;
+    int64_t startDisplayTime;
+    int64_t startAudioTime;
+} benchmark;
+#endif
+
+static struct
+{
+    int64_t startTime;
+    int64_t startAudioTime;
+    int64_t nextTime; // When the next frame is due, when pacing with the clock
+    int skipFrames;
+    int lateTime;  // How far behind schedule we are (us)
+    int budget;    // How far behind schedule we tolerate before skipping (us)
+    int drawCost;  // Rolling average cost of a drawn frame (us), excluding time blocked in audio
+    int skipCost;  // Rolling average cost of a skipped frame (us), excluding time blocked in audio
+    bool audioPacing; // Audio is submitted from the emulation loop, so we can pace it
+    bool drawing;
+} scheduler = {.budget = 1500, .audioPacing = true};
+
+static struct
+{
+    bool loaded;    // The setting has been read
+    bool enabled;   // The user wants it
+    bool supported; // The app runs hidden frames when asked (it called rg_emu_runahead_begin)
+    bool active;    // The cost estimate allows it
+    bool pending;   // A snapshot was taken after the hidden frame and must be restored
+    void *buffer;
+    size_t capacity;
+    size_t size;
+    int64_t startTime;
+    int saveTime;
+    int hiddenCost; // Rolling average cost of the hidden frame (us)
+    int stateCost;  // Rolling average cost of saving and loading the state (us)
+    int frames;     // Frames since the estimate was last checked
+} runahead = {.active = true};
+
 // The trace will survive a software reset
 static RTC_NOINIT_ATTR panic_trace_t panicTrace;
 // static RTC_NOINIT_ATTR boot_config_t bootConfig;
@@ -92,12 +167,18 @@ static rg_color_t ledColor = -1;
 static rg_stats_t statistics;
 static rg_app_t app;
 static rg_task_t tasks[8];
+#ifdef RG_ENABLE_SPANS
+// One ring per task slot, never freed because a dump could be reading it from another task
+static span_ring_t *spans[RG_COUNT(tasks)];
+static void dump_spans(FILE *fp);
+#endif
 
 static const char *SETTING_BOOT_NAME = "BootName";
 static const char *SETTING_BOOT_ARGS = "BootArgs";
 static const char *SETTING_BOOT_FLAGS = "BootFlags";
 static const char *SETTING_TIMEZONE = "Timezone";
 static const char *SETTING_INDICATOR_MASK = "Indicators";
+static const char *SETTING_RUNAHEAD = "RunAhead";
 
 #define logbuf_putc(buf, c) (buf)->console[(buf)->cursor++] = c, (buf)->cursor %= RG_LOGBUF_SIZE;
 #define logbuf_puts(buf, str) for (const char *ptr = str; *ptr; ptr++) logbuf_putc(buf, *ptr);
@@ -242,6 +323,27 @@ static void update_indicators(void)
     ledColor = newColor;
 }
 
+static void update_frameskip(void)
+{
+    // With a frameskip of 0 rg_system_frame_end's scheduler decides frame by frame, leave it alone
+    if (statistics.ticks <= app.tickRate * 2 || app.isBenchmark || app.frameskip == 0)
+        return;
+
+    float speed = ((float)statistics.totalFPS / app.tickRate) * 100.f / app.speed;
+    // We don't fully go back to 0 frameskip because if we dip below 95% once, we're clearly
+    // borderline in power and going back to 0 is just asking for stuttering...
+    if (speed > 99.f && statistics.busyPercent < 85.f && app.frameskip > 1)
+    {
+        app.frameskip--;
+        RG_LOGI("Reduced frameskip to %d", app.frameskip);
+    }
+    else if (speed < 96.f && statistics.busyPercent > 85.f && app.frameskip < 5)
+    {
+        app.frameskip++;
+        RG_LOGI("Raised frameskip to %d", app.frameskip);
+    }
+}
+
 static void system_monitor_task(void *arg)
 {
     int64_t nextLoopTime = 0;
@@ -276,23 +378,7 @@ static void system_monitor_task(void *arg)
             (int)roundf(statistics.fullFPS),
             (int)roundf((battery.volts * 1000) ?: battery.level));
 
-        // Auto frameskip
-        if (statistics.ticks > app.tickRate * 2)
-        {
-            float speed = ((float)statistics.totalFPS / app.tickRate) * 100.f / app.speed;
-            // We don't fully go back to 0 frameskip because if we dip below 95% once, we're clearly
-            // borderline in power and going back to 0 is just asking for stuttering...
-            if (speed > 99.f && statistics.busyPercent < 85.f && app.frameskip > 1)
-            {
-                app.frameskip--;
-                RG_LOGI("Reduced frameskip to %d", app.frameskip);
-            }
-            else if (speed < 96.f && statistics.busyPercent > 85.f && app.frameskip < 5)
-            {
-                app.frameskip++;
-                RG_LOGI("Raised frameskip to %d", app.frameskip);
-            }
-        }
+        update_frameskip();
 
         if (statistics.lastTick < rg_system_timer() - app.tickTimeout)
         {
@@ -437,6 +523,8 @@ rg_app_t *rg_system_init(int sampleRate, const rg_handlers_t *handlers, void *_u
     tasks[0] = (rg_task_t){.handle = xTaskGetCurrentTaskHandle(), .name = "main"};
 #elif defined(RG_TARGET_SDL2)
     tasks[0] = (rg_task_t){.handle = SDL_ThreadID(), .name = "main"};
+#else
+    tasks[0] = (rg_task_t){.handle = pthread_self(), .name = "main"};
 #endif
 
     printf("\n========================================================\n");
@@ -464,7 +552,29 @@ rg_app_t *rg_system_init(int sampleRate, const rg_handlers_t *handlers, void *_u
     app.configNs = rg_settings_get_string(NS_BOOT, SETTING_BOOT_NAME, app.configNs);
     app.bootArgs = rg_settings_get_string(NS_BOOT, SETTING_BOOT_ARGS, app.bootArgs);
     app.bootFlags = rg_settings_get_number(NS_BOOT, SETTING_BOOT_FLAGS, app.bootFlags);
+#ifndef ESP_PLATFORM
+    // Benchmark mode, refer to targets/headless/docs/README.md for details
+    if (getenv("RG_BENCH_APP") || getenv("RG_BENCH_ROM"))
+    {
+        app.configNs = getenv("RG_BENCH_APP") ?: app.configNs;
+        app.bootArgs = getenv("RG_BENCH_ROM") ?: app.bootArgs;
+        app.bootFlags = 0;
+        app.isBenchmark = true;
+        benchmark.frames = RG_MAX(atoi(getenv("RG_BENCH_FRAMES") ?: "600"), 2);
+        benchmark.expect = strtoul(getenv("RG_BENCH_EXPECT") ?: "0", NULL, 0);
+        benchmark.expectScreen = strtoul(getenv("RG_BENCH_EXPECT_SCREEN") ?: "0", NULL, 0);
+        benchmark.audio = getenv("RG_BENCH_AUDIO");
+        benchmark.audioAsync = atoi(getenv("RG_BENCH_AUDIO_ASYNC") ?: "0");
+        const char *trace = getenv("RG_BENCH_INPUT");
+        if (trace && *trace && !rg_input_load_trace(trace))
+            RG_PANIC("Failed to load input trace!");
+    }
+#endif
     rg_display_init();
+#ifndef ESP_PLATFORM
+    if (app.isBenchmark && getenv("RG_BENCH_DUMP"))
+        rg_display_set_capture_dir(getenv("RG_BENCH_DUMP"));
+#endif
     rg_gui_init();
 
     if (enterRecoveryMode)
@@ -499,6 +609,10 @@ rg_app_t *rg_system_init(int sampleRate, const rg_handlers_t *handlers, void *_u
 
     rg_gui_draw_hourglass();
     rg_audio_init(sampleRate);
+#ifndef ESP_PLATFORM
+    if (benchmark.audio && *benchmark.audio && !rg_audio_set_capture(benchmark.audio, !benchmark.audioAsync))
+        RG_PANIC("Failed to open audio capture!");
+#endif
 
     rg_system_set_timezone(rg_settings_get_string(NS_GLOBAL, SETTING_TIMEZONE, "EST+5"));
     rg_system_load_time();
@@ -522,6 +636,13 @@ rg_app_t *rg_system_init(int sampleRate, const rg_handlers_t *handlers, void *_u
     rg_task_create("rg_sysmon", &system_monitor_task, NULL, 3 * 1024, RG_TASK_PRIORITY_5, -1);
     app.initialized = true;
 
+#if defined(RG_ENABLE_NETPLAY) && !defined(ESP_PLATFORM)
+    // The game will wait for the peer on its first frame, see libs/netplay/NETPLAY.md
+    const char *netplay = app.isBenchmark ? getenv("RG_BENCH_NETPLAY") : NULL;
+    if (netplay && !rg_netplay_start(strcmp(netplay, "host") == 0 ? NETPLAY_MODE_HOST : NETPLAY_MODE_GUEST))
+        RG_PANIC("Netplay failed to start!");
+#endif
+
     update_memory_statistics();
     RG_LOGI("Available memory: %d/%d + %d/%d", statistics.freeMemoryInt / 1024, statistics.totalMemoryInt / 1024,
             statistics.freeMemoryExt / 1024, statistics.totalMemoryExt / 1024);
@@ -543,7 +664,7 @@ static void task_wrapper(void *arg)
     memset(task, 0, sizeof(rg_task_t));
     vTaskDelete(NULL);
 }
-#else
+#elif defined(RG_TARGET_SDL2)
 static int task_wrapper(void *arg)
 {
     rg_task_t *task = arg;
@@ -552,6 +673,15 @@ static int task_wrapper(void *arg)
     memset(task, 0, sizeof(rg_task_t));
     return 0;
 }
+#else
+static void *task_wrapper(void *arg)
+{
+    rg_task_t *task = arg;
+    task->handle = pthread_self();
+    (task->func)(task->arg);
+    memset(task, 0, sizeof(rg_task_t));
+    return NULL;
+}
 #endif
 
 rg_task_t *rg_task_create(const char *name, void (*taskFunc)(void *arg), void *arg, size_t stackSize, int priority, int affinity)
@@ -564,6 +694,10 @@ rg_task_t *rg_task_create(const char *name, void (*taskFunc)(void *arg), void *a
         if (tasks[i].func)
             continue;
         task = memset(&tasks[i], 0, sizeof(rg_task_t));
+    #ifdef RG_ENABLE_SPANS
+        if (spans[i])
+            spans[i]->cursor = spans[i]->depth = 0;
+    #endif
         break;
     }
     RG_ASSERT(task, "Out of task slots");
@@ -584,6 +718,13 @@ rg_task_t *rg_task_create(const char *name, void (*taskFunc)(void *arg), void *a
     SDL_DetachThread(thread);
     if (thread)
         return task;
+#else
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, task_wrapper, task) == 0)
+    {
+        pthread_detach(thread);
+        return task;
+    }
 #endif
 
     RG_LOGE("Task creation failed: name='%s', fn='%p', stack=%d\n", name, taskFunc, (int)stackSize);
@@ -609,6 +750,8 @@ rg_task_t *rg_task_current(void)
     TaskHandle_t handle = xTaskGetCurrentTaskHandle();
 #elif defined(RG_TARGET_SDL2)
     SDL_threadID handle = SDL_ThreadID();
+#else
+    pthread_t handle = pthread_self();
 #endif
     for (size_t i = 0; i < RG_COUNT(tasks); ++i)
     {
@@ -629,6 +772,12 @@ bool rg_task_send(rg_task_t *task, const rg_task_msg_t *msg)
     task->msg = *msg;
     task->msgWaiting = 1;
     return true;
+#else
+    while (task->msgWaiting > 0)
+        sched_yield();
+    task->msg = *msg;
+    task->msgWaiting = 1;
+    return true;
 #endif
 }
 
@@ -645,6 +794,12 @@ bool rg_task_peek(rg_task_msg_t *out)
     while (task->msgWaiting < 1)
         continue;
     *out = task->msg;
+    success = true;
+#else
+    while (task->msgWaiting < 1)
+        sched_yield();
+    *out = task->msg;
+    success = true;
 #endif
     // task->blocked = false;
     return success;
@@ -664,6 +819,13 @@ bool rg_task_receive(rg_task_msg_t *out)
         continue;
     *out = task->msg;
     task->msgWaiting = 0;
+    success = true;
+#else
+    while (task->msgWaiting < 1)
+        sched_yield();
+    *out = task->msg;
+    task->msgWaiting = 0;
+    success = true;
 #endif
     // task->blocked = false;
     return success;
@@ -674,7 +836,7 @@ size_t rg_task_messages_waiting(rg_task_t *task)
     if (!task) task = rg_task_current();
 #if defined(ESP_PLATFORM)
     return uxQueueMessagesWaiting(task->queue);
-#elif defined(RG_TARGET_SDL2)
+#else
     return task->msgWaiting;
 #endif
 }
@@ -691,6 +853,8 @@ void rg_task_delay(uint32_t ms)
 #elif defined(RG_TARGET_SDL2)
     SDL_PumpEvents();
     SDL_Delay(ms);
+#else
+    usleep(ms * 1000);
 #endif
 }
 
@@ -700,6 +864,8 @@ void rg_task_yield(void)
     vPortYield();
 #elif defined(RG_TARGET_SDL2)
     SDL_PumpEvents();
+#else
+    sched_yield();
 #endif
 }
 
@@ -709,6 +875,16 @@ rg_mutex_t *rg_mutex_create(void)
     return (rg_mutex_t *)xSemaphoreCreateMutex();
 #elif defined(RG_TARGET_SDL2)
     return (rg_mutex_t *)SDL_CreateMutex();
+#else
+    pthread_mutex_t *mutex = malloc(sizeof(pthread_mutex_t));
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    // Error checking allows us to match FreeRTOS' behavior when giving a mutex that isn't held
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_ERRORCHECK);
+    if (mutex && pthread_mutex_init(mutex, &attr) != 0)
+        free(mutex), mutex = NULL;
+    pthread_mutexattr_destroy(&attr);
+    return (rg_mutex_t *)mutex;
 #endif
 }
 
@@ -719,6 +895,9 @@ void rg_mutex_free(rg_mutex_t *mutex)
     vSemaphoreDelete((QueueHandle_t)mutex);
 #elif defined(RG_TARGET_SDL2)
     SDL_DestroyMutex((SDL_mutex *)mutex);
+#else
+    pthread_mutex_destroy((pthread_mutex_t *)mutex);
+    free(mutex);
 #endif
 }
 
@@ -729,6 +908,8 @@ bool rg_mutex_give(rg_mutex_t *mutex)
     return xSemaphoreGive((QueueHandle_t)mutex) == pdPASS;
 #elif defined(RG_TARGET_SDL2)
     return SDL_UnlockMutex((SDL_mutex *)mutex) == 0;
+#else
+    return pthread_mutex_unlock((pthread_mutex_t *)mutex) == 0;
 #endif
 }
 
@@ -740,6 +921,18 @@ bool rg_mutex_take(rg_mutex_t *mutex, int timeoutMS)
     return xSemaphoreTake((QueueHandle_t)mutex, timeout) == pdPASS;
 #elif defined(RG_TARGET_SDL2)
     return SDL_LockMutex((SDL_mutex *)mutex) == 0;
+#else
+    if (timeoutMS == 0)
+        return pthread_mutex_trylock((pthread_mutex_t *)mutex) == 0;
+    if (timeoutMS < 0)
+        return pthread_mutex_lock((pthread_mutex_t *)mutex) == 0;
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeoutMS / 1000;
+    deadline.tv_nsec += (timeoutMS % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000)
+        deadline.tv_sec++, deadline.tv_nsec -= 1000000000;
+    return pthread_mutex_timedlock((pthread_mutex_t *)mutex, &deadline) == 0;
 #endif
 }
 
@@ -818,20 +1011,196 @@ int rg_system_get_tick_rate(void)
     return app.tickRate;
 }
 
+#ifndef ESP_PLATFORM
+static uint32_t benchmark_hash_surface(const rg_surface_t *surface)
+{
+    if (!surface || !surface->data)
+        return 0;
+    const uint8_t *data = surface->data + surface->offset;
+    size_t line_length = surface->width * RG_PIXEL_GET_SIZE(surface->format);
+    uint32_t crc = 0;
+    for (int y = 0; y < surface->height; ++y)
+        crc = rg_crc32(crc, data + y * surface->stride, line_length);
+    if (surface->palette)
+        crc = rg_crc32(crc, (const uint8_t *)surface->palette, 256 * 2);
+    return crc;
+}
+
+static void benchmark_tick(void)
+{
+    // We want every frame to be rendered, so that both the timings and the hash are comparable between runs
+    app.frameskip = 0;
+
+    // The first frame is used as warm-up
+    if (statistics.ticks == 1)
+    {
+        rg_display_sync(true);
+        benchmark.startTime = rg_system_timer();
+        benchmark.startBusyTime = statistics.busyTime;
+        benchmark.startDisplayTime = rg_display_get_counters().busyTime;
+        benchmark.startAudioTime = rg_audio_get_counters().busyTime;
+        return;
+    }
+
+    if (statistics.ticks < benchmark.frames)
+        return;
+
+    rg_display_sync(true);
+
+    int frames = statistics.ticks - 1;
+    float totalTime = (rg_system_timer() - benchmark.startTime) / 1000000.f;
+    int emulateTime = (statistics.busyTime - benchmark.startBusyTime) / frames;
+    int displayTime = (rg_display_get_counters().busyTime - benchmark.startDisplayTime) / frames;
+    int audioTime = (rg_audio_get_counters().busyTime - benchmark.startAudioTime) / frames;
+    uint32_t hash = benchmark_hash_surface(rg_display_get_last_update());
+    uint32_t screenHash = rg_display_get_capture_hash();
+
+    printf("BENCH app=%s rom=%s frames=%d\n", app.configNs, rg_basename(app.romPath), benchmark.frames);
+    printf("BENCH time=%.3fs fps=%.1f\n", totalTime, frames / totalTime);
+    printf("BENCH us/frame: emulate=%d display=%d audio=%d\n", emulateTime, displayTime, audioTime);
+    printf("BENCH fbhash=0x%08X\n", (unsigned)hash);
+    printf("BENCH scrhash=0x%08X\n", (unsigned)screenHash);
+    if (benchmark.audio && *benchmark.audio)
+    {
+        rg_audio_counters_t counters = rg_audio_get_counters();
+        rg_audio_deinit(); // Finalizes the WAV file
+        printf("BENCH audio=%s frames=%lld overruns=%d\n", rg_basename(benchmark.audio),
+               (long long)counters.totalSamples, counters.overruns);
+    }
+#ifdef RG_ENABLE_SPANS
+    dump_spans(stdout);
+#endif
+
+    if (benchmark.expect && benchmark.expect != hash)
+    {
+        printf("BENCH FAILED: expected fbhash=0x%08X\n", (unsigned)benchmark.expect);
+        fflush(stdout);
+        exit(1);
+    }
+    if (benchmark.expectScreen && benchmark.expectScreen != screenHash)
+    {
+        printf("BENCH FAILED: expected scrhash=0x%08X\n", (unsigned)benchmark.expectScreen);
+        fflush(stdout);
+        exit(1);
+    }
+    fflush(stdout);
+    exit(0);
+}
+#endif
+
 void rg_system_tick(int busyTime)
 {
     statistics.lastTick = rg_system_timer();
     statistics.busyTime += busyTime;
     statistics.ticks++;
+#ifndef ESP_PLATFORM
+    if (app.isBenchmark)
+        benchmark_tick();
+#endif
     // WDT_RELOAD(WDT_TIMEOUT);
 }
 
+bool rg_system_frame_begin(void)
+{
+    scheduler.startTime = rg_system_timer();
+    scheduler.startAudioTime = rg_audio_get_counters().busyTime;
+    // The benchmark wants every frame, its timings and hashes would be meaningless otherwise
+    scheduler.drawing = scheduler.skipFrames == 0 || app.isBenchmark;
+    // Rewinding happens here so that the frame the app is about to run starts from the restored state
+#ifdef RG_ENABLE_NETPLAY
+    // Going back in time alone would desync the players, netplay keeps its own history
+    if (rg_netplay_status() != NETPLAY_STATUS_CONNECTED)
+#endif
+    rg_rewind_tick((rg_input_read_gamepad() & RG_REWIND_KEYS) == RG_REWIND_KEYS);
+    return scheduler.drawing;
+}
+
+void rg_system_frame_end(bool slowFrame)
+{
+    if (!scheduler.startTime)
+        return;
+
+    int frameTime = app.frameTime;
+    int waitTime = 0;
+
+    if (scheduler.audioPacing && rg_audio_get_rate_control() && !app.isBenchmark)
+    {
+        // The resampler keeps the ring steady, so we run at the core's native rate. If we fell more than a few
+        // frames behind (or were paused) we don't try to catch up, lateTime will take care of skipping.
+        int64_t now = rg_system_timer();
+        scheduler.nextTime += frameTime;
+        if (scheduler.nextTime < now - frameTime * 4 || scheduler.nextTime > now + frameTime * 4)
+            scheduler.nextTime = now;
+        if (scheduler.nextTime > now)
+            rg_usleep(scheduler.nextTime - now);
+        waitTime = RG_MAX(scheduler.nextTime - now, 0) + rg_audio_get_counters().busyTime - scheduler.startAudioTime;
+    }
+    else if (scheduler.audioPacing && rg_audio_get_sample_rate() > 0 && !app.isBenchmark)
+    {
+        // Any audio queued beyond one frame is how far ahead of playback we are. We sleep it off here,
+        // with the ring still holding a frame for the output task, rather than block in rg_audio_submit.
+        int lead = (int64_t)rg_audio_get_queued() * 1000000 / rg_audio_get_sample_rate() - frameTime;
+        if (lead > 0)
+            rg_usleep(lead);
+        // Time spent waiting for room in the ring also means that we're ahead
+        waitTime = RG_MAX(lead, 0) + rg_audio_get_counters().busyTime - scheduler.startAudioTime;
+    }
+
+    int elapsed = rg_system_timer() - scheduler.startTime;
+    int cost = elapsed - waitTime;
+
+    if (scheduler.drawing)
+        scheduler.drawCost += (cost - scheduler.drawCost) / 8;
+    else
+        scheduler.skipCost += (cost - scheduler.skipCost) / 8;
+
+    // If we had to wait on audio (or the clock) we're ahead no matter what our own timings say.
+    // Otherwise we accumulate how late we are, short frames paying back long ones.
+    if (waitTime > frameTime / 8)
+        scheduler.lateTime = 0;
+    else
+        scheduler.lateTime = RG_MIN(RG_MAX(scheduler.lateTime + elapsed - frameTime, 0), frameTime * 4);
+
+    // Decisions are only made after a drawn frame, skipped frames just count down
+    if (!scheduler.drawing)
+        scheduler.skipFrames = RG_MAX(scheduler.skipFrames - 1, 0);
+    else if (app.isBenchmark)
+        scheduler.skipFrames = 0;
+    else if (app.frameskip > 0)
+        scheduler.skipFrames = app.frameskip;
+    else if (scheduler.lateTime > scheduler.budget)
+        scheduler.skipFrames = 1;
+    else if (slowFrame)
+        scheduler.skipFrames = 1;
+    else if (scheduler.drawCost > frameTime + scheduler.budget)
+        scheduler.skipFrames = 1; // We can't sustain drawing every frame even when we're on time
+}
+
+void rg_system_set_frame_budget(int budget)
+{
+    scheduler.budget = RG_MAX(budget, 0);
+}
+
+int rg_system_get_frame_budget(void)
+{
+    return scheduler.budget;
+}
+
+void rg_system_set_audio_pacing(bool enable)
+{
+    scheduler.audioPacing = enable;
+}
+
 IRAM_ATTR int64_t rg_system_timer(void)
 {
 #if defined(ESP_PLATFORM)
     return esp_timer_get_time();
 #elif defined(RG_TARGET_SDL2)
     return (SDL_GetPerformanceCounter() * 1000000.f) / SDL_GetPerformanceFrequency();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
 #endif
 }
 
@@ -992,6 +1361,82 @@ void rg_system_log(int level, const char *context, const char *format, ...)
     va_end(va);
 }
 
+#ifdef RG_ENABLE_SPANS
+static void dump_spans(FILE *fp)
+{
+    for (size_t i = 0; i < RG_COUNT(tasks); ++i)
+    {
+        span_ring_t *ring = spans[i];
+        if (!ring || !ring->cursor)
+            continue;
+
+        size_t count = RG_MIN(ring->cursor, RG_SPANS_BUFFER_SIZE);
+        size_t first = ring->cursor - count;
+        struct {const char *tag; int count; int64_t total; int32_t max;} summary[16] = {0};
+
+        for (size_t j = 0; j < count; ++j)
+        {
+            span_record_t *rec = &ring->records[(first + j) % RG_SPANS_BUFFER_SIZE];
+            for (size_t k = 0; k < RG_COUNT(summary); ++k)
+            {
+                if (summary[k].tag && summary[k].tag != rec->tag && strcmp(summary[k].tag, rec->tag) != 0)
+                    continue;
+                summary[k].tag = rec->tag;
+                summary[k].count++;
+                summary[k].total += rec->duration;
+                summary[k].max = RG_MAX(summary[k].max, rec->duration);
+                break;
+            }
+        }
+
+        fprintf(fp, "\nSpans of task '%.16s' (last %d of %d):\n", tasks[i].name, (int)count, (int)ring->cursor);
+        fprintf(fp, "  %-24s %8s %10s %10s\n", "tag", "count", "avg(us)", "max(us)");
+        for (size_t k = 0; k < RG_COUNT(summary) && summary[k].tag; ++k)
+            fprintf(fp, "  %-24s %8d %10d %10d\n", summary[k].tag, summary[k].count,
+                    (int)(summary[k].total / summary[k].count), (int)summary[k].max);
+        if (fp == stdout) // The full list is only useful in a file
+            continue;
+        fprintf(fp, "  %12s %10s  %s\n", "start(us)", "dur(us)", "tag");
+        for (size_t j = 0; j < count; ++j)
+        {
+            span_record_t *rec = &ring->records[(first + j) % RG_SPANS_BUFFER_SIZE];
+            fprintf(fp, "  %12lld %10d  %*s%s\n", (long long)rec->start, (int)rec->duration, (int)rec->depth * 2, "", rec->tag);
+        }
+    }
+}
+
+void rg_span_begin(const char *tag)
+{
+    rg_task_t *task = rg_task_current();
+    if (!task)
+        return;
+    span_ring_t *ring = spans[task - tasks];
+    if (!ring)
+    {
+        // This only happens once per task slot, after that the ring is reused
+        ring = spans[task - tasks] = rg_alloc(sizeof(span_ring_t), MEM_SLOW);
+    }
+    if (ring->depth < RG_SPANS_MAX_DEPTH)
+        ring->stack[ring->depth] = (span_record_t){tag, rg_system_timer(), 0, ring->depth};
+    ring->depth++; // Spans nested deeper than the stack are counted but not recorded
+}
+
+void rg_span_end(void)
+{
+    int64_t now = rg_system_timer();
+    rg_task_t *task = rg_task_current();
+    span_ring_t *ring = task ? spans[task - tasks] : NULL;
+    if (!ring || !ring->depth) // Unbalanced end is ignored, it makes instrumenting loops easier
+        return;
+    if (--ring->depth < RG_SPANS_MAX_DEPTH)
+    {
+        span_record_t *rec = &ring->records[ring->cursor++ % RG_SPANS_BUFFER_SIZE];
+        *rec = ring->stack[ring->depth];
+        rec->duration = now - rec->start;
+    }
+}
+#endif
+
 bool rg_system_save_trace(const char *filename, bool panic_trace)
 {
     if (!filename)
@@ -1028,6 +1473,10 @@ bool rg_system_save_trace(const char *filename, bool panic_trace)
         if (panicTrace.console[index])
             fputc(panicTrace.console[index], fp);
     }
+#ifdef RG_ENABLE_SPANS
+    if (!panic_trace)
+        dump_spans(fp);
+#endif
     fputs("\n\nEnd of trace\n\n", fp);
     fclose(fp);
 
@@ -1253,10 +1702,14 @@ bool rg_emu_load_state(uint8_t slot)
     else
     {
         emu_update_save_slot(slot);
+        rg_rewind_clear();
     }
 
     free(filename);
 
+    // Whatever we were catching up on no longer matters
+    scheduler.skipFrames = scheduler.lateTime = 0;
+
     return success;
 }
 
@@ -1320,6 +1773,194 @@ bool rg_emu_save_state(uint8_t slot)
     return success;
 }
 
+size_t rg_emu_save_state_mem(void *buffer, size_t size)
+{
+    if (!app.handlers.saveStateMem)
+        return 0;
+    return (*app.handlers.saveStateMem)(buffer, size);
+}
+
+bool rg_emu_load_state_mem(const void *buffer, size_t size)
+{
+    if (!app.handlers.loadStateMem || !buffer || !size)
+        return false;
+    return (*app.handlers.loadStateMem)(buffer, size);
+}
+
+static size_t save_state_stream(void *buffer, size_t size, bool (*save)(FILE *fp))
+{
+#ifdef _WIN32
+    FILE *fp = tmpfile();
+#else
+    FILE *fp = fmemopen(buffer, size, "wb");
+#endif
+    if (!fp)
+        return 0;
+
+    bool success = save(fp);
+    // Some cores seek back to patch a header, the end of the stream is the size of the state
+    success &= fflush(fp) == 0 && fseek(fp, 0, SEEK_END) == 0;
+    long written = ftell(fp);
+    success &= written > 0 && (size_t)written <= size && !ferror(fp);
+#ifdef _WIN32
+    rewind(fp);
+    success = success && fread(buffer, written, 1, fp) == 1;
+#endif
+    fclose(fp);
+
+    return success ? written : 0;
+}
+
+size_t rg_emu_save_state_stream(void *buffer, size_t size, bool (*save)(FILE *fp))
+{
+    if (buffer)
+        return save_state_stream(buffer, size, save);
+
+    // Without a buffer we only want the size. A dynamic stream (open_memstream) can't tell the size
+    // once the core has seeked back, so we grow a scratch buffer until the state fits.
+    static size_t last_size = 0x10000;
+    for (size_t scratch_size = last_size; scratch_size <= 0x1000000; scratch_size *= 2)
+    {
+        void *scratch = malloc(scratch_size);
+        if (!scratch)
+            break;
+        size_t ret = save_state_stream(scratch, scratch_size, save);
+        free(scratch);
+        if (ret > 0)
+        {
+            last_size = scratch_size;
+            return ret;
+        }
+    }
+    return 0;
+}
+
+bool rg_emu_load_state_stream(const void *buffer, size_t size, bool (*load)(FILE *fp))
+{
+#ifdef _WIN32
+    FILE *fp = tmpfile();
+    if (fp && (fwrite(buffer, size, 1, fp) != 1 || fseek(fp, 0, SEEK_SET) != 0))
+        fclose(fp), fp = NULL;
+#else
+    FILE *fp = fmemopen((void *)buffer, size, "rb");
+#endif
+    if (!fp)
+        return false;
+
+    bool success = load(fp);
+    fclose(fp);
+
+    return success;
+}
+
+static void runahead_update_estimate(void)
+{
+    // drawCost includes the overhead while run-ahead is active, we have to estimate the frame without it.
+    // There's some hysteresis so that we don't flip every check when we're right at the limit.
+    if (++runahead.frames < 60)
+        return;
+    runahead.frames = 0;
+
+    int overhead = runahead.hiddenCost + runahead.stateCost;
+    int base = scheduler.drawCost - (runahead.active ? overhead : 0);
+    bool fits = base + overhead < app.frameTime * (runahead.active ? 95 : 80) / 100;
+    if (fits != runahead.active)
+    {
+        RG_LOGI("Run-ahead %s (frame: %dus, overhead: %dus)\n", fits ? "resumed" : "suspended", base, overhead);
+        runahead.active = fits;
+    }
+}
+
+bool rg_emu_runahead_begin(void)
+{
+    runahead.supported = true;
+
+    if (!rg_emu_get_runahead() || !app.handlers.saveStateMem || !app.handlers.loadStateMem)
+        return false;
+
+    if (!runahead.buffer)
+    {
+        runahead.capacity = rg_emu_save_state_mem(NULL, 0);
+        runahead.buffer = runahead.capacity ? rg_alloc(runahead.capacity, MEM_ANY | MEM_NOPANIC) : NULL;
+        if (!runahead.buffer)
+        {
+            RG_LOGE("Unable to allocate the run-ahead state, disabled.\n");
+            runahead.enabled = false;
+            return false;
+        }
+    }
+
+    runahead_update_estimate();
+
+    // There's nothing to gain if the frame won't be shown
+    if (!runahead.active || !scheduler.drawing)
+        return false;
+
+    runahead.startTime = rg_system_timer();
+    return true;
+}
+
+void rg_emu_runahead_save(void)
+{
+    int64_t startTime = rg_system_timer();
+    runahead.hiddenCost += (int)(startTime - runahead.startTime - runahead.hiddenCost) / 8;
+
+    runahead.size = rg_emu_save_state_mem(runahead.buffer, runahead.capacity);
+    runahead.pending = runahead.size > 0;
+    runahead.saveTime = rg_system_timer() - startTime;
+
+    if (!runahead.pending)
+    {
+        RG_LOGE("Run-ahead snapshot failed, disabled.\n");
+        runahead.enabled = false;
+    }
+}
+
+void rg_emu_runahead_end(void)
+{
+    if (!runahead.pending)
+        return;
+
+    int64_t startTime = rg_system_timer();
+    rg_emu_load_state_mem(runahead.buffer, runahead.size);
+    runahead.pending = false;
+
+    int cost = runahead.saveTime + (rg_system_timer() - startTime);
+    runahead.stateCost += (cost - runahead.stateCost) / 8;
+}
+
+bool rg_emu_get_runahead(void)
+{
+    if (!runahead.loaded)
+    {
+        runahead.enabled = rg_settings_get_boolean(NS_APP, SETTING_RUNAHEAD, false);
+        runahead.loaded = true;
+    }
+    return runahead.enabled;
+}
+
+void rg_emu_set_runahead(bool enable)
+{
+    runahead.enabled = enable;
+    runahead.loaded = true;
+    runahead.active = true; // Give it a chance, the estimate will be updated shortly
+    runahead.frames = 0;
+    rg_settings_set_boolean(NS_APP, SETTING_RUNAHEAD, enable);
+    RG_LOGI("Run-ahead %s\n", enable ? "enabled" : "disabled");
+}
+
+int rg_emu_get_runahead_cost(void)
+{
+    if (!runahead.supported || !app.handlers.saveStateMem)
+        return -1;
+    return runahead.hiddenCost + runahead.stateCost;
+}
+
+bool rg_emu_runahead_is_active(void)
+{
+    return rg_emu_get_runahead() && runahead.supported && runahead.active && runahead.buffer;
+}
+
 bool rg_emu_screenshot(const char *filename, int width, int height)
 {
     if (!app.handlers.screenshot)
@@ -1399,6 +2040,8 @@ bool rg_emu_reset(bool hard)
 {
     if (app.speed != 1.f)
         rg_emu_set_speed(1.f);
+    scheduler.skipFrames = scheduler.lateTime = 0;
+    rg_rewind_clear();
     if (app.handlers.reset)
         return app.handlers.reset(hard);
     return false;
@@ -1505,3 +2148,14 @@ NO_PROFILE void __cyg_profile_func_exit(void *this_fn, void *call_site)
     UNLOCK_PROFILE();
 }
 #endif
+
+#ifdef RG_TARGET_HEADLESS
+// The apps keep their ESP-IDF entry point, no need to turn it into a (non-standard) main
+extern void app_main(void);
+
+int main(int argc, char **argv)
+{
+    app_main();
+    return 0;
+}
+#endif
@@ -34,6 +34,7 @@ extern "C" {
 #include "rg_gui.h"
 #include "rg_i2c.h"
 #include "rg_utils.h"
+#include "rg_rewind.h"
 
 #ifdef RG_ENABLE_NETPLAY
 #include "rg_netplay.h"
@@ -130,6 +131,8 @@ typedef struct
 {
     bool (*loadState)(const char *filename);                         // rg_emu_load_state() handler
     bool (*saveState)(const char *filename);                         // rg_emu_save_state() handler
+    bool (*loadStateMem)(const void *buffer, size_t size);           // rg_emu_load_state_mem() handler
+    size_t (*saveStateMem)(void *buffer, size_t size);               // rg_emu_save_state_mem() handler
     bool (*reset)(bool hard);                                        // rg_emu_reset() handler
     bool (*screenshot)(const char *filename, int width, int height); // rg_emu_screenshot() handler
     void (*event)(int event, void *data);                            // listen to retro-go system events
@@ -137,6 +140,7 @@ typedef struct
     int (*memWrite)(int addr, int value);                            // Used by for cheats and debugging
     void (*options)(rg_gui_option_t *dest);                          // Add extra options to rg_gui_options_menu()
     void (*about)(rg_gui_option_t *dest);                            // Add extra options to rg_gui_about_menu()
+    void (*debug)(rg_gui_option_t *dest, size_t max);                // Add up to max extra options to rg_gui_debug_menu()
 } rg_handlers_t;
 
 typedef struct
@@ -180,6 +184,7 @@ typedef struct
     bool enWatchdog;
     bool isColdBoot;
     bool isLauncher;
+    bool isBenchmark;
     // bool isOfficial;
     bool isRelease;
     int logLevel;
@@ -229,6 +234,14 @@ int  rg_system_get_overclock(void);
 void rg_system_set_log_level(rg_log_level_t level);
 int  rg_system_get_log_level(void);
 void rg_system_tick(int busyTime);
+// Frame scheduler: begin returns true if the frame should be drawn, end goes after video/audio were submitted
+// (slowFrame is !rg_display_sync(false)). The budget is how late (us) we can fall before skipping frames.
+// Audio pacing must be disabled if audio isn't submitted from the emulation loop.
+bool rg_system_frame_begin(void);
+void rg_system_frame_end(bool slowFrame);
+void rg_system_set_frame_budget(int budget);
+int  rg_system_get_frame_budget(void);
+void rg_system_set_audio_pacing(bool enable);
 void rg_system_vlog(int level, const char *context, const char *format, va_list va);
 void rg_system_log(int level, const char *context, const char *format, ...) __attribute__((format(printf,3,4)));
 bool rg_system_save_trace(const char *filename, bool append);
@@ -278,6 +291,25 @@ bool rg_mutex_take(rg_mutex_t *mutex, int timeoutMS);
 char *rg_emu_get_path(rg_path_type_t type, const char *arg);
 bool rg_emu_save_state(uint8_t slot);
 bool rg_emu_load_state(uint8_t slot);
+// In-memory states for rewind, run-ahead, netplay, etc. They don't touch the storage nor the GUI. Returns the size
+// of the state, or 0 if it failed or didn't fit (the buffer is then undefined). A NULL buffer only returns the size needed.
+size_t rg_emu_save_state_mem(void *buffer, size_t size);
+bool rg_emu_load_state_mem(const void *buffer, size_t size);
+// For handlers of cores that serialize to a FILE*: runs the callback on a stream over the buffer
+size_t rg_emu_save_state_stream(void *buffer, size_t size, bool (*save)(FILE *fp));
+bool rg_emu_load_state_stream(const void *buffer, size_t size, bool (*load)(FILE *fp));
+// Run-ahead hides a frame of input latency. When rg_emu_runahead_begin() returns true the app emulates a hidden
+// frame (no video, no audio) and calls rg_emu_runahead_save(), then it emulates the frame it shows as usual and
+// calls rg_emu_runahead_end() which goes back to the state after the hidden frame. It is suspended when the
+// frame with the overhead wouldn't fit in the CPU budget.
+bool rg_emu_runahead_begin(void);
+void rg_emu_runahead_save(void);
+void rg_emu_runahead_end(void);
+bool rg_emu_get_runahead(void);
+void rg_emu_set_runahead(bool enable);
+// Estimated overhead of run-ahead per frame (us), -1 if the app doesn't support it
+int rg_emu_get_runahead_cost(void);
+bool rg_emu_runahead_is_active(void);
 bool rg_emu_reset(bool hard);
 bool rg_emu_screenshot(const char *filename, int width, int height);
 rg_emu_states_t *rg_emu_get_states(const char *romPath, size_t slots);
@@ -311,6 +343,19 @@ float rg_emu_get_speed(void);
 #define RG_LOGV(x, ...) rg_system_log(RG_LOG_VERBOSE, RG_LOG_TAG, x, ## __VA_ARGS__)
 #endif
 
+// Lightweight tracing of the hot paths. Spans are recorded in a ring buffer per task and
+// included in rg_system_save_trace(). They compile to nothing unless RG_ENABLE_SPANS is defined.
+// `tag` must be a static string, only its pointer is stored.
+#ifdef RG_ENABLE_SPANS
+void rg_span_begin(const char *tag);
+void rg_span_end(void);
+#define RG_SPAN_BEGIN(tag) rg_span_begin(tag)
+#define RG_SPAN_END() rg_span_end()
+#else
+#define RG_SPAN_BEGIN(tag) ((void)0)
+#define RG_SPAN_END() ((void)0)
+#endif
+
 #ifdef RG_ENABLE_PROFILING
 void __cyg_profile_func_enter(void *this_fn, void *call_site);
 void __cyg_profile_func_exit(void *this_fn, void *call_site);
@@ -210,16 +210,26 @@ uint32_t rg_crc32(uint32_t crc, const uint8_t *buf, size_t len)
     return crc32_le(crc, buf, len);
 #else
     // Derived from: http://www.hackersdelight.org/hdcodetxt/crc.c.txt
-    crc = ~crc;
-    for (size_t i = 0; i < len; ++i)
+    // The table is built on first use, a racing thread would only build an identical one.
+    static uint32_t table[256];
+    static bool table_ready = false;
+    if (!__atomic_load_n(&table_ready, __ATOMIC_ACQUIRE))
     {
-        crc = crc ^ buf[i];
-        for (int j = 7; j >= 0; j--) // Do eight times.
+        for (uint32_t i = 0; i < 256; ++i)
         {
-            uint32_t mask = -(crc & 1);
-            crc = (crc >> 1) ^ (0xEDB88320 & mask);
+            uint32_t value = i;
+            for (int j = 7; j >= 0; j--) // Do eight times.
+            {
+                uint32_t mask = -(value & 1);
+                value = (value >> 1) ^ (0xEDB88320 & mask);
+            }
+            table[i] = value;
         }
+        __atomic_store_n(&table_ready, true, __ATOMIC_RELEASE);
     }
+    crc = ~crc;
+    for (size_t i = 0; i < len; ++i)
+        crc = (crc >> 8) ^ table[(crc ^ buf[i]) & 0xFF];
     return ~crc;
 #endif
 }
@@ -0,0 +1,25 @@
+// Target definition
+#define RG_TARGET_NAME             "HEADLESS"
+
+// Storage
+#define RG_STORAGE_ROOT             "./sd"  // Storage mount point
+
+// Audio
+#define RG_AUDIO_USE_INT_DAC        0   // 0 = Disable, 1 = GPIO25, 2 = GPIO26, 3 = Both
+#define RG_AUDIO_USE_EXT_DAC        0   // 0 = Disable, 1 = Enable
+#define RG_AUDIO_USE_FILE           1   // 0 = Disable, 1 = Enable
+
+// Video
+#define RG_SCREEN_DRIVER            97  // 97 = Capture, 98 = Dummy
+#define RG_SCREEN_HOST              0
+#define RG_SCREEN_SPEED             0
+#define RG_SCREEN_BACKLIGHT         1
+#define RG_SCREEN_WIDTH             320
+#define RG_SCREEN_HEIGHT            240
+#define RG_SCREEN_ROTATE            0
+#define RG_SCREEN_VISIBLE_AREA      {0, 0, 0, 0}
+#define RG_SCREEN_SAFE_AREA         {0, 0, 0, 0}
+#define RG_SCREEN_INIT()
+
+// Input
+// There is no physical input, use rg_input_load_trace() (or RG_BENCH_INPUT) to feed keys to the app
@@ -8,6 +8,7 @@
 #define RG_AUDIO_USE_INT_DAC        0   // 0 = Disable, 1 = GPIO25, 2 = GPIO26, 3 = Both
 #define RG_AUDIO_USE_EXT_DAC        0   // 0 = Disable, 1 = Enable
 #define RG_AUDIO_USE_SDL2           1   // 0 = Disable, 1 = Enable
+#define RG_AUDIO_USE_FILE           1   // 0 = Disable, 1 = Enable
 
 // Video
 #define RG_SCREEN_DRIVER            99   // 0 = ILI9341/ST7789
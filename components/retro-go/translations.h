@@ -232,6 +232,10 @@ static const char *translations[][RG_LANG_MAX] =
         [RG_LANG_EN] = "Enable BIOS",
         [RG_LANG_FR] = "Activer BIOS",
     },
+    {
+        [RG_LANG_EN] = "Render thread",
+        [RG_LANG_FR] = "Rendu parallèle",
+    },
     {
         [RG_LANG_EN] = "Name",
         [RG_LANG_FR] = "Nom",
@@ -292,6 +296,10 @@ static const char *translations[][RG_LANG_MAX] =
         [RG_LANG_EN] = "Audio filter",
         [RG_LANG_FR] = "Filtre audio",
     },
+    {
+        [RG_LANG_EN] = "Audio thread",
+        [RG_LANG_FR] = "Audio en parallèle",
+    },
 
 
     // rg_gui.c
@@ -421,6 +429,10 @@ static const char *translations[][RG_LANG_MAX] =
         [RG_LANG_EN] = "Audio out",
         [RG_LANG_FR] = "Sortie audio",
     },
+    {
+        [RG_LANG_EN] = "Rate control",
+        [RG_LANG_FR] = "Contrôle du débit",
+    },
     {
         [RG_LANG_EN] = "Font type",
         [RG_LANG_FR] = "Police",
@@ -463,6 +475,26 @@ static const char *translations[][RG_LANG_MAX] =
         [RG_LANG_EN] = "Speed",
         [RG_LANG_FR] = "Vitesse",
     },
+    {
+        [RG_LANG_EN] = "Rewind",
+        [RG_LANG_FR] = "Retour arrière",
+    },
+    {
+        [RG_LANG_EN] = "Rewind step",
+        [RG_LANG_FR] = "Pas du retour",
+    },
+    {
+        [RG_LANG_EN] = "%d frames",
+        [RG_LANG_FR] = "%d images",
+    },
+    {
+        [RG_LANG_EN] = "Run-ahead",
+        [RG_LANG_FR] = "Anticipation",
+    },
+    {
+        [RG_LANG_EN] = "Too slow",
+        [RG_LANG_FR] = "Trop lent",
+    },
 
     // about menu
     {
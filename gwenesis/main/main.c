@@ -6,16 +6,23 @@
 
 #define AUDIO_SAMPLE_RATE (53267)
 #define AUDIO_BUFFER_LENGTH (AUDIO_SAMPLE_RATE / 60 + 1)
+// The chips' buffers must hold a PAL frame (313 lines) too
+#define AUDIO_BUFFER_LENGTH_MAX (LINES_PER_FRAME_PAL * VDP_CYCLES_PER_LINE / AUDIO_FREQ_DIVISOR + 1)
+
+// Both chips output mono samples at the same rate (AUDIO_FREQ_DIVISOR), they're mixed with these Q8 gains.
+// The PSG is a bit hot compared to the FM otherwise, its four channels can reach half of full scale.
+#define YM2612_GAIN  256
+#define SN76489_GAIN 160
 
 extern unsigned char* VRAM;
 extern int zclk;
 int system_clock;
 int scan_line;
 
-int16_t gwenesis_sn76489_buffer[AUDIO_BUFFER_LENGTH];
+int16_t gwenesis_sn76489_buffer[AUDIO_BUFFER_LENGTH_MAX];
 int sn76489_index;
 int sn76489_clock;
-int16_t gwenesis_ym2612_buffer[AUDIO_BUFFER_LENGTH];
+int16_t gwenesis_ym2612_buffer[AUDIO_BUFFER_LENGTH_MAX];
 int ym2612_index;
 int ym2612_clock;
 
@@ -107,6 +114,33 @@ void gwenesis_io_get_buttons()
 {
 }
 
+// Mixes the frame's PSG samples into the YM2612 buffer and returns the number of samples in it.
+// A chip that's off (or that didn't run) contributes silence, so we always return a full frame.
+static size_t mix_audio(void)
+{
+    int16_t *ym = gwenesis_ym2612_buffer, *sn = gwenesis_sn76489_buffer;
+    size_t ym_count = RG_MIN(ym2612_index, AUDIO_BUFFER_LENGTH_MAX);
+    size_t sn_count = RG_MIN(sn76489_index, AUDIO_BUFFER_LENGTH_MAX);
+    size_t count = RG_MAX(ym_count, sn_count) ?: AUDIO_BUFFER_LENGTH;
+
+    if (ym_count < count)
+        memset(ym + ym_count, 0, (count - ym_count) * sizeof(int16_t));
+
+    if (sn_count == 0 && YM2612_GAIN == 256)
+        return count;
+
+    if (sn_count < count)
+        memset(sn + sn_count, 0, (count - sn_count) * sizeof(int16_t));
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        int sample = (ym[i] * YM2612_GAIN + sn[i] * SN76489_GAIN) >> 8;
+        ym[i] = sample > 32767 ? 32767 : (sample < -32768 ? -32768 : sample);
+    }
+
+    return count;
+}
+
 
 static rg_gui_event_t yfm_update_cb(rg_gui_option_t *option, rg_gui_event_t event)
 {
@@ -149,32 +183,60 @@ static bool screenshot_handler(const char *filename, int width, int height)
     return rg_surface_save_image_file(currentUpdate, filename, width, height);
 }
 
+static bool save_state_fp(FILE *fp)
+{
+    savestate_fp = fp;
+    savestate_errors = 0;
+    gwenesis_save_state();
+    savestate_fp = NULL;
+    return savestate_errors == 0;
+}
+
+static bool load_state_fp(FILE *fp)
+{
+    savestate_fp = fp;
+    savestate_errors = 0;
+    gwenesis_load_state();
+    savestate_fp = NULL;
+    return savestate_errors == 0;
+}
+
 static bool save_state_handler(const char *filename)
 {
-    if ((savestate_fp = fopen(filename, "wb")))
+    FILE *fp = fopen(filename, "wb");
+    if (fp)
     {
-        savestate_errors = 0;
-        gwenesis_save_state();
-        fclose(savestate_fp);
-        return savestate_errors == 0;
+        bool success = save_state_fp(fp);
+        fclose(fp);
+        return success;
     }
     return false;
 }
 
 static bool load_state_handler(const char *filename)
 {
-    if ((savestate_fp = fopen(filename, "rb")))
+    FILE *fp = fopen(filename, "rb");
+    if (fp)
     {
-        savestate_errors = 0;
-        gwenesis_load_state();
-        fclose(savestate_fp);
-        if (savestate_errors == 0)
+        bool success = load_state_fp(fp);
+        fclose(fp);
+        if (success)
             return true;
     }
     reset_emulation();
     return false;
 }
 
+static size_t save_state_mem_handler(void *buffer, size_t size)
+{
+    return rg_emu_save_state_stream(buffer, size, &save_state_fp);
+}
+
+static bool load_state_mem_handler(const void *buffer, size_t size)
+{
+    return rg_emu_load_state_stream(buffer, size, &load_state_fp);
+}
+
 static bool reset_handler(bool hard)
 {
     reset_emulation();
@@ -202,6 +264,8 @@ void app_main(void)
     const rg_handlers_t handlers = {
         .loadState = &load_state_handler,
         .saveState = &save_state_handler,
+        .loadStateMem = &load_state_mem_handler,
+        .saveStateMem = &save_state_mem_handler,
         .reset = &reset_handler,
         .screenshot = &screenshot_handler,
         .event = &event_handler,
@@ -268,8 +332,6 @@ void app_main(void)
     uint32_t keymap[8] = {RG_KEY_UP, RG_KEY_DOWN, RG_KEY_LEFT, RG_KEY_RIGHT, RG_KEY_A, RG_KEY_B, RG_KEY_SELECT, RG_KEY_START};
     uint32_t joystick = 0, joystick_old;
 
-    int skipFrames = 0;
-
     RG_LOGI("emulation loop\n");
     while (true)
     {
@@ -295,9 +357,11 @@ void app_main(void)
         }
 
         int64_t startTime = rg_system_timer();
-        bool drawFrame = skipFrames == 0;
+        bool drawFrame = rg_system_frame_begin();
         bool slowFrame = false;
 
+        RG_SPAN_BEGIN("gwenesis_frame");
+
         int lines_per_frame = REG1_PAL ? LINES_PER_FRAME_PAL : LINES_PER_FRAME_NTSC;
         int hint_counter = gwenesis_vdp_regs[10];
 
@@ -386,6 +450,8 @@ void app_main(void)
         // reset m68k cycles to the begin of next frame cycle
         m68k.cycles -= system_clock;
 
+        RG_SPAN_END();
+
         if (drawFrame)
         {
             for (int i = 0; i < 256; ++i)
@@ -398,24 +464,13 @@ void app_main(void)
 
         rg_system_tick(rg_system_timer() - startTime);
 
-        if (yfm_enabled || z80_enabled) {
-            // TODO: Mix in gwenesis_sn76489_buffer
-            rg_audio_submit((void *)gwenesis_ym2612_buffer, AUDIO_BUFFER_LENGTH >> 1);
+        if (yfm_enabled || z80_enabled || sn76489_enabled) {
+            // The mono buffer is submitted as stereo at half the rate, see rg_system_init
+            size_t samples = mix_audio();
+            rg_audio_submit((void *)gwenesis_ym2612_buffer, samples >> 1);
         }
 
-        if (skipFrames == 0)
-        {
-            int elapsed = rg_system_timer() - startTime;
-            if (app->frameskip > 0)
-                skipFrames = app->frameskip;
-            else if (elapsed > app->frameTime + 1500) // Allow some jitter
-                skipFrames = 1; // (elapsed / frameTime)
-            else if (drawFrame && slowFrame)
-                skipFrames = 1;
-        }
-        else if (skipFrames > 0)
-        {
-            skipFrames--;
-        }
+        // See if we need to skip a frame to keep up
+        rg_system_frame_end(slowFrame);
     }
 }
@@ -9,22 +9,40 @@
 #include "bookmarks.h"
 #include "gui.h"
 
-#define CRC_CACHE_MAGIC 0x21112223
-#define CRC_CACHE_MAX_ENTRIES 8192
+// The CRC cache is an open addressing hash table (linear probing) keyed by the crc32 of the file's path.
+// Its on-disk layout is the in-memory layout, so it can be loaded with a single read.
+#define CRC_CACHE_MAGIC 0x43524343 // "CCRC"
+#define CRC_CACHE_VERSION 2
+#define CRC_CACHE_CAPACITY 8192 // Must be a power of two
+#define CRC_CACHE_MAX_ENTRIES (CRC_CACHE_CAPACITY / 4 * 3)
 static struct __attribute__((__packed__))
 {
     uint32_t magic;
+    uint32_t version;
+    uint32_t capacity;
     uint32_t count;
     struct {
-        uint32_t key;
+        uint32_t key; // 0 means the slot is free
         uint32_t crc;
-    } entries[CRC_CACHE_MAX_ENTRIES];
+        uint32_t size;
+        uint32_t mtime;
+    } entries[CRC_CACHE_CAPACITY];
 } *crc_cache;
-static bool crc_cache_dirty = true;
+static bool crc_cache_dirty = false;
+static bool crc_cache_on_disk = false; // The file has our layout, changed entries can be written in place
+static uint32_t crc_cache_dirty_first, crc_cache_dirty_last;
 
 static retro_app_t *apps[24];
 static int apps_count = 0;
 
+static const char *get_file_path(retro_file_t *file)
+{
+    static char buffer[RG_PATH_MAX + 1];
+    RG_ASSERT_ARG(file);
+    snprintf(buffer, RG_PATH_MAX, "%s/%s", file->folder, file->name);
+    return buffer;
+}
+
 static int scan_folder_cb(const rg_scandir_t *entry, void *arg)
 {
     retro_app_t *app = (retro_app_t *)arg;
@@ -48,6 +66,12 @@ static int scan_folder_cb(const rg_scandir_t *entry, void *arg)
     if (type == RETRO_TYPE_INVALID)
         return RG_SCANDIR_CONTINUE;
 
+    // Only the entries we keep are stat'ed. A folder's mtime is taken before we list it, so that any later
+    // change invalidates the index.
+    rg_stat_t info = rg_storage_stat(entry->path);
+    if (type == RETRO_TYPE_FOLDER)
+        info.mtime = info.is_dir ? (uint32_t)info.mtime | 1 : 0;
+
     if (app->files_count + 1 > app->files_capacity)
     {
         size_t new_capacity = (app->files_capacity * 1.5) + 1;
@@ -65,6 +89,8 @@ static int scan_folder_cb(const rg_scandir_t *entry, void *arg)
         .name = strdup(entry->basename),
         .folder = rg_unique_string(entry->dirname),
         .checksum = 0,
+        .size = info.size,
+        .mtime = info.mtime,
         .missing_cover = 0,
         .saves = 0,
         .type = type,
@@ -74,26 +100,339 @@ static int scan_folder_cb(const rg_scandir_t *entry, void *arg)
     return RG_SCANDIR_CONTINUE;
 }
 
+// Saves mirror the roms tree: `<saves>/<subdir>/<rom name>[-<slot>].sav`. Both sides are hashed on
+// the path relative to their base folder so that a save can be matched to its rom in O(1).
+typedef struct
+{
+    retro_app_t *app;
+    uint32_t *slots; // Index into app->files + 1, 0 means the slot is free
+    uint32_t mask;
+    char *dirs; // Every saves folder visited, NUL separated, so the index can revalidate them
+    size_t dirs_size;
+    size_t dirs_count;
+} saves_scan_t;
+
+static uint32_t saves_calc_key(const char *relpath, const char *name, size_t name_len)
+{
+    uint32_t key = rg_crc32(0, (const uint8_t *)relpath, strlen(relpath));
+    return rg_crc32(key, (const uint8_t *)name, name_len);
+}
+
+static retro_file_t *saves_find_file(saves_scan_t *scan, const char *relpath, const char *name, size_t name_len)
+{
+    size_t roms_len = strlen(scan->app->paths.roms);
+    uint32_t index = saves_calc_key(relpath, name, name_len) & scan->mask;
+
+    for (; scan->slots[index]; index = (index + 1) & scan->mask)
+    {
+        retro_file_t *file = &scan->app->files[scan->slots[index] - 1];
+        if (strncmp(file->name, name, name_len) == 0 && file->name[name_len] == 0
+            && strcmp(file->folder + roms_len, relpath) == 0)
+            return file;
+    }
+
+    return NULL;
+}
+
+static void saves_add_dir(saves_scan_t *scan, const char *path)
+{
+    size_t len = strlen(path) + 1;
+    char *new_buf = realloc(scan->dirs, scan->dirs_size + len);
+    if (new_buf)
+    {
+        memcpy(new_buf + scan->dirs_size, path, len);
+        scan->dirs = new_buf;
+        scan->dirs_size += len;
+        scan->dirs_count++;
+    }
+}
+
 static int scan_saves_cb(const rg_scandir_t *entry, void *arg)
 {
-    if (entry->is_file && rg_extension_match(entry->basename, "sav"))
+    saves_scan_t *scan = (saves_scan_t *)arg;
+    retro_app_t *app = scan->app;
+
+    if (entry->is_dir)
     {
-        retro_app_t *app = (retro_app_t *)arg;
-        for (size_t i = 0; i < app->files_count; i++)
+        saves_add_dir(scan, entry->path);
+    }
+    else if (entry->is_file && rg_extension_match(entry->basename, "sav"))
+    {
+        const char *relpath = entry->dirname + strlen(app->paths.saves);
+        size_t name_len = strlen(entry->basename) - 4;
+        retro_file_t *file = saves_find_file(scan, relpath, entry->basename, name_len);
+
+        // Numbered slots are saved as `-N.sav`
+        if (!file)
         {
-            retro_file_t *file = &app->files[i];
-            // Saves are the rom name with possibly `.sav` or `-0.sav` appended.
-            if (strncmp(entry->basename, file->name, strlen(file->name)) == 0)
-            {
-                // FIXME: Check if folder matches first
-                file->saves++;
-                break;
-            }
+            size_t len = name_len;
+            while (len > 0 && isdigit((int)entry->basename[len - 1]))
+                len--;
+            if (len > 1 && len < name_len && entry->basename[len - 1] == '-')
+                file = saves_find_file(scan, relpath, entry->basename, len - 1);
         }
+
+        if (file && file->saves < 0xFF)
+            file->saves++;
     }
     return RG_SCANDIR_CONTINUE;
 }
 
+static bool application_scan_saves(retro_app_t *app, saves_scan_t *scan)
+{
+    size_t roms_len = strlen(app->paths.roms);
+    size_t capacity = 64;
+
+    while (capacity < app->files_count * 2)
+        capacity *= 2;
+
+    *scan = (saves_scan_t){.app = app, .slots = calloc(capacity, sizeof(uint32_t)), .mask = capacity - 1};
+    if (!scan->slots)
+    {
+        RG_LOGW("Out of memory, save files won't be counted");
+        return false;
+    }
+
+    for (size_t i = 0; i < app->files_count; i++)
+    {
+        retro_file_t *file = &app->files[i];
+        file->saves = 0;
+        if (file->type != RETRO_TYPE_FILE)
+            continue;
+        uint32_t index = saves_calc_key(file->folder + roms_len, file->name, strlen(file->name)) & scan->mask;
+        while (scan->slots[index])
+            index = (index + 1) & scan->mask;
+        scan->slots[index] = i + 1;
+    }
+
+    // The root itself is recorded too, that's where new saves usually land
+    saves_add_dir(scan, app->paths.saves);
+
+    rg_storage_scandir(app->paths.saves, scan_saves_cb, scan, RG_SCANDIR_RECURSIVE);
+
+    free(scan->slots);
+    scan->slots = NULL;
+    return true;
+}
+
+// The index is a snapshot of app->files along with the mtime of every folder that was scanned to build it.
+// It is trusted as long as none of those folders changed. The saves part is tracked separately because
+// it changes every time a game is played, and rescanning saves alone is cheap. Not every FAT driver
+// updates a folder's mtime when its content changes, crc_cache_prebuild forces a full rescan for that.
+#define INDEX_MAGIC 0x58444952 // "RIDX"
+#define INDEX_VERSION 3
+typedef struct __attribute__((__packed__))
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t files_count;
+    uint32_t saves_dirs_count;
+    uint32_t strings_size;
+    uint32_t roms_mtime;
+    uint8_t saves_valid;
+    uint8_t reserved[3];
+} index_header_t;
+typedef struct __attribute__((__packed__))
+{
+    uint32_t name; // Offsets into the strings area
+    uint32_t folder;
+    uint32_t size;
+    uint32_t mtime;
+    uint8_t saves;
+    uint8_t type;
+    uint8_t reserved[2];
+} index_file_t;
+typedef struct __attribute__((__packed__))
+{
+    uint32_t path;
+    uint32_t mtime;
+} index_dir_t;
+
+static const char *index_get_path(retro_app_t *app)
+{
+    static char buffer[RG_PATH_MAX + 1];
+    snprintf(buffer, RG_PATH_MAX, RG_BASE_PATH_CACHE "/index_%s.bin", app->short_name);
+    return buffer;
+}
+
+static uint32_t index_get_mtime(const char *path)
+{
+    rg_stat_t info = rg_storage_stat(path);
+    // 0 can never match a real folder, so a missing folder always invalidates the index
+    return info.is_dir ? (uint32_t)info.mtime | 1 : 0;
+}
+
+static void index_save(retro_app_t *app, const saves_scan_t *scan)
+{
+    size_t strings_size = scan->dirs_size;
+    for (size_t i = 0; i < app->files_count; i++)
+        strings_size += strlen(app->files[i].name) + strlen(app->files[i].folder) + 2;
+
+    size_t data_len = sizeof(index_header_t) + app->files_count * sizeof(index_file_t)
+                    + scan->dirs_count * sizeof(index_dir_t) + strings_size;
+    uint8_t *data = calloc(1, data_len);
+    if (!data)
+    {
+        RG_LOGW("Out of memory, index not saved");
+        return;
+    }
+
+    index_header_t *header = (index_header_t *)data;
+    index_file_t *files = (index_file_t *)(header + 1);
+    index_dir_t *dirs = (index_dir_t *)(files + app->files_count);
+    char *strings = (char *)(dirs + scan->dirs_count);
+    const char *last_folder = NULL;
+    uint32_t last_folder_offset = 0;
+    uint32_t offset = 0;
+
+    for (size_t i = 0; i < app->files_count; i++)
+    {
+        retro_file_t *file = &app->files[i];
+        // Files of the same folder are adjacent and share the same unique string, store it only once
+        if (file->folder != last_folder)
+        {
+            last_folder = file->folder;
+            last_folder_offset = offset;
+            offset += strlen(strcpy(strings + offset, file->folder)) + 1;
+        }
+        files[i] = (index_file_t){
+            .name = offset,
+            .folder = last_folder_offset,
+            .size = file->size,
+            .mtime = file->mtime,
+            .saves = file->saves,
+            .type = file->type,
+        };
+        offset += strlen(strcpy(strings + offset, file->name)) + 1;
+    }
+
+    for (const char *dir = scan->dirs; dir && dir < scan->dirs + scan->dirs_size; dir += strlen(dir) + 1)
+    {
+        dirs->path = offset;
+        dirs->mtime = index_get_mtime(dir);
+        offset += strlen(strcpy(strings + offset, dir)) + 1;
+        dirs++;
+    }
+
+    *header = (index_header_t){
+        .magic = INDEX_MAGIC,
+        .version = INDEX_VERSION,
+        .files_count = app->files_count,
+        .saves_dirs_count = scan->dirs_count,
+        .strings_size = offset,
+        .roms_mtime = index_get_mtime(app->paths.roms),
+        .saves_valid = 1,
+    };
+
+    data_len -= strings_size - offset;
+    if (!rg_storage_write_file(index_get_path(app), data, data_len, RG_FILE_ATOMIC_WRITE))
+        RG_LOGW("Failed to save index '%s'", index_get_path(app));
+
+    free(data);
+}
+
+// Returns 0 if the index can't be used, 1 if the files were loaded but the saves must be recounted, 2 if all is good.
+static int index_load(retro_app_t *app)
+{
+    void *data = NULL;
+    size_t data_len = 0;
+    int ret = 0;
+
+    if (!rg_storage_read_file(index_get_path(app), &data, &data_len, 0))
+        return 0;
+
+    index_header_t *header = (index_header_t *)data;
+    if (data_len < sizeof(index_header_t) || header->magic != INDEX_MAGIC || header->version != INDEX_VERSION
+        || data_len != sizeof(index_header_t) + (size_t)header->files_count * sizeof(index_file_t)
+                        + (size_t)header->saves_dirs_count * sizeof(index_dir_t) + header->strings_size
+        || header->strings_size == 0 || ((char *)data)[data_len - 1] != 0)
+    {
+        RG_LOGW("Index '%s' is invalid, rebuilding", index_get_path(app));
+        goto _done;
+    }
+
+    index_file_t *files = (index_file_t *)(header + 1);
+    index_dir_t *dirs = (index_dir_t *)(files + header->files_count);
+    char *strings = (char *)(dirs + header->saves_dirs_count);
+
+    if (header->roms_mtime != index_get_mtime(app->paths.roms))
+        goto _done;
+
+    for (size_t i = 0; i < header->files_count; i++)
+    {
+        if (files[i].name >= header->strings_size || files[i].folder >= header->strings_size)
+            goto _done;
+        if (files[i].type == RETRO_TYPE_FOLDER)
+        {
+            char path[RG_PATH_MAX + 1];
+            snprintf(path, RG_PATH_MAX, "%s/%s", strings + files[i].folder, strings + files[i].name);
+            if (files[i].mtime != index_get_mtime(path))
+                goto _done;
+        }
+    }
+
+    if (header->files_count > app->files_capacity)
+    {
+        retro_file_t *new_buf = realloc(app->files, header->files_count * sizeof(retro_file_t));
+        if (!new_buf)
+            goto _done;
+        app->files = new_buf;
+        app->files_capacity = header->files_count;
+    }
+
+    const char *last_folder = NULL;
+    for (size_t i = 0; i < header->files_count; i++)
+    {
+        // Folders are shared between files, so the unique string lookup can be skipped most of the time
+        if (!last_folder || strcmp(last_folder, strings + files[i].folder) != 0)
+            last_folder = rg_unique_string(strings + files[i].folder);
+        app->files[i] = (retro_file_t) {
+            .name = strdup(strings + files[i].name),
+            .folder = last_folder,
+            .size = files[i].size,
+            .mtime = files[i].mtime,
+            .saves = files[i].saves,
+            .type = files[i].type,
+            .app = (void*)app,
+        };
+    }
+    app->files_count = header->files_count;
+    ret = header->saves_valid ? 2 : 1;
+
+    for (size_t i = 0; i < header->saves_dirs_count && ret == 2; i++)
+    {
+        if (dirs[i].path >= header->strings_size || dirs[i].mtime != index_get_mtime(strings + dirs[i].path))
+            ret = 1;
+    }
+
+    RG_LOGI("Loaded index '%s' (files: %d, saves: %s)", index_get_path(app), (int)app->files_count,
+        ret == 2 ? "valid" : "stale");
+
+_done:
+    free(data);
+    return ret;
+}
+
+static void index_invalidate(retro_app_t *app, bool saves_only)
+{
+    if (!saves_only)
+    {
+        if (rg_storage_exists(index_get_path(app)))
+            rg_storage_delete(index_get_path(app));
+        return;
+    }
+
+    // We only have to clear a single byte, no need to rewrite the whole thing
+    FILE *fp = fopen(index_get_path(app), "r+b");
+    if (fp)
+    {
+        uint8_t saves_valid = 0;
+        fseek(fp, offsetof(index_header_t, saves_valid), SEEK_SET);
+        fwrite(&saves_valid, 1, 1, fp);
+        fclose(fp);
+    }
+}
+
 static void application_init(retro_app_t *app)
 {
     RG_LOGI("Initializing application '%s' (%s)", app->description, app->partition);
@@ -105,9 +444,24 @@ static void application_init(retro_app_t *app)
     rg_storage_mkdir(app->paths.saves);
     rg_storage_mkdir(app->paths.roms);
 
-    rg_storage_scandir(app->paths.roms, scan_folder_cb, app, RG_SCANDIR_RECURSIVE);
-    rg_storage_scandir(app->paths.saves, scan_saves_cb, app, RG_SCANDIR_RECURSIVE);
-    // rg_storage_scandir(app->paths.covers, scan_folder_cb3, app, RG_SCANDIR_RECURSIVE);
+    int64_t start_time = rg_system_timer();
+    int index_state = index_load(app);
+
+    if (index_state == 0)
+    {
+        rg_storage_scandir(app->paths.roms, scan_folder_cb, app, RG_SCANDIR_RECURSIVE);
+    }
+
+    if (index_state < 2)
+    {
+        saves_scan_t scan;
+        if (application_scan_saves(app, &scan))
+            index_save(app, &scan);
+        free(scan.dirs);
+    }
+
+    RG_LOGI("Found %d entries in %dms (index: %s)", (int)app->files_count,
+        (int)((rg_system_timer() - start_time) / 1000), index_state == 2 ? "hit" : index_state == 1 ? "saves" : "miss");
 
     app->use_crc_covers = rg_storage_exists(strcat(app->paths.covers, "/0"));
     app->paths.covers[strlen(app->paths.covers) - 2] = 0;
@@ -115,14 +469,6 @@ static void application_init(retro_app_t *app)
     app->initialized = true;
 }
 
-static const char *get_file_path(retro_file_t *file)
-{
-    static char buffer[RG_PATH_MAX + 1];
-    RG_ASSERT_ARG(file);
-    snprintf(buffer, RG_PATH_MAX, "%s/%s", file->folder, file->name);
-    return buffer;
-}
-
 static void application_start(retro_file_t *file, int load_state)
 {
     RG_ASSERT_ARG(file);
@@ -135,6 +481,7 @@ static void application_start(retro_file_t *file, int load_state)
         flags |= RG_BOOT_RESUME;
         flags |= (load_state << 4) & RG_BOOT_SLOT_MASK;
     }
+    index_invalidate(file->app, true); // The game is likely to create or replace saves
     bookmark_add(BOOK_TYPE_RECENT, file); // This could relocate *file, but we no longer need it
     rg_system_switch_app(part, name, path, flags);
 }
@@ -183,15 +530,21 @@ static void crc_cache_init(void)
 
     void *data_ptr = crc_cache;
     size_t data_len = sizeof(*crc_cache);
-    rg_storage_read_file(RG_BASE_PATH_CACHE "/crc32.bin", &data_ptr, &data_len, RG_FILE_USER_BUFFER);
-    if (crc_cache->magic == CRC_CACHE_MAGIC && crc_cache->count <= CRC_CACHE_MAX_ENTRIES)
+    if (rg_storage_read_file(RG_BASE_PATH_CACHE "/crc32.bin", &data_ptr, &data_len, RG_FILE_USER_BUFFER)
+        && data_len == sizeof(*crc_cache) && crc_cache->magic == CRC_CACHE_MAGIC
+        && crc_cache->version == CRC_CACHE_VERSION && crc_cache->capacity == CRC_CACHE_CAPACITY
+        && crc_cache->count <= CRC_CACHE_MAX_ENTRIES)
     {
         RG_LOGI("Loaded CRC cache (entries: %d)", (int)crc_cache->count);
-        crc_cache_dirty = false;
+        crc_cache_on_disk = true;
     }
     else
     {
-        crc_cache->count = 0;
+        // Missing, from an older version, or corrupted. Either way we start over.
+        memset(crc_cache, 0, sizeof(*crc_cache));
+        crc_cache->magic = CRC_CACHE_MAGIC;
+        crc_cache->version = CRC_CACHE_VERSION;
+        crc_cache->capacity = CRC_CACHE_CAPACITY;
     }
 }
 
@@ -200,41 +553,73 @@ static void crc_cache_save(void)
     if (!crc_cache || !crc_cache_dirty)
         return;
 
+    // The table is 128KB, usually only a handful of entries changed
+    if (crc_cache_on_disk)
+    {
+        size_t first = (uint8_t *)&crc_cache->entries[crc_cache_dirty_first] - (uint8_t *)crc_cache;
+        size_t last = (uint8_t *)&crc_cache->entries[crc_cache_dirty_last + 1] - (uint8_t *)crc_cache;
+        RG_LOGI("Saving CRC cache (entries %d-%d)...", (int)crc_cache_dirty_first, (int)crc_cache_dirty_last);
+        FILE *fp = fopen(RG_BASE_PATH_CACHE "/crc32.bin", "r+b");
+        if (fp)
+        {
+            size_t header = (uint8_t *)&crc_cache->entries[0] - (uint8_t *)crc_cache;
+            bool success = fwrite(crc_cache, header, 1, fp)
+                && fseek(fp, first, SEEK_SET) == 0 && fwrite((uint8_t *)crc_cache + first, last - first, 1, fp);
+            crc_cache_dirty = !(fclose(fp) == 0 && success);
+        }
+        crc_cache_on_disk = !crc_cache_dirty;
+        if (!crc_cache_dirty)
+            return;
+    }
+
     RG_LOGI("Saving CRC cache...");
-    size_t data_len = RG_MIN(8 + (crc_cache->count * sizeof(crc_cache->entries[0])), sizeof(*crc_cache));
-    crc_cache_dirty = !rg_storage_write_file(RG_BASE_PATH_CACHE"/crc32.bin", crc_cache, data_len, 0);
+    crc_cache_dirty = !rg_storage_write_file(RG_BASE_PATH_CACHE"/crc32.bin", crc_cache, sizeof(*crc_cache), 0);
+    crc_cache_on_disk = !crc_cache_dirty;
+}
+
+// The scan (or the index) gives us the size and mtime, only files that didn't come from it need a stat
+static void crc_cache_stat(retro_file_t *file)
+{
+    if (file->mtime)
+        return;
+    rg_stat_t info = rg_storage_stat(get_file_path(file));
+    file->size = info.size;
+    file->mtime = info.mtime;
 }
 
 static uint32_t crc_cache_calc_key(retro_file_t *file)
 {
-    // return ((uint64_t)rg_crc32(0, (void *)file->name, strlen(file->name)) << 33 | file->size);
     // This should be reasonably unique
     const char *path = get_file_path(file);
-    return rg_crc32(0, (const uint8_t *)path, strlen(path));
+    uint32_t key = rg_crc32(0, (const uint8_t *)path, strlen(path));
+    return key ? key : 1; // 0 is reserved for free slots
 }
 
-static int crc_cache_find(retro_file_t *file)
+static int crc_cache_find(uint32_t key)
 {
-    if (!crc_cache)
-        return -1;
-
-    uint32_t key = crc_cache_calc_key(file);
-
-    for (int i = 0; i < crc_cache->count; i++)
-    {
-        if (crc_cache->entries[i].key == key)
-            return i;
-    }
-
-    return -1;
+    // The table is never allowed to fill up completely, so the probe always hits a match or a free slot
+    uint32_t mask = CRC_CACHE_CAPACITY - 1;
+    uint32_t index = key & mask;
+    while (crc_cache->entries[index].key != key && crc_cache->entries[index].key != 0)
+        index = (index + 1) & mask;
+    return index;
 }
 
 static uint32_t crc_cache_lookup(retro_file_t *file)
 {
-    int index = crc_cache_find(file);
-    if (index != -1)
-        return crc_cache->entries[index].crc;
-    return 0;
+    if (!crc_cache)
+        return 0;
+
+    int index = crc_cache_find(crc_cache_calc_key(file));
+    if (crc_cache->entries[index].key == 0)
+        return 0;
+
+    // The file might have been replaced by a different one with the same name
+    crc_cache_stat(file);
+    if (crc_cache->entries[index].size != file->size || crc_cache->entries[index].mtime != file->mtime)
+        return 0;
+
+    return crc_cache->entries[index].crc;
 }
 
 static void crc_cache_update(retro_file_t *file)
@@ -242,14 +627,20 @@ static void crc_cache_update(retro_file_t *file)
     if (!crc_cache)
         return;
 
+    crc_cache_stat(file);
     uint32_t key = crc_cache_calc_key(file);
-    int index = crc_cache_find(file);
-    if (index == -1)
+    int index = crc_cache_find(key);
+    if (crc_cache->entries[index].key == key && crc_cache->entries[index].crc == file->checksum
+        && crc_cache->entries[index].size == file->size && crc_cache->entries[index].mtime == file->mtime)
+        return;
+
+    if (crc_cache->entries[index].key == 0)
     {
+        // When we're full we overwrite the key's home slot instead, that way no probe chain is ever broken
         if (crc_cache->count < CRC_CACHE_MAX_ENTRIES)
-            index = crc_cache->count++;
+            crc_cache->count++;
         else
-            index = rand() % CRC_CACHE_MAX_ENTRIES;
+            index = key & (CRC_CACHE_CAPACITY - 1);
 
         RG_LOGI("Adding %08X => %08X to cache (new total: %d)",
             (int)key, (int)file->checksum, (int)crc_cache->count);
@@ -260,9 +651,15 @@ static void crc_cache_update(retro_file_t *file)
             (int)key, (int)file->checksum, (int)crc_cache->count);
     }
 
-    crc_cache->magic = CRC_CACHE_MAGIC;
     crc_cache->entries[index].key = key;
     crc_cache->entries[index].crc = file->checksum;
+    crc_cache->entries[index].size = file->size;
+    crc_cache->entries[index].mtime = file->mtime;
+
+    if (!crc_cache_dirty || index < crc_cache_dirty_first)
+        crc_cache_dirty_first = index;
+    if (!crc_cache_dirty || index > crc_cache_dirty_last)
+        crc_cache_dirty_last = index;
     crc_cache_dirty = true;
 
     // crc_cache_save();
@@ -280,6 +677,9 @@ void crc_cache_prebuild(void)
         if (!app->available)
             continue;
 
+        // Not every OS updates folder mtimes on FAT, this doubles as a way to force a full rescan
+        index_invalidate(app, false);
+
         if (!app->initialized)
             application_init(app);
 
@@ -436,11 +836,16 @@ static void event_handler(gui_event_t event, tab_t *tab)
     {
         gui_set_status(tab, NULL, "");
         gui_set_preview(tab, NULL);
+        // Previews that were prefetched can be shown right away, even while scrolling
+        if (event != TAB_LEAVE)
+            gui_update_preview(tab);
     }
     else if (event == TAB_IDLE)
     {
         if (file && !tab->preview && gui.idle_counter == 1)
             gui_load_preview(tab);
+        else if (file && !tab->preview && gui_update_preview(tab))
+            gui_redraw();
     }
     else if (event == TAB_ACTION)
     {
@@ -571,6 +976,7 @@ static void show_file_info(retro_file_t *file)
                     bookmark_remove(BOOK_TYPE_FAVORITE, file);
                     bookmark_remove(BOOK_TYPE_RECENT, file);
                     file->type = RETRO_TYPE_INVALID;
+                    index_invalidate(file->app, false);
                     gui_event(TAB_REFRESH, gui_get_current_tab());
                     return;
                 }
@@ -623,6 +1029,7 @@ void application_show_file_menu(retro_file_t *file, bool advanced)
             remove(savestates->slots[slot].file);
             // FIXME: We should update the last slot used here
         }
+        index_invalidate(file->app, true);
         if (has_sram && rg_gui_confirm(_("Delete sram file?"), 0, 0))
         {
             remove(sram_path);
@@ -705,3 +1112,9 @@ void applications_init(void)
     if (!rg_system_get_app()->lowMemoryMode)
         crc_cache_init();
 }
+
+void applications_invalidate_index(void)
+{
+    for (int i = 0; i < apps_count; i++)
+        index_invalidate(apps[i], false);
+}
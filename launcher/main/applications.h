@@ -19,6 +19,8 @@ typedef struct
     const char *name;
     const char *folder;
     uint32_t checksum;
+    uint32_t size;  // 0 if unknown
+    uint32_t mtime; // 0 if unknown
     uint16_t missing_cover;
     uint8_t saves;
     uint8_t type;
@@ -52,3 +54,4 @@ void application_show_file_menu(retro_file_t *file, bool simplified);
 bool application_get_file_crc32(retro_file_t *file);
 bool application_path_to_file(const char *path, retro_file_t *out_file);
 void crc_cache_prebuild(void);
+void applications_invalidate_index(void);
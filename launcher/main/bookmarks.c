@@ -31,11 +31,16 @@ static void event_handler(gui_event_t event, tab_t *tab)
     {
         gui_set_status(tab, NULL, "");
         gui_set_preview(tab, NULL);
+        // Previews that were prefetched can be shown right away, even while scrolling
+        if (event != TAB_LEAVE)
+            gui_update_preview(tab);
     }
     else if (event == TAB_IDLE)
     {
         if (file && !tab->preview && gui.idle_counter == 1)
             gui_load_preview(tab);
+        else if (file && !tab->preview && gui_update_preview(tab))
+            gui_redraw();
     }
     else if (event == TAB_ACTION)
     {
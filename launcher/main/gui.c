@@ -3,6 +3,7 @@
 #include <stdlib.h>
 
 #include "applications.h"
+#include "previews.h"
 #include "gui.h"
 
 #define HEADER_HEIGHT       (50)
@@ -117,6 +118,8 @@ tab_t *gui_get_tab(int index)
 
 void gui_invalidate(void)
 {
+    // The file system was modified behind our back, the indexes can't be trusted anymore
+    applications_invalidate_index();
     for (size_t i = 0; i < gui.tabs_count; ++i)
         gui_deinit_tab(gui.tabs[i]);
     // Kick the user out of the tab and only re-init upon manual re-entry
@@ -543,97 +546,64 @@ void gui_set_preview(tab_t *tab, rg_image_t *preview)
     tab->preview = preview;
 }
 
-void gui_load_preview(tab_t *tab)
+bool gui_update_preview(tab_t *tab)
 {
+    static const retro_file_t *last_file;
+    static bool miss_reported;
     listbox_item_t *item = gui_get_selected_item(tab);
-    bool show_missing_cover = false;
-    uint32_t order;
+    retro_file_t *files[1 + PREVIEWS_PREFETCH_RANGE * 2];
+    size_t count = 0;
 
-    gui_set_preview(tab, NULL);
+    if (!item || !item->arg || tab->preview || gui.low_memory_mode || gui.show_preview == PREVIEW_MODE_NONE)
+        return false;
 
-    if (!item || !item->arg || gui.low_memory_mode)
-        return;
+    retro_file_t *file = item->arg;
 
-    switch (gui.show_preview)
+    // We're polled while idle, a missing preview is only reported once for each selection
+    if (file != last_file)
     {
-        case PREVIEW_MODE_COVER_SAVE:
-            show_missing_cover = true;
-            order = 0x4123;
-            break;
-        case PREVIEW_MODE_SAVE_COVER:
-            show_missing_cover = true;
-            order = 0x1234;
-            break;
-        case PREVIEW_MODE_COVER_ONLY:
-            show_missing_cover = true;
-            order = 0x0123;
-            break;
-        case PREVIEW_MODE_SAVE_ONLY:
-            show_missing_cover = false;
-            order = 0x0004;
-            break;
-        default:
-            show_missing_cover = false;
-            order = 0x0000;
+        last_file = file;
+        miss_reported = false;
     }
 
-    retro_file_t *file = item->arg;
-    retro_app_t *app = file->app;
-    uint32_t errors = 0;
+    if (previews_get(file, gui.show_preview, &tab->preview) && !tab->preview && file->checksum
+        && gui.show_preview != PREVIEW_MODE_SAVE_ONLY && !miss_reported)
+    {
+        RG_LOGI("No image found for '%s'\n", file->name);
+        gui_set_status(tab, NULL, "No cover");
+        miss_reported = true;
+    }
 
-    while (order && !tab->preview)
+    // The selected item goes first, then its neighbours from closest to farthest
+    files[count++] = file;
+    for (int i = 1; i <= PREVIEWS_PREFETCH_RANGE; i++)
     {
-        char path[RG_PATH_MAX + 1];
-        size_t path_len = 0;
-        int type = order & 0xF;
+        int below = tab->listbox.cursor + i, above = tab->listbox.cursor - i;
+        if (below < tab->listbox.length && tab->listbox.items[below].arg)
+            files[count++] = tab->listbox.items[below].arg;
+        if (above >= 0 && tab->listbox.items[above].arg)
+            files[count++] = tab->listbox.items[above].arg;
+    }
+    previews_request(files, count, gui.show_preview);
 
-        order >>= 4;
+    return tab->preview != NULL;
+}
 
-        // Give up on any button press to improve responsiveness
-        if ((gui.joystick |= rg_input_read_gamepad()))
-            break;
+void gui_load_preview(tab_t *tab)
+{
+    listbox_item_t *item = gui_get_selected_item(tab);
 
-        if (file->missing_cover & (1 << type))
-            continue;
+    gui_set_preview(tab, NULL);
 
-        if (type == 0x1 && app->use_crc_covers && application_get_file_crc32(file)) // Game cover (old format)
-            path_len = snprintf(path, RG_PATH_MAX, "%s/%X/%08X.art", app->paths.covers, (int)(file->checksum >> 28), (int)file->checksum);
-        else if (type == 0x2 && app->use_crc_covers && application_get_file_crc32(file)) // Game cover (png)
-            path_len = snprintf(path, RG_PATH_MAX, "%s/%X/%08X.png", app->paths.covers, (int)(file->checksum >> 28), (int)file->checksum);
-        else if (type == 0x3) // Game cover (based on filename)
-        {
-            path_len = snprintf(path, RG_PATH_MAX, "%s/%s", app->paths.covers, file->name);
-            if (path_len < RG_PATH_MAX - 3) // Don't bother if we already have an overflow
-                strcpy(path + path_len - strlen(rg_extension(file->name) ?: ""), "png");
-        }
-        else if (type == 0x4 && file->saves > 0) // Save state screenshot (png)
-        {
-            snprintf(path, RG_PATH_MAX, "%s/%s", file->folder, file->name);
-            uint8_t last_used_slot = rg_emu_get_last_used_slot(path);
-            if (last_used_slot != 0xFF)
-            {
-                char *preview = rg_emu_get_path(RG_PATH_SCREENSHOT + last_used_slot, path);
-                path_len = snprintf(path, RG_PATH_MAX, "%s", preview);
-                free(preview);
-            }
-        }
+    if (!item || !item->arg || gui.low_memory_mode || gui.show_preview == PREVIEW_MODE_NONE)
+        return;
 
-        if (path_len > 0 && path_len < RG_PATH_MAX)
-        {
-            RG_LOGD("Looking for %s", path);
-            gui_set_preview(tab, rg_surface_load_image_file(path, 0));
-            // if (!tab->preview && rg_storage_exists(path))
-            //     errors++;
-        }
+    retro_file_t *file = item->arg;
 
-        file->missing_cover |= (tab->preview ? 0 : 1) << type;
-    }
+    // Computing the checksum might mean reading the whole file, it stays here where a keypress can interrupt it.
+    // The prefetcher only uses checksums that are already known.
+    if (file->app->use_crc_covers && gui.show_preview != PREVIEW_MODE_SAVE_ONLY && (~file->missing_cover & 0x6))
+        application_get_file_crc32(file);
 
-    if (!tab->preview && file->checksum && (show_missing_cover || errors))
-    {
-        RG_LOGI("No image found for '%s'\n", file->name);
-        gui_set_status(tab, NULL, errors ? "Bad cover" : "No cover");
-        // gui_draw_status(tab);
-        // tab->preview = gui_get_image("cover", file->app);
-    }
+    gui_update_preview(tab);
 }
@@ -13,6 +13,7 @@
 #include "bookmarks.h"
 #include "browser.h"
 #include "gui.h"
+#include "previews.h"
 #include "webui.h"
 #include "updater.h"
 
@@ -203,6 +204,7 @@ static void retro_loop(void)
     gui_init(app->isColdBoot);
     applications_init();
     bookmarks_init();
+    previews_init();
     // browser_init();
 
 #ifdef RG_ENABLE_NETWORKING
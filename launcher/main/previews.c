@@ -0,0 +1,327 @@
+#include <rg_system.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "applications.h"
+#include "previews.h"
+#include "gui.h"
+
+#define PREVIEWS_CACHE_PATH     RG_BASE_PATH_CACHE "/previews"
+#define PREVIEWS_CACHE_SIZE     6
+#define PREVIEWS_MAX_REQUESTS   (1 + PREVIEWS_PREFETCH_RANGE * 2)
+
+typedef struct
+{
+    char path[RG_PATH_MAX + 1]; // Path of the rom
+    uint32_t key;
+    uint32_t checksum;
+    uint16_t missing;
+    uint8_t saves;
+    uint8_t mode;
+    retro_app_t *app;
+} preview_request_t;
+
+typedef struct
+{
+    uint32_t key;
+    uint32_t checksum; // The checksum that was known when the entry was resolved
+    uint32_t last_used;
+    uint16_t missing;
+    uint8_t mode;
+    rg_image_t *image; // NULL if no image was found
+} preview_entry_t;
+
+// Files in PREVIEWS_CACHE_PATH are this header followed by a RAW565 image
+typedef struct
+{
+    uint32_t size;
+    uint32_t mtime;
+} preview_file_header_t;
+
+static struct
+{
+    preview_request_t requests[PREVIEWS_MAX_REQUESTS];
+    size_t count;
+    uint32_t generation;
+} job;
+static preview_entry_t cache[PREVIEWS_CACHE_SIZE];
+static uint32_t cache_clock;
+static rg_mutex_t *lock;
+static rg_task_t *task;
+
+// Each nibble is a preview type to try, starting from the lowest
+static const uint32_t preview_orders[PREVIEW_MODE_COUNT] = {
+    [PREVIEW_MODE_NONE] = 0x0000,
+    [PREVIEW_MODE_COVER_SAVE] = 0x4123,
+    [PREVIEW_MODE_SAVE_COVER] = 0x1234,
+    [PREVIEW_MODE_COVER_ONLY] = 0x0123,
+    [PREVIEW_MODE_SAVE_ONLY] = 0x0004,
+};
+
+static uint32_t get_file_key(const retro_file_t *file, char *path)
+{
+    snprintf(path, RG_PATH_MAX, "%s/%s", file->folder, file->name);
+    uint32_t key = rg_crc32(0, (const uint8_t *)path, strlen(path));
+    return key ? key : 1; // 0 is reserved for free entries
+}
+
+static preview_entry_t *cache_find(uint32_t key, int mode, uint32_t checksum)
+{
+    for (size_t i = 0; i < PREVIEWS_CACHE_SIZE; i++)
+    {
+        // An entry resolved before the checksum was known may have skipped the CRC-named covers
+        if (cache[i].key == key && cache[i].mode == mode && cache[i].checksum == checksum)
+            return &cache[i];
+    }
+    return NULL;
+}
+
+static void cache_store(const preview_request_t *req, uint16_t missing, rg_image_t *image)
+{
+    preview_entry_t *entry = &cache[0];
+    for (size_t i = 0; i < PREVIEWS_CACHE_SIZE; i++)
+    {
+        if (cache[i].key == req->key && cache[i].mode == req->mode)
+        {
+            entry = &cache[i];
+            break;
+        }
+        if (cache[i].last_used < entry->last_used)
+            entry = &cache[i];
+    }
+    rg_surface_free(entry->image);
+    *entry = (preview_entry_t){
+        .key = req->key,
+        .checksum = req->checksum,
+        .last_used = ++cache_clock,
+        .missing = missing,
+        .mode = req->mode,
+        .image = image,
+    };
+}
+
+static rg_image_t *load_image(const char *path)
+{
+    rg_stat_t info = rg_storage_stat(path);
+    if (!info.is_file)
+        return NULL;
+
+    // Other formats are already raw, decoding them is as cheap as reading our copy would be
+    if (!rg_extension_match(path, "png"))
+        return rg_surface_load_image_file(path, 0);
+
+    char cache_path[RG_PATH_MAX + 1];
+    snprintf(cache_path, RG_PATH_MAX, PREVIEWS_CACHE_PATH "/%08X.565", (int)rg_crc32(0, (const uint8_t *)path, strlen(path)));
+
+    rg_image_t *image = NULL;
+    void *data = NULL;
+    size_t data_len = 0;
+
+    if (rg_storage_exists(cache_path) && rg_storage_read_file(cache_path, &data, &data_len, 0))
+    {
+        const preview_file_header_t *header = data;
+        if (data_len >= sizeof(*header) + 16 && header->size == (uint32_t)info.size && header->mtime == (uint32_t)info.mtime)
+            image = rg_surface_load_image(data + sizeof(*header), data_len - sizeof(*header), 0);
+        free(data);
+    }
+
+    if (image || !(image = rg_surface_load_image_file(path, 0)))
+        return image;
+
+    // Keep the decoded image so that we never have to go through lodepng for this file again
+    size_t pixels_len = image->width * image->height * 2;
+    data_len = sizeof(preview_file_header_t) + 4 + pixels_len;
+    if ((data = malloc(data_len)))
+    {
+        preview_file_header_t header = {info.size, info.mtime};
+        uint16_t dimensions[2] = {image->width, image->height};
+        memcpy(data, &header, sizeof(header));
+        memcpy(data + sizeof(header), dimensions, sizeof(dimensions));
+        memcpy(data + sizeof(header) + sizeof(dimensions), image->data, pixels_len);
+        if (!rg_storage_write_file(cache_path, data, data_len, 0))
+            RG_LOGW("Failed to save '%s'", cache_path);
+        free(data);
+    }
+
+    return image;
+}
+
+// Returns false if the job was cancelled before we could reach a conclusion
+static bool load_preview(const preview_request_t *req, uint32_t generation, rg_image_t **image, uint16_t *missing)
+{
+    retro_app_t *app = req->app;
+    uint32_t order = req->mode < PREVIEW_MODE_COUNT ? preview_orders[req->mode] : 0;
+
+    while (order && !*image)
+    {
+        char path[RG_PATH_MAX + 1];
+        size_t path_len = 0;
+        int type = order & 0xF;
+
+        // The cursor moved, our result would likely be evicted before it's needed
+        if (job.generation != generation)
+            return false;
+
+        order >>= 4;
+
+        if (*missing & (1 << type))
+            continue;
+
+        // CRC-named covers will be looked up once the item is selected and its checksum is known
+        if ((type == 0x1 || type == 0x2) && app->use_crc_covers && !req->checksum)
+            continue;
+
+        if (type == 0x1 && app->use_crc_covers) // Game cover (old format)
+            path_len = snprintf(path, RG_PATH_MAX, "%s/%X/%08X.art", app->paths.covers, (int)(req->checksum >> 28), (int)req->checksum);
+        else if (type == 0x2 && app->use_crc_covers) // Game cover (png)
+            path_len = snprintf(path, RG_PATH_MAX, "%s/%X/%08X.png", app->paths.covers, (int)(req->checksum >> 28), (int)req->checksum);
+        else if (type == 0x3) // Game cover (based on filename)
+        {
+            const char *name = rg_basename(req->path);
+            path_len = snprintf(path, RG_PATH_MAX, "%s/%s", app->paths.covers, name);
+            if (path_len < RG_PATH_MAX - 3) // Don't bother if we already have an overflow
+                strcpy(path + path_len - strlen(rg_extension(name) ?: ""), "png");
+        }
+        else if (type == 0x4 && req->saves > 0) // Save state screenshot (png)
+        {
+            uint8_t last_used_slot = rg_emu_get_last_used_slot(req->path);
+            if (last_used_slot != 0xFF)
+            {
+                char *preview = rg_emu_get_path(RG_PATH_SCREENSHOT + last_used_slot, req->path);
+                path_len = snprintf(path, RG_PATH_MAX, "%s", preview);
+                free(preview);
+            }
+        }
+
+        if (path_len > 0 && path_len < RG_PATH_MAX)
+        {
+            RG_LOGD("Looking for %s", path);
+            *image = load_image(path);
+        }
+
+        *missing |= (*image ? 0 : 1) << type;
+    }
+
+    return true;
+}
+
+static void previews_task(void *arg)
+{
+    rg_task_msg_t msg;
+
+    while (rg_task_receive(&msg))
+    {
+        if (msg.type == RG_TASK_MSG_STOP)
+            break;
+
+        uint32_t generation = 0;
+        size_t index = 0;
+
+        while (true)
+        {
+            preview_request_t req;
+            bool done, cached = false;
+
+            rg_mutex_take(lock, -1);
+            if (generation != job.generation) // New job, start over from the selected item
+                generation = job.generation, index = 0;
+            if (!(done = index >= job.count))
+            {
+                req = job.requests[index++];
+                cached = cache_find(req.key, req.mode, req.checksum) != NULL;
+            }
+            rg_mutex_give(lock);
+
+            if (done)
+                break;
+            if (cached)
+                continue;
+
+            rg_image_t *image = NULL;
+            uint16_t missing = req.missing;
+
+            // If cancelled, the next iteration will pick up the new job
+            if (load_preview(&req, generation, &image, &missing))
+            {
+                rg_mutex_take(lock, -1);
+                cache_store(&req, missing, image);
+                rg_mutex_give(lock);
+            }
+        }
+    }
+}
+
+void previews_init(void)
+{
+    if (task || gui.low_memory_mode)
+        return;
+
+    rg_storage_mkdir(PREVIEWS_CACHE_PATH);
+    lock = rg_mutex_create();
+    task = rg_task_create("previews", &previews_task, NULL, 6 * 1024, RG_TASK_PRIORITY_1, -1);
+}
+
+bool previews_get(retro_file_t *file, int mode, rg_image_t **image)
+{
+    char path[RG_PATH_MAX + 1];
+    bool found = false;
+
+    *image = NULL;
+
+    if (!task || !file)
+        return false;
+
+    uint32_t key = get_file_key(file, path);
+
+    rg_mutex_take(lock, -1);
+    preview_entry_t *entry = cache_find(key, mode, file->checksum);
+    if (entry)
+    {
+        // The cache keeps its copy, the caller is free to do whatever it wants with its own
+        if (entry->image)
+            *image = rg_surface_convert(entry->image, 0, 0, RG_PIXEL_565_LE);
+        file->missing_cover |= entry->missing;
+        entry->last_used = ++cache_clock;
+        found = true;
+    }
+    rg_mutex_give(lock);
+
+    return found;
+}
+
+void previews_request(retro_file_t **files, size_t count, int mode)
+{
+    preview_request_t requests[PREVIEWS_MAX_REQUESTS];
+    bool changed = false;
+
+    if (!task)
+        return;
+
+    count = RG_MIN(count, PREVIEWS_MAX_REQUESTS);
+    memset(requests, 0, sizeof(requests));
+
+    for (size_t i = 0; i < count; i++)
+    {
+        requests[i].key = get_file_key(files[i], requests[i].path);
+        requests[i].checksum = files[i]->checksum;
+        requests[i].missing = files[i]->missing_cover;
+        requests[i].saves = files[i]->saves;
+        requests[i].mode = mode;
+        requests[i].app = files[i]->app;
+    }
+
+    rg_mutex_take(lock, -1);
+    // Resubmitting the same job would needlessly cancel the one in progress
+    if (count != job.count || memcmp(requests, job.requests, count * sizeof(preview_request_t)) != 0)
+    {
+        memcpy(job.requests, requests, count * sizeof(preview_request_t));
+        job.count = count;
+        job.generation++;
+        changed = true;
+    }
+    rg_mutex_give(lock);
+
+    // The task's queue holds a single message, if one is already pending the task will see our job anyway
+    if (changed && rg_task_messages_waiting(task) == 0)
+        rg_task_send(task, &(rg_task_msg_t){0});
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <rg_system.h>
+#include <stdbool.h>
+
+#include "applications.h"
+
+// How many items above and below the cursor are decoded ahead of time
+#define PREVIEWS_PREFETCH_RANGE 2
+
+void previews_init(void);
+bool previews_get(retro_file_t *file, int mode, rg_image_t **image);
+void previews_request(retro_file_t **files, size_t count, int mode);
@@ -41,6 +41,8 @@
 #include <midifile.h>
 #include <oplplayer.h>
 #include <rg_system.h>
+
+#include "sfx_mixer.h"
 #ifdef ESP_PLATFORM
 #include <esp_heap_caps.h>
 #endif
@@ -70,14 +72,19 @@ typedef struct {
 
 typedef struct {
     const doom_sfx_t *sfx;
-    size_t pos;
-    float factor;
+    sfx_voice_t voice;
     int starttic;
+    uint32_t generation; // Bumped every time I_StartSound (re)arms the channel
+    uint32_t finished;   // Set by the mixer to the generation that reached its end
 } channel_t;
 
+// Only the game thread arms and retires channels. The mixer owns the play position and only reports back
+// which generation it finished, so nothing it writes can ever land on a newer sound.
 static channel_t channels[NUM_MIX_CHANNELS];
+static struct {uint32_t generation, pos;} mixing[NUM_MIX_CHANNELS];
 static const doom_sfx_t *sfx[NUMSFX];
 static rg_audio_sample_t mixbuffer[AUDIO_BUFFER_LENGTH];
+static int32_t mixaccum[AUDIO_BUFFER_LENGTH * 2];
 static const music_player_t *music_player = &opl_synth_player;
 static bool musicPlaying = false;
 
@@ -139,8 +146,10 @@ void I_UpdateNoBlit(void)
 
 void I_FinishUpdate(void)
 {
-    rg_display_submit(update, 0);
-    rg_display_sync(true); // Wait for update->buffer to be released
+    // The display normally makes its own copy (see rg_display_set_queue) and we can start the next frame
+    // right away. If the queue couldn't be allocated we must wait for update->buffer to be released.
+    if (!rg_display_submit(update, 0))
+        rg_display_sync(true);
 }
 
 bool I_StartDisplay(void)
@@ -207,8 +216,17 @@ const char *I_DoomExeDir(void)
     return RG_BASE_PATH_ROMS "/doom";
 }
 
+static inline bool channel_playing(const channel_t *chan)
+{
+    return chan->sfx && __atomic_load_n(&chan->finished, __ATOMIC_ACQUIRE) != chan->generation;
+}
+
 void I_UpdateSoundParams(int handle, int volume, int seperation, int pitch)
 {
+    if (handle < 0 || handle >= NUM_MIX_CHANNELS)
+        return;
+    channels[handle].voice.left = SFX_GAIN_LEFT(volume, seperation);
+    channels[handle].voice.right = SFX_GAIN_RIGHT(volume, seperation);
 }
 
 int I_StartSound(int sfxid, int channel, int vol, int sep, int pitch, int priority)
@@ -234,7 +252,7 @@ int I_StartSound(int sfxid, int channel, int vol, int sep, int pitch, int priori
     // Find available channel or steal the oldest
     for (int i = 0; i < NUM_MIX_CHANNELS; i++)
     {
-        if (channels[i].sfx == NULL)
+        if (!channel_playing(&channels[i]))
         {
             slot = i;
             break;
@@ -246,10 +264,17 @@ int I_StartSound(int sfxid, int channel, int vol, int sep, int pitch, int priori
         }
     }
 
+    // The mixer skips the channel while sfx is NULL, so fill the voice in first
     channel_t *chan = &channels[slot];
+    chan->sfx = NULL;
+    chan->voice.data = sfx[sfxid]->samples;
+    chan->voice.length = sfx[sfxid]->length;
+    chan->voice.step = SFX_STEP(sfx[sfxid]->samplerate, snd_samplerate);
+    chan->voice.left = SFX_GAIN_LEFT(vol, sep);
+    chan->voice.right = SFX_GAIN_RIGHT(vol, sep);
+    chan->starttic = gametic;
+    __atomic_add_fetch(&chan->generation, 1, __ATOMIC_RELEASE);
     chan->sfx = sfx[sfxid];
-    chan->factor = (float)chan->sfx->samplerate / snd_samplerate;
-    chan->pos = 0;
 
     return slot;
 }
@@ -269,7 +294,7 @@ bool I_SoundIsPlaying(int handle)
 bool I_AnySoundStillPlaying(void)
 {
     for (int i = 0; i < NUM_MIX_CHANNELS; i++)
-        if (channels[i].sfx)
+        if (channel_playing(&channels[i]))
             return true;
     return false;
 }
@@ -281,6 +306,8 @@ static void soundTask(void *arg)
         bool haveMusic = snd_MusicVolume > 0 && musicPlaying;
         bool haveSFX = snd_SfxVolume > 0 && I_AnySoundStillPlaying();
 
+        RG_SPAN_BEGIN("soundTask_mix");
+
         if (haveMusic)
         {
             music_player->render(mixbuffer, AUDIO_BUFFER_LENGTH);
@@ -288,59 +315,40 @@ static void soundTask(void *arg)
 
         if (haveSFX)
         {
-            int16_t *audioBuffer = (int16_t *)mixbuffer;
-            int16_t *audioBufferEnd = audioBuffer + AUDIO_BUFFER_LENGTH * 2;
-            while (audioBuffer < audioBufferEnd)
+            // The volume (which already includes snd_SfxVolume) and separation are baked in each
+            // voice's gains, so all that's left to do per sample is a multiply-accumulate.
+            memset(mixaccum, 0, sizeof(mixaccum));
+            for (int i = 0; i < NUM_MIX_CHANNELS; i++)
             {
-                int totalSample = 0;
-                int totalSources = 0;
-                int sample;
-
-                for (int i = 0; i < NUM_MIX_CHANNELS; i++)
+                channel_t *chan = &channels[i];
+                if (!chan->sfx)
+                    continue;
+                // A copy torn by a concurrent I_StartSound is skipped, we'll get it right on the next block
+                uint32_t generation = __atomic_load_n(&chan->generation, __ATOMIC_ACQUIRE);
+                sfx_voice_t voice = chan->voice;
+                if (!chan->sfx || __atomic_load_n(&chan->generation, __ATOMIC_ACQUIRE) != generation)
+                    continue;
+                // A new generation (even of the same sfx) starts from the beginning
+                if (mixing[i].generation != generation)
                 {
-                    channel_t *chan = &channels[i];
-                    if (!chan->sfx)
-                        continue;
-
-                    size_t pos = (size_t)(chan->pos++ * chan->factor);
-
-                    if (pos >= chan->sfx->length)
-                    {
-                        chan->sfx = NULL;
-                    }
-                    else if ((sample = chan->sfx->samples[pos]))
-                    {
-                        totalSample += sample - 127;
-                        totalSources++;
-                    }
+                    mixing[i].generation = generation;
+                    mixing[i].pos = 0;
                 }
-
-                totalSample <<= 7;
-                totalSample /= (16 - snd_SfxVolume);
-
-                if (haveMusic)
-                {
-                    totalSample += *audioBuffer;
-                    totalSources += (totalSources == 0);
-                }
-
-                if (totalSources > 0)
-                    totalSample /= totalSources;
-
-                if (totalSample > 32767)
-                    totalSample = 32767;
-                else if (totalSample < -32768)
-                    totalSample = -32768;
-
-                *audioBuffer++ = totalSample;
-                *audioBuffer++ = totalSample;
+                else if (__atomic_load_n(&chan->finished, __ATOMIC_RELAXED) == generation)
+                    continue;
+                voice.pos = mixing[i].pos;
+                if (!sfx_mix_voice(mixaccum, AUDIO_BUFFER_LENGTH, &voice))
+                    __atomic_store_n(&chan->finished, generation, __ATOMIC_RELEASE);
+                mixing[i].pos = voice.pos;
             }
+            sfx_mix_output((int16_t *)mixbuffer, mixaccum, haveMusic ? (int16_t *)mixbuffer : NULL, AUDIO_BUFFER_LENGTH);
         }
 
         if (!haveMusic && !haveSFX)
         {
             memset(mixbuffer, 0, sizeof(mixbuffer));
         }
+        RG_SPAN_END();
 
         rg_audio_submit(mixbuffer, AUDIO_BUFFER_LENGTH);
     }
@@ -548,6 +556,7 @@ void app_main()
     SCREENHEIGHT = RG_MIN(rg_display_get_height(), MAX_SCREENHEIGHT);
 
     update = rg_surface_create(SCREENWIDTH, SCREENHEIGHT, RG_PIXEL_PAL565_BE, MEM_FAST);
+    rg_display_set_queue(2, RG_DISPLAY_QUEUE_DROP_OLDEST);
 
     const char *iwad = NULL;
     const char *pwad = NULL;
@@ -0,0 +1,79 @@
+#pragma once
+
+// Sound effects mixer used by soundTask. It's kept in its own header so that it can be benchmarked
+// on the host, see tools/bench_doom_sfx.c.
+//
+// Voices are mixed one at a time over the whole block into a stereo int32 accumulator, stepping
+// through the 8-bit unsigned samples in 16.16 fixed point. The accumulator is then added to the
+// music (if any) and saturated to int16 in a single pass.
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct
+{
+    const uint8_t *data;
+    uint32_t length;  // In samples
+    uint32_t pos;     // 16.16
+    uint32_t step;    // 16.16, source rate / output rate
+    int left, right;  // Gains, 256 is full scale
+} sfx_voice_t;
+
+// Doom volumes go from 0 to 127 (but the game never exceeds 15*8), separation from 0 (left) to 255 (right)
+#define SFX_GAIN_LEFT(vol, sep) (((vol) * (255 - (sep))) >> 7)
+#define SFX_GAIN_RIGHT(vol, sep) (((vol) * (sep)) >> 7)
+#define SFX_STEP(from, to) (((uint32_t)(from) << 16) / (to))
+
+// Adds up to `frames` frames of the voice to acc, returns false once the voice reached its end
+static inline int sfx_mix_voice(int32_t *acc, size_t frames, sfx_voice_t *voice)
+{
+    const uint8_t *data = voice->data;
+    uint32_t pos = voice->pos, step = voice->step;
+    uint32_t end = voice->length << 16;
+    int left = voice->left, right = voice->right;
+    int playing = 1;
+
+    // Find how many frames we have left so that the loop doesn't need to check
+    if (pos >= end)
+        return 0;
+    size_t remaining = (end - pos + step - 1) / step;
+    if (remaining <= frames)
+    {
+        frames = remaining;
+        playing = 0;
+    }
+
+    for (size_t i = 0; i < frames; ++i, pos += step)
+    {
+        int sample = (int)data[pos >> 16] - 128;
+        acc[i * 2 + 0] += sample * left;
+        acc[i * 2 + 1] += sample * right;
+    }
+
+    voice->pos = pos;
+    return playing;
+}
+
+// Min/max rather than branches, the compiler turns them into conditional moves (or Xtensa's MIN/MAX)
+#define SFX_CLAMP16(x) ((x) < -32768 ? -32768 : ((x) > 32767 ? 32767 : (x)))
+
+// Writes acc (plus the music, if not NULL) to out, saturated. Both music and out are stereo int16.
+static inline void sfx_mix_output(int16_t *out, const int32_t *acc, const int16_t *music, size_t frames)
+{
+    if (music)
+    {
+        for (size_t i = 0; i < frames * 2; ++i)
+        {
+            int sample = acc[i] + music[i];
+            out[i] = SFX_CLAMP16(sample);
+        }
+    }
+    else
+    {
+        for (size_t i = 0; i < frames * 2; ++i)
+        {
+            int sample = acc[i];
+            out[i] = SFX_CLAMP16(sample);
+        }
+    }
+}
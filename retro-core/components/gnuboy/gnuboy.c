@@ -12,6 +12,14 @@
 #define RTC_BASE 1893456000
 
 #define BANK_SIZE 0x4000
+#define BANK_READAHEAD 2
+
+static gb_bank_stats_t bankstats;
+static int readahead[BANK_READAHEAD];
+
+#define PAD_QUEUE_SIZE 16
+static struct {int line, pad;} padqueue[PAD_QUEUE_SIZE];
+static int padqueue_len, padqueue_pos;
 
 
 // Note: Eventually we'll just pass a gb_host_t to init...
@@ -46,9 +54,26 @@ void gnuboy_reset(bool hard)
 }
 
 
-void gnuboy_set_framebuffer(void *buffer)
+void gnuboy_set_framebuffer(void *buffer, uint32_t *dirty_rows)
 {
 	GB.video.buffer = buffer;
+	GB.video.dirty_rows = dirty_rows;
+}
+
+
+void gnuboy_set_render_pipeline(bool enable, gb_lines_cb_t *lines_callback)
+{
+	gb_lcd_sync();
+	GB.video.pipelined = enable;
+	GB.video.lines_callback = lines_callback;
+	// Trap (or stop trapping) VRAM writes, see gb_hw_updatemap
+	GB.wmap[0x8] = GB.wmap[0x9] = enable ? NULL : GB.rmap[0x8];
+}
+
+
+int gnuboy_render_lines(void)
+{
+	return gb_lcd_render_pending();
 }
 
 
@@ -59,6 +84,16 @@ void gnuboy_set_soundbuffer(void *buffer, size_t length)
 }
 
 
+// Applies the queued pad changes up to the given line
+static void apply_pad_queue(int line)
+{
+	while (padqueue_pos < padqueue_len && padqueue[padqueue_pos].line <= line)
+		gnuboy_set_pad(padqueue[padqueue_pos++].pad);
+	if (padqueue_pos == padqueue_len)
+		padqueue_pos = padqueue_len = 0;
+}
+
+
 /*
 	Time intervals throughout the code, unless otherwise noted, are
 	specified in double-speed machine cycles (2MHz), each unit
@@ -82,10 +117,15 @@ void gnuboy_run(bool draw)
 	GB.video.enabled = draw;
 	GB.audio.pos = 0;
 
+	// Rows that aren't drawn this frame (LCD turned off midway) stay dirty
+	if (draw && GB.video.dirty_rows)
+		memset(GB.video.dirty_rows, 0xFF, (GB_HEIGHT + 31) / 32 * 4);
+
 	int cycles = 0;
 
 	// LCD is powered down, it won't touch LY or do vblank
 	if (!(R_LCDC & 0x80)) {
+		apply_pad_queue(153);
 		cycles += 154 * 228;
 		cycles -= gb_cpu_emulate(cycles);
 		return;
@@ -93,23 +133,30 @@ void gnuboy_run(bool draw)
 
 	// We emulate until vblank (0..144)
 	while (R_LY <= 144) {
+		apply_pad_queue(R_LY);
 		cycles += 228;
 		cycles -= gb_cpu_emulate(cycles);
 	}
 
+	// Finish drawing whatever the host's render task hasn't yet
+	gb_lcd_sync();
+
 	/* When using GB_PIXEL_PALETTED, the host should draw the frame in this callback
 	   because the palette can be modified below before gnuboy_run returns. */
 	if (draw && GB.video.callback) {
 		(GB.video.callback)(GB.video.buffer);
+		GB.video.previous = GB.video.buffer;
 	}
 
 	gb_hw_vblank();
 
 	// Emulate vblank (145...0)
 	while (R_LY > 0) {
+		apply_pad_queue(R_LY);
 		cycles += 228;
 		cycles -= gb_cpu_emulate(cycles);
 	}
+	apply_pad_queue(153);
 
 	if (GB.audio.callback && GB.audio.pos > 0) {
 		(GB.audio.callback)(GB.audio.buffer, GB.audio.pos);
@@ -126,6 +173,17 @@ void gnuboy_set_pad(int pad)
 }
 
 
+void gnuboy_queue_pad(int line, int pad)
+{
+	// Out of room, the last change is replaced so that we still end the frame in the right state
+	if (padqueue_len == PAD_QUEUE_SIZE)
+		padqueue_len--;
+	padqueue[padqueue_len].line = line;
+	padqueue[padqueue_len].pad = pad;
+	padqueue_len++;
+}
+
+
 int gnuboy_load_bios(const byte *data, size_t size)
 {
 	if (size > 0x900)
@@ -174,37 +232,132 @@ int gnuboy_load_bios_file(const char *file)
 }
 
 
+static bool rom_is_streamed(void)
+{
+#ifdef RETRO_GO
+	if (cart.romZip)
+		return true;
+#endif
+	return cart.romFile != NULL;
+}
+
+
+static bool rom_read(size_t offset, void *buffer, size_t size)
+{
+#ifdef RETRO_GO
+	if (cart.romZip)
+		return rg_storage_zip_seek(cart.romZip, offset) && rg_storage_zip_read(cart.romZip, buffer, size) == size;
+#endif
+	return fseek(cart.romFile, offset, SEEK_SET) == 0 && fread(buffer, size, 1, cart.romFile) == 1;
+}
+
+
+// Evicts the least recently mapped bank, except bank 0 and the one currently in 0x4000-0x7FFF
+static byte *evict_bank(int keep)
+{
+	int current = cart.rombank & (cart.romsize - 1);
+	int victim = -1;
+
+	for (int i = 1; i < cart.romsize; i++)
+	{
+		if (!cart.rombanks[i] || i == keep || i == current)
+			continue;
+		if (victim < 0 || cart.bankstamps[i] < cart.bankstamps[victim])
+			victim = i;
+	}
+
+	if (victim < 0)
+		return NULL;
+
+	MESSAGE_INFO("reclaiming bank %d.\n", victim);
+	byte *buffer = cart.rombanks[victim];
+	cart.rombanks[victim] = NULL;
+	bankstats.evictions++;
+	bankstats.resident--;
+	return buffer;
+}
+
+
 void gnuboy_load_bank(int bank)
 {
 	const size_t OFFSET = bank * BANK_SIZE;
 
-	if (!cart.rombanks[bank])
-		cart.rombanks[bank] = malloc(BANK_SIZE);
+	if (!rom_is_streamed())
+	{
+		if (!cart.rombanks[bank])
+			cart.rombanks[bank] = malloc(BANK_SIZE);
+		return;
+	}
 
-	if (!cart.romFile)
+	if (cart.rombanks[bank])
 		return;
 
 	MESSAGE_INFO("loading bank %d.\n", bank);
-	while (!cart.rombanks[bank])
-	{
-		int i = rand() & 0xFF;
-		if (cart.rombanks[i])
-		{
-			MESSAGE_INFO("reclaiming bank %d.\n", i);
-			cart.rombanks[bank] = cart.rombanks[i];
-			cart.rombanks[i] = NULL;
-			break;
-		}
-	}
+	if (!(cart.rombanks[bank] = malloc(BANK_SIZE)) && !(cart.rombanks[bank] = evict_bank(bank)))
+		abort(); // We can't run without the bank, and there's nothing left to evict
+	bankstats.resident++;
+	bankstats.loads++;
 
 	// Load the 16K page
-	if (fseek(cart.romFile, OFFSET, SEEK_SET) != 0
-		|| !fread(cart.rombanks[bank], BANK_SIZE, 1, cart.romFile))
+	if (!rom_read(OFFSET, cart.rombanks[bank], BANK_SIZE))
 	{
 		MESSAGE_WARN("ROM bank loading failed\n");
-		if (!feof(cart.romFile))
+		if (cart.romFile && !feof(cart.romFile))
 			abort(); // This indicates an SD Card failure
 	}
+
+	// Games tend to walk through their banks in order, so queue the next ones for gnuboy_prefetch_bank
+	for (int i = 1; i <= BANK_READAHEAD; i++)
+	{
+		int next = bank + i;
+		if (next >= cart.romsize || cart.rombanks[next])
+			break;
+		if (bankstats.pending < BANK_READAHEAD)
+			readahead[bankstats.pending++] = next;
+	}
+}
+
+
+int gnuboy_prefetch_bank(void)
+{
+	while (bankstats.pending > 0)
+	{
+		int bank = readahead[0];
+		bankstats.pending--;
+		memmove(readahead, readahead + 1, bankstats.pending * sizeof(int));
+
+		if (!rom_is_streamed() || cart.rombanks[bank])
+			continue;
+
+		// Only read ahead into free memory. Evicting a bank the game may still use for one it may never use
+		// isn't a good trade, gnuboy_load_bank will evict when the game actually needs a bank.
+		byte *buffer = malloc(BANK_SIZE);
+		if (!buffer)
+		{
+			bankstats.pending = 0;
+			return -1;
+		}
+		cart.rombanks[bank] = buffer;
+		bankstats.resident++;
+		bankstats.loads++;
+		bankstats.prefetched++;
+
+		if (!rom_read(bank * BANK_SIZE, buffer, BANK_SIZE))
+			MESSAGE_WARN("ROM bank prefetching failed\n");
+
+		// Counts as used now, but older than whatever gets mapped next
+		cart.bankstamps[bank] = cart.bankclock;
+		return bank;
+	}
+	return -1;
+}
+
+
+void gnuboy_get_bank_stats(gb_bank_stats_t *out)
+{
+	*out = bankstats;
+	out->total = cart.romsize;
+	out->switches = cart.bankclock;
 }
 
 
@@ -411,18 +564,28 @@ int gnuboy_load_rom_file(const char *file)
 
 	byte header[0x200];
 
-	cart.romFile = fopen(file, "rb");
-	if (cart.romFile == NULL)
+#ifdef RETRO_GO
+	if (rg_extension_match(file, "zip"))
+	{
+		cart.romZip = rg_storage_zip_open(file, "gb gbc");
+		if (cart.romZip == NULL)
+		{
+			MESSAGE_ERROR("ROM unzip failed\n");
+			return -1;
+		}
+	}
+	else
+#endif
+	if ((cart.romFile = fopen(file, "rb")) == NULL)
 	{
 		MESSAGE_ERROR("ROM fopen failed\n");
 		return -1;
 	}
 
-	if (fread(&header, 0x200, 1, cart.romFile) != 1)
+	if (!rom_read(0, &header, 0x200))
 	{
 		MESSAGE_ERROR("ROM fread failed\n");
-		fclose(cart.romFile);
-		cart.romFile = NULL;
+		gnuboy_free_rom();
 		return -1;
 	}
 
@@ -444,20 +607,32 @@ int gnuboy_load_rom_file(const char *file)
 		preload = cart.romsize - 40;
 	}
 
+	cart.bankstamps = calloc(cart.romsize, sizeof(uint32_t));
+	cart.bankclock = 0;
+	if (!cart.bankstamps)
+	{
+		MESSAGE_ERROR("Memory allocation failed.");
+		gnuboy_free_rom();
+		return -3;
+	}
+
 	MESSAGE_INFO("Preloading the first %d banks\n", preload);
 	for (int i = 0; i < preload; i++)
 	{
 		gnuboy_load_bank(i);
 	}
 
+	// We only care about what happens during gameplay
+	bankstats = (gb_bank_stats_t){.resident = bankstats.resident};
+
 	return 0;
 }
 
 
 void gnuboy_free_rom(void)
 {
-	// If cart.romFile isn't NULL it indicates that we haven't allocated those buffers, don't free them.
-	if (cart.romFile && cart.rombanks)
+	// If the ROM is streamed the banks were allocated one by one, otherwise they point into the ROM data.
+	if (rom_is_streamed() && cart.rombanks)
 	{
 		for (int i = 0; i < cart.romsize; i++)
 			free(cart.rombanks[i]);
@@ -466,6 +641,10 @@ void gnuboy_free_rom(void)
 	free(cart.rombanks);
 	cart.rombanks = NULL;
 
+	free(cart.bankstamps);
+	cart.bankstamps = NULL;
+	bankstats = (gb_bank_stats_t){0};
+
 	free(cart.rambanks);
 	cart.rambanks = NULL;
 
@@ -475,6 +654,11 @@ void gnuboy_free_rom(void)
 		cart.romFile = NULL;
 	}
 
+#ifdef RETRO_GO
+	rg_storage_zip_close(cart.romZip);
+	cart.romZip = NULL;
+#endif
+
 	if (cart.sramFile)
 	{
 		fclose(cart.sramFile);
@@ -699,8 +883,31 @@ typedef struct
 	size_t len;
 } sblock_t;
 
+typedef struct
+{
+	FILE *fp;
+	byte *mem; // Used instead of fp when not NULL
+	size_t size;
+	size_t pos;
+} sstream_t;
+
+
+static bool sstream_io(sstream_t *s, void *ptr, size_t len, bool save)
+{
+	if (!s->mem)
+		return (save ? fwrite(ptr, len, 1, s->fp) : fread(ptr, len, 1, s->fp)) == 1;
+	if (s->pos + len > s->size)
+		return false;
+	if (save)
+		memcpy(s->mem + s->pos, ptr, len);
+	else
+		memcpy(ptr, s->mem + s->pos, len);
+	s->pos += len;
+	return true;
+}
+
 
-static int do_save_load(const char *file, bool save)
+static int do_save_load(sstream_t *s, bool save)
 {
 	uint32_t sav_ver = SAVE_VERSION;
 	const svar_t svars[] =
@@ -785,13 +992,19 @@ static int do_save_load(const char *file, bool save)
 		{NULL, 0},
 	};
 
-	FILE *fp = NULL;
+	size_t total = 0;
+	for (int i = 0; blocks[i].ptr != NULL; i++)
+		total += 4096 * blocks[i].len;
 
-	if (save)
+	// A memory stream without a buffer only wants to know the size
+	if (s->mem == NULL && s->fp == NULL)
 	{
-		if (!(fp = fopen(file, "wb")))
-			goto _error;
+		free(buf);
+		return total;
+	}
 
+	if (save)
+	{
 		for (int i = 0; svars[i].ptr; i++)
 		{
 			uint32_t d = 0;
@@ -820,7 +1033,7 @@ static int do_save_load(const char *file, bool save)
 
 		for (int i = 0; blocks[i].ptr != NULL; i++)
 		{
-			if (fwrite(blocks[i].ptr, 4096, blocks[i].len, fp) < 1)
+			if (!sstream_io(s, blocks[i].ptr, 4096 * blocks[i].len, true))
 			{
 				MESSAGE_ERROR("Write error in block %d\n", i);
 				goto _error;
@@ -829,12 +1042,9 @@ static int do_save_load(const char *file, bool save)
 	}
 	else
 	{
-		if (!(fp = fopen(file, "rb")))
-			goto _error;
-
 		for (int i = 0; blocks[i].ptr != NULL; i++)
 		{
-			if (fread(blocks[i].ptr, 4096, blocks[i].len, fp) < 1)
+			if (!sstream_io(s, blocks[i].ptr, 4096 * blocks[i].len, false))
 			{
 				MESSAGE_ERROR("Read error in block %d\n", i);
 				goto _error;
@@ -887,14 +1097,12 @@ static int do_save_load(const char *file, bool save)
 		gb_hw_updatemap();
 	}
 
-	fclose(fp);
 	free(buf);
 
-	return 0;
+	return total;
 
 _error:
-	if (fp) fclose(fp);
-	if (buf) free(buf);
+	free(buf);
 
 	return -1;
 }
@@ -902,11 +1110,36 @@ _error:
 
 int gnuboy_save_state(const char *file)
 {
-	return do_save_load(file, true);
+	sstream_t s = {fopen(file, "wb")};
+	if (!s.fp)
+		return -1;
+	int ret = do_save_load(&s, true);
+	if (fclose(s.fp) != 0)
+		ret = -1;
+	return ret < 0 ? ret : 0;
 }
 
 
 int gnuboy_load_state(const char *file)
 {
-	return do_save_load(file, false);
+	sstream_t s = {fopen(file, "rb")};
+	if (!s.fp)
+		return -1;
+	int ret = do_save_load(&s, false);
+	fclose(s.fp);
+	return ret < 0 ? ret : 0;
+}
+
+
+int gnuboy_save_state_mem(void *buffer, size_t size)
+{
+	sstream_t s = {NULL, buffer, size, 0};
+	return do_save_load(&s, true);
+}
+
+
+int gnuboy_load_state_mem(const void *buffer, size_t size)
+{
+	sstream_t s = {NULL, (byte *)buffer, size, 0};
+	return do_save_load(&s, false);
 }
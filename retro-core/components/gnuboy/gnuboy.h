@@ -97,8 +97,20 @@ typedef enum
 	GB_AUDIO_MONO_S16,
 } gb_audio_fmt_t;
 
+typedef struct
+{
+	int total;          // Banks in the ROM
+	int resident;       // Banks currently in memory
+	int pending;        // Banks queued for read-ahead
+	unsigned switches;  // Number of times a bank was mapped
+	unsigned loads;     // Banks read from storage (misses + prefetched)
+	unsigned prefetched;
+	unsigned evictions;
+} gb_bank_stats_t;
+
 typedef void (gb_video_cb_t)(void *buffer);
 typedef void (gb_audio_cb_t)(void *buffer, size_t length);
+typedef void (gb_lines_cb_t)(void);
 
 int  gnuboy_init(int samplerate, gb_audio_fmt_t audio_fmt, gb_video_fmt_t video_fmt, gb_video_cb_t *video_callback, gb_audio_cb_t *audio_callback);
 int  gnuboy_load_bios(const byte *data, size_t size);
@@ -111,9 +123,21 @@ void gnuboy_reset(bool hard);
 void gnuboy_run(bool draw);
 bool gnuboy_sram_dirty(void);
 void gnuboy_load_bank(int);
+int  gnuboy_prefetch_bank(void);
+void gnuboy_get_bank_stats(gb_bank_stats_t *out);
 void gnuboy_set_pad(int);
+// Queues a pad change for the next gnuboy_run, applied when it reaches the given line (0-153). Changes must be
+// queued in order. This lets the host apply input at the point of the frame where it actually happened.
+void gnuboy_queue_pad(int line, int pad);
 
-void gnuboy_set_framebuffer(void *buffer);
+// When dirty_rows is set (one bit per row), gnuboy_run(true) leaves set only the bits of the rows that
+// differ from the frame it last passed to the video callback (all of them if it's the same buffer).
+void gnuboy_set_framebuffer(void *buffer, uint32_t *dirty_rows);
+// When pipelined, gnuboy_run only records the scanlines and gnuboy_render_lines draws the ones recorded so far.
+// The host can call it from another core while gnuboy_run runs, lines left over are drawn before the video callback.
+// The lines callback is called by gnuboy_run every few recorded lines, so that the host can wake its renderer.
+void gnuboy_set_render_pipeline(bool enable, gb_lines_cb_t *lines_callback);
+int  gnuboy_render_lines(void);
 void gnuboy_set_soundbuffer(void *buffer, size_t length);
 
 void gnuboy_get_time(int *day, int *hour, int *minute, int *second);
@@ -127,3 +151,7 @@ int gnuboy_load_sram(const char *file);
 int gnuboy_save_sram(const char *file, bool quick_save);
 int gnuboy_load_state(const char *file);
 int gnuboy_save_state(const char *file);
+// Same as above but in memory (for rewind etc). Returns the state size, or a negative value on error.
+// A NULL buffer only returns the size needed.
+int gnuboy_load_state_mem(const void *buffer, size_t size);
+int gnuboy_save_state_mem(void *buffer, size_t size);
@@ -293,6 +293,11 @@ void gb_hw_updatemap(void)
 		gnuboy_load_bank(rombank);
 	}
 
+	if (cart.bankstamps)
+	{
+		cart.bankstamps[rombank] = ++cart.bankclock;
+	}
+
 	// ROM
 	hw.rmap[0x0] = cart.rombanks[0];
 	hw.rmap[0x1] = cart.rombanks[0];
@@ -311,9 +316,9 @@ void gb_hw_updatemap(void)
 	hw.rmap[0x6] = hw.rmap[0x4];
 	hw.rmap[0x7] = hw.rmap[0x4];
 
-	// Video RAM
-	hw.rmap[0x8] = hw.wmap[0x8] = hw.vbanks[R_VBK & 1] - 0x8000;
-	hw.rmap[0x9] = hw.wmap[0x9] = hw.vbanks[R_VBK & 1] - 0x8000;
+	// Video RAM (writes must wait for the renderer when it's pipelined)
+	hw.rmap[0x8] = hw.rmap[0x9] = hw.vbanks[R_VBK & 1] - 0x8000;
+	hw.wmap[0x8] = hw.wmap[0x9] = hw.video.pipelined ? NULL : hw.rmap[0x8];
 
 	// Cartridge RAM
 	hw.rmap[0xA] = hw.wmap[0xA] = NULL;
@@ -477,7 +482,11 @@ void gb_hw_write(unsigned a, byte b)
 		break;
 
 	case 0x8000: // Video RAM
-		hw.vbanks[R_VBK&1][a & 0x1FFF] = b;
+		if (hw.vbanks[R_VBK&1][a & 0x1FFF] != b)
+		{
+			gb_lcd_sync();
+			hw.vbanks[R_VBK&1][a & 0x1FFF] = b;
+		}
 		break;
 
 	case 0xA000: // Save RAM or RTC
@@ -182,6 +182,8 @@ typedef struct
 
 	// Memory
 	byte **rombanks; // [512];
+	uint32_t *bankstamps; // Value of bankclock when each bank was last mapped, only used when streaming
+	uint32_t bankclock;
 	byte (*rambanks)[8192];
 	unsigned sram_dirty;
 	unsigned sram_saved;
@@ -203,6 +205,9 @@ typedef struct
 	// File descriptors that we keep open
 	FILE *romFile;
 	FILE *sramFile;
+#ifdef RETRO_GO
+	rg_zip_t *romZip; // Zipped ROMs that don't fit in memory are inflated one bank at a time, like romFile
+#endif
 } gb_cart_t;
 
 typedef struct
@@ -233,14 +238,18 @@ typedef struct
 
 	struct {
 		bool enabled;
+		bool pipelined;	// Lines are drawn by gnuboy_render_lines
 		gb_video_fmt_t format;
 		gb_palette_t colorize;
 		gb_video_cb_t *callback;
+		gb_lines_cb_t *lines_callback;
 		union {
 			uint16_t *buffer16;
 			uint8_t *buffer8;
 			void *buffer;
 		};
+		void *previous;			// Buffer of the last frame passed to the callback
+		uint32_t *dirty_rows;	// Rows of buffer that differ from previous
 		uint16_t palette[64];
 	} video;
 
@@ -13,6 +13,17 @@ typedef struct
 	short v, x, pat, pal, pri;
 } gb_vs_t;
 
+// State of a scanline at the time it was reached, everything draw_line needs apart from VRAM
+typedef struct
+{
+	void *buffer;
+	const void *previous;
+	uint32_t *dirty_rows;
+	short SL, SCX, SCY, WX, WY;
+	byte LCDC, NS;
+	gb_vs_t VS[10];
+} gb_line_t;
+
 #define priused(attr) ({uint32_t *a = (uint32_t *)(attr); (int)((a[0]|a[1]|a[2]|a[3]|a[4]|a[5]|a[6]|a[7])&0x80808080);})
 
 #define blendcpy(dest, src, b, cnt) {					\
@@ -25,8 +36,23 @@ typedef struct
 
 static byte BUF[0x100];
 static int WX, WY;
+static byte LCDC;
 static bool pal_dirty;
 
+/*
+ * When rendering is pipelined, lcd_renderline only records lines and whoever calls
+ * gb_lcd_render_pending (the host's render task, or us when we need to catch up)
+ * draws them. Lines only depend on their gb_line_t and on VRAM, which the emulation
+ * leaves alone until the renderer has caught up (see gb_lcd_sync).
+ */
+static struct
+{
+	gb_line_t lines[GB_HEIGHT];
+	int recorded; // Only written by the emulation
+	int drawn;    // Only written by the renderer holding busy
+	bool busy;
+} pipeline;
+
 
 /**
  * Drawing routines
@@ -71,7 +97,7 @@ static inline void tilebuf(int S, int T, int WT, int *WND, int *BG)
 	};
 	const int8_t *wrap = wraptable + S;
 
-	base = ((R_LCDC&0x08)?0x1C00:0x1800) + (T<<5) + S;
+	base = ((LCDC&0x08)?0x1C00:0x1800) + (T<<5) + S;
 	tilemap = VBANKS[0] + base;
 	attrmap = VBANKS[1] + base;
 	tilebuf = BG;
@@ -79,7 +105,7 @@ static inline void tilebuf(int S, int T, int WT, int *WND, int *BG)
 
 	if (IS_CGB)
 	{
-		if (R_LCDC & 0x10)
+		if (LCDC & 0x10)
 			for (int i = cnt; i > 0; i--)
 			{
 				*(tilebuf++) = *tilemap
@@ -102,7 +128,7 @@ static inline void tilebuf(int S, int T, int WT, int *WND, int *BG)
 	}
 	else
 	{
-		if (R_LCDC & 0x10)
+		if (LCDC & 0x10)
 			for (int i = cnt; i > 0; i--)
 			{
 				*(tilebuf++) = *(tilemap++);
@@ -120,7 +146,7 @@ static inline void tilebuf(int S, int T, int WT, int *WND, int *BG)
 
 	/* Window tiles */
 
-	base = ((R_LCDC&0x40)?0x1C00:0x1800) + (WT<<5);
+	base = ((LCDC&0x40)?0x1C00:0x1800) + (WT<<5);
 	tilemap = VBANKS[0] + base;
 	attrmap = VBANKS[1] + base;
 	tilebuf = WND;
@@ -128,7 +154,7 @@ static inline void tilebuf(int S, int T, int WT, int *WND, int *BG)
 
 	if (IS_CGB)
 	{
-		if (R_LCDC & 0x10)
+		if (LCDC & 0x10)
 			for (int i = cnt; i > 0; i--)
 			{
 				*(tilebuf++) = *(tilemap++)
@@ -147,7 +173,7 @@ static inline void tilebuf(int S, int T, int WT, int *WND, int *BG)
 	}
 	else
 	{
-		if (R_LCDC & 0x10)
+		if (LCDC & 0x10)
 			for (int i = cnt; i > 0; i--)
 				*(tilebuf++) = *(tilemap++);
 		else
@@ -211,7 +237,7 @@ static inline void bg_scan_pri(int S, int T, int U, byte *PRI)
 	i = S;
 	cnt = WX;
 	dest = PRI;
-	src = VBANKS[1] + ((R_LCDC&0x08)?0x1C00:0x1800) + (T<<5);
+	src = VBANKS[1] + ((LCDC&0x08)?0x1C00:0x1800) + (T<<5);
 
 	if (!priused(src))
 	{
@@ -244,7 +270,7 @@ static inline void wnd_scan_pri(int WT, byte *PRI)
 	i = 0;
 	cnt = 160 - WX;
 	dest = PRI + WX;
-	src = VBANKS[1] + ((R_LCDC&0x40)?0x1C00:0x1800) + (WT<<5);
+	src = VBANKS[1] + ((LCDC&0x40)?0x1C00:0x1800) + (WT<<5);
 
 	if (!priused(src))
 	{
@@ -388,7 +414,7 @@ static inline int spr_enum(gb_vs_t *VS)
 	return NS;
 }
 
-static inline void spr_scan(gb_vs_t *VS, int ns, byte *PRI)
+static inline void spr_scan(const gb_vs_t *VS, int ns, byte *PRI)
 {
 	byte *src, *dest, *bg, *pri;
 	int i, b, x, pal;
@@ -396,7 +422,7 @@ static inline void spr_scan(gb_vs_t *VS, int ns, byte *PRI)
 
 	memcpy(bgdup, BUF, 256);
 
-	gb_vs_t *vs = &VS[ns-1];
+	const gb_vs_t *vs = &VS[ns-1];
 
 	for (; ns; ns--, vs--)
 	{
@@ -463,6 +489,8 @@ void gb_lcd_pal_dirty(void)
 
 void gb_lcd_reset(bool hard)
 {
+	gb_lcd_sync();
+
 	if (hard)
 	{
 		memset(VBANKS, 0, 2 * 8192);
@@ -630,38 +658,36 @@ static inline void sync_palette(void)
 	sprites on the line and probably other factors. States 1, 2 and 3
 	do not require precise sub-line CPU-LCDC sync, but state 0 might do.
 */
-static inline void lcd_renderline()
+static void draw_line(const gb_line_t *line)
 {
-	if (!host.video.enabled || !host.video.buffer)
-		return;
-
 	byte PRI[0x100];
 	int WND[64];
 	int BG[64];
-	gb_vs_t VS[10];
 
-	int SL = R_LY;
-	int SX = R_SCX;
-	int SY = (R_SCY + SL) & 0xff;
+	int SL = line->SL;
+	int SX = line->SCX;
+	int SY = (line->SCY + SL) & 0xff;
 	int S = SX >> 3;
 	int T = SY >> 3;
 	int U = SX & 7;
 	int V = SY & 7;
+	int NS = line->NS;
+	int WY = line->WY;
 
-	WX = R_WX - 7;
-	if (WY>SL || WY<0 || WY>143 || WX<-7 || WX>160 || !(R_LCDC&0x20))
+	LCDC = line->LCDC;
+	WX = line->WX - 7;
+	if (WY>SL || WY<0 || WY>143 || WX<-7 || WX>160 || !(LCDC&0x20))
 		WX = 160;
 	int WV = (SL - WY) & 7;
 	int WT = (SL - WY) >> 3;
 
 	// Fix for Fushigi no Dungeon - Fuurai no Shiren GB2 and Donkey Kong
 	// This is a hack, the real problem is elsewhere
-	if (GB.compat.window_offset && (R_LCDC & 0x20))
+	if (GB.compat.window_offset && (LCDC & 0x20))
 	{
 		WT %= GB.compat.window_offset;
 	}
 
-	int NS = spr_enum(VS);
 	tilebuf(S, T, WT, WND, BG);
 
 	if (IS_CGB)
@@ -681,27 +707,104 @@ static inline void lcd_renderline()
 		blendcpy(BUF+WX, BUF+WX, 0x04, 160-WX);
 	}
 
-	spr_scan(VS, NS, PRI);
+	spr_scan(line->VS, NS, PRI);
 
-	// Real hardware allows palette change to occur between each scanline but very few games take
-	// advantage of this. So we can switch to once per frame if performance becomes a problem...
-	if (pal_dirty) // && SL == 0)
-	{
-		sync_palette();
-	}
+	size_t length = 160;
 
 	if (host.video.format == GB_PIXEL_PALETTED)
 	{
-		memcpy(host.video.buffer8 + SL * 160 , BUF, 160);
+		memcpy((uint8_t *)line->buffer + SL * 160, BUF, 160);
 	}
 	else
 	{
-		uint16_t *dst = host.video.buffer16 + SL * 160;
+		uint16_t *dst = (uint16_t *)line->buffer + SL * 160;
 		uint16_t *pal = host.video.palette;
 
 		for (int i = 0; i < 160; ++i)
 			dst[i] = pal[BUF[i]];
+		length *= 2;
+	}
+
+	// Flag the row if it differs from the last frame we handed out (a row can be drawn twice if LCDC toggles)
+	if (line->dirty_rows && line->previous && line->previous != line->buffer)
+	{
+		uint32_t bit = 1u << (SL & 31);
+		if (memcmp(line->buffer + SL * length, line->previous + SL * length, length))
+			line->dirty_rows[SL >> 5] |= bit;
+		else
+			line->dirty_rows[SL >> 5] &= ~bit;
+	}
+}
+
+int gb_lcd_render_pending(void)
+{
+	int count = 0;
+
+	if (__atomic_load_n(&pipeline.recorded, __ATOMIC_ACQUIRE) == __atomic_load_n(&pipeline.drawn, __ATOMIC_ACQUIRE))
+		return 0;
+
+	if (__atomic_exchange_n(&pipeline.busy, true, __ATOMIC_ACQUIRE))
+		return 0;
+
+	int recorded = __atomic_load_n(&pipeline.recorded, __ATOMIC_ACQUIRE);
+	while (pipeline.drawn != recorded)
+	{
+		draw_line(&pipeline.lines[pipeline.drawn % GB_HEIGHT]);
+		__atomic_store_n(&pipeline.drawn, pipeline.drawn + 1, __ATOMIC_RELEASE);
+		count++;
 	}
+
+	__atomic_store_n(&pipeline.busy, false, __ATOMIC_RELEASE);
+	return count;
+}
+
+/*
+ * Waits for (or helps with) the drawing of all recorded lines. Must be called before
+ * anything the renderer reads is modified: VRAM, the palette, the frame buffer...
+ */
+void gb_lcd_sync(void)
+{
+	while (__atomic_load_n(&pipeline.drawn, __ATOMIC_ACQUIRE) != pipeline.recorded)
+		gb_lcd_render_pending();
+}
+
+static inline void lcd_renderline()
+{
+	if (!host.video.enabled || !host.video.buffer)
+		return;
+
+	if (pipeline.recorded - __atomic_load_n(&pipeline.drawn, __ATOMIC_ACQUIRE) >= GB_HEIGHT)
+		gb_lcd_sync();
+
+	gb_line_t *line = &pipeline.lines[pipeline.recorded % GB_HEIGHT];
+	line->buffer = host.video.buffer;
+	line->previous = host.video.previous;
+	line->dirty_rows = host.video.dirty_rows;
+	line->SL = R_LY;
+	line->SCX = R_SCX;
+	line->SCY = R_SCY;
+	line->WX = R_WX;
+	line->WY = WY;
+	line->LCDC = R_LCDC;
+	line->NS = spr_enum(line->VS);
+
+	// Real hardware allows palette change to occur between each scanline but very few games take
+	// advantage of this. So we can switch to once per frame if performance becomes a problem...
+	if (pal_dirty) // && SL == 0)
+	{
+		gb_lcd_sync();
+		sync_palette();
+	}
+
+	if (host.video.pipelined)
+	{
+		__atomic_store_n(&pipeline.recorded, pipeline.recorded + 1, __ATOMIC_RELEASE);
+		// Waking the renderer for every line would cost about as much as drawing it
+		if (host.video.lines_callback && (pipeline.recorded % 8) == 0)
+			(host.video.lines_callback)();
+	}
+	else
+		draw_line(line);
 }
 
 void gb_lcd_emulate(int cycles)
@@ -35,6 +35,12 @@ void nes_emulate(bool draw)
 {
     draw = draw && nes.vidbuf != NULL;
 
+    /* Rows start dirty, the PPU clears those that end up identical to prevbuf's */
+    if (draw && nes.dirty_rows)
+        memset(nes.dirty_rows, 0xFF, (NES_SCREEN_HEIGHT + 31) / 32 * 4);
+    nes.ppu->prevbuf = nes.prevbuf;
+    nes.ppu->dirty_rows = (draw && nes.prevbuf && nes.prevbuf != nes.vidbuf) ? nes.dirty_rows : NULL;
+
     while (nes.scanline < nes.scanlines_per_frame)
     {
         // Running a little bit ahead seems to fix both Battletoads games...
@@ -72,16 +78,23 @@ void nes_emulate(bool draw)
 
     nes.scanline = 0;
 
+    /* Finish drawing whatever the host's renderer hasn't yet */
+    ppu_sync();
+
     if (draw && nes.blit_func)
+    {
         nes.blit_func(nes.vidbuf);
+        nes.prevbuf = nes.vidbuf;
+    }
 
     apu_emulate();
 }
 
-uint8 *nes_setvidbuf(uint8 *vidbuf)
+uint8 *nes_setvidbuf(uint8 *vidbuf, uint32 *dirty_rows)
 {
     uint8 *prevbuf = nes.vidbuf;
     nes.vidbuf = vidbuf;
+    nes.dirty_rows = dirty_rows;
     return prevbuf;
 }
 
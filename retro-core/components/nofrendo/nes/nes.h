@@ -88,6 +88,8 @@ typedef struct nes_s
 
     /* Video buffer */
     uint8 *vidbuf; // [NES_SCREEN_PITCH * NES_SCREEN_HEIGHT]
+    uint8 *prevbuf; // Last buffer passed to blit_func
+    uint32 *dirty_rows; // One bit per row, rows of vidbuf that differ from prevbuf
 
     /* Misc */
     nes_type_t system;
@@ -114,7 +116,7 @@ typedef struct nes_s
 
 nes_t *nes_getptr(void);
 nes_t *nes_init(nes_type_t system, int sample_rate, bool stereo, const char *fds_bios);
-uint8 *nes_setvidbuf(uint8 *vidbuf);
+uint8 *nes_setvidbuf(uint8 *vidbuf, uint32 *dirty_rows);
 void nes_shutdown(void);
 int nes_insertcart(rom_t *cart);
 int nes_loadfile(const char *filename);
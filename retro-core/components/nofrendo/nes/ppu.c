@@ -53,6 +53,36 @@ static const uint8 mirroring_maps[][4] = {
 /* the NES PPU */
 static ppu_t ppu;
 
+/* State of a visible scanline at the time it was reached, everything the renderer
+** needs apart from VRAM, OAM and the palette */
+typedef struct
+{
+   uint8 *bmp;
+   const uint8 *prevbuf;
+   uint32 *dirty_rows;
+   int scanline, vaddr, tile_xofs;
+   int obj_height, obj_base, bg_base;
+   bool bg_on, obj_on, left_bg_on, left_obj_on;
+   bool draw_bg, draw_obj;
+} ppu_line_t;
+
+/*
+** When rendering is pipelined, ppu_renderline only records visible lines (and does what
+** drawing them would do to the emulation, see ppu_evaloam) and whoever calls
+** ppu_renderpending (the host's render task, or us when we need to catch up) draws them.
+** VRAM, OAM and the palette are left alone until the renderer has caught up, see ppu_sync.
+** Mappers that hook into the PPU's fetches (MMC2, MMC4, MMC5) are always drawn directly.
+*/
+static struct
+{
+   ppu_line_t lines[NES_SCREEN_HEIGHT];
+   ppu_linesfunc_t linesfunc;
+   bool enabled;
+   int recorded; /* Only written by the emulation */
+   int drawn;    /* Only written by the renderer holding busy */
+   bool busy;
+} pipeline;
+
 
 #ifndef PPU_MEM_READ
 INLINE uint8 PPU_MEM_READ(uint32 x)
@@ -81,6 +111,8 @@ void ppu_setpage(uint32 page, uint8 *location)
       MESSAGE_ERROR("Invalid PPU page #%d!\n", (int)page);
       return;
    }
+   if (ppu.page[page] != location - (page << PPU_PAGESHIFT))
+      ppu_sync();
    ppu.page[page] = location - (page << PPU_PAGESHIFT);
 
    /* Setup mirror if required (8-11 <=> 12-15) */
@@ -126,6 +158,8 @@ INLINE void ppu_oamdma(uint8 value)
 {
    uint32 cpu_address = (uint32) (value << 8);
 
+   ppu_sync();
+
    for (size_t i = 0; i < 256; ++i)
       ppu.oam[ppu.oam_addr++] = mem_getbyte(cpu_address++);
 
@@ -247,6 +281,8 @@ void ppu_write(uint32 address, uint8 value)
       break;
 
    case PPU_OAMDATA:
+      if (ppu.oam[ppu.oam_addr] != value)
+         ppu_sync();
       ppu.oam[ppu.oam_addr++] = value;
       break;
 
@@ -288,6 +324,7 @@ void ppu_write(uint32 address, uint8 value)
       break;
 
    case PPU_VDATA:
+      ppu_sync();
       if (ppu.vaddr < 0x3F00)
       {
          /* VRAM only accessible during scanlines 241-260 */
@@ -331,6 +368,8 @@ void ppu_write(uint32 address, uint8 value)
 
 void ppu_setopt(ppu_option_t n, int val)
 {
+   ppu_sync();
+
    // Some options need special care
    switch (n)
    {
@@ -348,11 +387,13 @@ int ppu_getopt(ppu_option_t n)
 
 void ppu_setlatchfunc(ppu_latchfunc_t func)
 {
+   ppu_sync();
    ppu.latchfunc = func;
 }
 
 void ppu_setvreadfunc(ppu_vreadfunc_t func)
 {
+   ppu_sync();
    ppu.vreadfunc = func;
 }
 
@@ -469,23 +510,23 @@ INLINE void draw_oamtile(uint8 *surface, uint8 attrib, uint32 pattern, const uin
    }
 }
 
-INLINE void ppu_renderbg(uint8 *vidbuf)
+INLINE void ppu_renderbg(uint8 *vidbuf, const ppu_line_t *line)
 {
    /* draw a line of transparent background color if bg is disabled */
-   if (!ppu.bg_on)
+   if (!line->bg_on)
    {
       memset(vidbuf, FULLBG, NES_SCREEN_WIDTH);
       return;
    }
 
-   uint8 *bmp_ptr = vidbuf - ppu.tile_xofs; /* scroll x */
-   uint32 x_tile = ppu.vaddr & 0x1F;
-   uint32 refresh_vaddr = 0x2000 + (ppu.vaddr & 0x0FE0); /* mask out x tile */
-   uint32 bg_offset = ((ppu.vaddr >> 12) & 7) + ppu.bg_base; /* offset in y tile */
-   uint32 attrib_base = (refresh_vaddr & 0x2C00) + 0x3C0 + (((ppu.vaddr >> 5) & 0x1C) << 1);
+   uint8 *bmp_ptr = vidbuf - line->tile_xofs; /* scroll x */
+   uint32 x_tile = line->vaddr & 0x1F;
+   uint32 refresh_vaddr = 0x2000 + (line->vaddr & 0x0FE0); /* mask out x tile */
+   uint32 bg_offset = ((line->vaddr >> 12) & 7) + line->bg_base; /* offset in y tile */
+   uint32 attrib_base = (refresh_vaddr & 0x2C00) + 0x3C0 + (((line->vaddr >> 5) & 0x1C) << 1);
    uint32 attrib_addr = attrib_base + (x_tile >> 2);
    uint32 attrib = PPU_MEM_READ(attrib_addr); attrib_addr++;
-   uint32 attrib_shift = (x_tile & 2) + (((ppu.vaddr >> 5) & 2) << 1);
+   uint32 attrib_shift = (x_tile & 2) + (((line->vaddr >> 5) & 2) << 1);
    uint32 col_high = ((attrib >> attrib_shift) & 3) << 2;
 
    /* ppu fetches 33 tiles */
@@ -496,7 +537,7 @@ INLINE void ppu_renderbg(uint8 *vidbuf)
 
       /* Handle $FD/$FE magic tile CHR-ROM switching (MMC2/MMC4) */
       if (ppu.latchfunc && (tile_index == 0xFD || tile_index == 0xFE))
-         ppu.latchfunc(ppu.bg_base, tile_index);
+         ppu.latchfunc(line->bg_base, tile_index);
 
       /* Fetch tile and draw it */
       draw_bgtile(bmp_ptr, get_patpix(bg_offset + (tile_index << 4)), ppu.palette + col_high);
@@ -526,73 +567,79 @@ INLINE void ppu_renderbg(uint8 *vidbuf)
    }
 
    /* Blank left hand column if need be */
-   if (!ppu.left_bg_on)
-   {
+   if (!line->left_bg_on)
       memset(vidbuf, FULLBG, 8);
-      ppu.left_bg_counter++;
+}
+
+/* Pattern address of the sprite's row on this line, -1 if the sprite isn't on it */
+INLINE int ppu_spriteaddr(const ppu_obj_t *sprite, const ppu_line_t *line)
+{
+   int sprite_height = line->obj_height;
+   int sprite_y = sprite->y_loc + 1;
+   int tile_index = sprite->tile;
+   int tile_addr, y_offset;
+
+   /* Check to see if sprite is out of range */
+   if ((sprite_y > line->scanline) || (sprite_y <= (line->scanline - sprite_height))
+       || (0 == sprite_y) || (sprite_y >= 240))
+      return -1;
+
+   /* 8x16 even sprites use $0000, odd use $1000 */
+   if (16 == sprite_height)
+      tile_addr = ((tile_index & 1) << 12) | ((tile_index & 0xFE) << 4);
+   else
+      tile_addr = line->obj_base + (tile_index << 4);
+
+   /* Calculate offset (line within the sprite) */
+   y_offset = line->scanline - sprite_y;
+   if (y_offset > 7)
+      y_offset += 8;
+
+   /* Account for vertical flippage */
+   if (sprite->attr & OAMF_VFLIP)
+   {
+      if (16 == sprite_height)
+         y_offset -= 23;
+      else
+         y_offset -= 7;
+
+      tile_addr -= y_offset;
+   }
+   else
+   {
+      tile_addr += y_offset;
    }
+
+   return tile_addr;
 }
 
 /* TODO: fetch valid OAM a scanline before, like the Real Thing */
-INLINE void ppu_renderoam(uint8 *vidbuf, int scanline, bool draw)
+/* emulate: apply the sprite 0 strike and the sprite overflow to the PPU (the renderer doesn't) */
+INLINE void ppu_renderoam(uint8 *vidbuf, const ppu_line_t *line, bool draw, bool emulate)
 {
-   if (!ppu.obj_on)
+   if (!line->obj_on)
       return;
 
-   int sprite_height = ppu.obj_height;
-   int sprite_offset = ppu.obj_base;
    uint8 savecol[8];
 
    /* Left column masking enabled, save first 8 pixels to reapply at the end */
-   if (draw && !ppu.left_obj_on)
+   if (draw && !line->left_obj_on)
       memcpy(&savecol, vidbuf, 8);
 
    for (int sprite_num = 0, count = 0; sprite_num < 64; sprite_num++)
    {
       ppu_obj_t *sprite = (ppu_obj_t *)ppu.oam + sprite_num;
+      int tile_addr = ppu_spriteaddr(sprite, line);
 
-      int sprite_y = sprite->y_loc + 1;
-      int tile_index = sprite->tile;
-
-      /* Check to see if sprite is out of range */
-      if ((sprite_y > scanline) || (sprite_y <= (scanline - sprite_height))
-          || (0 == sprite_y) || (sprite_y >= 240))
+      if (tile_addr < 0)
          continue;
 
       /* Handle $FD/$FE magic tile CHR-ROM switching (MMC2/MMC4) */
-      if (ppu.latchfunc && (tile_index == 0xFD || tile_index == 0xFE))
-         ppu.latchfunc(sprite_offset, tile_index);
-
-      int tile_addr, y_offset;
-
-      /* 8x16 even sprites use $0000, odd use $1000 */
-      if (16 == sprite_height)
-         tile_addr = ((tile_index & 1) << 12) | ((tile_index & 0xFE) << 4);
-      else
-         tile_addr = sprite_offset + (tile_index << 4);
-
-      /* Calculate offset (line within the sprite) */
-      y_offset = scanline - sprite_y;
-      if (y_offset > 7)
-         y_offset += 8;
-
-      /* Account for vertical flippage */
-      if (sprite->attr & OAMF_VFLIP)
-      {
-         if (16 == sprite_height)
-            y_offset -= 23;
-         else
-            y_offset -= 7;
-
-         tile_addr -= y_offset;
-      }
-      else
-      {
-         tile_addr += y_offset;
-      }
+      if (ppu.latchfunc && (sprite->tile == 0xFD || sprite->tile == 0xFE))
+         ppu.latchfunc(line->obj_base, sprite->tile);
 
       /* Check for a strike on sprite 0 if strike flag isn't set */
-      if (sprite_num == 0 && !ppu.strikeflag)
+      if (emulate && sprite_num == 0 && !ppu.strikeflag)
       {
          check_strike(draw ? vidbuf + sprite->x_loc : NULL, sprite->attr, get_patpix(tile_addr));
       }
@@ -611,16 +658,113 @@ INLINE void ppu_renderoam(uint8 *vidbuf, int scanline, bool draw)
       /* maximum of 8 sprites per scanline */
       if (OPT(PPU_LIMIT_SPRITES) && ++count == PPU_MAXSPRITE)
       {
-         ppu.stat |= PPU_STATF_MAXSPRITE;
+         if (emulate)
+            ppu.stat |= PPU_STATF_MAXSPRITE;
          break;
       }
    }
 
    /* Mask left columns if necessary */
-   if (draw && !ppu.left_obj_on)
+   if (draw && !line->left_obj_on)
       memcpy(vidbuf, &savecol, 8);
 }
 
+/* What drawing the line's sprites would do to the emulation, for a line that the renderer draws later */
+INLINE void ppu_evaloam(const ppu_line_t *line)
+{
+   if (!line->obj_on)
+      return;
+
+   if (!line->draw_obj)
+   {
+      ppu_renderoam(NULL, line, false, true);
+      return;
+   }
+
+   for (int sprite_num = 0, count = 0; sprite_num < 64; sprite_num++)
+   {
+      ppu_obj_t *sprite = (ppu_obj_t *)ppu.oam + sprite_num;
+      int tile_addr = ppu_spriteaddr(sprite, line);
+
+      if (tile_addr < 0)
+         continue;
+
+      /* The strike depends on the background under sprite 0, so we draw it here too. It's
+      ** only for the few lines between the top of sprite 0 and the strike. */
+      if (sprite_num == 0 && !ppu.strikeflag)
+      {
+         uint8 bgbuf[NES_SCREEN_PITCH];
+         ppu_renderbg(bgbuf + NES_SCREEN_OVERDRAW, line);
+         check_strike(bgbuf + NES_SCREEN_OVERDRAW + sprite->x_loc, sprite->attr, get_patpix(tile_addr));
+      }
+
+      if (OPT(PPU_LIMIT_SPRITES) && ++count == PPU_MAXSPRITE)
+      {
+         ppu.stat |= PPU_STATF_MAXSPRITE;
+         break;
+      }
+   }
+}
+
+/* Flag the line's row if it differs from the last frame the host got */
+INLINE void ppu_checkrow(const uint8 *vidbuf, const ppu_line_t *line)
+{
+   int row = line->scanline;
+
+   if (line->dirty_rows && !memcmp(vidbuf, NES_SCREEN_GETPTR(line->prevbuf, 0, row), NES_SCREEN_WIDTH))
+      line->dirty_rows[row >> 5] &= ~(1u << (row & 31));
+}
+
+static void ppu_drawline(const ppu_line_t *line)
+{
+   uint8 *vidbuf = NES_SCREEN_GETPTR(line->bmp, 0, line->scanline);
+
+   if (line->draw_bg)
+      ppu_renderbg(vidbuf, line);
+
+   if (line->draw_obj)
+      ppu_renderoam(vidbuf, line, true, false);
+
+   ppu_checkrow(vidbuf, line);
+}
+
+int ppu_renderpending(void)
+{
+   int count = 0;
+
+   if (__atomic_load_n(&pipeline.recorded, __ATOMIC_ACQUIRE) == __atomic_load_n(&pipeline.drawn, __ATOMIC_ACQUIRE))
+      return 0;
+
+   if (__atomic_exchange_n(&pipeline.busy, true, __ATOMIC_ACQUIRE))
+      return 0;
+
+   int recorded = __atomic_load_n(&pipeline.recorded, __ATOMIC_ACQUIRE);
+   while (pipeline.drawn != recorded)
+   {
+      ppu_drawline(&pipeline.lines[pipeline.drawn % NES_SCREEN_HEIGHT]);
+      __atomic_store_n(&pipeline.drawn, pipeline.drawn + 1, __ATOMIC_RELEASE);
+      count++;
+   }
+
+   __atomic_store_n(&pipeline.busy, false, __ATOMIC_RELEASE);
+   return count;
+}
+
+/* Waits for (or helps with) the drawing of all recorded lines. Must be called before
+** anything the renderer reads is modified: VRAM, paging, OAM, the palette... */
+void ppu_sync(void)
+{
+   while (__atomic_load_n(&pipeline.drawn, __ATOMIC_ACQUIRE) != pipeline.recorded)
+      ppu_renderpending();
+}
+
+void ppu_setpipeline(bool enable, ppu_linesfunc_t func)
+{
+   ppu_sync();
+   pipeline.enabled = enable;
+   pipeline.linesfunc = func;
+}
+
 bool ppu_enabled(void)
 {
    return (ppu.bg_on || ppu.obj_on);
@@ -674,13 +818,54 @@ void ppu_renderline(uint8 *bmp, int scanline, bool draw_flag)
             ppu.vaddr = (ppu.vaddr & ~0x041F) | (ppu.vaddr_latch & 0x041F);
       }
 
-      uint8 *vidbuf = NES_SCREEN_GETPTR(bmp, 0, scanline);
+      bool pipelined = draw_flag && pipeline.enabled && !ppu.latchfunc && !ppu.vreadfunc;
+      ppu_line_t *line, direct;
+
+      /* A line can't be overwritten before it's drawn */
+      if (pipelined && pipeline.recorded - __atomic_load_n(&pipeline.drawn, __ATOMIC_ACQUIRE) >= NES_SCREEN_HEIGHT)
+         ppu_sync();
+
+      line = pipelined ? &pipeline.lines[pipeline.recorded % NES_SCREEN_HEIGHT] : &direct;
+      line->bmp = bmp;
+      line->prevbuf = ppu.prevbuf;
+      line->dirty_rows = ppu.dirty_rows;
+      line->scanline = scanline;
+      line->vaddr = ppu.vaddr;
+      line->tile_xofs = ppu.tile_xofs;
+      line->obj_height = ppu.obj_height;
+      line->obj_base = ppu.obj_base;
+      line->bg_base = ppu.bg_base;
+      line->bg_on = ppu.bg_on;
+      line->obj_on = ppu.obj_on;
+      line->left_bg_on = ppu.left_bg_on;
+      line->left_obj_on = ppu.left_obj_on;
+      line->draw_bg = draw_flag && OPT(PPU_DRAW_BACKGROUND);
+      line->draw_obj = draw_flag && OPT(PPU_DRAW_SPRITES);
+
+      if (line->draw_bg && line->bg_on && !line->left_bg_on)
+         ppu.left_bg_counter++;
+
+      if (pipelined)
+      {
+         ppu_evaloam(line);
+         __atomic_store_n(&pipeline.recorded, pipeline.recorded + 1, __ATOMIC_RELEASE);
+         /* Waking the renderer for every line would cost about as much as drawing it */
+         if (pipeline.linesfunc && (pipeline.recorded % 8) == 0)
+            pipeline.linesfunc();
+      }
+      else
+      {
+         uint8 *vidbuf = NES_SCREEN_GETPTR(bmp, 0, scanline);
+
+         if (line->draw_bg)
+            ppu_renderbg(vidbuf, line);
 
-      if (draw_flag && OPT(PPU_DRAW_BACKGROUND))
-         ppu_renderbg(vidbuf);
+         /* TODO: fetch obj data 1 scanline before */
+         ppu_renderoam(vidbuf, line, line->draw_obj, true);
 
-      /* TODO: fetch obj data 1 scanline before */
-      ppu_renderoam(vidbuf, scanline, draw_flag && OPT(PPU_DRAW_SPRITES));
+         if (draw_flag)
+            ppu_checkrow(vidbuf, line);
+      }
    }
    // Vertical Blank
    else if (scanline == 241)
@@ -701,6 +886,7 @@ void ppu_renderline(uint8 *bmp, int scanline, bool draw_flag)
 
 void ppu_reset(void)
 {
+   ppu_sync();
    memset(ppu.nametab, 0, 0x400 * 4);
    memset(ppu.oam, 0, 0x100);
 
@@ -73,6 +73,9 @@
 typedef void (*ppu_latchfunc_t)(uint32 address, uint8 value);
 typedef uint8 (*ppu_vreadfunc_t)(uint32 address, uint8 value);
 
+/* Called every few lines recorded by a pipelined PPU, see ppu_setpipeline */
+typedef void (*ppu_linesfunc_t)(void);
+
 enum
 {
    // Start at 192 because it's unlikely that a pixel will have both BG_TRANS|SP_PIXEL
@@ -148,6 +151,10 @@ typedef struct
    ppu_latchfunc_t latchfunc; // For MMC2 and MMC4
    ppu_vreadfunc_t vreadfunc; // For MMC5
 
+   /* Rows of the frame being drawn that are identical in prevbuf are cleared in dirty_rows */
+   const uint8 *prevbuf;
+   uint32 *dirty_rows;
+
    bool vram_accessible;
    bool vram_present;
 
@@ -184,6 +191,13 @@ void ppu_write(uint32 address, uint8 value);
 void ppu_renderline(uint8 *bmp, int scanline, bool draw_flag);
 void ppu_endline(void);
 
+/* When pipelined, ppu_renderline only records the visible lines and ppu_renderpending draws the
+** ones recorded so far. The host can call it from another core while nes_emulate runs, lines left
+** over are drawn before the frame is blitted. func is called every few lines to wake the host's renderer. */
+void ppu_setpipeline(bool enable, ppu_linesfunc_t func);
+int ppu_renderpending(void);
+void ppu_sync(void);
+
 /* Debugging */
 void ppu_dumppattern(uint8 *bmp, int table_num, int x_loc, int y_loc, int col);
 void ppu_dumpoam(uint8 *bmp, int x_loc, int y_loc);
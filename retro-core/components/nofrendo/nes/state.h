@@ -23,5 +23,9 @@
 
 #pragma once
 
+#include <stdio.h>
+
 int state_load(const char *fn);
 int state_save(const char *fn);
+int state_load_fp(FILE *file);
+int state_save_fp(FILE *file);
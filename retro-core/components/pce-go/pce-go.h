@@ -72,6 +72,8 @@
 
 int LoadState(const char *name);
 int SaveState(const char *name);
+int LoadStateFile(FILE *fp);
+int SaveStateFile(FILE *fp);
 void ResetPCE(bool);
 void RunPCE(void);
 void ShutdownPCE();
@@ -25,13 +25,49 @@
 #include "shared.h"
 #include "hvc.h"
 
-struct
+typedef struct
 {
-  uint16 yrange;
-  uint16 xpos;
-  uint16 attr;
-  uint16 _pad0;
-} object_info[64];
+  uint8 yrange;
+  uint8 xpos;
+  uint8 attr;
+  uint8 _pad0;
+} object_info_t;
+
+/* State of a Mode 4 line at the time it was reached, everything it takes to draw it apart from VRAM */
+typedef struct
+{
+  uint8 *dest;              /* Row in bitmap.data */
+  const uint8 *prev;        /* Same row in the previous frame, NULL if unknown */
+  uint32_t *dirty_rows;
+  int16 line, vline;
+  uint8 reg[11];
+  uint8 vscroll;
+  uint8 extended;
+  uint8 object_count;
+  uint16 ntab;
+  object_info_t objects[64];
+} sms_line_t;
+
+static object_info_t object_info[64];
+
+/*
+ * When rendering is pipelined, render_line only records the active Mode 4 lines and whoever calls
+ * render_pending (the host's render task, or us when we need to catch up) draws them. The sprite
+ * flags are still evaluated as the lines are reached. VRAM is left alone until the renderer has
+ * caught up (see render_sync), other modes and the borders are always drawn directly.
+ */
+#define PIPELINE_DEPTH 64
+
+static struct
+{
+  sms_line_t lines[PIPELINE_DEPTH];
+  uint8 buffer[0x200];
+  void (*linesfunc)(void);
+  bool enabled;
+  int recorded; /* Only written by the emulation */
+  int drawn;    /* Only written by the renderer holding busy */
+  bool busy;
+} pipeline;
 
 /* Background drawing function */
 void (*render_bg)(int line) = NULL;
@@ -141,6 +177,8 @@ static const uint8 *lut; // )[0x10000];
 static const uint32 *bp_lut; // 0x10000
 
 static inline void parse_satb(int line);
+static void draw_bg_sms(const sms_line_t *l, uint8 *buf);
+static void draw_obj_sms(const sms_line_t *l, uint8 *buf, bool emulate);
 
 
 
@@ -319,6 +357,8 @@ void render_reset(void)
 {
   int i;
 
+  render_sync();
+
   /* Clear display bitmap */
   memset(bitmap.data, 0, bitmap.pitch * bitmap.height);
 
@@ -370,6 +410,46 @@ void render_mode(int skip)
     skip_render = skip;
 }
 
+/* Copy a finished line to its row, flagging the row if it differs from the last frame */
+static void output_line(uint8 *dest, const uint8 *prev, uint32_t *dirty_rows, int vline, const uint8 *src, int length)
+{
+  if (dirty_rows && prev)
+  {
+    uint32_t bit = 1u << (vline & 31);
+    if (memcmp(prev, src, length))
+      dirty_rows[vline >> 5] |= bit;
+    else
+      dirty_rows[vline >> 5] &= ~bit;
+  }
+
+  memcpy(dest, src, length);
+}
+
+/* Take a copy of the VDP state that drawing a Mode 4 line depends on */
+static void record_line(sms_line_t *l, int line)
+{
+  l->line = line;
+  memcpy(l->reg, vdp.reg, sizeof(l->reg));
+  l->vscroll = vdp.vscroll;
+  l->extended = vdp.extended;
+  l->ntab = vdp.ntab;
+  l->object_count = object_index_count;
+  memcpy(l->objects, object_info, object_index_count * sizeof(object_info_t));
+}
+
+/* What drawing the line's sprites would do to the emulation, for a line that the renderer draws later */
+static void eval_obj_sms(const sms_line_t *l)
+{
+  /* The collision flag takes two sprites and stays set until the status is read */
+  if (l->object_count > 1 && !(vdp.status & 0x20))
+  {
+    /* Sprites mark the pixels they draw, the background never does */
+    uint8 buf[0x200];
+    memset(buf, 0, 0x110);
+    draw_obj_sms(l, buf, true);
+  }
+}
+
 /* Draw a line of the display */
 void render_line(int line)
 {
@@ -414,6 +494,29 @@ void render_line(int line)
       view = 1;
     }
   }
+  /* Active display, drawn later by render_pending */
+  else if ((vdp.mode > 7) && (vdp.reg[1] & 0x40) && pipeline.enabled && !skip_render)
+  {
+    /* A line can't be overwritten before it's drawn */
+    if (pipeline.recorded - __atomic_load_n(&pipeline.drawn, __ATOMIC_ACQUIRE) >= PIPELINE_DEPTH)
+      render_sync();
+
+    sms_line_t *l = &pipeline.lines[pipeline.recorded % PIPELINE_DEPTH];
+    record_line(l, line);
+    l->vline = overscan ? vline : vline - top_border;
+    l->dest = bitmap.data + (l->vline * bitmap.pitch);
+    l->prev = (bitmap.prev_data && bitmap.prev_data != bitmap.data) ? bitmap.prev_data + (l->vline * bitmap.pitch) : NULL;
+    l->dirty_rows = bitmap.dirty_rows;
+    eval_obj_sms(l);
+
+    __atomic_store_n(&pipeline.recorded, pipeline.recorded + 1, __ATOMIC_RELEASE);
+    /* Waking the renderer for every line would cost about as much as drawing it */
+    if (pipeline.linesfunc && (pipeline.recorded % 8) == 0)
+      pipeline.linesfunc();
+
+    /* Nothing to copy */
+    view = 0;
+  }
   /* Active display */
   else
   {
@@ -483,18 +586,83 @@ void render_line(int line)
     if (!overscan)
       vline -= top_border;
 
-    memcpy(
+    output_line(
       bitmap.data + (vline * bitmap.pitch),
+      (bitmap.prev_data && bitmap.prev_data != bitmap.data) ? bitmap.prev_data + (vline * bitmap.pitch) : NULL,
+      bitmap.dirty_rows,
+      vline,
       internal_buffer,
       bitmap.viewport.w + 2*bitmap.viewport.x
     );
   }
 }
 
-static uint8 data[8];
+/* Draw a line recorded by render_line */
+static void draw_line_sms(const sms_line_t *l)
+{
+  uint8 backdrop = 0x10 | (l->reg[7] & 0x0F);
+  uint8 *buf = &pipeline.buffer[0];
+
+  /* adjust line horizontal offset */
+  if (option.overscan)
+    buf += 14;
+
+  draw_bg_sms(l, buf);
+  draw_obj_sms(l, buf, false);
+
+  /* Blank leftmost column of display */
+  if((l->reg[0] & 0x20) && IS_SMS)
+    memset(buf, backdrop, 8);
+
+  /* Horizontal borders */
+  if (option.overscan)
+  {
+    memset(buf - 14, backdrop, bitmap.viewport.x);
+    memset(buf - 14 + bitmap.viewport.w + bitmap.viewport.x, backdrop, bitmap.viewport.x);
+  }
+
+  output_line(l->dest, l->prev, l->dirty_rows, l->vline, pipeline.buffer, bitmap.viewport.w + 2*bitmap.viewport.x);
+}
+
+int render_pending(void)
+{
+  int count = 0;
+
+  if (__atomic_load_n(&pipeline.recorded, __ATOMIC_ACQUIRE) == __atomic_load_n(&pipeline.drawn, __ATOMIC_ACQUIRE))
+    return 0;
+
+  if (__atomic_exchange_n(&pipeline.busy, true, __ATOMIC_ACQUIRE))
+    return 0;
+
+  int recorded = __atomic_load_n(&pipeline.recorded, __ATOMIC_ACQUIRE);
+  while (pipeline.drawn != recorded)
+  {
+    draw_line_sms(&pipeline.lines[pipeline.drawn % PIPELINE_DEPTH]);
+    __atomic_store_n(&pipeline.drawn, pipeline.drawn + 1, __ATOMIC_RELEASE);
+    count++;
+  }
+
+  __atomic_store_n(&pipeline.busy, false, __ATOMIC_RELEASE);
+  return count;
+}
+
+/* Waits for (or helps with) the drawing of all recorded lines. Must be called before
+   VRAM is modified or the bitmap is handed over to the host. */
+void render_sync(void)
+{
+  while (__atomic_load_n(&pipeline.drawn, __ATOMIC_ACQUIRE) != pipeline.recorded)
+    render_pending();
+}
+
+void render_set_pipeline(bool enable, void (*func)(void))
+{
+  render_sync();
+  pipeline.enabled = enable;
+  pipeline.linesfunc = func;
+}
 
 __attribute__((optimize("unroll-loops")))
-static inline void* tile_get(int attr, int line)
+static inline void* tile_get(uint8 *data, int attr, int line)
 {
     // ---p cvhn nnnn nnnn
     const uint16 name = attr & 0x1ff;
@@ -509,22 +677,24 @@ static inline void* tile_get(int attr, int line)
 }
 
 /* Draw the Master System background */
-void render_bg_sms(int line)
+static void draw_bg_sms(const sms_line_t *l, uint8 *buf)
 {
+  int line = l->line;
   int locked = 0;
-  int yscroll_mask = (vdp.extended) ? 256 : 224;
-  int v_line = (line + vdp.vscroll) % yscroll_mask;
+  int yscroll_mask = (l->extended) ? 256 : 224;
+  int v_line = (line + l->vscroll) % yscroll_mask;
   int v_row  = (v_line & 7) << 3;
-  int hscroll = ((vdp.reg[0] & 0x40) && (line < 0x10) && (sms.console != CONSOLE_GG)) ? 0 : (0x100 - vdp.reg[8]);
+  int hscroll = ((l->reg[0] & 0x40) && (line < 0x10) && (sms.console != CONSOLE_GG)) ? 0 : (0x100 - l->reg[8]);
   int column = 0;
   uint16 attr;
-  uint16 nt_addr = (vdp.ntab + ((v_line >> 3) << 6)) & (((sms.console == CONSOLE_SMS) && !(vdp.reg[2] & 1)) ? ~0x400 :0xFFFF);
+  uint16 nt_addr = (l->ntab + ((v_line >> 3) << 6)) & (((sms.console == CONSOLE_SMS) && !(l->reg[2] & 1)) ? ~0x400 :0xFFFF);
   uint16 *nt = (uint16 *)&vdp.vram[nt_addr];
   int nt_scroll = (hscroll >> 3);
   int shift = (hscroll & 7);
   uint32 atex_mask;
   uint32 *cache_ptr;
-  uint32 *linebuf_ptr = (uint32 *)&linebuf[0 - shift];
+  uint32 data[2];
+  uint32 *linebuf_ptr = (uint32 *)&buf[0 - shift];
 
   /* Draw first column (clipped) */
   if(shift)
@@ -532,7 +702,7 @@ void render_bg_sms(int line)
     int x;
 
     for(x = shift; x < 8; x++)
-      linebuf[(0 - shift) + (x)] = 0;
+      buf[(0 - shift) + (x)] = 0;
 
     column++;
   }
@@ -541,7 +711,7 @@ void render_bg_sms(int line)
   for(; column < 32; column++)
   {
     /* Stop vertical scrolling for leftmost eight columns */
-    if((vdp.reg[0] & 0x80) && (!locked) && (column >= 24))
+    if((l->reg[0] & 0x80) && (!locked) && (column >= 24))
     {
       locked = 1;
       v_row = (line & 7) << 3;
@@ -558,7 +728,7 @@ void render_bg_sms(int line)
     /* Expand priority and palette bits */
     atex_mask = atex[(attr >> 11) & 3];
 
-    cache_ptr = tile_get(attr, v_row >> 3);
+    cache_ptr = tile_get((uint8 *)data, attr, v_row >> 3);
 
     /* Copy the left half, adding the attribute bits in */
     write_dword( &linebuf_ptr[(column << 1)] , read_dword( &cache_ptr[0] ) | (atex_mask));
@@ -572,7 +742,7 @@ void render_bg_sms(int line)
   {
     int x, c, a;
 
-    uint8 *p = &linebuf[(0 - shift)+(column << 3)];
+    uint8 *p = &buf[(0 - shift)+(column << 3)];
 
     attr = nt[(column + nt_scroll) & 0x1F];
 
@@ -582,7 +752,7 @@ void render_bg_sms(int line)
 
     a = (attr >> 7) & 0x30;
 
-    uint8* ptr = (uint8*)tile_get(attr, v_row >> 3);
+    uint8* ptr = (uint8*)tile_get((uint8 *)data, attr, v_row >> 3);
     for(x = 0; x < shift; x++)
     {
       c = *(ptr + x);
@@ -592,47 +762,49 @@ void render_bg_sms(int line)
 }
 
 
-/* Draw sprites */
-void render_obj_sms(int line)
+/* Draw sprites, only emulating their effect on the VDP's status if emulate is set */
+static void draw_obj_sms(const sms_line_t *l, uint8 *buf, bool emulate)
 {
+  int line = l->line;
   int i,x,start,end,xp,yp,n;
   uint8 sp,bg;
   uint8 *linebuf_ptr;
   uint8 *cache_ptr;
+  uint8 data[8];
 
   int width = 8;
 
   /* Adjust dimensions for double size sprites */
-  if(vdp.reg[1] & 0x01)
+  if(l->reg[1] & 0x01)
     width *= 2;
 
   /* Draw sprites in front-to-back order */
-  for(i = 0; i < object_index_count; i++)
+  for(i = 0; i < l->object_count; i++)
   {
     /* Width of sprite */
     start = 0;
     end = width;
 
     /* Sprite X position */
-    xp = object_info[i].xpos;
+    xp = l->objects[i].xpos;
 
     /* Sprite Y range */
-    yp = object_info[i].yrange;
+    yp = l->objects[i].yrange;
 
     /* Pattern name */
-    n = object_info[i].attr;
+    n = l->objects[i].attr;
 
     /* X position shift */
-    if(vdp.reg[0] & 0x08) xp -= 8;
+    if(l->reg[0] & 0x08) xp -= 8;
 
     /* Add MSB of pattern name */
-    if(vdp.reg[6] & 0x04) n |= 0x0100;
+    if(l->reg[6] & 0x04) n |= 0x0100;
 
     /* Mask LSB for 8x16 sprites */
-    if(vdp.reg[1] & 0x02) n &= 0x01FE;
+    if(l->reg[1] & 0x02) n &= 0x01FE;
 
     /* Point to offset in line buffer */
-    linebuf_ptr = (uint8 *)&linebuf[xp];
+    linebuf_ptr = (uint8 *)&buf[xp];
 
     /* Clip sprites on left edge */
     if(xp < 0)
@@ -643,9 +815,9 @@ void render_obj_sms(int line)
       end = (256 - xp);
 
     /* Draw double size sprite */
-    if(vdp.reg[1] & 0x01)
+    if(l->reg[1] & 0x01)
     {
-      cache_ptr = tile_get(n, yp >> 1);
+      cache_ptr = tile_get(data, n, yp >> 1);
 
       /* Draw sprite line (at 1/2 dot rate) */
       for(x = start; x < end; x+=2)
@@ -663,7 +835,7 @@ void render_obj_sms(int line)
           linebuf_ptr[x] = linebuf_ptr[x+1] = lut[(bg << 8) | (sp)];
 
           /* Check sprite collision */
-          if ((bg & 0x40) && !(vdp.status & 0x20))
+          if (emulate && (bg & 0x40) && !(vdp.status & 0x20))
           {
             /* pixel-accurate SPR_COL flag */
             vdp.status |= 0x20;
@@ -674,7 +846,7 @@ void render_obj_sms(int line)
     }
     else /* Regular size sprite (8x8 / 8x16) */
     {
-      cache_ptr = tile_get(n, yp);
+      cache_ptr = tile_get(data, n, yp);
 
       /* Draw sprite line */
       for(x = start; x < end; x++)
@@ -692,7 +864,7 @@ void render_obj_sms(int line)
           linebuf_ptr[x] = lut[(bg << 8) | (sp)];
 
           /* Check sprite collision */
-          if ((bg & 0x40) && !(vdp.status & 0x20))
+          if (emulate && (bg & 0x40) && !(vdp.status & 0x20))
           {
             /* pixel-accurate SPR_COL flag */
             vdp.status |= 0x20;
@@ -704,6 +876,20 @@ void render_obj_sms(int line)
   }
 }
 
+void render_bg_sms(int line)
+{
+  sms_line_t l;
+  record_line(&l, line);
+  draw_bg_sms(&l, linebuf);
+}
+
+void render_obj_sms(int line)
+{
+  sms_line_t l;
+  record_line(&l, line);
+  draw_obj_sms(&l, linebuf, true);
+}
+
 /* Update a palette entry */
 void palette_sync(int index)
 {
@@ -48,4 +48,11 @@ extern void render_obj_sms(int line);
 extern void palette_sync(int index);
 extern bool render_copy_palette(uint16* palette);
 
+/* When pipelined, render_line only records the active Mode 4 lines and render_pending draws the
+   ones recorded so far. The host can call it from another core while system_frame runs, lines left
+   over are drawn before it returns. func is called every few lines to wake the host's renderer. */
+extern void render_set_pipeline(bool enable, void (*func)(void));
+extern int render_pending(void);
+extern void render_sync(void);
+
 #endif /* _RENDER_H_ */
@@ -1,13 +1,15 @@
 #ifndef _SHARED_H_
 #define _SHARED_H_
 
+#include <stdint.h>
+
 typedef unsigned char uint8;
 typedef unsigned short int uint16;
-typedef unsigned long int uint32;
+typedef uint32_t uint32;
 
 typedef signed char int8;
 typedef signed short int int16;
-typedef signed long int int32;
+typedef int32_t int32;
 
 #include <assert.h>
 #include <stdio.h>
@@ -30,9 +30,14 @@ smsplus_t smsplus;
 void system_frame(int skip)
 {
   int iline, line_z80 = 0;
+  int draw = !skip;
 
   render_mode(skip);
 
+  /* Rows start dirty, render_line clears the ones identical to prev_data */
+  if (draw && bitmap.dirty_rows)
+    memset(bitmap.dirty_rows, 0xFF, (bitmap.height + 31) / 32 * 4);
+
   /* Debounce pause key */
   if(input.system & INPUT_PAUSE)
   {
@@ -118,6 +123,12 @@ void system_frame(int skip)
 
   /* Adjust Z80 cycle count for next frame */
   z80_cycle_count -= line_z80;
+
+  /* Finish drawing whatever the host's renderer hasn't yet */
+  render_sync();
+
+  if (draw)
+    bitmap.prev_data = bitmap.data;
 }
 
 void system_reset_config()
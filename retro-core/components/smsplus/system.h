@@ -78,6 +78,8 @@ typedef struct
 typedef struct
 {
   unsigned char *data;
+  unsigned char *prev_data; /* Last frame rendered, in another buffer if data was swapped since */
+  uint32_t *dirty_rows;     /* Optional, one bit per row of data that differs from prev_data */
   int width;
   int height;
   int pitch;
@@ -315,6 +315,7 @@ void vdp_write(int offset, uint8 data)
       case 0: /* VRAM write */
       case 1: /* VRAM write */
       case 2: /* VRAM write */
+        render_sync();
         vdp.vram[(vdp.addr & 0x3FFF)] = data;
         vdp.buffer = data;
         break;
@@ -426,6 +427,7 @@ void gg_vdp_write(int offset, uint8 data)
       case 0: /* VRAM write */
       case 1: /* VRAM write */
       case 2: /* VRAM write */
+        render_sync();
         vdp.vram[(vdp.addr & 0x3FFF)] = data;
         vdp.buffer = data;
         break;
@@ -489,6 +491,7 @@ void tms_write(int offset, int data)
       case 1: /* VRAM write */
       case 2: /* VRAM write */
       case 3: /* VRAM write */
+        render_sync();
         vdp.vram[(vdp.addr & 0x3FFF)] = data;
         break;
     }
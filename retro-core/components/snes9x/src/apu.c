@@ -10,9 +10,23 @@
 
 extern const int32_t NoiseFreq[32];
 
+/* When a hook is installed, DSP writes are queued by the frontend and applied (with S9xApplyAPUDSP) by
+ * whoever runs the sound emulation, possibly on another thread. The SPC700 then reads back its own writes
+ * from the shadow registers, and the voice status from a snapshot taken while the mixer was idle. */
+static void (*DSPWriteHook)(uint8_t reg, uint8_t byte);
+static uint8_t DSPShadow [0x80];
+
+/* The mixer reads BRR samples and the sample directory from APUSampleRAM. It normally is IAPU.RAM, but a
+ * frontend mixing on another thread can point it to a copy refreshed between frames (S9xSyncAPUSampleRAM),
+ * so that the SPC700 can keep writing the next frame's samples meanwhile. APURAMDirty tracks the pages
+ * written since the last refresh. */
+uint8_t* APUSampleRAM;
+uint8_t APURAMDirty [0x100];
+
 bool S9xInitAPU()
 {
    IAPU.RAM = (uint8_t*) malloc(0x10000);
+   APUSampleRAM = IAPU.RAM;
 
    if (!IAPU.RAM)
    {
@@ -30,6 +44,7 @@ void S9xDeinitAPU()
       free(IAPU.RAM);
       IAPU.RAM = NULL;
    }
+   APUSampleRAM = NULL;
 }
 
 void S9xResetAPU()
@@ -133,6 +148,85 @@ void S9xAPUWritePort(int32_t Address, uint8_t Byte)
 void S9xSetAPUDSP(uint8_t byte)
 {
    uint8_t reg = IAPU.RAM [0xf2];
+
+   if (!DSPWriteHook)
+   {
+      S9xApplyAPUDSP(reg, byte);
+      return;
+   }
+
+   DSPWriteHook(reg, byte);
+   S9xShadowAPUDSP(reg, byte);
+}
+
+/* Updates the shadow registers for a write that the sound emulation hasn't applied yet */
+void S9xShadowAPUDSP(uint8_t reg, uint8_t byte)
+{
+   if (reg == APU_FLG && (byte & APU_SOFT_RESET))
+      DSPShadow [APU_ENDX] = DSPShadow [APU_KOFF] = DSPShadow [APU_KON] = 0;
+
+   if (reg == APU_ENDX)
+      DSPShadow [reg] = 0;
+   else if (reg < 0x80 && reg != APU_KON)
+      DSPShadow [reg] = byte;
+}
+
+void S9xSetAPUDSPHook(void (*hook)(uint8_t reg, uint8_t byte))
+{
+   DSPWriteHook = hook;
+   S9xSyncAPUDSPShadow();
+}
+
+void S9xSetAPUSampleRAM(uint8_t* ram)
+{
+   APUSampleRAM = ram ? ram : IAPU.RAM;
+   S9xSyncAPUSampleRAM(true);
+}
+
+void S9xSyncAPUSampleRAM(bool full)
+{
+   int32_t page;
+
+   if (APUSampleRAM == IAPU.RAM)
+      return;
+
+   /* The direct pages and the IPL ROM page are also written without going through S9xAPUSetByte */
+   APURAMDirty [0x00] = APURAMDirty [0x01] = APURAMDirty [0xff] = 1;
+
+   for (page = 0; page < 0x100; page++)
+   {
+      if (full || APURAMDirty [page])
+      {
+         memcpy(APUSampleRAM + (page << 8), IAPU.RAM + (page << 8), 0x100);
+         APURAMDirty [page] = 0;
+      }
+   }
+}
+
+void S9xSyncAPUDSPShadow(void)
+{
+   int32_t reg;
+
+   for (reg = 0; reg < 0x80; reg++)
+      DSPShadow [reg] = APU.DSP [reg];
+
+   for (reg = APU_ENVX; reg < 0x80; reg += 0x10)
+   {
+      int32_t eVal = SoundData.channels [reg >> 4].envx;
+      DSPShadow [reg] = (eVal > 0x7F) ? 0x7F : (eVal < 0 ? 0 : eVal);
+   }
+
+   for (reg = APU_OUTX; reg < 0x80; reg += 0x10)
+   {
+      if (SoundData.channels [reg >> 4].state == SOUND_SILENT)
+         DSPShadow [reg] = 0;
+      else
+         DSPShadow [reg] = (SoundData.channels [reg >> 4].sample >> 8) | (SoundData.channels [reg >> 4].sample & 0xff);
+   }
+}
+
+void S9xApplyAPUDSP(uint8_t reg, uint8_t byte)
+{
    static uint8_t KeyOn;
    static uint8_t KeyOnPrev;
    int32_t i;
@@ -453,6 +547,9 @@ uint8_t S9xGetAPUDSP()
    uint8_t reg = IAPU.RAM [0xf2] & 0x7f;
    uint8_t byte = APU.DSP [reg];
 
+   if (DSPWriteHook)
+      return DSPShadow [reg];
+
    switch (reg)
    {
    case APU_OUTX + 0x00:
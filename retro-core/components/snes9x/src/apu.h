@@ -48,6 +48,8 @@ typedef struct
 
 extern SAPU APU;
 extern SIAPU IAPU;
+extern uint8_t* APUSampleRAM;
+extern uint8_t APURAMDirty [0x100];
 
 static INLINE void S9xAPUUnpackStatus(void)
 {
@@ -75,6 +77,12 @@ void S9xDeinitAPU(void);
 void S9xDecacheSamples(void);
 void S9xSetAPUControl(uint8_t byte);
 void S9xSetAPUDSP(uint8_t byte);
+void S9xApplyAPUDSP(uint8_t reg, uint8_t byte);
+void S9xSetAPUDSPHook(void (*hook)(uint8_t reg, uint8_t byte));
+void S9xSyncAPUDSPShadow(void);
+void S9xShadowAPUDSP(uint8_t reg, uint8_t byte);
+void S9xSetAPUSampleRAM(uint8_t* ram);
+void S9xSyncAPUSampleRAM(bool full);
 uint8_t S9xGetAPUDSP(void);
 uint8_t S9xAPUReadPort(int32_t Address);
 void S9xAPUWritePort(int32_t Address, uint8_t Byte);
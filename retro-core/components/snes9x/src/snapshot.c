@@ -13,13 +13,9 @@
 static const char header[16] = "SNES9X_000000002";
 
 
-bool S9xSaveState(const char *filename)
+bool S9xSaveStateFile(FILE *fp)
 {
    int chunks = 0;
-   FILE *fp = NULL;
-
-   if (!(fp = fopen(filename, "wb")))
-      return false;
 
    chunks += fwrite(&header, sizeof(header), 1, fp);
    chunks += fwrite(&CPU, sizeof(CPU), 1, fp);
@@ -35,26 +31,32 @@ bool S9xSaveState(const char *filename)
    chunks += fwrite(IAPU.RAM, 0x10000, 1, fp);
    chunks += fwrite(&SoundData, sizeof(SoundData), 1, fp);
 
-   printf("Saved chunks = %d\n", chunks);
-
-   fclose(fp);
-
    return chunks == 13;
 }
 
-bool S9xLoadState(const char *filename)
+bool S9xSaveState(const char *filename)
 {
-   uint8_t buffer[512];
-   int chunks = 0;
    FILE *fp = NULL;
 
-   if (!(fp = fopen(filename, "rb")))
+   if (!(fp = fopen(filename, "wb")))
       return false;
 
+   bool success = S9xSaveStateFile(fp);
+   success &= fclose(fp) == 0;
+   printf("Saved state: %s\n", success ? "ok" : "failed");
+
+   return success;
+}
+
+bool S9xLoadStateFile(FILE *fp)
+{
+   uint8_t buffer[512];
+   int chunks = 0;
+
    if (!fread(buffer, 16, 1, fp) || memcmp(header, buffer, sizeof(header)) != 0)
    {
       printf("Wrong header found\n");
-      goto fail;
+      return false;
    }
 
    // At this point we can't go back and a failure will corrupt the state anyway
@@ -75,8 +77,6 @@ bool S9xLoadState(const char *filename)
    chunks += fread(IAPU.RAM, 0x10000, 1, fp);
    chunks += fread(&SoundData, sizeof(SoundData), 1, fp);
 
-   printf("Loaded chunks = %d\n", chunks);
-
    // Fixing up registers and pointers:
 
    IAPU.PC = IAPU.PC - IAPU.RAM + IAPU_RAM;
@@ -99,10 +99,19 @@ bool S9xLoadState(const char *filename)
    S9xFixCycles();
    S9xReschedule();
 
-   fclose(fp);
-   return true;
+   return chunks == 12;
+}
 
-fail:
+bool S9xLoadState(const char *filename)
+{
+   FILE *fp = NULL;
+
+   if (!(fp = fopen(filename, "rb")))
+      return false;
+
+   bool success = S9xLoadStateFile(fp);
    fclose(fp);
-   return false;
+   printf("Loaded state: %s\n", success ? "ok" : "failed");
+
+   return success;
 }
@@ -113,6 +113,7 @@ static void S9xAPUSetByte(uint8_t byte, uint32_t Address)
    }
    else
    {
+      APURAMDirty [Address >> 8] = 1;
       if (Address < 0xffc0)
          IAPU.RAM [Address] = byte;
       else
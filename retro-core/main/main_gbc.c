@@ -3,7 +3,6 @@
 #include <sys/time.h>
 #include <gnuboy.h>
 
-static int skipFrames = 0;
 static bool slowFrame = false;
 
 static int video_time;
@@ -14,6 +13,10 @@ static int autoSaveSRAM = 0;
 static int autoSaveSRAM_Timer = 0;
 static bool useSystemTime = true;
 static bool loadBIOSFile = false;
+static bool renderThread = false;
+static bool hiddenFrame = false;
+
+static rg_task_t *renderTask;
 
 static rg_app_t *app;
 static rg_surface_t *updates[2];
@@ -23,6 +26,7 @@ static const char *SETTING_SAVESRAM = "SaveSRAM";
 static const char *SETTING_PALETTE  = "Palette";
 static const char *SETTING_SYSTIME = "SysTime";
 static const char *SETTING_LOADBIOS = "LoadBIOS";
+static const char *SETTING_RENDERTHREAD = "RenderThread";
 // --- MAIN
 
 
@@ -35,6 +39,43 @@ static void update_rtc_time(void)
     gnuboy_set_time(info->tm_yday, info->tm_hour, info->tm_min, info->tm_sec);
 }
 
+static int joystick_to_pad(uint32_t joystick)
+{
+    int pad = 0;
+    if (joystick & RG_KEY_UP) pad |= GB_PAD_UP;
+    if (joystick & RG_KEY_RIGHT) pad |= GB_PAD_RIGHT;
+    if (joystick & RG_KEY_DOWN) pad |= GB_PAD_DOWN;
+    if (joystick & RG_KEY_LEFT) pad |= GB_PAD_LEFT;
+    if (joystick & RG_KEY_SELECT) pad |= GB_PAD_SELECT;
+    if (joystick & RG_KEY_START) pad |= GB_PAD_START;
+    if (joystick & RG_KEY_A) pad |= GB_PAD_A;
+    if (joystick & RG_KEY_B) pad |= GB_PAD_B;
+    return pad;
+}
+
+static void render_task(void *arg)
+{
+    rg_task_msg_t msg;
+    // Sleep until gnuboy_run recorded a few lines, it draws whatever we didn't get to before vblank
+    while (rg_task_receive(&msg))
+        gnuboy_render_lines();
+}
+
+static void render_lines_callback(void)
+{
+    // We're the only sender so this can't block. If a message is still waiting, the task will see our lines.
+    if (rg_task_messages_waiting(renderTask) == 0)
+        rg_task_send(renderTask, &(rg_task_msg_t){0});
+}
+
+static void set_render_thread(bool enable)
+{
+    if (enable && !renderTask)
+        renderTask = rg_task_create("gb_render", &render_task, NULL, 3 * 1024, RG_TASK_PRIORITY_2, 1);
+    renderThread = enable && renderTask;
+    gnuboy_set_render_pipeline(renderThread, &render_lines_callback);
+}
+
 static void event_handler(int event, void *arg)
 {
     if (event == RG_EVENT_REDRAW)
@@ -53,6 +94,17 @@ static bool save_state_handler(const char *filename)
     return gnuboy_save_state(filename) == 0;
 }
 
+static size_t save_state_mem_handler(void *buffer, size_t size)
+{
+    int ret = gnuboy_save_state_mem(buffer, size);
+    return ret > 0 ? ret : 0;
+}
+
+static bool load_state_mem_handler(const void *buffer, size_t size)
+{
+    return gnuboy_load_state_mem(buffer, size) > 0;
+}
+
 static bool load_state_handler(const char *filename)
 {
     if (gnuboy_load_state(filename) != 0)
@@ -68,7 +120,6 @@ static bool load_state_handler(const char *filename)
 
     update_rtc_time();
 
-    skipFrames = 0;
     autoSaveSRAM_Timer = 0;
 
     // TO DO: Call rtc_sync() if a physical RTC is present
@@ -80,7 +131,6 @@ static bool reset_handler(bool hard)
     gnuboy_reset(hard);
     update_rtc_time();
 
-    skipFrames = 0;
     autoSaveSRAM_Timer = 0;
 
     return true;
@@ -156,6 +206,17 @@ static rg_gui_event_t enable_bios_cb(rg_gui_option_t *option, rg_gui_event_t eve
     return RG_DIALOG_VOID;
 }
 
+static rg_gui_event_t render_thread_cb(rg_gui_option_t *option, rg_gui_event_t event)
+{
+    if (event == RG_DIALOG_PREV || event == RG_DIALOG_NEXT)
+    {
+        set_render_thread(!renderThread);
+        rg_settings_set_number(NS_APP, SETTING_RENDERTHREAD, renderThread);
+    }
+    strcpy(option->value, renderThread ? _("On") : _("Off"));
+    return RG_DIALOG_VOID;
+}
+
 static rg_gui_event_t rtc_t_update_cb(rg_gui_option_t *option, rg_gui_event_t event)
 {
     int d, h, m, s;
@@ -227,6 +288,8 @@ static void video_callback(void *buffer)
 
 static void audio_callback(void *buffer, size_t length)
 {
+    if (hiddenFrame)
+        return;
     int64_t startTime = rg_system_timer();
     rg_audio_submit(buffer, length >> 1);
     audio_time += rg_system_timer() - startTime;
@@ -238,6 +301,21 @@ static void options_handler(rg_gui_option_t *dest)
     *dest++ = (rg_gui_option_t){0, _("RTC config"),    "-", RG_DIALOG_FLAG_NORMAL, &rtc_update_cb};
     *dest++ = (rg_gui_option_t){0, _("SRAM autosave"), "-", RG_DIALOG_FLAG_NORMAL, &sram_autosave_cb};
     *dest++ = (rg_gui_option_t){0, _("Enable BIOS"),   "-", RG_DIALOG_FLAG_NORMAL, &enable_bios_cb};
+    *dest++ = (rg_gui_option_t){0, _("Render thread"), "-", RG_DIALOG_FLAG_NORMAL, &render_thread_cb};
+    *dest++ = (rg_gui_option_t)RG_DIALOG_END;
+}
+
+static void debug_handler(rg_gui_option_t *dest, size_t max)
+{
+    static char banks[24], loads[24];
+    gb_bank_stats_t stats;
+    if (max < 2)
+        return;
+    gnuboy_get_bank_stats(&stats);
+    snprintf(banks, sizeof(banks), "%d/%d (%u sw)", stats.resident, stats.total, stats.switches);
+    snprintf(loads, sizeof(loads), "%u (%u pf, %u ev)", stats.loads, stats.prefetched, stats.evictions);
+    *dest++ = (rg_gui_option_t){0, "ROM banks ", banks, RG_DIALOG_FLAG_NORMAL, NULL};
+    *dest++ = (rg_gui_option_t){0, "Bank loads", loads, RG_DIALOG_FLAG_NORMAL, NULL};
     *dest++ = (rg_gui_option_t)RG_DIALOG_END;
 }
 
@@ -246,16 +324,21 @@ void gbc_main(void)
     const rg_handlers_t handlers = {
         .loadState = &load_state_handler,
         .saveState = &save_state_handler,
+        .loadStateMem = &load_state_mem_handler,
+        .saveStateMem = &save_state_mem_handler,
         .reset = &reset_handler,
         .screenshot = &screenshot_handler,
         .event = &event_handler,
         .options = &options_handler,
+        .debug = &debug_handler,
     };
 
     app = rg_system_reinit(AUDIO_SAMPLE_RATE, &handlers, NULL);
 
     updates[0] = rg_surface_create(GB_WIDTH, GB_HEIGHT, RG_PIXEL_565_BE, MEM_ANY);
     updates[1] = rg_surface_create(GB_WIDTH, GB_HEIGHT, RG_PIXEL_565_BE, MEM_ANY);
+    updates[0]->dirty_rows = calloc((GB_HEIGHT + 31) / 32, 4);
+    updates[1]->dirty_rows = calloc((GB_HEIGHT + 31) / 32, 4);
     currentUpdate = updates[0];
 
     useSystemTime = (bool)rg_settings_get_number(NS_APP, SETTING_SYSTIME, 1);
@@ -270,16 +353,16 @@ void gbc_main(void)
     if (gnuboy_init(app->sampleRate, GB_AUDIO_STEREO_S16, GB_PIXEL_565_BE, &video_callback, &audio_callback) < 0)
         RG_PANIC("Emulator init failed!");
 
-    gnuboy_set_framebuffer(currentUpdate->data);
+    gnuboy_set_framebuffer(currentUpdate->data, currentUpdate->dirty_rows);
     gnuboy_set_soundbuffer(malloc(AUDIO_BUFFER_LENGTH * 4), AUDIO_BUFFER_LENGTH);
 
-    // Load ROM
-    if (rg_extension_match(app->romPath, "zip"))
+    // Load ROM. Zipped ROMs are unzipped to memory when they fit: gnuboy can stream them like regular files,
+    // but inflating can't seek backward without restarting the entry, which would stall on every bank miss.
+    void *data;
+    size_t size;
+    if (rg_extension_match(app->romPath, "zip")
+        && rg_storage_unzip_file(app->romPath, "gb gbc", &data, &size, RG_FILE_ALIGN_16KB))
     {
-        void *data;
-        size_t size;
-        if (!rg_storage_unzip_file(app->romPath, NULL, &data, &size, RG_FILE_ALIGN_16KB))
-            RG_PANIC("ROM file unzipping failed!");
         if (gnuboy_load_rom(data, size) < 0)
             RG_PANIC("ROM Loading failed!");
     }
@@ -298,6 +381,7 @@ void gbc_main(void)
     }
 
     gnuboy_set_palette(rg_settings_get_number(NS_APP, SETTING_PALETTE, GB_PALETTE_DMG));
+    set_render_thread(rg_settings_get_number(NS_APP, SETTING_RENDERTHREAD, 0));
 
     // Hard reset to have a clean slate
     gnuboy_reset(true);
@@ -312,11 +396,13 @@ void gbc_main(void)
 
     // Ready!
 
-    uint32_t joystick_old = -1;
+    int64_t events_time = rg_system_timer();
+    int pad_old = -1;
     uint32_t joystick = 0;
 
     while (true)
     {
+        int64_t now = rg_system_timer();
         joystick = rg_input_read_gamepad();
 
         if (joystick & (RG_KEY_MENU|RG_KEY_OPTION))
@@ -330,32 +416,54 @@ void gbc_main(void)
             else
                 rg_gui_options_menu();
         }
-        else if (joystick != joystick_old)
+        else
         {
-            int pad = 0;
-            if (joystick & RG_KEY_UP) pad |= GB_PAD_UP;
-            if (joystick & RG_KEY_RIGHT) pad |= GB_PAD_RIGHT;
-            if (joystick & RG_KEY_DOWN) pad |= GB_PAD_DOWN;
-            if (joystick & RG_KEY_LEFT) pad |= GB_PAD_LEFT;
-            if (joystick & RG_KEY_SELECT) pad |= GB_PAD_SELECT;
-            if (joystick & RG_KEY_START) pad |= GB_PAD_START;
-            if (joystick & RG_KEY_A) pad |= GB_PAD_A;
-            if (joystick & RG_KEY_B) pad |= GB_PAD_B;
-            gnuboy_set_pad(pad); // That call is somewhat costly, that's why we try to avoid it
-            joystick_old = joystick;
+            // Spread the key changes since the last frame over the lines of this one, so that a press lands
+            // roughly where it happened instead of at the start of the frame. Older changes (we were in a
+            // menu or lagging) are applied at line 0.
+            int64_t window_start = RG_MAX(events_time, now - app->frameTime * 2);
+            int64_t window = RG_MAX(now - window_start, 1);
+            rg_input_event_t event;
+            while (rg_input_read_event(&event, now))
+            {
+                int line = RG_MIN(RG_MAX((event.time - window_start) * 154 / window, 0), 153);
+                pad_old = joystick_to_pad(event.state);
+                gnuboy_queue_pad(line, pad_old);
+            }
+            // No events when replaying a trace or when some were dropped, catch up with the current state
+            if (joystick_to_pad(joystick) != pad_old)
+            {
+                pad_old = joystick_to_pad(joystick);
+                gnuboy_set_pad(pad_old); // That call is somewhat costly, that's why we try to avoid it
+            }
         }
+        events_time = now;
 
         int64_t startTime = rg_system_timer();
-        bool drawFrame = !skipFrames;
+        bool drawFrame = rg_system_frame_begin();
 
         video_time = audio_time = 0;
 
+        // Run-ahead: the frame we show is one ahead of the state we keep
+        if (rg_emu_runahead_begin())
+        {
+            hiddenFrame = true;
+            gnuboy_run(false);
+            hiddenFrame = false;
+            rg_emu_runahead_save();
+        }
+
         if (drawFrame)
         {
             currentUpdate = updates[currentUpdate == updates[0]];
-            gnuboy_set_framebuffer(currentUpdate->data);
+            gnuboy_set_framebuffer(currentUpdate->data, currentUpdate->dirty_rows);
         }
+        // When renderThread is set, the render task draws the frame's lines on the other core while we emulate
+        RG_SPAN_BEGIN("gnuboy_run");
         gnuboy_run(drawFrame);
+        RG_SPAN_END();
+
+        rg_emu_runahead_end();
 
         if (autoSaveSRAM > 0)
         {
@@ -375,19 +483,11 @@ void gbc_main(void)
         // Tick before submitting audio/syncing
         rg_system_tick(rg_system_timer() - startTime - audio_time);
 
-        if (skipFrames == 0)
-        {
-            int elapsed = rg_system_timer() - startTime;
-            if (app->frameskip > 0)
-                skipFrames = app->frameskip;
-            else if (elapsed > app->frameTime + 1500) // Allow some jitter
-                skipFrames = 1; // (elapsed / frameTime)
-            else if (drawFrame && slowFrame)
-                skipFrames = 1;
-        }
-        else if (skipFrames > 0)
-        {
-            skipFrames--;
-        }
+        // See if we need to skip a frame to keep up
+        rg_system_frame_end(slowFrame);
+
+        // Use what's left of a fast frame to read ahead ROM banks (large games only)
+        if (rg_system_timer() - startTime - audio_time < app->frameTime / 2)
+            gnuboy_prefetch_bank();
     }
 }
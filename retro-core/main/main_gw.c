@@ -259,7 +259,9 @@ void gw_main(void)
         /* Emulate and Blit */
         // Call the emulator function with number of clock cycles
         // to execute on the emulated device
+        RG_SPAN_BEGIN("gw_system_run");
         gw_system_run(GW_SYSTEM_CYCLES);
+        RG_SPAN_END();
 
         // Our refresh rate is 128Hz, which is way too fast for our display
         // so make sure the previous frame is done sending before queuing a new one
@@ -171,6 +171,26 @@ static bool load_state_handler(const char *filename)
     return ret;
 }
 
+static bool save_state_fp(FILE *fp)
+{
+    return lynx->ContextSave(fp);
+}
+
+static bool load_state_fp(FILE *fp)
+{
+    return lynx->ContextLoad(fp);
+}
+
+static size_t save_state_mem_handler(void *buffer, size_t size)
+{
+    return rg_emu_save_state_stream(buffer, size, &save_state_fp);
+}
+
+static bool load_state_mem_handler(const void *buffer, size_t size)
+{
+    return rg_emu_load_state_stream(buffer, size, &load_state_fp);
+}
+
 static bool reset_handler(bool hard)
 {
     // This isn't nice but lynx->Reset() crashes...
@@ -190,6 +210,8 @@ extern "C" void lynx_main(void)
     const rg_handlers_t handlers = {
         .loadState = &load_state_handler,
         .saveState = &save_state_handler,
+        .loadStateMem = &load_state_mem_handler,
+        .saveStateMem = &save_state_mem_handler,
         .reset = &reset_handler,
         .screenshot = &screenshot_handler,
         .event = &event_handler,
@@ -197,6 +219,7 @@ extern "C" void lynx_main(void)
         .memWrite = NULL,
         .options = &options_handler,
         .about = NULL,
+        .debug = NULL,
     };
 
     app = rg_system_reinit(AUDIO_SAMPLE_RATE, &handlers, NULL);
@@ -225,7 +248,6 @@ extern "C" void lynx_main(void)
 
     set_display_mode();
 
-    long skipFrames = 0;
     bool slowFrame = false;
 
     // Start emulation
@@ -242,7 +264,7 @@ extern "C" void lynx_main(void)
         }
 
         int64_t startTime = rg_system_timer();
-        bool drawFrame = !skipFrames;
+        bool drawFrame = rg_system_frame_begin();
         ULONG buttons = 0;
 
     	if (joystick & RG_KEY_UP)     buttons |= dpad_mapped_up;
@@ -255,7 +277,9 @@ extern "C" void lynx_main(void)
     	if (joystick & RG_KEY_SELECT) buttons |= BUTTON_OPT1;
 
         lynx->SetButtonData(buttons);
+        RG_SPAN_BEGIN("UpdateFrame");
         lynx->UpdateFrame(drawFrame);
+        RG_SPAN_END();
 
         if (drawFrame)
         {
@@ -272,21 +296,7 @@ extern "C" void lynx_main(void)
         rg_audio_submit((const rg_audio_frame_t *)gAudioBuffer, gAudioBufferPointer / 2);
 
         // See if we need to skip a frame to keep up
-        if (skipFrames == 0)
-        {
-            int elapsed = rg_system_timer() - startTime;
-            if (app->frameskip > 0)
-                skipFrames = app->frameskip;
-            // The Lynx uses a variable framerate so we use the count of generated audio samples as reference instead
-            else if (elapsed > app->frameTime + 1500)
-                skipFrames = 1; // (elapsed / frameTime)
-            else if (drawFrame && slowFrame)
-                skipFrames = 1;
-        }
-        else if (skipFrames > 0)
-        {
-            skipFrames--;
-        }
+        rg_system_frame_end(slowFrame);
         gAudioBufferPointer = 0;
     }
 }
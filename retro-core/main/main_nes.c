@@ -7,8 +7,11 @@ static int autocrop = 0;
 static int palette = 0;
 static bool slowFrame = false;
 static bool nsfPlayer = false;
+static bool renderThread = false;
 static nes_t *nes;
 
+static rg_task_t *renderTask;
+
 static rg_app_t *app;
 static rg_surface_t *updates[2];
 static rg_surface_t *currentUpdate;
@@ -17,9 +20,34 @@ static const char *SETTING_AUTOCROP = "autocrop";
 static const char *SETTING_OVERSCAN = "overscan";
 static const char *SETTING_PALETTE = "palette";
 static const char *SETTING_SPRITELIMIT = "spritelimit";
+static const char *SETTING_RENDERTHREAD = "RenderThread";
 // --- MAIN
 
 
+static void render_task(void *arg)
+{
+    rg_task_msg_t msg;
+    // Sleep until nes_emulate recorded a few lines, it draws whatever we didn't get to before the blit
+    while (rg_task_receive(&msg))
+        ppu_renderpending();
+}
+
+static void render_lines_callback(void)
+{
+    // We're the only sender so this can't block. If a message is still waiting, the task will see our lines.
+    if (rg_task_messages_waiting(renderTask) == 0)
+        rg_task_send(renderTask, &(rg_task_msg_t){0});
+}
+
+static void set_render_thread(bool enable)
+{
+    if (enable && !renderTask)
+        renderTask = rg_task_create("nes_render", &render_task, NULL, 3 * 1024, RG_TASK_PRIORITY_2, 1);
+    renderThread = enable && renderTask;
+    ppu_setpipeline(renderThread, &render_lines_callback);
+}
+
+
 static void event_handler(int event, void *arg)
 {
     if (event == RG_EVENT_REDRAW)
@@ -51,12 +79,48 @@ static bool load_state_handler(const char *filename)
     return true;
 }
 
+static bool save_state_fp(FILE *fp)
+{
+    return state_save_fp(fp) == 0;
+}
+
+static bool load_state_fp(FILE *fp)
+{
+    return state_load_fp(fp) == 0;
+}
+
+static size_t save_state_mem_handler(void *buffer, size_t size)
+{
+    return rg_emu_save_state_stream(buffer, size, &save_state_fp);
+}
+
+static bool load_state_mem_handler(const void *buffer, size_t size)
+{
+    return rg_emu_load_state_stream(buffer, size, &load_state_fp);
+}
+
 static bool reset_handler(bool hard)
 {
     nes_reset(hard);
     return true;
 }
 
+static int get_buttons(uint32_t joystick)
+{
+    int buttons = 0;
+
+    if (joystick & RG_KEY_START)  buttons |= NES_PAD_START;
+    if (joystick & RG_KEY_SELECT) buttons |= NES_PAD_SELECT;
+    if (joystick & RG_KEY_UP)     buttons |= NES_PAD_UP;
+    if (joystick & RG_KEY_RIGHT)  buttons |= NES_PAD_RIGHT;
+    if (joystick & RG_KEY_DOWN)   buttons |= NES_PAD_DOWN;
+    if (joystick & RG_KEY_LEFT)   buttons |= NES_PAD_LEFT;
+    if (joystick & RG_KEY_A)      buttons |= NES_PAD_A;
+    if (joystick & RG_KEY_B)      buttons |= NES_PAD_B;
+
+    return buttons;
+}
+
 static void build_palette(int n)
 {
     uint16_t *pal = nofrendo_buildpalette(n, 16);
@@ -85,6 +149,17 @@ static rg_gui_event_t sprite_limit_cb(rg_gui_option_t *option, rg_gui_event_t ev
     return RG_DIALOG_VOID;
 }
 
+static rg_gui_event_t render_thread_cb(rg_gui_option_t *option, rg_gui_event_t event)
+{
+    if (event == RG_DIALOG_PREV || event == RG_DIALOG_NEXT)
+    {
+        set_render_thread(!renderThread);
+        rg_settings_set_number(NS_APP, SETTING_RENDERTHREAD, renderThread);
+    }
+    strcpy(option->value, renderThread ? _("On") : _("Off"));
+    return RG_DIALOG_VOID;
+}
+
 static rg_gui_event_t overscan_update_cb(rg_gui_option_t *option, rg_gui_event_t event)
 {
     if (event == RG_DIALOG_PREV || event == RG_DIALOG_NEXT)
@@ -185,6 +260,7 @@ static void options_handler(rg_gui_option_t *dest)
     *dest++ = (rg_gui_option_t){0, _("Overscan"),     "-", RG_DIALOG_FLAG_NORMAL, &overscan_update_cb};
     *dest++ = (rg_gui_option_t){0, _("Crop sides"),   "-", RG_DIALOG_FLAG_NORMAL, &autocrop_update_cb};
     *dest++ = (rg_gui_option_t){0, _("Sprite limit"), "-", RG_DIALOG_FLAG_NORMAL, &sprite_limit_cb};
+    *dest++ = (rg_gui_option_t){0, _("Render thread"), "-", RG_DIALOG_FLAG_NORMAL, &render_thread_cb};
     *dest++ = (rg_gui_option_t)RG_DIALOG_END;
 }
 
@@ -193,6 +269,8 @@ void nes_main(void)
     const rg_handlers_t handlers = {
         .loadState = &load_state_handler,
         .saveState = &save_state_handler,
+        .loadStateMem = &load_state_mem_handler,
+        .saveStateMem = &save_state_mem_handler,
         .reset = &reset_handler,
         .event = &event_handler,
         .screenshot = &screenshot_handler,
@@ -207,6 +285,8 @@ void nes_main(void)
 
     updates[0] = rg_surface_create(NES_SCREEN_PITCH, NES_SCREEN_HEIGHT, RG_PIXEL_PAL565_BE, MEM_FAST);
     updates[1] = rg_surface_create(NES_SCREEN_PITCH, NES_SCREEN_HEIGHT, RG_PIXEL_PAL565_BE, MEM_FAST);
+    updates[0]->dirty_rows = calloc((NES_SCREEN_HEIGHT + 31) / 32, 4);
+    updates[1]->dirty_rows = calloc((NES_SCREEN_HEIGHT + 31) / 32, 4);
     currentUpdate = updates[0];
 
     nes = nes_init(SYS_DETECT, app->sampleRate, true, RG_BASE_PATH_BIOS "/fds_bios.bin");
@@ -241,7 +321,13 @@ void nes_main(void)
 
     nsfPlayer = nes->cart->type == ROM_TYPE_NSF;
 
+    #ifdef RG_ENABLE_NETPLAY
+    // Player 2 comes from netplay. An idle joypad reads the same as an empty port.
+    input_connect(1, NES_JOYPAD);
+    #endif
+
     ppu_setopt(PPU_LIMIT_SPRITES, rg_settings_get_number(NS_APP, SETTING_SPRITELIMIT, 1));
+    set_render_thread(rg_settings_get_number(NS_APP, SETTING_RENDERTHREAD, 0));
 
     build_palette(palette);
 
@@ -257,7 +343,7 @@ void nes_main(void)
 
     rg_system_set_tick_rate(nes->refresh_rate);
 
-    int skipFrames = 0;
+    int nsfFrames = 0;
 
     while (true)
     {
@@ -272,26 +358,41 @@ void nes_main(void)
         }
 
         int64_t startTime = rg_system_timer();
-        bool drawFrame = !skipFrames && !nsfPlayer;
-        int buttons = 0;
-
-        if (joystick & RG_KEY_START)  buttons |= NES_PAD_START;
-        if (joystick & RG_KEY_SELECT) buttons |= NES_PAD_SELECT;
-        if (joystick & RG_KEY_UP)     buttons |= NES_PAD_UP;
-        if (joystick & RG_KEY_RIGHT)  buttons |= NES_PAD_RIGHT;
-        if (joystick & RG_KEY_DOWN)   buttons |= NES_PAD_DOWN;
-        if (joystick & RG_KEY_LEFT)   buttons |= NES_PAD_LEFT;
-        if (joystick & RG_KEY_A)      buttons |= NES_PAD_A;
-        if (joystick & RG_KEY_B)      buttons |= NES_PAD_B;
+        bool drawFrame = rg_system_frame_begin() && !nsfPlayer;
+        uint32_t inputs[2] = {joystick, 0};
 
         if (drawFrame)
         {
             currentUpdate = updates[currentUpdate == updates[0]];
-            nes_setvidbuf(currentUpdate->data);
+            nes_setvidbuf(currentUpdate->data, currentUpdate->dirty_rows);
         }
 
-        input_update(0, buttons);
+    #ifdef RG_ENABLE_NETPLAY
+        // When a prediction was wrong we're rolled back and must emulate the frames again with the right input
+        while (rg_netplay_sync(&joystick, inputs, sizeof(joystick)))
+        {
+            input_update(0, get_buttons(inputs[0]));
+            input_update(1, get_buttons(inputs[1]));
+            nes_emulate(false);
+        }
+    #endif
+
+        input_update(0, get_buttons(inputs[0]));
+        input_update(1, get_buttons(inputs[1]));
+
+        // Run-ahead: the frame we show is one ahead of the state we keep. The hidden frame's audio is
+        // overwritten by the next one.
+        if (rg_emu_runahead_begin())
+        {
+            nes_emulate(false);
+            rg_emu_runahead_save();
+        }
+
+        RG_SPAN_BEGIN("nes_emulate");
         nes_emulate(drawFrame);
+        RG_SPAN_END();
+
+        rg_emu_runahead_end();
 
         // Tick before submitting audio/syncing
         rg_system_tick(rg_system_timer() - startTime);
@@ -299,23 +400,12 @@ void nes_main(void)
         // Audio is used to pace emulation :)
         rg_audio_submit((void*)nes->apu->buffer, nes->apu->samples_per_frame);
 
-        if (skipFrames == 0)
-        {
-            int frameTime = 1000000 / (nes->refresh_rate * app->speed);
-            int elapsed = rg_system_timer() - startTime;
-            if (nsfPlayer)
-                skipFrames = 10, nsf_draw_overlay();
-            else if (app->frameskip > 0)
-                skipFrames = app->frameskip;
-            else if (elapsed > frameTime + 1500) // Allow some jitter
-                skipFrames = 1; // (elapsed / frameTime)
-            else if (drawFrame && slowFrame)
-                skipFrames = 1;
-        }
-        else if (skipFrames > 0)
-        {
-            skipFrames--;
-        }
+        // The NSF player doesn't emulate video, it only refreshes its overlay every now and then
+        if (nsfPlayer && nsfFrames++ % 11 == 0)
+            nsf_draw_overlay();
+
+        // See if we need to skip a frame to keep up
+        rg_system_frame_end(slowFrame);
     }
 
     RG_PANIC("Nofrendo died!");
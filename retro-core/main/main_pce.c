@@ -14,7 +14,6 @@
 
 static bool emulationPaused = false; // This should probably be a mutex
 static int overscan = false;
-static int skipFrames = 0;
 static bool drawFrame = true;
 static bool slowFrame = false;
 
@@ -54,6 +53,9 @@ void osd_vsync(void)
 {
     static int64_t lasttime, prevtime;
 
+    // The emulation loop lives in pce-go, so the span covers everything between two vsyncs
+    RG_SPAN_END();
+
     if (drawFrame)
     {
         slowFrame = !rg_display_sync(false);
@@ -62,17 +64,7 @@ void osd_vsync(void)
     }
 
     // See if we need to skip a frame to keep up
-    if (skipFrames == 0)
-    {
-        if (app->frameskip > 0)
-            skipFrames = app->frameskip;
-        else if (drawFrame && slowFrame)
-            skipFrames = 1;
-    }
-    else if (skipFrames > 0)
-    {
-        skipFrames--;
-    }
+    rg_system_frame_end(slowFrame);
 
     int64_t curtime = rg_system_timer();
     int frameTime = app->frameTime;
@@ -84,11 +76,8 @@ void osd_vsync(void)
     }
     else if (sleep > 0)
     {
-        rg_usleep(sleep);
-    }
-    else if (sleep < -(frameTime / 2))
-    {
-        skipFrames++;
+        if (!app->isBenchmark)
+            rg_usleep(sleep);
     }
 
     rg_system_tick(curtime - prevtime);
@@ -99,7 +88,9 @@ void osd_vsync(void)
     if ((lasttime + frameTime) < prevtime)
         lasttime = prevtime;
 
-    drawFrame = (skipFrames == 0);
+    drawFrame = rg_system_frame_begin();
+
+    RG_SPAN_BEGIN("pce_run");
 }
 
 void osd_input_read(uint8_t joypads[8])
@@ -140,7 +131,9 @@ static void audioTask(void *arg)
         // TODO: Clearly we need to add a better way to remain in sync with the main task...
         while (emulationPaused)
             rg_task_yield();
+        RG_SPAN_BEGIN("psg_update");
         psg_update((int16_t *)samples, numSamples, 0xFF);
+        RG_SPAN_END();
         rg_audio_submit(samples, numSamples);
     }
 }
@@ -175,6 +168,26 @@ static bool load_state_handler(const char *filename)
     return true;
 }
 
+static bool save_state_fp(FILE *fp)
+{
+    return SaveStateFile(fp) == 0;
+}
+
+static bool load_state_fp(FILE *fp)
+{
+    return LoadStateFile(fp) == 0;
+}
+
+static size_t save_state_mem_handler(void *buffer, size_t size)
+{
+    return rg_emu_save_state_stream(buffer, size, &save_state_fp);
+}
+
+static bool load_state_mem_handler(const void *buffer, size_t size)
+{
+    return rg_emu_load_state_stream(buffer, size, &load_state_fp);
+}
+
 static bool reset_handler(bool hard)
 {
     ResetPCE(hard);
@@ -192,6 +205,8 @@ void pce_main(void)
     const rg_handlers_t handlers = {
         .loadState = &load_state_handler,
         .saveState = &save_state_handler,
+        .loadStateMem = &load_state_mem_handler,
+        .saveStateMem = &save_state_mem_handler,
         .reset = &reset_handler,
         .screenshot = &screenshot_handler,
         .event = &event_handler,
@@ -221,6 +236,7 @@ void pce_main(void)
 
     emulationPaused = true;
     rg_task_create("pce_sound", &audioTask, NULL, 2 * 1024, RG_TASK_PRIORITY_2, 1);
+    rg_system_set_audio_pacing(false); // Audio has its own task, we pace with osd_vsync's timer
 
     InitPCE(app->sampleRate, true);
 
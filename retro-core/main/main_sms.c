@@ -2,6 +2,10 @@
 
 #include <smsplus.h>
 
+static bool renderThread = false;
+
+static rg_task_t *renderTask;
+
 static rg_app_t *app;
 static rg_surface_t *updates[2];
 static rg_surface_t *currentUpdate;
@@ -18,9 +22,33 @@ const rg_keyboard_map_t coleco_keyboard = {
 };
 
 static const char *SETTING_PALETTE = "palette";
+static const char *SETTING_RENDERTHREAD = "RenderThread";
 // --- MAIN
 
 
+static void render_task(void *arg)
+{
+    rg_task_msg_t msg;
+    // Sleep until system_frame recorded a few lines, it draws whatever we didn't get to before returning
+    while (rg_task_receive(&msg))
+        render_pending();
+}
+
+static void render_lines_callback(void)
+{
+    // We're the only sender so this can't block. If a message is still waiting, the task will see our lines.
+    if (rg_task_messages_waiting(renderTask) == 0)
+        rg_task_send(renderTask, &(rg_task_msg_t){0});
+}
+
+static void set_render_thread(bool enable)
+{
+    if (enable && !renderTask)
+        renderTask = rg_task_create("sms_render", &render_task, NULL, 3 * 1024, RG_TASK_PRIORITY_2, 1);
+    renderThread = enable && renderTask;
+    render_set_pipeline(renderThread, &render_lines_callback);
+}
+
 static void event_handler(int event, void *arg)
 {
     if (event == RG_EVENT_REDRAW)
@@ -59,6 +87,28 @@ static bool load_state_handler(const char *filename)
     return false;
 }
 
+static bool save_state_fp(FILE *fp)
+{
+    system_save_state(fp);
+    return !ferror(fp);
+}
+
+static bool load_state_fp(FILE *fp)
+{
+    system_load_state(fp);
+    return !ferror(fp) && !feof(fp);
+}
+
+static size_t save_state_mem_handler(void *buffer, size_t size)
+{
+    return rg_emu_save_state_stream(buffer, size, &save_state_fp);
+}
+
+static bool load_state_mem_handler(const void *buffer, size_t size)
+{
+    return rg_emu_load_state_stream(buffer, size, &load_state_fp);
+}
+
 static bool reset_handler(bool hard)
 {
     system_reset();
@@ -93,9 +143,21 @@ static rg_gui_event_t palette_update_cb(rg_gui_option_t *opt, rg_gui_event_t eve
     return RG_DIALOG_VOID;
 }
 
+static rg_gui_event_t render_thread_cb(rg_gui_option_t *opt, rg_gui_event_t event)
+{
+    if (event == RG_DIALOG_PREV || event == RG_DIALOG_NEXT)
+    {
+        set_render_thread(!renderThread);
+        rg_settings_set_number(NS_APP, SETTING_RENDERTHREAD, renderThread);
+    }
+    strcpy(opt->value, renderThread ? _("On") : _("Off"));
+    return RG_DIALOG_VOID;
+}
+
 static void options_handler(rg_gui_option_t *dest)
 {
     *dest++ = (rg_gui_option_t){0, _("Palette"), "-", RG_DIALOG_FLAG_NORMAL, &palette_update_cb};
+    *dest++ = (rg_gui_option_t){0, _("Render thread"), "-", RG_DIALOG_FLAG_NORMAL, &render_thread_cb};
     *dest++ = (rg_gui_option_t)RG_DIALOG_END;
 }
 
@@ -104,6 +166,8 @@ void sms_main(void)
     const rg_handlers_t handlers = {
         .loadState = &load_state_handler,
         .saveState = &save_state_handler,
+        .loadStateMem = &load_state_mem_handler,
+        .saveStateMem = &save_state_mem_handler,
         .reset = &reset_handler,
         .screenshot = &screenshot_handler,
         .event = &event_handler,
@@ -114,6 +178,8 @@ void sms_main(void)
 
     updates[0] = rg_surface_create(SMS_WIDTH, SMS_HEIGHT, RG_PIXEL_PAL565_BE, MEM_FAST);
     updates[1] = rg_surface_create(SMS_WIDTH, SMS_HEIGHT, RG_PIXEL_PAL565_BE, MEM_FAST);
+    updates[0]->dirty_rows = calloc((SMS_HEIGHT + 31) / 32, 4);
+    updates[1]->dirty_rows = calloc((SMS_HEIGHT + 31) / 32, 4);
     currentUpdate = updates[0];
 
     system_reset_config();
@@ -147,6 +213,7 @@ void sms_main(void)
     bitmap.height = SMS_HEIGHT;
     bitmap.pitch = bitmap.width;
     bitmap.data = currentUpdate->data;
+    bitmap.dirty_rows = currentUpdate->dirty_rows;
 
     system_poweron();
 
@@ -157,6 +224,8 @@ void sms_main(void)
     updates[1]->width = bitmap.viewport.w;
     updates[1]->height = bitmap.viewport.h;
 
+    set_render_thread(rg_settings_get_number(NS_APP, SETTING_RENDERTHREAD, 0));
+
     if (app->bootFlags & RG_BOOT_RESUME)
     {
         rg_emu_load_state(app->saveSlot);
@@ -165,7 +234,6 @@ void sms_main(void)
     rg_system_set_tick_rate((sms.display == DISPLAY_NTSC) ? FPS_NTSC : FPS_PAL);
     app->frameskip = 0;
 
-    int skipFrames = 0;
     int colecoKey = 0;
     int colecoKeyDecay = 0;
 
@@ -182,7 +250,7 @@ void sms_main(void)
         }
 
         int64_t startTime = rg_system_timer();
-        bool drawFrame = !skipFrames;
+        bool drawFrame = rg_system_frame_begin();
         bool slowFrame = false;
 
         input.pad[0] = 0x00;
@@ -241,7 +309,9 @@ void sms_main(void)
             }
         }
 
+        RG_SPAN_BEGIN("system_frame");
         system_frame(!drawFrame);
+        RG_SPAN_END();
 
         if (drawFrame)
         {
@@ -251,6 +321,7 @@ void sms_main(void)
             rg_display_submit(currentUpdate, 0);
             currentUpdate = updates[currentUpdate == updates[0]]; // Swap
             bitmap.data = currentUpdate->data;
+            bitmap.dirty_rows = currentUpdate->dirty_rows;
         }
 
         // The emulator's sound buffer isn't in a very convenient format, we must remix it.
@@ -269,19 +340,6 @@ void sms_main(void)
         rg_audio_submit(mixbuffer, sample_count);
 
         // See if we need to skip a frame to keep up
-        if (skipFrames == 0)
-        {
-            int elapsed = rg_system_timer() - startTime;
-            if (app->frameskip > 0)
-                skipFrames = app->frameskip;
-            else if (elapsed > app->frameTime + 1500) // Allow some jitter
-                skipFrames = 1; // (elapsed / frameTime)
-            else if (drawFrame && slowFrame)
-                skipFrames = 1;
-        }
-        else if (skipFrames > 0)
-        {
-            skipFrames--;
-        }
+        rg_system_frame_end(slowFrame);
     }
 }
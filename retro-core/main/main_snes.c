@@ -73,14 +73,147 @@ static rg_audio_sample_t *audioBuffer;
 
 static bool apu_enabled = true;
 static bool lowpass_filter = false;
+static bool apu_thread = false;
 
 static int keymap_id = 0;
 static keymap_t keymap;
 
 static const char *SETTING_KEYMAP = "keymap";
 static const char *SETTING_APU_EMULATION = "apu";
+static const char *SETTING_APU_THREAD = "apuThread";
+
+#ifndef USE_BLARGG_APU
+// With apu_thread the sound emulation (DSP register side effects and mixing) runs on its own task, one frame
+// behind the CPU and SPC700. The DSP writes made during a frame are queued in order and the task applies them
+// all before mixing that frame, which is what the single-threaded loop does too, so the output is the same.
+// The SPC700 reads its own writes back from shadow registers and the voice status (ENVX/OUTX/ENDX) from a
+// snapshot taken between frames, the latter being one frame staler than when single-threaded.
+#define DSP_QUEUE_SIZE 4096 // movw $f2 takes 5 cycles, the SPC700 can't do more than ~3400 writes per frame
+
+typedef struct
+{
+    struct {uint8_t reg, byte;} *writes;
+    size_t count;
+    rg_audio_sample_t *samples;
+    bool mix, lowpass;
+} apu_job_t;
+
+static rg_task_t *apu_task;
+static apu_job_t apu_jobs[2];
+static apu_job_t *apu_queue;   // Collects the writes of the frame being emulated
+static apu_job_t *apu_pending; // Handed to the task, its samples are submitted at the end of the next frame
+static uint8_t *apu_sample_ram; // What the task mixes from while the SPC700 writes the next frame to IAPU.RAM
+#endif
 // --- MAIN
 
+#ifndef USE_BLARGG_APU
+static void mix_samples(rg_audio_sample_t *buffer, bool lowpass)
+{
+    if (lowpass)
+        S9xMixSamplesLowPass((void *)buffer, AUDIO_BUFFER_LENGTH << 1, AUDIO_LOW_PASS_RANGE);
+    else
+        S9xMixSamples((void *)buffer, AUDIO_BUFFER_LENGTH << 1);
+}
+
+static void apu_queue_write(uint8_t reg, uint8_t byte)
+{
+    // Can't happen with real SPC700 code, but if it did we'd rather drop writes than stall
+    if (apu_queue->count < DSP_QUEUE_SIZE)
+    {
+        apu_queue->writes[apu_queue->count].reg = reg;
+        apu_queue->writes[apu_queue->count].byte = byte;
+        apu_queue->count++;
+    }
+}
+
+static void apu_task_func(void *arg)
+{
+    rg_task_msg_t msg;
+    while (rg_task_peek(&msg))
+    {
+        apu_job_t *job = (apu_job_t *)msg.dataPtr;
+        RG_SPAN_BEGIN("apu_job");
+        for (size_t i = 0; i < job->count; ++i)
+            S9xApplyAPUDSP(job->writes[i].reg, job->writes[i].byte);
+        if (job->mix)
+            mix_samples(job->samples, job->lowpass);
+        RG_SPAN_END();
+        rg_task_receive(&msg);
+    }
+}
+
+// Waits for the APU task to be idle, after that the sound state can be used from the main task
+static void apu_sync(void)
+{
+    while (apu_task && rg_task_messages_waiting(apu_task) > 0)
+        rg_task_yield();
+}
+
+// Brings the sound state up to date with the SPC700, for save states, resets, or leaving threaded mode.
+// Writes that weren't handed over yet are applied right away, the frame is still mixed when it ends. The
+// previous frame's samples stay pending, so snapshots (rewind, run-ahead) don't cost any audio.
+static void apu_flush(void)
+{
+    if (!apu_thread)
+        return;
+    apu_sync();
+    for (size_t i = 0; i < apu_queue->count; ++i)
+        S9xApplyAPUDSP(apu_queue->writes[i].reg, apu_queue->writes[i].byte);
+    apu_queue->count = 0;
+    S9xSyncAPUDSPShadow();
+}
+
+// Same as apu_flush, but the pending samples belong to a timeline (or mode) we're leaving
+static void apu_discard(void)
+{
+    apu_flush();
+    apu_pending = NULL;
+}
+
+static void apu_set_threaded(bool enable)
+{
+    if (enable && !apu_task)
+    {
+        for (size_t i = 0; i < 2; ++i)
+        {
+            apu_jobs[i].writes = rg_alloc(DSP_QUEUE_SIZE * sizeof(*apu_jobs[i].writes), MEM_ANY);
+            apu_jobs[i].samples = rg_alloc(AUDIO_BUFFER_LENGTH * 4, MEM_ANY);
+        }
+        apu_sample_ram = rg_alloc(0x10000, MEM_ANY);
+        apu_queue = &apu_jobs[0];
+        apu_task = rg_task_create("snes_apu", &apu_task_func, NULL, 3 * 1024, RG_TASK_PRIORITY_5, 1);
+    }
+    apu_discard();
+    apu_thread = enable && apu_task;
+    S9xSetAPUDSPHook(apu_thread ? &apu_queue_write : NULL);
+    S9xSetAPUSampleRAM(apu_thread ? apu_sample_ram : NULL);
+    // Single-threaded we can't draw more than 1 frame in 4, otherwise let the scheduler skip only what it must
+    app->frameskip = apu_thread ? 0 : 3;
+}
+
+// Hands the frame's DSP writes to the APU task and returns the samples of the previous frame, if any
+static rg_audio_sample_t *apu_end_frame(void)
+{
+    apu_job_t *done = apu_pending;
+
+    apu_sync();
+    // APU.DSP is only up to date with the previous frames, this frame's writes haven't been handed over yet
+    S9xSyncAPUDSPShadow();
+    for (size_t i = 0; i < apu_queue->count; ++i)
+        S9xShadowAPUDSP(apu_queue->writes[i].reg, apu_queue->writes[i].byte);
+    S9xSyncAPUSampleRAM(false);
+
+    apu_queue->mix = apu_enabled;
+    apu_queue->lowpass = lowpass_filter;
+    rg_task_send(apu_task, &(rg_task_msg_t){.dataPtr = apu_queue});
+    apu_pending = apu_queue;
+    apu_queue = (apu_queue == &apu_jobs[0]) ? &apu_jobs[1] : &apu_jobs[0];
+    apu_queue->count = 0;
+
+    return (done && done->mix) ? done->samples : NULL;
+}
+#endif
+
 static void update_keymap(int id)
 {
     keymap_id = id % KEYMAPS_COUNT;
@@ -94,17 +227,66 @@ static bool screenshot_handler(const char *filename, int width, int height)
 
 static bool save_state_handler(const char *filename)
 {
+#ifndef USE_BLARGG_APU
+    apu_flush();
+#endif
     return S9xSaveState(filename);
 }
 
 static bool load_state_handler(const char *filename)
 {
+#ifndef USE_BLARGG_APU
+    apu_discard();
+    bool success = S9xLoadState(filename);
+    S9xSyncAPUDSPShadow();
+    S9xSyncAPUSampleRAM(true);
+    return success;
+#else
     return S9xLoadState(filename);
+#endif
+}
+
+static bool save_state_fp(FILE *fp)
+{
+    return S9xSaveStateFile(fp);
+}
+
+static bool load_state_fp(FILE *fp)
+{
+    return S9xLoadStateFile(fp);
+}
+
+static size_t save_state_mem_handler(void *buffer, size_t size)
+{
+#ifndef USE_BLARGG_APU
+    apu_flush();
+#endif
+    return rg_emu_save_state_stream(buffer, size, &save_state_fp);
+}
+
+static bool load_state_mem_handler(const void *buffer, size_t size)
+{
+#ifndef USE_BLARGG_APU
+    apu_discard();
+    bool success = rg_emu_load_state_stream(buffer, size, &load_state_fp);
+    S9xSyncAPUDSPShadow();
+    S9xSyncAPUSampleRAM(true);
+    return success;
+#else
+    return rg_emu_load_state_stream(buffer, size, &load_state_fp);
+#endif
 }
 
 static bool reset_handler(bool hard)
 {
+#ifndef USE_BLARGG_APU
+    apu_discard();
+    S9xReset();
+    S9xSyncAPUDSPShadow();
+    S9xSyncAPUSampleRAM(true);
+#else
     S9xReset();
+#endif
     return true;
 }
 
@@ -129,6 +311,21 @@ static rg_gui_event_t apu_toggle_cb(rg_gui_option_t *option, rg_gui_event_t even
     return RG_DIALOG_VOID;
 }
 
+#ifndef USE_BLARGG_APU
+static rg_gui_event_t apu_thread_cb(rg_gui_option_t *option, rg_gui_event_t event)
+{
+    if (event == RG_DIALOG_PREV || event == RG_DIALOG_NEXT)
+    {
+        apu_set_threaded(!apu_thread);
+        rg_settings_set_number(NS_APP, SETTING_APU_THREAD, apu_thread);
+    }
+
+    strcpy(option->value, apu_thread ? _("On") : _("Off"));
+
+    return RG_DIALOG_VOID;
+}
+#endif
+
 static rg_gui_event_t lowpass_filter_cb(rg_gui_option_t *option, rg_gui_event_t event)
 {
     if (event == RG_DIALOG_PREV || event == RG_DIALOG_NEXT)
@@ -288,6 +485,9 @@ static void options_handler(rg_gui_option_t *dest)
 {
     *dest++ = (rg_gui_option_t){0, _("Audio enable"), "-", RG_DIALOG_FLAG_NORMAL, &apu_toggle_cb};
     *dest++ = (rg_gui_option_t){0, _("Audio filter"), "-", RG_DIALOG_FLAG_NORMAL, &lowpass_filter_cb};
+#ifndef USE_BLARGG_APU
+    *dest++ = (rg_gui_option_t){0, _("Audio thread"), "-", RG_DIALOG_FLAG_NORMAL, &apu_thread_cb};
+#endif
     *dest++ = (rg_gui_option_t){0, _("Controls"),     "-", RG_DIALOG_FLAG_NORMAL, &menu_keymap_cb};
     *dest++ = (rg_gui_option_t)RG_DIALOG_END;
 }
@@ -297,6 +497,8 @@ void snes_main(void)
     const rg_handlers_t handlers = {
         .loadState = &load_state_handler,
         .saveState = &save_state_handler,
+        .loadStateMem = &load_state_mem_handler,
+        .saveStateMem = &save_state_mem_handler,
         .reset = &reset_handler,
         .screenshot = &screenshot_handler,
         .event = &event_handler,
@@ -356,6 +558,7 @@ void snes_main(void)
     S9xSetSamplesAvailableCallback(S9xAudioCallback);
 #else
     S9xSetPlaybackRate(Settings.SoundPlaybackRate);
+    apu_set_threaded(rg_settings_get_number(NS_APP, SETTING_APU_THREAD, 0));
 #endif
 
     if (app->bootFlags & RG_BOOT_RESUME)
@@ -364,11 +567,12 @@ void snes_main(void)
     }
 
     rg_system_set_tick_rate(Memory.ROMFramesPerSecond);
+#ifdef USE_BLARGG_APU
     app->frameskip = 3;
+#endif
 
     bool menuCancelled = false;
     bool menuPressed = false;
-    int skipFrames = 0;
 
     while (1)
     {
@@ -396,13 +600,15 @@ void snes_main(void)
         }
 
         int64_t startTime = rg_system_timer();
-        bool drawFrame = (skipFrames == 0);
+        bool drawFrame = rg_system_frame_begin();
         bool slowFrame = false;
 
         IPPU.RenderThisFrame = drawFrame;
         GFX.Screen = currentUpdate->data;
 
+        RG_SPAN_BEGIN("S9xMainLoop");
         S9xMainLoop();
+        RG_SPAN_END();
 
         if (drawFrame)
         {
@@ -411,32 +617,26 @@ void snes_main(void)
         }
 
     #ifndef USE_BLARGG_APU
-        if (apu_enabled && lowpass_filter)
-            S9xMixSamplesLowPass((void *)audioBuffer, AUDIO_BUFFER_LENGTH << 1, AUDIO_LOW_PASS_RANGE);
+        rg_audio_sample_t *samples = NULL;
+        if (apu_thread)
+        {
+            samples = apu_end_frame();
+        }
         else if (apu_enabled)
-            S9xMixSamples((void *)audioBuffer, AUDIO_BUFFER_LENGTH << 1);
+        {
+            mix_samples(audioBuffer, lowpass_filter);
+            samples = audioBuffer;
+        }
     #endif
 
         rg_system_tick(rg_system_timer() - startTime);
 
     #ifndef USE_BLARGG_APU
-        if (apu_enabled)
-            rg_audio_submit(audioBuffer, AUDIO_BUFFER_LENGTH);
+        if (samples)
+            rg_audio_submit(samples, AUDIO_BUFFER_LENGTH);
     #endif
 
-        if (skipFrames == 0)
-        {
-            int elapsed = rg_system_timer() - startTime;
-            if (app->frameskip > 0)
-                skipFrames = app->frameskip;
-            else if (elapsed > app->frameTime + 1500) // Allow some jitter
-                skipFrames = 1; // (elapsed / frameTime)
-            else if (drawFrame && slowFrame)
-                skipFrames = 1;
-        }
-        else if (skipFrames > 0)
-        {
-            skipFrames--;
-        }
+        // See if we need to skip a frame to keep up
+        rg_system_frame_end(slowFrame);
     }
 }
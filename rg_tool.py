@@ -135,7 +135,7 @@ def clean_app(app):
     print("Done.\n")
 
 
-def build_app(app, device_type, with_profiling=False, no_networking=False, is_release=False):
+def build_app(app, device_type, with_profiling=False, no_networking=False, is_release=False, with_spans=False):
     # To do: clean up if any of the flags changed since last build
     print("Building app '%s'" % app)
     args = [IDF_PY, "app"]
@@ -144,6 +144,7 @@ def build_app(app, device_type, with_profiling=False, no_networking=False, is_re
     args.append(f"-DRG_BUILD_TARGET=RG_TARGET_{re.sub(r'[^A-Z0-9]', '_', device_type.upper())}")
     args.append(f"-DRG_BUILD_RELEASE={1 if is_release else 0}")
     args.append(f"-DRG_ENABLE_PROFILING={1 if with_profiling else 0}")
+    args.append(f"-DRG_ENABLE_SPANS={1 if with_spans else 0}")
     args.append(f"-DRG_ENABLE_NETWORKING={0 if no_networking else 1}")
     with open("partitions.csv", "w") as f:
         f.write("# This table isn't used, it's just needed to avoid esp-idf build failures.\n")
@@ -196,6 +197,9 @@ parser.add_argument(
 parser.add_argument(
     "--no-networking", action="store_const", const=True, help="Build without networking support"
 )
+parser.add_argument(
+    "--with-spans", action="store_const", const=True, help="Record hot path spans (see RG_SPAN_BEGIN)"
+)
 parser.add_argument(
     "--port", default=DEFAULT_PORT, help="Serial port to use for flash and monitor"
 )
@@ -231,7 +235,7 @@ try:
     if command in ["build", "build-fw", "build-img", "release", "run", "profile", "install"]:
         print("=== Step: Building ===\n")
         for app in apps:
-            build_app(app, args.target, command == "profile", args.no_networking, command == "release")
+            build_app(app, args.target, command == "profile", args.no_networking, command == "release", args.with_spans)
 
     if command in ["build-fw", "release"]:
         print("=== Step: Packing ===\n")
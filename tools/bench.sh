@@ -0,0 +1,20 @@
+#!/bin/bash
+
+# Usage: ./tools/bench.sh <app> <rom> [frames] [input trace] [expected hash]
+# Example: ./tools/bench.sh gbc roms/gbc/game.gbc 1200 traces/game.txt 0x1234ABCD
+
+if [ $# -lt 2 ]; then
+	echo "Usage: $0 <app> <rom> [frames] [input trace] [expected hash]"
+	exit 2
+fi
+
+if [ ! -x ./retro-core-headless ]; then
+	./tools/build_headless.sh || exit 2
+fi
+
+RG_BENCH_APP="$1" \
+RG_BENCH_ROM="$2" \
+RG_BENCH_FRAMES="${3:-600}" \
+RG_BENCH_INPUT="$4" \
+RG_BENCH_EXPECT="$5" \
+./retro-core-headless
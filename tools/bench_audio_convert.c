@@ -0,0 +1,101 @@
+// Host micro-benchmark for the I2S sample conversion kernels (components/retro-go/drivers/audio/convert.h).
+// It compares them against the float implementation they replaced, both for speed and output.
+//
+// Build: gcc -O2 -Icomponents/retro-go/drivers/audio tools/bench_audio_convert.c -o bench_audio_convert
+// Usage: ./bench_audio_convert [iterations]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "convert.h"
+
+#define FRAMES 180 // One I2S DMA buffer, same as the driver
+
+// The original driver_submit loop, for reference
+static void float_convert(int16_t *dst, const int16_t *src, size_t frames, int mode, int percent)
+{
+    float volume = percent * 0.01f;
+    for (size_t i = 0; i < frames; ++i)
+    {
+        int left = src[i * 2] * volume;
+        int right = src[i * 2 + 1] * volume;
+        if (mode > 0)
+        {
+            int sample = (left + right) >> 1;
+            if (mode == 1)
+                left = sample + 0x8000, right = 0;
+            else if (mode == 2)
+                left = 0, right = sample + 0x8000;
+            else if (sample > 0x7F00)
+                left = 0x8000 + (sample - 0x7F00), right = -0x8000 + 0x7F00;
+            else if (sample < -0x7F00)
+                left = 0x8000 + (sample + 0x7F00), right = -0x8000 + -0x7F00;
+            else
+                left = 0x8000, right = -0x8000 + sample;
+        }
+        dst[i * 2] = left;
+        dst[i * 2 + 1] = right;
+    }
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+    static const struct {const char *name; rg_audio_convert_t func;} kernels[] = {
+        {"stereo (ext DAC)", rg_audio_convert_stereo},
+        {"dac mode 1", rg_audio_convert_dac_left},
+        {"dac mode 2", rg_audio_convert_dac_right},
+        {"dac mode 3", rg_audio_convert_dac_both},
+    };
+    static int16_t src[FRAMES * 2] __attribute__((aligned(16)));
+    static int16_t dst[FRAMES * 2] __attribute__((aligned(16)));
+    static int16_t ref[FRAMES * 2] __attribute__((aligned(16)));
+    long iterations = argc > 1 ? atol(argv[1]) : 200000;
+    const int percent = 75;
+    int failed = 0;
+
+    srand(1234);
+    for (size_t i = 0; i < FRAMES * 2; ++i)
+        src[i] = (rand() & 0xFFFF) - 0x8000;
+
+    printf("%-18s %12s %12s %9s\n", "kernel", "float ns/fr", "q15 ns/fr", "max diff");
+    for (int mode = 0; mode < 4; ++mode)
+    {
+        double start = now();
+        for (long n = 0; n < iterations; ++n)
+        {
+            float_convert(ref, src, FRAMES, mode, percent);
+            __asm__ volatile("" ::: "memory");
+        }
+        double float_time = now() - start;
+
+        start = now();
+        for (long n = 0; n < iterations; ++n)
+        {
+            kernels[mode].func(dst, src, FRAMES, RG_AUDIO_GAIN_Q15(percent));
+            __asm__ volatile("" ::: "memory");
+        }
+        double q15_time = now() - start;
+
+        // Outputs are compared modulo 2^16 because the internal DAC data is unsigned
+        int max_diff = 0;
+        for (size_t i = 0; i < FRAMES * 2; ++i)
+        {
+            int diff = abs((int16_t)(uint16_t)(dst[i] - ref[i]));
+            max_diff = diff > max_diff ? diff : max_diff;
+        }
+        failed |= max_diff > 2;
+
+        printf("%-18s %12.2f %12.2f %9d\n", kernels[mode].name, float_time * 1e9 / iterations / FRAMES,
+               q15_time * 1e9 / iterations / FRAMES, max_diff);
+    }
+
+    return failed;
+}
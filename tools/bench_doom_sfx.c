@@ -0,0 +1,167 @@
+// Host micro-benchmark for the Doom sound effects mixer (prboom-go/main/sfx_mixer.h).
+// It compares it against the float per-sample loop it replaced for speed, and against a straightforward
+// per-sample implementation of the same semantics for output.
+//
+// Build: gcc -O2 -Iprboom-go/main tools/bench_doom_sfx.c -o bench_doom_sfx
+// Usage: ./bench_doom_sfx [iterations]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "sfx_mixer.h"
+
+#define OUTPUT_RATE 22050
+#define FRAMES (OUTPUT_RATE / 35 + 1) // One game tic, same as soundTask
+#define VOICES 8
+#define SFX_LENGTH 8000
+
+typedef struct
+{
+    const uint8_t *data;
+    size_t length, pos;
+    float factor;
+} float_voice_t;
+
+// The original soundTask loop, for reference
+static void float_mix(int16_t *buffer, float_voice_t *voices, int sfx_volume)
+{
+    for (size_t n = 0; n < FRAMES; ++n)
+    {
+        int total = 0, sources = 0, sample;
+        for (int i = 0; i < VOICES; i++)
+        {
+            float_voice_t *voice = &voices[i];
+            if (!voice->data)
+                continue;
+            size_t pos = (size_t)(voice->pos++ * voice->factor);
+            if (pos >= voice->length)
+                voice->data = NULL;
+            else if ((sample = voice->data[pos]))
+            {
+                total += sample - 127;
+                sources++;
+            }
+        }
+        total <<= 7;
+        total /= (16 - sfx_volume);
+        total += buffer[n * 2];
+        sources += (sources == 0);
+        total /= sources;
+        total = total > 32767 ? 32767 : (total < -32768 ? -32768 : total);
+        buffer[n * 2] = total;
+        buffer[n * 2 + 1] = total;
+    }
+}
+
+// One sample at a time, with the exact semantics of sfx_mix_voice + sfx_mix_output
+static void reference_mix(int16_t *buffer, sfx_voice_t *voices)
+{
+    for (size_t n = 0; n < FRAMES; ++n)
+    {
+        int left = 0, right = 0;
+        for (int i = 0; i < VOICES; i++)
+        {
+            sfx_voice_t *voice = &voices[i];
+            if (!voice->data)
+                continue;
+            if ((voice->pos >> 16) >= voice->length)
+            {
+                voice->data = NULL;
+                continue;
+            }
+            int sample = voice->data[voice->pos >> 16] - 128;
+            left += sample * voice->left;
+            right += sample * voice->right;
+            voice->pos += voice->step;
+        }
+        left += buffer[n * 2];
+        right += buffer[n * 2 + 1];
+        buffer[n * 2] = left > 32767 ? 32767 : (left < -32768 ? -32768 : left);
+        buffer[n * 2 + 1] = right > 32767 ? 32767 : (right < -32768 ? -32768 : right);
+    }
+}
+
+static void block_mix(int16_t *buffer, sfx_voice_t *voices)
+{
+    static int32_t acc[FRAMES * 2];
+    memset(acc, 0, sizeof(acc));
+    for (int i = 0; i < VOICES; i++)
+    {
+        if (voices[i].data && !sfx_mix_voice(acc, FRAMES, &voices[i]))
+            voices[i].data = NULL;
+    }
+    sfx_mix_output(buffer, acc, buffer, FRAMES);
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+    static const int rates[VOICES] = {11025, 11025, 22050, 11025, 8000, 11025, 44100, 11025};
+    static uint8_t samples[VOICES][SFX_LENGTH];
+    static int16_t music[FRAMES * 2], ref[FRAMES * 2], dst[FRAMES * 2];
+    float_voice_t float_voices[VOICES];
+    sfx_voice_t voices[VOICES], ref_voices[VOICES];
+    long iterations = argc > 1 ? atol(argv[1]) : 20000;
+    int failed = 0;
+
+    srand(1234);
+    for (size_t i = 0; i < FRAMES * 2; ++i)
+        music[i] = (rand() & 0x3FFF) - 0x2000;
+    for (int v = 0; v < VOICES; ++v)
+        for (size_t i = 0; i < SFX_LENGTH; ++i)
+            samples[v][i] = rand() & 0xFF;
+
+    // Speed: all voices playing for the whole block, restarted every iteration
+    double float_time = 0, block_time = 0;
+    for (long n = 0; n < iterations; ++n)
+    {
+        for (int v = 0; v < VOICES; ++v)
+            float_voices[v] = (float_voice_t){samples[v], SFX_LENGTH, 0, (float)rates[v] / OUTPUT_RATE};
+        memcpy(ref, music, sizeof(ref));
+        double start = now();
+        float_mix(ref, float_voices, 15);
+        __asm__ volatile("" ::: "memory");
+        float_time += now() - start;
+
+        for (int v = 0; v < VOICES; ++v)
+            voices[v] = (sfx_voice_t){samples[v], SFX_LENGTH, 0, SFX_STEP(rates[v], OUTPUT_RATE),
+                                      SFX_GAIN_LEFT(120, v * 32), SFX_GAIN_RIGHT(120, v * 32)};
+        memcpy(dst, music, sizeof(dst));
+        start = now();
+        block_mix(dst, voices);
+        __asm__ volatile("" ::: "memory");
+        block_time += now() - start;
+    }
+
+    // Output: play short sounds through several blocks so that voices end mid-block
+    for (int v = 0; v < VOICES; ++v)
+    {
+        voices[v] = (sfx_voice_t){samples[v], 300 + v * 257, 0, SFX_STEP(rates[v], OUTPUT_RATE),
+                                  SFX_GAIN_LEFT(v * 15, 255 - v * 32), SFX_GAIN_RIGHT(v * 15, 255 - v * 32)};
+        ref_voices[v] = voices[v];
+    }
+    for (int block = 0; block < 8; ++block)
+    {
+        memcpy(ref, music, sizeof(ref));
+        memcpy(dst, music, sizeof(dst));
+        reference_mix(ref, ref_voices);
+        block_mix(dst, voices);
+        failed |= memcmp(ref, dst, sizeof(dst)) != 0;
+        for (int v = 0; v < VOICES; ++v)
+            failed |= !voices[v].data != !ref_voices[v].data;
+    }
+
+    printf("float ns/frame: %.2f\n", float_time * 1e9 / iterations / FRAMES);
+    printf("block ns/frame: %.2f\n", block_time * 1e9 / iterations / FRAMES);
+    printf("output: %s\n", failed ? "MISMATCH" : "identical");
+
+    return failed;
+}
@@ -0,0 +1,47 @@
+#!/bin/bash
+
+# Supported systems: Linux / MINGW32 / MINGW64
+# Builds retro-core without any display/audio/input backend, for benchmarks and regression tests.
+# See components/retro-go/targets/headless/docs/README.md
+
+CC="gcc"
+CFLAGS="-O2 -no-pie -DRG_TARGET_HEADLESS -DRETRO_GO -DCJSON_HIDE_SYMBOLS -DRG_BUILD_INFO=\"HEADLESS\" $EXTRA_CFLAGS"
+INCLUDES="-Icomponents/retro-go -Icomponents/retro-go/libs/netplay -Icomponents/retro-go/libs/cJSON -Icomponents/retro-go/libs/lodepng -Icomponents/retro-go/libs/miniz"
+SRCFILES="components/retro-go/*.c components/retro-go/drivers/audio/*.c components/retro-go/fonts/*.c components/retro-go/libs/netplay/*.c
+		  components/retro-go/libs/cJSON/*.c components/retro-go/libs/lodepng/*.c components/retro-go/libs/miniz/*.c"
+LIBS="-lpthread -lstdc++ -lm"
+
+echo "Cleaning..."
+rm -f retro-core-headless
+
+echo "Building retro-core-headless..."
+$CC $CFLAGS $INCLUDES \
+	-Iretro-core/components/gnuboy \
+	-Iretro-core/components/gw-emulator/src \
+	-Iretro-core/components/gw-emulator/src/cpus \
+	-Iretro-core/components/gw-emulator/src/gw_sys \
+	-Iretro-core/components/handy \
+	-Iretro-core/components/nofrendo \
+	-Iretro-core/components/pce-go \
+	-Iretro-core/components/snes9x \
+	-Iretro-core/components/snes9x/src \
+	-Iretro-core/components/smsplus \
+	-Iretro-core/main \
+	$SRCFILES \
+	retro-core/components/gnuboy/*.c \
+	retro-core/components/gw-emulator/src/*.c \
+	retro-core/components/gw-emulator/src/cpus/*.c \
+	retro-core/components/gw-emulator/src/gw_sys/*.c \
+	retro-core/components/handy/*.cpp \
+	retro-core/components/nofrendo/mappers/*.c \
+	retro-core/components/nofrendo/nes/*.c \
+	retro-core/components/nofrendo/*.c \
+	retro-core/components/pce-go/*.c \
+	retro-core/components/snes9x/src/*.c \
+	retro-core/components/smsplus/*.c \
+	retro-core/components/smsplus/cpu/*.c \
+	retro-core/components/smsplus/sound/*.c \
+	retro-core/main/*.c \
+	retro-core/main/*.cpp \
+	$LIBS \
+	-o retro-core-headless
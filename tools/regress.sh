@@ -0,0 +1,79 @@
+#!/bin/bash
+
+# Usage: ./tools/regress.sh [--update] [pattern]
+# Runs the entries of tools/regression.txt (those matching pattern, if any) with the headless build and compares
+# the hash of the last frame (fbhash) and of everything that was on screen (scrhash) with the golden values.
+# --update writes the new hashes to tools/regression.txt instead, review the frames before committing them!
+#
+# ROM paths (without spaces) are relative to a ROM directory: blargg/ is extracted from gnuboy's tests,
+# anything else is looked up in $RG_TEST_ROMS and skipped if it isn't there.
+# See components/retro-go/targets/headless/docs/README.md
+
+ROOT="$(cd "$(dirname "$0")/.." && pwd)"
+GOLDEN="$ROOT/tools/regression.txt"
+UPDATE=0
+
+if [ "$1" == "--update" ]; then
+	UPDATE=1
+	shift
+fi
+PATTERN="$1"
+
+if [ ! -x "$ROOT/retro-core-headless" ]; then
+	(cd "$ROOT" && ./tools/build_headless.sh) || exit 2
+fi
+
+WORKDIR="$(mktemp -d)"
+trap 'rm -rf "$WORKDIR"' EXIT
+mkdir -p "$WORKDIR/roms/blargg"
+unzip -q "$ROOT/retro-core/components/gnuboy/tests/blargg.zip" -d "$WORKDIR/roms/blargg" || exit 2
+
+passed=0
+failed=0
+skipped=0
+
+while IFS= read -r line; do
+	read -r app rom frames fbhash scrhash <<< "$line"
+	rom_file="$WORKDIR/roms/$rom"
+	[ -f "$rom_file" ] || rom_file="$RG_TEST_ROMS/$rom"
+
+	if [[ -z "$app" || "$app" == \#* || ( -n "$PATTERN" && "$app $rom" != *$PATTERN* ) ]]; then
+		echo "$line" >> "$WORKDIR/golden.txt"
+		continue
+	elif [ ! -f "$rom_file" ]; then
+		echo "SKIP $app $rom (not found)"
+		echo "$line" >> "$WORKDIR/golden.txt"
+		skipped=$((skipped + 1))
+		continue
+	fi
+
+	# Each run starts from a fresh storage so that saved settings (scaling, filter, ...) can't affect it
+	rm -rf "$WORKDIR/run" && mkdir -p "$WORKDIR/run"
+	output=$(cd "$WORKDIR/run" && RG_BENCH_APP="$app" RG_BENCH_ROM="$rom_file" RG_BENCH_FRAMES="$frames" \
+		"$ROOT/retro-core-headless" < /dev/null 2>/dev/null | grep "^BENCH")
+	new_fbhash=$(echo "$output" | sed -n 's/^BENCH fbhash=//p')
+	new_scrhash=$(echo "$output" | sed -n 's/^BENCH scrhash=//p')
+
+	if [[ -z "$new_fbhash" || -z "$new_scrhash" ]]; then
+		echo "FAIL $app $rom (didn't complete)"
+		failed=$((failed + 1))
+	elif [[ "$new_fbhash" == "$fbhash" && "$new_scrhash" == "$scrhash" ]]; then
+		echo "PASS $app $rom"
+		passed=$((passed + 1))
+	elif [ $UPDATE == 1 ]; then
+		echo "UPDATE $app $rom fbhash=$new_fbhash scrhash=$new_scrhash"
+		line=$(printf "%-5s %-44s %6s %s %s" "$app" "$rom" "$frames" "$new_fbhash" "$new_scrhash")
+		passed=$((passed + 1))
+	else
+		echo "FAIL $app $rom fbhash=$new_fbhash (expected $fbhash) scrhash=$new_scrhash (expected $scrhash)"
+		failed=$((failed + 1))
+	fi
+	echo "$line" >> "$WORKDIR/golden.txt"
+done < "$GOLDEN"
+
+if [ $UPDATE == 1 ]; then
+	cp "$WORKDIR/golden.txt" "$GOLDEN"
+fi
+
+echo "$passed passed, $failed failed, $skipped skipped"
+[ $failed == 0 ]